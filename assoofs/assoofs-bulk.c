@@ -0,0 +1,157 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/statfs.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+#include "assoofs.h"
+
+// **************************
+// Declaraciones de funciones
+// **************************
+
+/**
+ * Lee un fichero local y prepara su entrada de la petición de creación en bloque
+ *
+ * @param path La ruta del fichero local (la entrada toma su nombre base)
+ * @param entry Puntero a la entrada que se rellena
+ *
+ * @return 0 si todo salió bien, -1 en caso contrario
+ */
+static int load_entry(const char *path, struct assoofs_bulk_entry *entry);
+
+// +++++++++++++++++++++++++
+// Definiciones de funciones
+// +++++++++++++++++++++++++
+
+static int load_entry(const char *path, struct assoofs_bulk_entry *entry)
+{
+    struct stat st;
+    char *copy;
+    char *data;
+    ssize_t ret;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+        perror(path);
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+
+    // El tamaño se comprueba en el kernel (depende de si los ficheros se comprimen), aquí solo se acota
+    if (!S_ISREG(st.st_mode) || st.st_size > ASSOOFS_MAX_COMPRESSED_FILE_SIZE)
+    {
+        printf("%s is not a regular file of at most %d bytes.\n", path, ASSOOFS_MAX_COMPRESSED_FILE_SIZE);
+        close(fd);
+        return -1;
+    }
+
+    data = malloc(st.st_size > 0 ? st.st_size : 1);
+    if (!data)
+    {
+        printf("Out of memory.\n");
+        close(fd);
+        return -1;
+    }
+    ret = read(fd, data, st.st_size);
+    close(fd);
+    if (ret != st.st_size)
+    {
+        printf("%s could not be read completely.\n", path);
+        free(data);
+        return -1;
+    }
+
+    // basename puede modificar su argumento, por lo que se trabaja sobre una copia de la ruta
+    copy = strdup(path);
+    if (!copy)
+    {
+        printf("Out of memory.\n");
+        free(data);
+        return -1;
+    }
+    memset(entry, 0, sizeof(*entry));
+    strncpy(entry->filename, basename(copy), ASSOOFS_FILENAME_MAXLEN);
+    free(copy);
+    entry->mode = S_IFREG | (st.st_mode & 0777);
+    entry->size = st.st_size;
+    entry->data = (uint64_t)(uintptr_t)data;
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct assoofs_bulk_create req;
+    struct assoofs_bulk_entry *entries;
+    struct statfs st;
+    int count;
+    int fd;
+    int i;
+    int ret = -1;
+
+    // Comprueba que el número de argumentos sea correcto
+    if (argc < 3)
+    {
+        printf("Usage: assoofs-bulk <directory> <file>...\n");
+        printf("  Copies the given files into a directory of a mounted assoofs filesystem with a single request.\n");
+        printf("  Either all the files are created or none of them.\n");
+        return -1;
+    }
+    count = argc - 2;
+
+    // Abre el directorio de destino y comprueba que pertenezca a un sistema de archivos assoofs
+    fd = open(argv[1], O_RDONLY | O_DIRECTORY);
+    if (fd == -1)
+    {
+        perror(argv[1]);
+        return -1;
+    }
+    if (fstatfs(fd, &st) == -1 || st.f_type != ASSOOFS_MAGIC)
+    {
+        printf("%s is not in a mounted assoofs filesystem.\n", argv[1]);
+        close(fd);
+        return -1;
+    }
+
+    entries = calloc(count, sizeof(*entries));
+    if (!entries)
+    {
+        printf("Out of memory.\n");
+        close(fd);
+        return -1;
+    }
+
+    // Lee todos los ficheros y crea sus entradas con una única petición
+    for (i = 0; i < count; i++)
+        if (load_entry(argv[i + 2], &entries[i]))
+            break;
+
+    if (i == count)
+    {
+        memset(&req, 0, sizeof(req));
+        req.entries = (uint64_t)(uintptr_t)entries;
+        req.count = count;
+        ret = ioctl(fd, ASSOOFS_IOC_BULK_CREATE, &req);
+        if (ret == -1)
+            perror("Error creating the files");
+        else
+        {
+            printf("%d files created in %s.\n", ret, argv[1]);
+            ret = 0;
+        }
+    }
+
+    for (i = 0; i < count; i++)
+        free((void *)(uintptr_t)entries[i].data);
+    free(entries);
+    close(fd);
+    return ret;
+}
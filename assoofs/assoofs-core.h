@@ -0,0 +1,458 @@
+#ifndef ASSOOFS_CORE_H
+#define ASSOOFS_CORE_H
+
+// Lógica del formato en disco común al módulo y a las herramientas: disposición de los bloques entre los dispositivos,
+// reserva de bloques, almacén de inodos, entradas de directorio y sumas de comprobación. Las funciones trabajan sobre
+// bloques ya leídos (o a través de struct assoofs_core_io), sin depender del kernel ni de la libc más allá de
+// memcpy, strcmp y crc32c, por lo que los algoritmos se pueden probar y medir en espacio de usuario.
+// Se incluye al final de assoofs.h
+#ifdef __KERNEL__
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/crc32c.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#endif
+
+// Número de entradas que caben en el bloque de un directorio
+#define ASSOOFS_DIR_ENTRIES_PER_BLOCK (ASSOOFS_DEFAULT_BLOCK_SIZE / sizeof(struct assoofs_dir_record_entry))
+
+// Número máximo de inodos del almacén (como los bloques, sin contar el superbloque ni el almacén de inodos)
+#define ASSOOFS_MAX_INODES (ASSOOFS_MAX_FILESYSTEM_OBJECTS_SUPPORTED - 2)
+
+// Valor máximo del contador de referencias de un bloque compartido (block_shared_refs es de 8 bits)
+#define ASSOOFS_MAX_BLOCK_REFS 0xFF
+
+/**
+ * Acceso abstracto a los bloques del sistema de archivos. Las herramientas lo implementan con pread/pwrite
+ * sobre una imagen y las pruebas pueden implementarlo sobre un array en memoria; el módulo trabaja con
+ * buffer heads y utiliza directamente las funciones que operan sobre bloques ya leídos
+ *
+ * @param priv Datos de la implementación (se pasan a read y write)
+ * @param read Lee un bloque de ASSOOFS_DEFAULT_BLOCK_SIZE bytes. Devuelve 0 si todo salió bien, un valor negativo (errno) en caso contrario
+ * @param write Escribe un bloque de ASSOOFS_DEFAULT_BLOCK_SIZE bytes. Devuelve 0 si todo salió bien, un valor negativo (errno) en caso contrario
+ */
+struct assoofs_core_io
+{
+    void *priv;
+    int (*read)(void *priv, uint64_t block, void *data);
+    int (*write)(void *priv, uint64_t block, const void *data);
+};
+
+// ****************************
+// Sumas de comprobación (crc32c)
+// ****************************
+
+#ifndef __KERNEL__
+/**
+ * Calcula la suma crc32c (polinomio de Castagnoli) de un buffer, igual que crc32c() en el kernel:
+ * sin invertir la semilla ni el resultado. Las herramientas la usan al escribir metadatos en una imagen
+ *
+ * @param crc La semilla (~0 para las sumas de los bloques de metadatos)
+ * @param data El buffer
+ * @param len El número de bytes del buffer
+ *
+ * @return La suma crc32c
+ */
+static inline uint32_t assoofs_crc32c(uint32_t crc, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    int k;
+
+    while (len--)
+    {
+        crc ^= *p++;
+        for (k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1));
+    }
+    return crc;
+}
+#endif
+
+/**
+ * Calcula la suma de comprobación de un bloque de metadatos (todo el bloque salvo el propio campo checksum)
+ *
+ * @param block El bloque (ASSOOFS_DEFAULT_BLOCK_SIZE bytes)
+ *
+ * @return La suma crc32c
+ */
+static inline uint32_t assoofs_block_checksum(const void *block)
+{
+#ifdef __KERNEL__
+    return crc32c(~0U, block, ASSOOFS_BLOCK_CHECKSUM_SIZE);
+#else
+    return assoofs_crc32c(~0U, block, ASSOOFS_BLOCK_CHECKSUM_SIZE);
+#endif
+}
+
+/**
+ * Escribe la suma de comprobación en la cola de un bloque de metadatos
+ *
+ * @param block El bloque (ASSOOFS_DEFAULT_BLOCK_SIZE bytes)
+ */
+static inline void assoofs_block_checksum_set(void *block)
+{
+    struct assoofs_block_tail *tail = (struct assoofs_block_tail *)((char *)block + ASSOOFS_BLOCK_TAIL_OFFSET);
+
+    tail->checksum = assoofs_block_checksum(block);
+}
+
+/**
+ * Comprueba la suma de comprobación de la cola de un bloque de metadatos
+ *
+ * @param block El bloque (ASSOOFS_DEFAULT_BLOCK_SIZE bytes)
+ *
+ * @return 1 si la suma coincide, 0 en caso contrario
+ */
+static inline int assoofs_block_checksum_ok(const void *block)
+{
+    const struct assoofs_block_tail *tail = (const struct assoofs_block_tail *)((const char *)block + ASSOOFS_BLOCK_TAIL_OFFSET);
+
+    return tail->checksum == assoofs_block_checksum(block);
+}
+
+/**
+ * Lee un bloque de metadatos y comprueba su suma
+ *
+ * @param io El acceso a los bloques
+ * @param block El número de bloque
+ * @param data Buffer de ASSOOFS_DEFAULT_BLOCK_SIZE bytes donde se almacena el bloque
+ *
+ * @return 0 si todo salió bien, -EBADMSG si la suma no coincide u otro valor negativo si falla la lectura
+ */
+static inline int assoofs_core_read_meta(const struct assoofs_core_io *io, uint64_t block, void *data)
+{
+    int ret;
+
+    ret = io->read(io->priv, block, data);
+    if (ret)
+        return ret;
+
+    return assoofs_block_checksum_ok(data) ? 0 : -EBADMSG;
+}
+
+/**
+ * Calcula la suma de un bloque de metadatos y lo escribe
+ *
+ * @param io El acceso a los bloques
+ * @param block El número de bloque
+ * @param data El bloque (ASSOOFS_DEFAULT_BLOCK_SIZE bytes); se actualiza su cola
+ *
+ * @return 0 si todo salió bien, un valor negativo (errno) en caso contrario
+ */
+static inline int assoofs_core_write_meta(const struct assoofs_core_io *io, uint64_t block, void *data)
+{
+    assoofs_block_checksum_set(data);
+
+    return io->write(io->priv, block, data);
+}
+
+// *************************************
+// Disposición de los bloques (layout)
+// *************************************
+
+/**
+ * Calcula el número de bloques de un sistema de archivos que ocupa por completo uno o varios dispositivos.
+ * Los bloques no reservados se reparten por turnos, por lo que cada dispositivo aporta tantos como el más pequeño
+ * (sin contar los bloques reservados del primero ni la cabecera de los miembros)
+ *
+ * @param device_blocks El número de bloques de cada dispositivo
+ * @param count El número de dispositivos (al menos 1)
+ *
+ * @return El número de bloques, como mucho ASSOOFS_MAX_BLOCKS
+ */
+static inline uint64_t assoofs_core_layout_blocks(const uint64_t *device_blocks, unsigned int count)
+{
+    uint64_t per_device = ~0ULL;
+    uint64_t reserved;
+    uint64_t blocks;
+    unsigned int i;
+
+    if (count <= 1)
+        return device_blocks[0] < ASSOOFS_MAX_BLOCKS ? device_blocks[0] : ASSOOFS_MAX_BLOCKS;
+
+    for (i = 0; i < count; i++)
+    {
+        reserved = i == 0 ? ASSOOFS_LAST_RESERVED_BLOCK + 1 : 1;
+        if ((device_blocks[i] > reserved ? device_blocks[i] - reserved : 0) < per_device)
+            per_device = device_blocks[i] > reserved ? device_blocks[i] - reserved : 0;
+    }
+
+    // Se limita per_device antes de multiplicar para que el producto no se desborde
+    if (per_device > ASSOOFS_MAX_BLOCKS)
+        per_device = ASSOOFS_MAX_BLOCKS;
+    blocks = ASSOOFS_LAST_RESERVED_BLOCK + 1 + per_device * count;
+
+    return blocks < ASSOOFS_MAX_BLOCKS ? blocks : ASSOOFS_MAX_BLOCKS;
+}
+
+/**
+ * Traduce un número de bloque del sistema de archivos a un dispositivo y un bloque dentro de él. Los bloques reservados
+ * están en el primer dispositivo; el bloque ASSOOFS_LAST_RESERVED_BLOCK + 1 + k está en el dispositivo k % count,
+ * detrás de los bloques reservados (en el primero) o de la cabecera del miembro (en el resto)
+ *
+ * @param block El número de bloque del sistema de archivos
+ * @param count El número de dispositivos
+ * @param dev Puntero donde se almacena el índice del dispositivo
+ *
+ * @return El número de bloque dentro del dispositivo
+ */
+static inline uint64_t assoofs_core_layout_map(uint64_t block, unsigned int count, unsigned int *dev)
+{
+    uint64_t k;
+
+    if (count <= 1 || block <= ASSOOFS_LAST_RESERVED_BLOCK)
+    {
+        *dev = 0;
+        return block;
+    }
+
+    k = block - (ASSOOFS_LAST_RESERVED_BLOCK + 1);
+    *dev = k % count;
+    return k / count + (*dev == 0 ? ASSOOFS_LAST_RESERVED_BLOCK + 1 : 1);
+}
+
+/**
+ * Calcula cuántos bloques de un dispositivo utiliza el sistema de archivos (reservados o cabecera incluidos)
+ *
+ * @param blocks_count El número de bloques del sistema de archivos
+ * @param count El número de dispositivos
+ * @param index El índice del dispositivo
+ *
+ * @return El número de bloques del dispositivo
+ */
+static inline uint64_t assoofs_core_layout_device_blocks(uint64_t blocks_count, unsigned int count, unsigned int index)
+{
+    uint64_t data = blocks_count - (ASSOOFS_LAST_RESERVED_BLOCK + 1);
+
+    if (count <= 1)
+        return blocks_count;
+
+    return (index == 0 ? ASSOOFS_LAST_RESERVED_BLOCK + 1 : 1) + (data > index ? (data - index + count - 1) / count : 0);
+}
+
+// ****************************
+// Reserva de bloques (bitmap)
+// ****************************
+
+/**
+ * Reserva el primer bloque libre a partir de un bloque dado (bit a 1 en free_blocks). Nunca se devuelven
+ * el superbloque (bloque 0) ni el almacén de inodos (bloque 1). Quien llama guarda el superbloque
+ *
+ * @param asb Puntero a la información persistente del superbloque
+ * @param goal El primer bloque que se considera
+ * @param block Puntero donde se almacena el número de bloque
+ *
+ * @return 0 si todo salió bien, -ENOSPC si no quedan bloques libres
+ */
+static inline int assoofs_core_alloc_block(struct assoofs_super_block_info *asb, uint64_t goal, uint64_t *block)
+{
+    uint64_t i;
+
+    for (i = goal > ASSOOFS_INODESTORE_BLOCK_NUMBER ? goal : ASSOOFS_INODESTORE_BLOCK_NUMBER + 1; i < asb->blocks_count; i++)
+    {
+        if (asb->free_blocks & (1ULL << i))
+        {
+            // Lo marcamos como ocupado (bit a 0) y sin compartir
+            asb->free_blocks &= ~(1ULL << i);
+            asb->block_shared_refs[i] = 0;
+            *block = i;
+            return 0;
+        }
+    }
+
+    return -ENOSPC;
+}
+
+/**
+ * Reserva los primeros count bloques libres recorriendo el mapa de bits una sola vez. O se reservan todos o ninguno
+ *
+ * @param asb Puntero a la información persistente del superbloque
+ * @param blocks Array donde se almacenan los números de bloque
+ * @param count El número de bloques
+ *
+ * @return 0 si todo salió bien, -ENOSPC si no hay count bloques libres
+ */
+static inline int assoofs_core_alloc_blocks(struct assoofs_super_block_info *asb, uint64_t *blocks, unsigned int count)
+{
+    unsigned int found = 0;
+    uint64_t i;
+
+    for (i = ASSOOFS_INODESTORE_BLOCK_NUMBER + 1; i < asb->blocks_count && found < count; i++)
+        if (asb->free_blocks & (1ULL << i))
+            blocks[found++] = i;
+    if (found < count)
+        return -ENOSPC;
+
+    for (found = 0; found < count; found++)
+    {
+        asb->free_blocks &= ~(1ULL << blocks[found]);
+        asb->block_shared_refs[blocks[found]] = 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Añade una referencia a un bloque ocupado (reflink)
+ *
+ * @param asb Puntero a la información persistente del superbloque
+ * @param block El número de bloque
+ *
+ * @return 0 si todo salió bien, -EMLINK si el bloque ya tiene el máximo de referencias
+ */
+static inline int assoofs_core_get_block_ref(struct assoofs_super_block_info *asb, uint64_t block)
+{
+    if (asb->block_shared_refs[block] == ASSOOFS_MAX_BLOCK_REFS)
+        return -EMLINK;
+
+    asb->block_shared_refs[block]++;
+    return 0;
+}
+
+/**
+ * Suelta una referencia a un bloque: si está compartido basta con descontarla; si no, se marca como libre (bit a 1)
+ *
+ * @param asb Puntero a la información persistente del superbloque
+ * @param block El número de bloque
+ *
+ * @return 1 si el bloque ha quedado libre, 0 si sigue en uso por otro inodo
+ */
+static inline int assoofs_core_put_block(struct assoofs_super_block_info *asb, uint64_t block)
+{
+    if (asb->block_shared_refs[block] > 0)
+    {
+        asb->block_shared_refs[block]--;
+        return 0;
+    }
+
+    asb->free_blocks |= (1ULL << block);
+    return 1;
+}
+
+// *****************
+// Almacén de inodos
+// *****************
+
+/**
+ * Obtiene el número máximo de inodos de un sistema de archivos
+ *
+ * @param asb Puntero a la información persistente del superbloque
+ *
+ * @return inodes_max si se fijó al formatear, ASSOOFS_MAX_INODES en caso contrario
+ */
+static inline uint64_t assoofs_core_max_inodes(const struct assoofs_super_block_info *asb)
+{
+    return asb->inodes_max > 0 && asb->inodes_max < ASSOOFS_MAX_INODES ? asb->inodes_max : ASSOOFS_MAX_INODES;
+}
+
+/**
+ * Busca un inodo en el almacén de inodos
+ *
+ * @param inodes La primera entrada del almacén
+ * @param count El número de inodos del almacén
+ * @param inode_no El número de inodo
+ *
+ * @return Puntero a la información persistente del inodo, o NULL si no está
+ */
+static inline struct assoofs_inode_info *assoofs_core_inode_find(struct assoofs_inode_info *inodes, uint64_t count, uint64_t inode_no)
+{
+    uint64_t i;
+
+    if (count > ASSOOFS_MAX_INODES)
+        count = ASSOOFS_MAX_INODES;
+    for (i = 0; i < count; i++)
+        if (inodes[i].inode_no == inode_no)
+            return &inodes[i];
+
+    return NULL;
+}
+
+/**
+ * Quita un inodo del almacén: la última entrada ocupa su hueco para que sigan siendo contiguas.
+ * Quien llama descuenta inodes_count en el superbloque
+ *
+ * @param inodes La primera entrada del almacén
+ * @param count El número de inodos del almacén (al menos 1)
+ * @param inode_info Puntero a la entrada que se quita
+ */
+static inline void assoofs_core_inode_remove(struct assoofs_inode_info *inodes, uint64_t count, struct assoofs_inode_info *inode_info)
+{
+    if (inode_info != &inodes[count - 1])
+        memcpy(inode_info, &inodes[count - 1], sizeof(*inodes));
+    memset(&inodes[count - 1], 0, sizeof(*inodes));
+}
+
+// **********************
+// Entradas de directorio
+// **********************
+
+/**
+ * Busca una entrada por su nombre en el bloque de un directorio
+ *
+ * @param entries La primera entrada del directorio
+ * @param count El número de entradas (dir_children_count)
+ * @param name El nombre
+ *
+ * @return Puntero a la entrada, o NULL si no está
+ */
+static inline struct assoofs_dir_record_entry *assoofs_core_dir_find(struct assoofs_dir_record_entry *entries, uint64_t count, const char *name)
+{
+    uint64_t i;
+
+    if (count > ASSOOFS_DIR_ENTRIES_PER_BLOCK)
+        count = ASSOOFS_DIR_ENTRIES_PER_BLOCK;
+    for (i = 0; i < count; i++)
+        if (strcmp(entries[i].filename, name) == 0)
+            return &entries[i];
+
+    return NULL;
+}
+
+/**
+ * Añade una entrada al final del bloque de un directorio. Quien llama incrementa dir_children_count
+ *
+ * @param entries La primera entrada del directorio
+ * @param count El número de entradas (dir_children_count)
+ * @param name El nombre
+ * @param inode_no El número de inodo
+ *
+ * @return 0 si todo salió bien, -ENOSPC si el bloque está lleno o -ENAMETOOLONG si el nombre no cabe
+ */
+static inline int assoofs_core_dir_add(struct assoofs_dir_record_entry *entries, uint64_t count, const char *name, uint64_t inode_no)
+{
+    size_t len = strlen(name);
+
+    if (count >= ASSOOFS_DIR_ENTRIES_PER_BLOCK)
+        return -ENOSPC;
+    if (len >= ASSOOFS_FILENAME_MAXLEN)
+        return -ENAMETOOLONG;
+
+    memset(&entries[count], 0, sizeof(*entries));
+    memcpy(entries[count].filename, name, len);
+    entries[count].inode_no = inode_no;
+
+    return 0;
+}
+
+/**
+ * Quita una entrada del bloque de un directorio: la última ocupa su hueco para que sigan siendo contiguas.
+ * Quien llama descuenta dir_children_count
+ *
+ * @param entries La primera entrada del directorio
+ * @param count El número de entradas (al menos 1)
+ * @param entry Puntero a la entrada que se quita
+ */
+static inline void assoofs_core_dir_remove(struct assoofs_dir_record_entry *entries, uint64_t count, struct assoofs_dir_record_entry *entry)
+{
+    if (count > ASSOOFS_DIR_ENTRIES_PER_BLOCK)
+        count = ASSOOFS_DIR_ENTRIES_PER_BLOCK;
+    if (entry != &entries[count - 1])
+        memcpy(entry, &entries[count - 1], sizeof(*entries));
+    memset(&entries[count - 1], 0, sizeof(*entries));
+}
+
+#endif
@@ -0,0 +1,561 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <linux/fs.h>
+#include "assoofs.h"
+
+// Número máximo de hilos que calculan los hashes en paralelo
+#define DEDUPE_MAX_THREADS 16
+
+/**
+ * Representa un fichero candidato a deduplicar
+ *
+ * @param inode_index La posición del inodo en el almacén de inodos (modo offline)
+ * @param path La ruta del fichero (modo online)
+ * @param data El contenido significativo del fichero (contenido o cabecera + datos comprimidos)
+ * @param len El número de bytes de data
+ * @param flags Los flags del inodo (solo se deduplican ficheros con el mismo formato)
+ * @param hash El hash FNV-1a de data
+ */
+struct dedupe_entry
+{
+    int inode_index;
+    char path[PATH_MAX];
+    char *data;
+    size_t len;
+    uint32_t flags;
+    uint64_t hash;
+};
+
+/**
+ * Representa el trabajo de un hilo de cálculo de hashes
+ *
+ * @param fd El descriptor de archivo de la imagen (-1 en modo online)
+ * @param inodes El almacén de inodos leído de la imagen (NULL en modo online)
+ * @param entries El array de ficheros candidatos
+ * @param first La primera entrada que procesa el hilo
+ * @param step La distancia entre entradas consecutivas del hilo (número de hilos)
+ * @param count El número total de entradas
+ * @param ret 0 si el hilo terminó correctamente, -1 en caso contrario
+ */
+struct dedupe_worker
+{
+    int fd;
+    struct assoofs_inode_info *inodes;
+    struct dedupe_entry *entries;
+    int first;
+    int step;
+    int count;
+    int ret;
+};
+
+// **************************
+// Declaraciones de funciones
+// **************************
+
+/**
+ * Calcula el hash FNV-1a de 64 bits de un buffer
+ *
+ * @param data Puntero al buffer
+ * @param len Tamaño del buffer en bytes
+ *
+ * @return El hash del buffer
+ */
+static uint64_t fnv1a(const char *data, size_t len);
+
+/**
+ * Lee el contenido significativo de una entrada y calcula su hash
+ *
+ * @param w Puntero al trabajo del hilo (indica el modo)
+ * @param e Puntero a la entrada
+ *
+ * @return 0 si todo salió bien, -1 en caso contrario
+ */
+static int load_entry(struct dedupe_worker *w, struct dedupe_entry *e);
+
+/**
+ * Función principal de los hilos de cálculo de hashes
+ *
+ * @param arg Puntero al trabajo del hilo (struct dedupe_worker)
+ *
+ * @return NULL
+ */
+static void *hash_worker(void *arg);
+
+/**
+ * Calcula en paralelo los hashes de todas las entradas
+ *
+ * @param fd El descriptor de archivo de la imagen (-1 en modo online)
+ * @param inodes El almacén de inodos (NULL en modo online)
+ * @param entries El array de entradas
+ * @param count El número de entradas
+ *
+ * @return 0 si todo salió bien, -1 en caso contrario
+ */
+static int hash_entries(int fd, struct assoofs_inode_info *inodes, struct dedupe_entry *entries, int count);
+
+/**
+ * Compara dos entradas por hash, flags, tamaño y contenido (para qsort)
+ *
+ * @param a Puntero a la primera entrada
+ * @param b Puntero a la segunda entrada
+ *
+ * @return Un valor negativo, cero o positivo según el orden de las entradas
+ */
+static int compare_entries(const void *a, const void *b);
+
+/**
+ * Deduplica una imagen de assoofs no montada (modo offline)
+ *
+ * @param image La ruta de la imagen
+ *
+ * @return 0 si todo salió bien, -1 en caso contrario
+ */
+static int dedupe_image(const char *image);
+
+/**
+ * Deduplica un sistema de archivos assoofs montado mediante FIDEDUPERANGE (modo online)
+ *
+ * @param mountpoint El directorio en el que está montado el sistema de archivos
+ *
+ * @return 0 si todo salió bien, -1 en caso contrario
+ */
+static int dedupe_mounted(const char *mountpoint);
+
+/**
+ * Añade recursivamente los ficheros regulares de un directorio al array de entradas
+ *
+ * @param dir La ruta del directorio
+ * @param entries Puntero al array de entradas (se amplía con realloc)
+ * @param count Puntero al número de entradas
+ *
+ * @return 0 si todo salió bien, -1 en caso contrario
+ */
+static int collect_files(const char *dir, struct dedupe_entry **entries, int *count);
+
+// +++++++++++++++++++++++++
+// Definiciones de funciones
+// +++++++++++++++++++++++++
+
+static uint64_t fnv1a(const char *data, size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static int load_entry(struct dedupe_worker *w, struct dedupe_entry *e)
+{
+    struct assoofs_inode_info *inode;
+    struct assoofs_compressed_header *header;
+    ssize_t ret;
+    int fd;
+
+    e->data = malloc(ASSOOFS_MAX_COMPRESSED_FILE_SIZE);
+    if (!e->data)
+        return -1;
+
+    if (w->inodes)
+    {
+        // Modo offline: leemos el bloque de datos del inodo directamente de la imagen
+        inode = &w->inodes[e->inode_index];
+        ret = pread(w->fd, e->data, ASSOOFS_DEFAULT_BLOCK_SIZE, inode->data_block_number * ASSOOFS_DEFAULT_BLOCK_SIZE);
+        if (ret != ASSOOFS_DEFAULT_BLOCK_SIZE)
+        {
+            printf("Reading block [%llu] has failed.\n", (unsigned long long)inode->data_block_number);
+            return -1;
+        }
+
+        // Solo es significativo el contenido del fichero o la cabecera más los datos comprimidos
+        e->flags = inode->flags & ASSOOFS_INODE_COMPRESSED;
+        if (e->flags)
+        {
+            header = (struct assoofs_compressed_header *)e->data;
+            e->len = sizeof(*header) + header->compressed_size;
+            if (e->len > ASSOOFS_DEFAULT_BLOCK_SIZE)
+                e->len = ASSOOFS_DEFAULT_BLOCK_SIZE;
+        }
+        else
+            e->len = inode->file_size;
+    }
+    else
+    {
+        // Modo online: leemos el contenido del fichero a través del sistema de archivos montado
+        fd = open(e->path, O_RDONLY);
+        if (fd == -1)
+        {
+            perror(e->path);
+            return -1;
+        }
+        // read puede devolver menos bytes de los pedidos: se lee hasta el final del fichero
+        e->len = 0;
+        while (e->len < ASSOOFS_MAX_COMPRESSED_FILE_SIZE && (ret = read(fd, e->data + e->len, ASSOOFS_MAX_COMPRESSED_FILE_SIZE - e->len)) > 0)
+            e->len += (size_t)ret;
+        close(fd);
+        if (ret < 0)
+        {
+            perror(e->path);
+            return -1;
+        }
+        e->flags = 0;
+    }
+
+    e->hash = fnv1a(e->data, e->len);
+    return 0;
+}
+
+static void *hash_worker(void *arg)
+{
+    struct dedupe_worker *w = arg;
+    int i;
+
+    w->ret = 0;
+    for (i = w->first; i < w->count; i += w->step)
+        if (load_entry(w, &w->entries[i]))
+            w->ret = -1;
+
+    return NULL;
+}
+
+static int hash_entries(int fd, struct assoofs_inode_info *inodes, struct dedupe_entry *entries, int count)
+{
+    pthread_t threads[DEDUPE_MAX_THREADS];
+    struct dedupe_worker workers[DEDUPE_MAX_THREADS];
+    long nthreads;
+    int i;
+    int ret = 0;
+
+    // Utilizamos un hilo por CPU, sin superar el número de entradas
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nthreads > DEDUPE_MAX_THREADS)
+        nthreads = DEDUPE_MAX_THREADS;
+    if (nthreads > count)
+        nthreads = count;
+
+    // Cada hilo procesa las entradas i, i + nthreads, i + 2 * nthreads...
+    for (i = 0; i < nthreads; i++)
+    {
+        workers[i] = (struct dedupe_worker){
+            .fd = fd,
+            .inodes = inodes,
+            .entries = entries,
+            .first = i,
+            .step = nthreads,
+            .count = count,
+        };
+        if (pthread_create(&threads[i], NULL, hash_worker, &workers[i]) != 0)
+        {
+            // Si no se puede crear el hilo, procesamos sus entradas en el hilo principal
+            hash_worker(&workers[i]);
+            threads[i] = 0;
+        }
+    }
+
+    for (i = 0; i < nthreads; i++)
+    {
+        if (threads[i])
+            pthread_join(threads[i], NULL);
+        if (workers[i].ret)
+            ret = -1;
+    }
+
+    return ret;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const struct dedupe_entry *ea = a;
+    const struct dedupe_entry *eb = b;
+
+    if (ea->hash != eb->hash)
+        return ea->hash < eb->hash ? -1 : 1;
+    if (ea->flags != eb->flags)
+        return ea->flags < eb->flags ? -1 : 1;
+    if (ea->len != eb->len)
+        return ea->len < eb->len ? -1 : 1;
+    return memcmp(ea->data, eb->data, ea->len);
+}
+
+static int dedupe_image(const char *image)
+{
+    struct assoofs_super_block_info sb;
+    struct assoofs_inode_info inodes[ASSOOFS_DEFAULT_BLOCK_SIZE / sizeof(struct assoofs_inode_info)];
+    struct dedupe_entry *entries;
+    struct assoofs_inode_info *dup;
+    uint64_t canon_block;
+    uint64_t dup_block;
+    int count = 0;
+    int merged = 0;
+    int freed = 0;
+    int fd;
+    int i;
+    int canon;
+    int ret = -1;
+
+    // Abre la imagen en modo lectura/escritura
+    fd = open(image, O_RDWR);
+    if (fd == -1)
+    {
+        perror("Error opening the image");
+        return -1;
+    }
+
+    entries = calloc(ASSOOFS_MAX_FILESYSTEM_OBJECTS_SUPPORTED, sizeof(*entries));
+    do
+    {
+        if (!entries)
+            break;
+
+        // 1. Leemos el superbloque y el almacén de inodos
+        if (pread(fd, &sb, sizeof(sb), ASSOOFS_SUPERBLOCK_BLOCK_NUMBER * ASSOOFS_DEFAULT_BLOCK_SIZE) != sizeof(sb) || sb.magic != ASSOOFS_MAGIC)
+        {
+            printf("%s is not an assoofs image.\n", image);
+            break;
+        }
+        if (sb.version != ASSOOFS_VERSION)
+        {
+            printf("%s uses format version %llu, mount it read-write once to upgrade it.\n", image, (unsigned long long)sb.version);
+            break;
+        }
+        // Los bloques de datos se leen por su posición en la imagen, lo que solo es válido con un único dispositivo
+        if (sb.devices_count > 1)
+        {
+            printf("%s spans %llu devices, mount it to deduplicate it.\n", image, (unsigned long long)sb.devices_count);
+            break;
+        }
+        if (pread(fd, inodes, sizeof(inodes), ASSOOFS_INODESTORE_BLOCK_NUMBER * ASSOOFS_DEFAULT_BLOCK_SIZE) != sizeof(inodes))
+        {
+            printf("Reading the inode store has failed.\n");
+            break;
+        }
+        // No se modifican metadatos dañados: el almacén y el superbloque se reescriben enteros
+        if (!assoofs_block_checksum_ok(&sb) || !assoofs_block_checksum_ok(inodes))
+        {
+            printf("%s has metadata checksum errors, it can't be deduplicated.\n", image);
+            break;
+        }
+
+        // 2. Los candidatos son los ficheros regulares con contenido
+        for (i = 0; i < ASSOOFS_MAX_FILESYSTEM_OBJECTS_SUPPORTED && (uint64_t)i < sb.inodes_count; i++)
+            if (S_ISREG(inodes[i].mode) && inodes[i].file_size > 0)
+                entries[count++].inode_index = i;
+
+        // 3. Calculamos los hashes en paralelo y ordenamos para agrupar los ficheros idénticos
+        if (count > 0 && hash_entries(fd, inodes, entries, count))
+            break;
+        qsort(entries, count, sizeof(*entries), compare_entries);
+
+        // 4. Cada fichero idéntico al anterior pasa a compartir el bloque del primero del grupo
+        canon = 0;
+        for (i = 1; i < count; i++)
+        {
+            if (compare_entries(&entries[canon], &entries[i]) != 0)
+            {
+                canon = i;
+                continue;
+            }
+
+            canon_block = inodes[entries[canon].inode_index].data_block_number;
+            dup = &inodes[entries[i].inode_index];
+            dup_block = dup->data_block_number;
+            if (dup_block == canon_block || canon_block >= ASSOOFS_MAX_BLOCKS || dup_block >= ASSOOFS_MAX_BLOCKS)
+                continue;
+            if (sb.block_shared_refs[canon_block] == UINT8_MAX)
+            {
+                // El bloque canónico no admite más referencias: empezamos un grupo nuevo
+                canon = i;
+                continue;
+            }
+
+            sb.block_shared_refs[canon_block]++;
+            dup->data_block_number = canon_block;
+            merged++;
+
+            // Soltamos la referencia sobre el bloque duplicado (se libera si no estaba compartido)
+            if (sb.block_shared_refs[dup_block] > 0)
+                sb.block_shared_refs[dup_block]--;
+            else
+            {
+                sb.free_blocks |= (1ULL << dup_block);
+                freed++;
+            }
+        }
+
+        // 5. Escribimos el almacén de inodos y el superbloque actualizados, con sus nuevas sumas de comprobación
+        if (merged > 0)
+        {
+            assoofs_block_checksum_set(inodes);
+            assoofs_block_checksum_set(&sb);
+            if (pwrite(fd, inodes, sizeof(inodes), ASSOOFS_INODESTORE_BLOCK_NUMBER * ASSOOFS_DEFAULT_BLOCK_SIZE) != sizeof(inodes))
+            {
+                printf("Writing the inode store has failed.\n");
+                break;
+            }
+            if (pwrite(fd, &sb, sizeof(sb), ASSOOFS_SUPERBLOCK_BLOCK_NUMBER * ASSOOFS_DEFAULT_BLOCK_SIZE) != sizeof(sb))
+            {
+                printf("Writing the super block has failed.\n");
+                break;
+            }
+        }
+
+        printf("%d files scanned, %d files merged, %d blocks freed.\n", count, merged, freed);
+        ret = 0;
+    } while (0);
+
+    for (i = 0; entries && i < count; i++)
+        free(entries[i].data);
+    free(entries);
+    close(fd);
+
+    return ret;
+}
+
+static int collect_files(const char *dir, struct dedupe_entry **entries, int *count)
+{
+    DIR *d;
+    struct dirent *de;
+    struct stat st;
+    struct dedupe_entry *grown;
+    char path[PATH_MAX];
+
+    d = opendir(dir);
+    if (!d)
+    {
+        perror(dir);
+        return -1;
+    }
+
+    while ((de = readdir(d)) != NULL)
+    {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (lstat(path, &st) == -1)
+            continue;
+
+        if (S_ISDIR(st.st_mode))
+            collect_files(path, entries, count);
+        else if (S_ISREG(st.st_mode) && st.st_size > 0)
+        {
+            grown = realloc(*entries, (*count + 1) * sizeof(**entries));
+            if (!grown)
+            {
+                closedir(d);
+                return -1;
+            }
+            *entries = grown;
+            memset(&grown[*count], 0, sizeof(grown[*count]));
+            strcpy(grown[*count].path, path);
+            (*count)++;
+        }
+    }
+
+    closedir(d);
+    return 0;
+}
+
+static int dedupe_mounted(const char *mountpoint)
+{
+    struct dedupe_entry *entries = NULL;
+    struct file_dedupe_range *range;
+    int count = 0;
+    int merged = 0;
+    int canon;
+    int src_fd;
+    int dst_fd;
+    int i;
+
+    // 1. Recorremos el sistema de archivos montado y calculamos los hashes en paralelo
+    if (collect_files(mountpoint, &entries, &count) || (count > 0 && hash_entries(-1, NULL, entries, count)))
+    {
+        free(entries);
+        return -1;
+    }
+    qsort(entries, count, sizeof(*entries), compare_entries);
+
+    range = calloc(1, sizeof(*range) + sizeof(struct file_dedupe_range_info));
+    if (!range)
+        return -1;
+
+    // 2. Pedimos al kernel que deduplique cada fichero idéntico al primero de su grupo
+    // El kernel vuelve a comparar el contenido, por lo que un fichero modificado entretanto no se deduplica
+    canon = 0;
+    for (i = 1; i < count; i++)
+    {
+        if (compare_entries(&entries[canon], &entries[i]) != 0)
+        {
+            canon = i;
+            continue;
+        }
+
+        src_fd = open(entries[canon].path, O_RDONLY);
+        dst_fd = open(entries[i].path, O_RDWR);
+        if (src_fd != -1 && dst_fd != -1)
+        {
+            range->src_offset = 0;
+            range->src_length = entries[canon].len;
+            range->dest_count = 1;
+            range->info[0].dest_fd = dst_fd;
+            range->info[0].dest_offset = 0;
+            if (ioctl(src_fd, FIDEDUPERANGE, range) == 0 && range->info[0].status == FILE_DEDUPE_RANGE_SAME)
+                merged++;
+            else
+                printf("%s could not be deduplicated.\n", entries[i].path);
+        }
+        if (src_fd != -1)
+            close(src_fd);
+        if (dst_fd != -1)
+            close(dst_fd);
+    }
+
+    printf("%d files scanned, %d files merged.\n", count, merged);
+
+    for (i = 0; i < count; i++)
+        free(entries[i].data);
+    free(entries);
+    free(range);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct stat st;
+
+    // Comprueba que el número de argumentos sea correcto
+    if (argc != 2)
+    {
+        printf("Usage: assoofs-dedupe <image|mountpoint>\n");
+        return -1;
+    }
+
+    if (stat(argv[1], &st) == -1)
+    {
+        perror(argv[1]);
+        return -1;
+    }
+
+    // Un directorio es un sistema de archivos montado (online); cualquier otra cosa, una imagen (offline)
+    if (S_ISDIR(st.st_mode))
+        return dedupe_mounted(argv[1]);
+
+    return dedupe_image(argv[1]);
+}
@@ -0,0 +1,410 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <errno.h>
+#include <mntent.h>
+#include "assoofs.h"
+
+/**
+ * Representa un fichero o directorio del sistema de archivos montado
+ *
+ * @param path La ruta del fichero
+ * @param inode_no El número de inodo del fichero
+ * @param block El bloque de datos del fichero
+ * @param free_below El número de bloques libres anteriores a su bloque (cuánto se puede acercar al principio)
+ */
+struct defrag_file
+{
+    char path[PATH_MAX];
+    uint64_t inode_no;
+    uint64_t block;
+    uint64_t free_below;
+};
+
+/**
+ * Representa el estado del sistema de archivos leído del dispositivo
+ *
+ * @param sb El superbloque
+ * @param inodes El almacén de inodos
+ * @param files Los ficheros y directorios encontrados en el punto de montaje
+ * @param count El número de ficheros y directorios
+ */
+struct defrag_state
+{
+    struct assoofs_super_block_info sb;
+    struct assoofs_inode_info inodes[ASSOOFS_DEFAULT_BLOCK_SIZE / sizeof(struct assoofs_inode_info)];
+    struct defrag_file files[ASSOOFS_MAX_BLOCKS];
+    int count;
+};
+
+// **************************
+// Declaraciones de funciones
+// **************************
+
+/**
+ * Busca el dispositivo en el que está montado un punto de montaje de assoofs
+ *
+ * @param mountpoint El punto de montaje
+ * @param device Buffer donde se almacenará la ruta del dispositivo (PATH_MAX bytes)
+ *
+ * @return 0 si todo salió bien, -1 si el punto de montaje no es un sistema de archivos assoofs
+ */
+static int find_device(const char *mountpoint, char *device);
+
+/**
+ * Lee el superbloque y el almacén de inodos del dispositivo
+ *
+ * @param device La ruta del dispositivo
+ * @param state Puntero al estado donde se almacenarán
+ *
+ * @return 0 si todo salió bien, -1 en caso contrario
+ */
+static int read_metadata(const char *device, struct defrag_state *state);
+
+/**
+ * Recorre recursivamente un directorio y añade sus ficheros y directorios al estado
+ *
+ * @param dir La ruta del directorio
+ * @param state Puntero al estado
+ */
+static void collect_files(const char *dir, struct defrag_state *state);
+
+/**
+ * Calcula el bloque de datos de cada fichero y los bloques libres anteriores a él
+ *
+ * @param state Puntero al estado
+ */
+static void compute_layout(struct defrag_state *state);
+
+/**
+ * Muestra la fragmentación de cada fichero (de peor a mejor) y la del sistema de archivos
+ *
+ * @param state Puntero al estado
+ * @param verbose Si es distinto de 0, muestra también cada fichero
+ */
+static void report(struct defrag_state *state, int verbose);
+
+/**
+ * Compara dos ficheros por su fragmentación, de peor a mejor (para qsort)
+ *
+ * @param a Puntero al primer fichero
+ * @param b Puntero al segundo fichero
+ *
+ * @return Un valor negativo, cero o positivo según el orden de los ficheros
+ */
+static int compare_files(const void *a, const void *b);
+
+/**
+ * Traslada los ficheros con bloques libres por delante a los primeros bloques libres, de peor a mejor
+ *
+ * @param state Puntero al estado
+ * @param rate Número máximo de bloques trasladados por segundo (0 sin límite)
+ *
+ * @return El número de ficheros trasladados
+ */
+static int defragment(struct defrag_state *state, long rate);
+
+// +++++++++++++++++++++++++
+// Definiciones de funciones
+// +++++++++++++++++++++++++
+
+static int find_device(const char *mountpoint, char *device)
+{
+    char real[PATH_MAX];
+    struct mntent *m;
+    FILE *f;
+    int ret = -1;
+
+    if (!realpath(mountpoint, real))
+    {
+        perror(mountpoint);
+        return -1;
+    }
+
+    f = setmntent("/proc/self/mounts", "r");
+    if (!f)
+    {
+        perror("Error reading /proc/self/mounts");
+        return -1;
+    }
+
+    // Nos quedamos con la última entrada, que es la visible si hay montajes superpuestos
+    while ((m = getmntent(f)) != NULL)
+    {
+        if (strcmp(m->mnt_dir, real) == 0 && strcmp(m->mnt_type, "assoofs") == 0)
+        {
+            snprintf(device, PATH_MAX, "%s", m->mnt_fsname);
+            ret = 0;
+        }
+    }
+
+    endmntent(f);
+    return ret;
+}
+
+static int read_metadata(const char *device, struct defrag_state *state)
+{
+    int fd;
+    int ret = -1;
+
+    // El dispositivo de bloques comparte su caché con el kernel, por lo que se leen los metadatos actuales
+    fd = open(device, O_RDONLY);
+    if (fd == -1)
+    {
+        perror(device);
+        return -1;
+    }
+
+    if (pread(fd, &state->sb, sizeof(state->sb), ASSOOFS_SUPERBLOCK_BLOCK_NUMBER * ASSOOFS_DEFAULT_BLOCK_SIZE) != sizeof(state->sb) || state->sb.magic != ASSOOFS_MAGIC)
+        printf("%s does not contain an assoofs filesystem.\n", device);
+    else if (state->sb.version != ASSOOFS_VERSION)
+        printf("%s uses format version %llu, which is not supported.\n", device, (unsigned long long)state->sb.version);
+    else if (pread(fd, state->inodes, sizeof(state->inodes), ASSOOFS_INODESTORE_BLOCK_NUMBER * ASSOOFS_DEFAULT_BLOCK_SIZE) != sizeof(state->inodes))
+        printf("Reading the inode store has failed.\n");
+    else
+        ret = 0;
+
+    close(fd);
+    return ret;
+}
+
+static void collect_files(const char *dir, struct defrag_state *state)
+{
+    DIR *d;
+    struct dirent *de;
+    struct stat st;
+    char path[PATH_MAX];
+
+    d = opendir(dir);
+    if (!d)
+        return;
+
+    while ((de = readdir(d)) != NULL && state->count < ASSOOFS_MAX_BLOCKS)
+    {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (lstat(path, &st) == -1)
+            continue;
+
+        if (S_ISREG(st.st_mode) || S_ISDIR(st.st_mode))
+        {
+            snprintf(state->files[state->count].path, PATH_MAX, "%s", path);
+            state->files[state->count].inode_no = st.st_ino;
+            state->count++;
+        }
+        if (S_ISDIR(st.st_mode))
+            collect_files(path, state);
+    }
+
+    closedir(d);
+}
+
+static void compute_layout(struct defrag_state *state)
+{
+    struct defrag_file *f;
+    uint64_t b;
+    int i;
+    int j;
+
+    for (i = 0; i < state->count; i++)
+    {
+        f = &state->files[i];
+        f->block = 0;
+        f->free_below = 0;
+
+        // Buscamos el inodo del fichero en el almacén de inodos
+        for (j = 0; (uint64_t)j < state->sb.inodes_count && j < ASSOOFS_MAX_BLOCKS; j++)
+            if (state->inodes[j].inode_no == f->inode_no)
+                f->block = state->inodes[j].data_block_number;
+
+        // Contamos los bloques libres que hay por delante del bloque del fichero
+        for (b = 2; b < f->block && b < ASSOOFS_MAX_BLOCKS; b++)
+            if (state->sb.free_blocks & (1ULL << b))
+                f->free_below++;
+    }
+}
+
+static int compare_files(const void *a, const void *b)
+{
+    const struct defrag_file *fa = a;
+    const struct defrag_file *fb = b;
+
+    // Peor cuantos más bloques libres tiene por delante; a igualdad, cuanto más al final está
+    if (fa->free_below != fb->free_below)
+        return fa->free_below > fb->free_below ? -1 : 1;
+    if (fa->block != fb->block)
+        return fa->block > fb->block ? -1 : 1;
+    return 0;
+}
+
+static void report(struct defrag_state *state, int verbose)
+{
+    uint64_t b;
+    uint64_t free_blocks = 0;
+    uint64_t free_runs = 0;
+    uint64_t last_used = 0;
+    int fragmented = 0;
+    int i;
+
+    qsort(state->files, state->count, sizeof(state->files[0]), compare_files);
+
+    // Fragmentación de cada fichero: bloques libres por delante de su bloque de datos
+    for (i = 0; i < state->count; i++)
+    {
+        if (state->files[i].free_below > 0)
+            fragmented++;
+        if (verbose)
+            printf("%6llu free blocks before block %3llu  %s\n", (unsigned long long)state->files[i].free_below,
+                   (unsigned long long)state->files[i].block, state->files[i].path);
+    }
+
+    // Fragmentación del sistema de archivos: número de tramos de bloques libres
+    for (b = 2; b < state->sb.blocks_count && b < ASSOOFS_MAX_BLOCKS; b++)
+    {
+        if (state->sb.free_blocks & (1ULL << b))
+        {
+            free_blocks++;
+            if (b == 2 || !(state->sb.free_blocks & (1ULL << (b - 1))))
+                free_runs++;
+        }
+        else
+            last_used = b;
+    }
+
+    printf("%d of %d files have free blocks in front of them.\n", fragmented, state->count);
+    printf("%llu free blocks in %llu runs, last used block %llu of %llu, free space fragmentation %llu%%.\n",
+           (unsigned long long)free_blocks, (unsigned long long)free_runs, (unsigned long long)last_used,
+           (unsigned long long)state->sb.blocks_count, free_blocks > 1 && free_runs > 0 ? (unsigned long long)((free_runs - 1) * 100 / (free_blocks - 1)) : 0ULL);
+}
+
+static int defragment(struct defrag_state *state, long rate)
+{
+    struct assoofs_move_block move;
+    struct defrag_file *f;
+    uint64_t first_free;
+    int moved = 0;
+    int fd;
+    int i;
+
+    // Los ficheros están ordenados de peor a mejor (report)
+    for (i = 0; i < state->count; i++)
+    {
+        f = &state->files[i];
+
+        // Los traslados anteriores pueden haber ocupado los huecos: solo se traslada si queda un bloque libre por delante
+        for (first_free = 2; first_free < f->block; first_free++)
+            if (state->sb.free_blocks & (1ULL << first_free))
+                break;
+        if (first_free >= f->block)
+            continue;
+
+        fd = open(f->path, O_RDONLY);
+        if (fd == -1)
+        {
+            perror(f->path);
+            continue;
+        }
+
+        // El kernel traslada el bloque al primer bloque libre del sistema de archivos
+        move.goal = 0;
+        if (ioctl(fd, ASSOOFS_IOC_MOVE_BLOCK, &move) == -1)
+        {
+            if (errno == EBUSY)
+                printf("%s shares its block with other files, skipped.\n", f->path);
+            else
+                perror(f->path);
+        }
+        else
+        {
+            printf("%s moved from block %llu to block %llu.\n", f->path, (unsigned long long)f->block, (unsigned long long)move.block);
+            moved++;
+
+            // Actualizamos nuestra copia del mapa de bits de bloques libres
+            state->sb.free_blocks &= ~(1ULL << move.block);
+            state->sb.free_blocks |= (1ULL << f->block);
+            f->block = move.block;
+        }
+        close(fd);
+
+        // Limitamos el número de bloques trasladados por segundo para no penalizar al resto de la E/S
+        if (rate > 0)
+            usleep(1000000 / rate);
+    }
+
+    return moved;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct defrag_state state;
+    char device[PATH_MAX];
+    int opt;
+    int dry_run = 0;
+    int verbose = 0;
+    long rate = 0;
+
+    // Interpreta las opciones: -n solo informa, -v muestra cada fichero, -r limita los bloques trasladados por segundo
+    while ((opt = getopt(argc, argv, "nvr:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            dry_run = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'r':
+            rate = strtol(optarg, NULL, 10);
+            break;
+        default:
+            optind = argc;
+            break;
+        }
+    }
+
+    // Comprueba que el número de argumentos sea correcto
+    if (optind != argc - 1)
+    {
+        printf("Usage: assoofs-defrag [-n] [-v] [-r blocks_per_second] <mountpoint>\n");
+        return -1;
+    }
+
+    if (find_device(argv[optind], device))
+    {
+        printf("%s is not a mounted assoofs filesystem.\n", argv[optind]);
+        return -1;
+    }
+
+    // 1. Leemos los metadatos e informamos de la fragmentación actual
+    if (read_metadata(device, &state))
+        return -1;
+    collect_files(argv[optind], &state);
+    compute_layout(&state);
+    report(&state, verbose);
+
+    if (dry_run)
+        return 0;
+
+    // 2. Desfragmentamos de peor a mejor e informamos del resultado
+    printf("%d files moved.\n", defragment(&state, rate));
+
+    state.count = 0;
+    if (read_metadata(device, &state))
+        return -1;
+    collect_files(argv[optind], &state);
+    compute_layout(&state);
+    report(&state, 0);
+
+    return 0;
+}
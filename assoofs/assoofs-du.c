@@ -0,0 +1,62 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/statfs.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "assoofs.h"
+
+int main(int argc, char *argv[])
+{
+    struct assoofs_usage usage;
+    struct statfs st;
+    int fd;
+    int i;
+    int ret = 0;
+
+    // Comprueba que el número de argumentos sea correcto
+    if (argc < 2)
+    {
+        printf("Usage: assoofs-du <path>...\n");
+        printf("  Shows the bytes and inodes used below each path of a mounted assoofs filesystem.\n");
+        printf("  The usage is kept up to date by the filesystem, so no subtree is traversed.\n");
+        return -1;
+    }
+
+    for (i = 1; i < argc; i++)
+    {
+        fd = open(argv[i], O_RDONLY);
+        if (fd == -1)
+        {
+            perror(argv[i]);
+            ret = -1;
+            continue;
+        }
+
+        // Comprueba que la ruta pertenezca a un sistema de archivos assoofs
+        if (fstatfs(fd, &st) == -1 || st.f_type != ASSOOFS_MAGIC)
+        {
+            printf("%s is not in a mounted assoofs filesystem.\n", argv[i]);
+            close(fd);
+            ret = -1;
+            continue;
+        }
+
+        // Una única petición por ruta: el directorio guarda el uso de todo su subárbol
+        if (ioctl(fd, ASSOOFS_IOC_GET_USAGE, &usage) == -1)
+        {
+            perror(argv[i]);
+            ret = -1;
+        }
+        else
+            printf("%llu bytes\t%llu inodes\t%s\n", (unsigned long long)usage.bytes, (unsigned long long)usage.inodes, argv[i]);
+
+        close(fd);
+    }
+
+    return ret;
+}
@@ -0,0 +1,302 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/statfs.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include "assoofs.h"
+
+// Número máximo de extensiones que se piden por fichero
+#define FRAG_MAX_EXTENTS 32
+
+// Número de intervalos de los histogramas (1, 2, 3-4, 5-8, ..., 33 o más)
+#define FRAG_HISTOGRAM_BUCKETS 7
+
+/**
+ * Representa el estado acumulado al recorrer el sistema de archivos
+ *
+ * @param used Mapa de bits de los bloques ocupados por las extensiones encontradas
+ * @param blocks_count El número de bloques del sistema de archivos
+ * @param files El número de ficheros y directorios con extensiones
+ * @param extents El número total de extensiones
+ * @param extents_histogram Histograma del número de extensiones por fichero
+ * @param verbose Si es distinto de 0, muestra las extensiones de cada fichero
+ */
+struct frag_state
+{
+    uint64_t used;
+    uint64_t blocks_count;
+    uint64_t files;
+    uint64_t extents;
+    uint64_t extents_histogram[FRAG_HISTOGRAM_BUCKETS];
+    int verbose;
+};
+
+// **************************
+// Declaraciones de funciones
+// **************************
+
+/**
+ * Calcula el intervalo del histograma que corresponde a un valor (1, 2, 3-4, 5-8, ...)
+ *
+ * @param value El valor (mayor que 0)
+ *
+ * @return El índice del intervalo
+ */
+static int histogram_bucket(uint64_t value);
+
+/**
+ * Muestra un histograma con una barra por intervalo
+ *
+ * @param title El título del histograma
+ * @param histogram Los valores de cada intervalo
+ */
+static void print_histogram(const char *title, const uint64_t *histogram);
+
+/**
+ * Obtiene las extensiones de un fichero con FS_IOC_FIEMAP, las muestra y las añade al estado
+ *
+ * @param path La ruta del fichero
+ * @param state Puntero al estado
+ *
+ * @return 0 si todo salió bien, -1 en caso contrario
+ */
+static int map_file(const char *path, struct frag_state *state);
+
+/**
+ * Recorre recursivamente un directorio y obtiene las extensiones de sus ficheros y directorios
+ *
+ * @param dir La ruta del directorio
+ * @param state Puntero al estado
+ */
+static void walk(const char *dir, struct frag_state *state);
+
+/**
+ * Muestra los histogramas de extensiones por fichero y de tramos de bloques libres
+ *
+ * @param state Puntero al estado
+ */
+static void report(struct frag_state *state);
+
+// +++++++++++++++++++++++++
+// Definiciones de funciones
+// +++++++++++++++++++++++++
+
+static int histogram_bucket(uint64_t value)
+{
+    int bucket = 0;
+
+    while (bucket < FRAG_HISTOGRAM_BUCKETS - 1 && value > (1ULL << bucket))
+        bucket++;
+    return bucket;
+}
+
+static void print_histogram(const char *title, const uint64_t *histogram)
+{
+    uint64_t max = 0;
+    int i;
+    int j;
+
+    for (i = 0; i < FRAG_HISTOGRAM_BUCKETS; i++)
+        if (histogram[i] > max)
+            max = histogram[i];
+
+    printf("%s\n", title);
+    for (i = 0; i < FRAG_HISTOGRAM_BUCKETS; i++)
+    {
+        if (i == 0)
+            printf("  %8s", "1");
+        else if (i == FRAG_HISTOGRAM_BUCKETS - 1)
+            printf("  %6llu+ ", (1ULL << (i - 1)) + 1);
+        else
+            printf("  %3llu-%-4llu", (1ULL << (i - 1)) + 1, 1ULL << i);
+        printf(" %6llu ", (unsigned long long)histogram[i]);
+
+        // Barras de hasta 40 caracteres, proporcionales al intervalo más poblado
+        for (j = 0; max > 0 && (uint64_t)j < histogram[i] * 40 / max; j++)
+            putchar('#');
+        putchar('\n');
+    }
+}
+
+static int map_file(const char *path, struct frag_state *state)
+{
+    struct fiemap *fm;
+    struct fiemap_extent *fe;
+    uint64_t block;
+    uint64_t last;
+    unsigned int i;
+    int fd;
+    int ret = -1;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        perror(path);
+        return -1;
+    }
+
+    fm = calloc(1, sizeof(*fm) + FRAG_MAX_EXTENTS * sizeof(struct fiemap_extent));
+    if (!fm)
+    {
+        printf("Out of memory.\n");
+        close(fd);
+        return -1;
+    }
+
+    // Pedimos todas las extensiones del fichero
+    fm->fm_start = 0;
+    fm->fm_length = FIEMAP_MAX_OFFSET;
+    fm->fm_flags = FIEMAP_FLAG_SYNC;
+    fm->fm_extent_count = FRAG_MAX_EXTENTS;
+
+    if (ioctl(fd, FS_IOC_FIEMAP, fm) == -1)
+    {
+        perror(path);
+        goto out;
+    }
+
+    if (state->verbose)
+        printf("%s: %u extent%s\n", path, fm->fm_mapped_extents, fm->fm_mapped_extents == 1 ? "" : "s");
+
+    for (i = 0; i < fm->fm_mapped_extents; i++)
+    {
+        fe = &fm->fm_extents[i];
+
+        if (state->verbose)
+            printf("  logical %llu..%llu physical block %llu%s%s\n", (unsigned long long)fe->fe_logical,
+                   (unsigned long long)(fe->fe_logical + fe->fe_length - 1), (unsigned long long)(fe->fe_physical / ASSOOFS_DEFAULT_BLOCK_SIZE),
+                   fe->fe_flags & FIEMAP_EXTENT_ENCODED ? " compressed" : "", fe->fe_flags & FIEMAP_EXTENT_SHARED ? " shared" : "");
+
+        // Una extensión comprimida ocupa un único bloque físico aunque su longitud lógica sea mayor
+        last = fe->fe_physical / ASSOOFS_DEFAULT_BLOCK_SIZE;
+        if (!(fe->fe_flags & FIEMAP_EXTENT_ENCODED))
+            last += (fe->fe_length - 1) / ASSOOFS_DEFAULT_BLOCK_SIZE;
+        for (block = fe->fe_physical / ASSOOFS_DEFAULT_BLOCK_SIZE; block <= last && block < ASSOOFS_MAX_BLOCKS; block++)
+            state->used |= 1ULL << block;
+    }
+
+    // Los ficheros vacíos no tienen extensiones y no cuentan en el histograma
+    if (fm->fm_mapped_extents > 0)
+    {
+        state->files++;
+        state->extents += fm->fm_mapped_extents;
+        state->extents_histogram[histogram_bucket(fm->fm_mapped_extents)]++;
+    }
+    ret = 0;
+
+out:
+    free(fm);
+    close(fd);
+    return ret;
+}
+
+static void walk(const char *dir, struct frag_state *state)
+{
+    DIR *d;
+    struct dirent *de;
+    struct stat st;
+    char path[PATH_MAX];
+
+    d = opendir(dir);
+    if (!d)
+    {
+        perror(dir);
+        return;
+    }
+
+    while ((de = readdir(d)) != NULL)
+    {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (lstat(path, &st) == -1)
+            continue;
+
+        if (S_ISREG(st.st_mode) || S_ISDIR(st.st_mode))
+            map_file(path, state);
+        if (S_ISDIR(st.st_mode))
+            walk(path, state);
+    }
+
+    closedir(d);
+}
+
+static void report(struct frag_state *state)
+{
+    uint64_t free_histogram[FRAG_HISTOGRAM_BUCKETS] = {0};
+    uint64_t free_blocks = 0;
+    uint64_t free_runs = 0;
+    uint64_t run = 0;
+    uint64_t b;
+
+    // Los bloques del superbloque y del almacén de inodos siempre están ocupados
+    state->used |= (1ULL << ASSOOFS_SUPERBLOCK_BLOCK_NUMBER) | (1ULL << ASSOOFS_INODESTORE_BLOCK_NUMBER);
+
+    // Tramos de bloques libres: bloques que no pertenecen a ninguna extensión
+    for (b = 0; b <= state->blocks_count && b <= ASSOOFS_MAX_BLOCKS; b++)
+    {
+        if (b < state->blocks_count && b < ASSOOFS_MAX_BLOCKS && !(state->used & (1ULL << b)))
+        {
+            free_blocks++;
+            run++;
+        }
+        else if (run > 0)
+        {
+            free_histogram[histogram_bucket(run)]++;
+            free_runs++;
+            run = 0;
+        }
+    }
+
+    print_histogram("Extents per file:", state->extents_histogram);
+    print_histogram("Free space runs (blocks):", free_histogram);
+
+    printf("%llu files in %llu extents (%.2f extents per file).\n", (unsigned long long)state->files, (unsigned long long)state->extents,
+           state->files > 0 ? (double)state->extents / state->files : 0.0);
+    printf("%llu free blocks in %llu runs of %llu blocks.\n", (unsigned long long)free_blocks, (unsigned long long)free_runs,
+           (unsigned long long)state->blocks_count);
+}
+
+int main(int argc, char *argv[])
+{
+    struct frag_state state;
+    struct statfs st;
+    const char *mountpoint;
+
+    memset(&state, 0, sizeof(state));
+
+    // Comprueba que el número de argumentos sea correcto
+    if (argc == 3 && strcmp(argv[1], "-v") == 0)
+        state.verbose = 1;
+    else if (argc != 2)
+    {
+        printf("Usage: assoofs-frag [-v] <mountpoint>\n");
+        return -1;
+    }
+    mountpoint = argv[argc - 1];
+
+    // Comprueba que el punto de montaje sea un sistema de archivos assoofs y obtiene su tamaño
+    if (statfs(mountpoint, &st) == -1 || st.f_type != ASSOOFS_MAGIC)
+    {
+        printf("%s is not a mounted assoofs filesystem.\n", mountpoint);
+        return -1;
+    }
+    state.blocks_count = st.f_blocks;
+
+    // El directorio raíz también ocupa un bloque
+    if (map_file(mountpoint, &state))
+        return -1;
+    walk(mountpoint, &state);
+    report(&state);
+
+    return 0;
+}
@@ -0,0 +1,1352 @@
+#define FUSE_USE_VERSION 34
+
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <fuse_lowlevel.h>
+#include <lz4.h>
+#include "assoofs.h"
+
+// Segundos durante los que el kernel reutiliza atributos y entradas sin consultarlos (el daemon es el único que modifica la imagen)
+#define AFUSE_TIMEOUT 1.0
+
+/**
+ * Representa el número de descriptores abiertos de un inodo
+ *
+ * @param ino El número de inodo (0 si la posición está libre)
+ * @param count El número de descriptores abiertos
+ */
+struct afuse_open
+{
+    uint64_t ino;
+    unsigned int count;
+};
+
+/**
+ * Representa el estado del daemon
+ *
+ * @param fd El descriptor de archivo de la imagen
+ * @param io El acceso a los bloques de la imagen (pread/pwrite sobre fd)
+ * @param lock Las peticiones que solo leen (lookup, getattr, readdir, read) se atienden en paralelo; las que modifican, de una en una
+ * @param meta Caché de los bloques de metadatos indexada por número de bloque (superbloque, almacén de inodos y bloques de
+ *        directorio): se carga completa al arrancar y se escribe en la imagen al modificarse, por lo que nunca se vuelve a leer
+ * @param sb La información persistente del superbloque (apunta a meta[ASSOOFS_SUPERBLOCK_BLOCK_NUMBER])
+ * @param inodes El almacén de inodos (apunta a meta[ASSOOFS_INODESTORE_BLOCK_NUMBER])
+ * @param opens Los inodos abiertos: un fichero borrado se libera al cerrar su último descriptor
+ */
+struct afuse
+{
+    int fd;
+    struct assoofs_core_io io;
+    pthread_rwlock_t lock;
+    char *meta[ASSOOFS_MAX_BLOCKS];
+    struct assoofs_super_block_info *sb;
+    struct assoofs_inode_info *inodes;
+    struct afuse_open opens[ASSOOFS_MAX_BLOCKS];
+};
+
+// **************************
+// Declaraciones de funciones
+// **************************
+
+/**
+ * Abre la imagen y carga en la caché el superbloque, el almacén de inodos y los bloques de los directorios,
+ * comprobando sus sumas. Libera los inodos que quedaron huérfanos
+ *
+ * @param fs Puntero al estado del daemon
+ * @param image La ruta de la imagen
+ *
+ * @return 0 si todo salió bien, -1 en caso contrario
+ */
+static int afuse_load(struct afuse *fs, const char *image);
+
+/**
+ * Lee un bloque de la imagen (read de struct assoofs_core_io)
+ *
+ * @param priv Puntero al estado del daemon
+ * @param block El número de bloque
+ * @param data Buffer de ASSOOFS_DEFAULT_BLOCK_SIZE bytes
+ *
+ * @return 0 si todo salió bien, -EIO en caso contrario
+ */
+static int afuse_io_read(void *priv, uint64_t block, void *data);
+
+/**
+ * Escribe un bloque en la imagen (write de struct assoofs_core_io)
+ *
+ * @param priv Puntero al estado del daemon
+ * @param block El número de bloque
+ * @param data El bloque (ASSOOFS_DEFAULT_BLOCK_SIZE bytes)
+ *
+ * @return 0 si todo salió bien, -EIO en caso contrario
+ */
+static int afuse_io_write(void *priv, uint64_t block, const void *data);
+
+/**
+ * Lee un bloque de metadatos de la imagen, comprueba su suma y lo guarda en la caché
+ *
+ * @param fs Puntero al estado del daemon
+ * @param block El número de bloque
+ *
+ * @return 0 si todo salió bien, -1 en caso contrario
+ */
+static int afuse_load_meta(struct afuse *fs, uint64_t block);
+
+/**
+ * Calcula la suma de un bloque de metadatos de la caché y lo escribe en la imagen
+ *
+ * @param fs Puntero al estado del daemon
+ * @param block El número de bloque
+ *
+ * @return 0 si todo salió bien, -EIO en caso contrario
+ */
+static int afuse_write_meta(struct afuse *fs, uint64_t block);
+
+/**
+ * Obtiene la fecha actual en nanosegundos desde el 1 de enero de 1970
+ *
+ * @return La fecha actual
+ */
+static int64_t afuse_now(void);
+
+/**
+ * Busca un inodo en el almacén de inodos
+ *
+ * @param fs Puntero al estado del daemon
+ * @param ino El número de inodo
+ *
+ * @return Puntero a la información persistente del inodo, o NULL si no existe
+ */
+static struct assoofs_inode_info *afuse_inode(struct afuse *fs, uint64_t ino);
+
+/**
+ * Rellena los atributos de un inodo
+ *
+ * @param info Puntero a la información persistente del inodo
+ * @param st Puntero a los atributos
+ */
+static void afuse_stat(const struct assoofs_inode_info *info, struct stat *st);
+
+/**
+ * Obtiene las entradas de un directorio (en la caché de metadatos)
+ *
+ * @param fs Puntero al estado del daemon
+ * @param dir Puntero a la información persistente del directorio
+ *
+ * @return Puntero a la primera entrada
+ */
+static struct assoofs_dir_record_entry *afuse_dir_entries(struct afuse *fs, const struct assoofs_inode_info *dir);
+
+/**
+ * Busca el directorio que contiene un inodo (el formato no guarda el padre de cada inodo)
+ *
+ * @param fs Puntero al estado del daemon
+ * @param ino El número de inodo
+ *
+ * @return Puntero a la información persistente del directorio padre, o NULL si es el raíz o no está en ningún directorio
+ */
+static struct assoofs_inode_info *afuse_parent(struct afuse *fs, uint64_t ino);
+
+/**
+ * Suma bytes e inodos al uso recursivo de un directorio y de todos sus antecesores (como assoofs_usage_add)
+ *
+ * @param fs Puntero al estado del daemon
+ * @param dir Puntero a la información persistente del directorio
+ * @param bytes Los bytes que se suman (negativo para restar)
+ * @param inodes Los inodos que se suman (negativo para restar)
+ */
+static void afuse_usage_add(struct afuse *fs, struct assoofs_inode_info *dir, int64_t bytes, int32_t inodes);
+
+/**
+ * Si el bloque de datos de un fichero está compartido (reflink), lo copia en un bloque propio (copy-on-write)
+ *
+ * @param fs Puntero al estado del daemon
+ * @param info Puntero a la información persistente del fichero
+ *
+ * @return 0 si todo salió bien, un valor negativo (errno) en caso contrario
+ */
+static int afuse_unshare(struct afuse *fs, struct assoofs_inode_info *info);
+
+/**
+ * Libera un inodo: lo quita del almacén (la última entrada ocupa su hueco) y suelta su bloque
+ *
+ * @param fs Puntero al estado del daemon
+ * @param ino El número de inodo
+ *
+ * @return 0 si todo salió bien, -EIO en caso contrario
+ */
+static int afuse_reclaim(struct afuse *fs, uint64_t ino);
+
+/**
+ * Busca la posición de un inodo en la tabla de inodos abiertos
+ *
+ * @param fs Puntero al estado del daemon
+ * @param ino El número de inodo
+ *
+ * @return Puntero a la posición del inodo, o NULL si no está abierto
+ */
+static struct afuse_open *afuse_open_slot(struct afuse *fs, uint64_t ino);
+
+/**
+ * Lee el contenido de un fichero comprimido y lo descomprime
+ *
+ * @param fs Puntero al estado del daemon
+ * @param info Puntero a la información persistente del fichero
+ * @param data Buffer de ASSOOFS_MAX_COMPRESSED_FILE_SIZE bytes donde se almacena el contenido
+ *
+ * @return 0 si todo salió bien, -EIO en caso contrario
+ */
+static int afuse_read_compressed(struct afuse *fs, const struct assoofs_inode_info *info, char *data);
+
+/**
+ * Comprime el contenido de un fichero comprimido y lo escribe en su bloque de datos
+ *
+ * @param fs Puntero al estado del daemon
+ * @param info Puntero a la información persistente del fichero
+ * @param data El contenido descomprimido
+ * @param size El número de bytes del contenido
+ *
+ * @return 0 si todo salió bien, -ENOSPC si no cabe en un bloque o -EIO si falla la escritura
+ */
+static int afuse_write_compressed(struct afuse *fs, const struct assoofs_inode_info *info, const char *data, size_t size);
+
+/**
+ * Crea un fichero o un directorio en un directorio
+ *
+ * @param fs Puntero al estado del daemon
+ * @param parent El número de inodo del directorio
+ * @param name El nombre de la nueva entrada
+ * @param mode El tipo y los permisos
+ * @param e Puntero donde se devuelve la entrada creada
+ *
+ * @return 0 si todo salió bien, un valor negativo (errno) en caso contrario
+ */
+static int afuse_make(struct afuse *fs, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_entry_param *e);
+
+/**
+ * Borra un fichero o un directorio vacío de un directorio
+ *
+ * @param fs Puntero al estado del daemon
+ * @param parent El número de inodo del directorio
+ * @param name El nombre de la entrada
+ * @param is_dir 1 para borrar un directorio (rmdir), 0 para borrar un fichero (unlink)
+ *
+ * @return 0 si todo salió bien, un valor negativo (errno) en caso contrario
+ */
+static int afuse_remove(struct afuse *fs, fuse_ino_t parent, const char *name, int is_dir);
+
+/**
+ * Cambia el tamaño de un fichero; los bytes que quedan fuera se ponen a cero (como assoofs_truncate)
+ *
+ * @param fs Puntero al estado del daemon
+ * @param info Puntero a la información persistente del fichero
+ * @param size El nuevo tamaño
+ *
+ * @return 0 si todo salió bien, un valor negativo (errno) en caso contrario
+ */
+static int afuse_truncate(struct afuse *fs, struct assoofs_inode_info *info, off_t size);
+
+/**
+ * Operaciones de sistema de archivos de la API de bajo nivel de libfuse
+ * (los parámetros son los de struct fuse_lowlevel_ops)
+ */
+static void afuse_init(void *userdata, struct fuse_conn_info *conn);
+static void afuse_destroy(void *userdata);
+static void afuse_lookup(fuse_req_t req, fuse_ino_t parent, const char *name);
+static void afuse_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
+static void afuse_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi);
+static void afuse_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi);
+static void afuse_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode);
+static void afuse_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi);
+static void afuse_unlink(fuse_req_t req, fuse_ino_t parent, const char *name);
+static void afuse_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name);
+static void afuse_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
+static void afuse_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
+static void afuse_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi);
+static void afuse_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv, off_t off, struct fuse_file_info *fi);
+static void afuse_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi);
+static void afuse_statfs(fuse_req_t req, fuse_ino_t ino);
+
+/**
+ * Guarda la ruta de la imagen, el primer argumento que no es una opción (para fuse_opt_parse)
+ *
+ * @param data Puntero a la ruta de la imagen
+ * @param arg El argumento
+ * @param key El tipo de argumento
+ * @param outargs Los argumentos que se pasan a libfuse
+ *
+ * @return 0 si el argumento es la imagen, 1 para que libfuse lo procese
+ */
+static int afuse_opt_proc(void *data, const char *arg, int key, struct fuse_args *outargs);
+
+static const struct fuse_lowlevel_ops afuse_ops = {
+    .init = afuse_init,
+    .destroy = afuse_destroy,
+    .lookup = afuse_lookup,
+    .getattr = afuse_getattr,
+    .setattr = afuse_setattr,
+    .readdir = afuse_readdir,
+    .mkdir = afuse_mkdir,
+    .create = afuse_create,
+    .unlink = afuse_unlink,
+    .rmdir = afuse_rmdir,
+    .open = afuse_open,
+    .release = afuse_release,
+    .read = afuse_read,
+    .write_buf = afuse_write_buf,
+    .fsync = afuse_fsync,
+    .statfs = afuse_statfs,
+};
+
+// +++++++++++++++++++++++++
+// Definiciones de funciones
+// +++++++++++++++++++++++++
+
+static int afuse_load(struct afuse *fs, const char *image)
+{
+    uint64_t i;
+    uint64_t count;
+
+    fs->fd = open(image, O_RDWR);
+    if (fs->fd == -1)
+    {
+        perror(image);
+        return -1;
+    }
+    fs->io.priv = fs;
+    fs->io.read = afuse_io_read;
+    fs->io.write = afuse_io_write;
+
+    // 1. Leemos el superbloque y comprobamos que la imagen tenga el formato actual
+    if (afuse_load_meta(fs, ASSOOFS_SUPERBLOCK_BLOCK_NUMBER))
+        return -1;
+    fs->sb = (struct assoofs_super_block_info *)fs->meta[ASSOOFS_SUPERBLOCK_BLOCK_NUMBER];
+    if (fs->sb->magic != ASSOOFS_MAGIC || fs->sb->version != ASSOOFS_VERSION)
+    {
+        printf("%s is not an assoofs image of format version %d.\n", image, ASSOOFS_VERSION);
+        return -1;
+    }
+    // Los bloques de datos se leen por su posición en la imagen, lo que solo es válido con un único dispositivo
+    if (fs->sb->devices_count > 1)
+    {
+        printf("%s spans %llu devices, which assoofs-fuse does not support.\n", image, (unsigned long long)fs->sb->devices_count);
+        return -1;
+    }
+    if (fs->sb->blocks_count < ASSOOFS_MIN_BLOCKS || fs->sb->blocks_count > ASSOOFS_MAX_BLOCKS)
+    {
+        printf("%s has an invalid number of blocks.\n", image);
+        return -1;
+    }
+
+    // 2. Leemos el almacén de inodos y los bloques de todos los directorios
+    if (afuse_load_meta(fs, ASSOOFS_INODESTORE_BLOCK_NUMBER))
+        return -1;
+    fs->inodes = (struct assoofs_inode_info *)fs->meta[ASSOOFS_INODESTORE_BLOCK_NUMBER];
+    if (fs->sb->inodes_count > ASSOOFS_MAX_INODES)
+    {
+        printf("%s has an invalid number of inodes.\n", image);
+        return -1;
+    }
+    for (i = 0; i < fs->sb->inodes_count; i++)
+    {
+        if (!S_ISDIR(fs->inodes[i].mode))
+            continue;
+        if (fs->inodes[i].data_block_number <= ASSOOFS_INODESTORE_BLOCK_NUMBER || fs->inodes[i].data_block_number >= fs->sb->blocks_count || afuse_load_meta(fs, fs->inodes[i].data_block_number))
+        {
+            printf("Reading the block of directory %llu has failed.\n", (unsigned long long)fs->inodes[i].inode_no);
+            return -1;
+        }
+    }
+
+    // 3. Liberamos los inodos borrados que seguían abiertos cuando se desmontó (como assoofs_orphan_recover)
+    count = fs->sb->inodes_count;
+    for (i = count; i-- > 0;)
+        if ((fs->inodes[i].flags & ASSOOFS_INODE_ORPHAN) && afuse_reclaim(fs, fs->inodes[i].inode_no))
+            return -1;
+
+    return 0;
+}
+
+static int afuse_load_meta(struct afuse *fs, uint64_t block)
+{
+    char *data;
+
+    int ret;
+
+    data = malloc(ASSOOFS_DEFAULT_BLOCK_SIZE);
+    if (!data)
+        return -1;
+
+    ret = assoofs_core_read_meta(&fs->io, block, data);
+    if (ret)
+    {
+        if (ret == -EBADMSG)
+            printf("Block [%llu] has a metadata checksum error.\n", (unsigned long long)block);
+        else
+            printf("Reading block [%llu] has failed.\n", (unsigned long long)block);
+        free(data);
+        return -1;
+    }
+
+    free(fs->meta[block]);
+    fs->meta[block] = data;
+    return 0;
+}
+
+static int afuse_io_read(void *priv, uint64_t block, void *data)
+{
+    struct afuse *fs = priv;
+
+    if (pread(fs->fd, data, ASSOOFS_DEFAULT_BLOCK_SIZE, block * ASSOOFS_DEFAULT_BLOCK_SIZE) != ASSOOFS_DEFAULT_BLOCK_SIZE)
+        return -EIO;
+
+    return 0;
+}
+
+static int afuse_io_write(void *priv, uint64_t block, const void *data)
+{
+    struct afuse *fs = priv;
+
+    if (pwrite(fs->fd, data, ASSOOFS_DEFAULT_BLOCK_SIZE, block * ASSOOFS_DEFAULT_BLOCK_SIZE) != ASSOOFS_DEFAULT_BLOCK_SIZE)
+        return -EIO;
+
+    return 0;
+}
+
+static int afuse_write_meta(struct afuse *fs, uint64_t block)
+{
+    return assoofs_core_write_meta(&fs->io, block, fs->meta[block]);
+}
+
+static int64_t afuse_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static struct assoofs_inode_info *afuse_inode(struct afuse *fs, uint64_t ino)
+{
+    return assoofs_core_inode_find(fs->inodes, fs->sb->inodes_count, ino);
+}
+
+static void afuse_stat(const struct assoofs_inode_info *info, struct stat *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->st_ino = info->inode_no;
+    st->st_mode = info->mode;
+    st->st_nlink = S_ISDIR(info->mode) ? 2 : 1;
+    // El formato no guarda propietario: como en el módulo, los inodos pertenecen a quien los usa (el usuario del daemon)
+    st->st_uid = getuid();
+    st->st_gid = getgid();
+    st->st_size = S_ISDIR(info->mode) ? ASSOOFS_DEFAULT_BLOCK_SIZE : info->file_size;
+    st->st_blksize = ASSOOFS_DEFAULT_BLOCK_SIZE;
+    st->st_blocks = ASSOOFS_DEFAULT_BLOCK_SIZE / 512;
+    st->st_atim.tv_sec = info->atime / 1000000000LL;
+    st->st_atim.tv_nsec = info->atime % 1000000000LL;
+    st->st_mtim.tv_sec = info->mtime / 1000000000LL;
+    st->st_mtim.tv_nsec = info->mtime % 1000000000LL;
+    st->st_ctim.tv_sec = info->ctime / 1000000000LL;
+    st->st_ctim.tv_nsec = info->ctime % 1000000000LL;
+}
+
+static struct assoofs_dir_record_entry *afuse_dir_entries(struct afuse *fs, const struct assoofs_inode_info *dir)
+{
+    return (struct assoofs_dir_record_entry *)fs->meta[dir->data_block_number];
+}
+
+static struct assoofs_inode_info *afuse_parent(struct afuse *fs, uint64_t ino)
+{
+    struct assoofs_dir_record_entry *entries;
+    uint64_t i;
+    uint64_t j;
+
+    if (ino == ASSOOFS_ROOTDIR_INODE_NUMBER)
+        return NULL;
+
+    for (i = 0; i < fs->sb->inodes_count; i++)
+    {
+        if (!S_ISDIR(fs->inodes[i].mode))
+            continue;
+        entries = afuse_dir_entries(fs, &fs->inodes[i]);
+        for (j = 0; j < fs->inodes[i].dir_children_count && j < ASSOOFS_DIR_ENTRIES_PER_BLOCK; j++)
+            if (entries[j].inode_no == ino)
+                return &fs->inodes[i];
+    }
+
+    return NULL;
+}
+
+static void afuse_usage_add(struct afuse *fs, struct assoofs_inode_info *dir, int64_t bytes, int32_t inodes)
+{
+    // Los directorios forman un árbol de como mucho ASSOOFS_MAX_INODES niveles
+    while (dir)
+    {
+        dir->tree_size += bytes;
+        dir->tree_inodes += inodes;
+        dir = afuse_parent(fs, dir->inode_no);
+    }
+}
+
+static int afuse_unshare(struct afuse *fs, struct assoofs_inode_info *info)
+{
+    char data[ASSOOFS_DEFAULT_BLOCK_SIZE];
+    uint64_t old_block = info->data_block_number;
+    uint64_t new_block;
+
+    if (fs->sb->block_shared_refs[old_block] == 0)
+        return 0;
+
+    // 1. Copiamos el bloque compartido en un bloque libre
+    if (assoofs_core_alloc_block(fs->sb, ASSOOFS_ROOTDIR_BLOCK_NUMBER, &new_block))
+        return -ENOSPC;
+    if (pread(fs->fd, data, sizeof(data), old_block * ASSOOFS_DEFAULT_BLOCK_SIZE) != sizeof(data) ||
+        pwrite(fs->fd, data, sizeof(data), new_block * ASSOOFS_DEFAULT_BLOCK_SIZE) != sizeof(data))
+    {
+        assoofs_core_put_block(fs->sb, new_block);
+        return -EIO;
+    }
+
+    // 2. El fichero apunta a su copia; el almacén se escribe antes que el superbloque, como en el módulo
+    info->data_block_number = new_block;
+    if (afuse_write_meta(fs, ASSOOFS_INODESTORE_BLOCK_NUMBER))
+        return -EIO;
+    assoofs_core_put_block(fs->sb, old_block);
+
+    return afuse_write_meta(fs, ASSOOFS_SUPERBLOCK_BLOCK_NUMBER);
+}
+
+static int afuse_reclaim(struct afuse *fs, uint64_t ino)
+{
+    struct assoofs_inode_info *info;
+    uint64_t count = fs->sb->inodes_count;
+    uint64_t block;
+
+    info = afuse_inode(fs, ino);
+    if (!info)
+        return 0;
+    block = info->data_block_number;
+
+    // 1. Quitamos el inodo del almacén: la última entrada ocupa su hueco para que sigan siendo contiguas
+    assoofs_core_inode_remove(fs->inodes, count, info);
+    if (afuse_write_meta(fs, ASSOOFS_INODESTORE_BLOCK_NUMBER))
+        return -EIO;
+
+    // 2. Soltamos su bloque (el de un directorio deja de ser un bloque de metadatos)
+    if (fs->sb->block_shared_refs[block] == 0)
+    {
+        free(fs->meta[block]);
+        fs->meta[block] = NULL;
+    }
+    fs->sb->inodes_count--;
+    assoofs_core_put_block(fs->sb, block);
+
+    return afuse_write_meta(fs, ASSOOFS_SUPERBLOCK_BLOCK_NUMBER);
+}
+
+static struct afuse_open *afuse_open_slot(struct afuse *fs, uint64_t ino)
+{
+    int i;
+
+    for (i = 0; i < ASSOOFS_MAX_BLOCKS; i++)
+        if (fs->opens[i].ino == ino)
+            return &fs->opens[i];
+
+    return NULL;
+}
+
+static int afuse_read_compressed(struct afuse *fs, const struct assoofs_inode_info *info, char *data)
+{
+    char block[ASSOOFS_DEFAULT_BLOCK_SIZE];
+    struct assoofs_compressed_header *header = (struct assoofs_compressed_header *)block;
+
+    if (info->file_size == 0)
+        return 0;
+
+    if (pread(fs->fd, block, sizeof(block), info->data_block_number * ASSOOFS_DEFAULT_BLOCK_SIZE) != sizeof(block))
+        return -EIO;
+    if (header->compressed_size > sizeof(block) - sizeof(*header) ||
+        LZ4_decompress_safe(block + sizeof(*header), data, header->compressed_size, ASSOOFS_MAX_COMPRESSED_FILE_SIZE) != (int)info->file_size)
+        return -EIO;
+
+    return 0;
+}
+
+static int afuse_write_compressed(struct afuse *fs, const struct assoofs_inode_info *info, const char *data, size_t size)
+{
+    char block[ASSOOFS_DEFAULT_BLOCK_SIZE];
+    struct assoofs_compressed_header *header = (struct assoofs_compressed_header *)block;
+    int compressed_size;
+
+    memset(block, 0, sizeof(block));
+    compressed_size = LZ4_compress_default(data, block + sizeof(*header), size, sizeof(block) - sizeof(*header));
+    if (compressed_size <= 0)
+        return -ENOSPC;
+    header->compressed_size = compressed_size;
+
+    if (pwrite(fs->fd, block, sizeof(block), info->data_block_number * ASSOOFS_DEFAULT_BLOCK_SIZE) != sizeof(block))
+        return -EIO;
+
+    return 0;
+}
+
+static int afuse_make(struct afuse *fs, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_entry_param *e)
+{
+    char zero[ASSOOFS_DEFAULT_BLOCK_SIZE];
+    struct assoofs_inode_info *dir;
+    struct assoofs_inode_info *info;
+    uint64_t block;
+    int64_t now;
+
+    // 1. Comprobamos el directorio, el nombre y que quede sitio
+    dir = afuse_inode(fs, parent);
+    if (!dir)
+        return -ENOENT;
+    if (!S_ISDIR(dir->mode))
+        return -ENOTDIR;
+    if (strlen(name) >= ASSOOFS_FILENAME_MAXLEN)
+        return -ENAMETOOLONG;
+    if (assoofs_core_dir_find(afuse_dir_entries(fs, dir), dir->dir_children_count, name))
+        return -EEXIST;
+    if (dir->dir_children_count >= ASSOOFS_DIR_ENTRIES_PER_BLOCK || fs->sb->inodes_count >= assoofs_core_max_inodes(fs->sb))
+        return -ENOSPC;
+
+    // 2. Reservamos y ponemos a cero el bloque del nuevo inodo (en la caché si es un directorio)
+    if (assoofs_core_alloc_block(fs->sb, ASSOOFS_ROOTDIR_BLOCK_NUMBER, &block))
+        return -ENOSPC;
+    memset(zero, 0, sizeof(zero));
+    if (S_ISDIR(mode))
+    {
+        fs->meta[block] = calloc(1, ASSOOFS_DEFAULT_BLOCK_SIZE);
+        if (!fs->meta[block])
+        {
+            assoofs_core_put_block(fs->sb, block);
+            return -ENOMEM;
+        }
+        if (afuse_write_meta(fs, block))
+            goto err_block;
+    }
+    else if (pwrite(fs->fd, zero, sizeof(zero), block * ASSOOFS_DEFAULT_BLOCK_SIZE) != sizeof(zero))
+        goto err_block;
+
+    // 3. Añadimos el inodo al final del almacén
+    now = afuse_now();
+    info = &fs->inodes[fs->sb->inodes_count];
+    memset(info, 0, sizeof(*info));
+    info->mode = mode;
+    info->inode_no = fs->sb->next_inode_no++;
+    info->data_block_number = block;
+    info->atime = info->mtime = info->ctime = now;
+    if (S_ISDIR(mode))
+        info->tree_inodes = 1;
+    fs->sb->inodes_count++;
+
+    // 4. Añadimos la entrada al directorio y actualizamos sus fechas y el uso de sus antecesores
+    assoofs_core_dir_add(afuse_dir_entries(fs, dir), dir->dir_children_count, name, info->inode_no);
+    dir->dir_children_count++;
+    dir->mtime = dir->ctime = now;
+    afuse_usage_add(fs, dir, 0, 1);
+
+    // 5. Escribimos el almacén, el directorio y el superbloque (en ese orden, como assoofs_create)
+    if (afuse_write_meta(fs, ASSOOFS_INODESTORE_BLOCK_NUMBER) || afuse_write_meta(fs, dir->data_block_number) ||
+        afuse_write_meta(fs, ASSOOFS_SUPERBLOCK_BLOCK_NUMBER))
+        return -EIO;
+
+    memset(e, 0, sizeof(*e));
+    e->ino = info->inode_no;
+    e->attr_timeout = AFUSE_TIMEOUT;
+    e->entry_timeout = AFUSE_TIMEOUT;
+    afuse_stat(info, &e->attr);
+    return 0;
+
+err_block:
+    free(fs->meta[block]);
+    fs->meta[block] = NULL;
+    assoofs_core_put_block(fs->sb, block);
+    return -EIO;
+}
+
+static int afuse_remove(struct afuse *fs, fuse_ino_t parent, const char *name, int is_dir)
+{
+    struct assoofs_inode_info *dir;
+    struct assoofs_inode_info *info;
+    struct assoofs_dir_record_entry *entries;
+    struct assoofs_dir_record_entry *entry;
+    struct afuse_open *slot;
+    uint64_t ino;
+
+    // 1. Buscamos la entrada y comprobamos que se pueda borrar
+    dir = afuse_inode(fs, parent);
+    if (!dir)
+        return -ENOENT;
+    if (!S_ISDIR(dir->mode))
+        return -ENOTDIR;
+    entries = afuse_dir_entries(fs, dir);
+    entry = assoofs_core_dir_find(entries, dir->dir_children_count, name);
+    if (!entry)
+        return -ENOENT;
+    ino = entry->inode_no;
+    info = afuse_inode(fs, ino);
+    if (!info)
+        return -EIO;
+    if (is_dir && !S_ISDIR(info->mode))
+        return -ENOTDIR;
+    if (!is_dir && S_ISDIR(info->mode))
+        return -EISDIR;
+    if (is_dir && info->dir_children_count > 0)
+        return -ENOTEMPTY;
+
+    // 2. Quitamos la entrada (la última ocupa su hueco) y actualizamos el directorio y el uso de sus antecesores
+    assoofs_core_dir_remove(entries, dir->dir_children_count, entry);
+    dir->dir_children_count--;
+    dir->mtime = dir->ctime = afuse_now();
+    afuse_usage_add(fs, dir, S_ISDIR(info->mode) ? 0 : -(int64_t)info->file_size, -1);
+    if (afuse_write_meta(fs, dir->data_block_number))
+        return -EIO;
+
+    // 3. Si sigue abierto, se marca como huérfano y se libera al cerrarlo; si no, se libera ya
+    slot = afuse_open_slot(fs, ino);
+    if (slot)
+    {
+        info->flags |= ASSOOFS_INODE_ORPHAN;
+        return afuse_write_meta(fs, ASSOOFS_INODESTORE_BLOCK_NUMBER);
+    }
+    if (afuse_write_meta(fs, ASSOOFS_INODESTORE_BLOCK_NUMBER))
+        return -EIO;
+
+    return afuse_reclaim(fs, ino);
+}
+
+static int afuse_truncate(struct afuse *fs, struct assoofs_inode_info *info, off_t size)
+{
+    char zero[ASSOOFS_DEFAULT_BLOCK_SIZE];
+    char *data;
+    size_t max_size;
+    int ret;
+
+    if (!S_ISREG(info->mode))
+        return -EISDIR;
+    max_size = (info->flags & ASSOOFS_INODE_COMPRESSED) ? ASSOOFS_MAX_COMPRESSED_FILE_SIZE : ASSOOFS_DEFAULT_BLOCK_SIZE;
+    if (size < 0 || (size_t)size > max_size)
+        return -EFBIG;
+    if ((uint64_t)size == info->file_size)
+        return 0;
+
+    ret = afuse_unshare(fs, info);
+    if (ret)
+        return ret;
+
+    if (info->flags & ASSOOFS_INODE_COMPRESSED)
+    {
+        // Los ficheros comprimidos se descomprimen, se recortan o amplían con ceros y se vuelven a comprimir
+        data = calloc(1, ASSOOFS_MAX_COMPRESSED_FILE_SIZE);
+        if (!data)
+            return -ENOMEM;
+        ret = afuse_read_compressed(fs, info, data);
+        if (ret == 0)
+        {
+            if ((uint64_t)size < info->file_size)
+                memset(data + size, 0, info->file_size - size);
+            ret = afuse_write_compressed(fs, info, data, size);
+        }
+        free(data);
+        if (ret)
+            return ret;
+    }
+    else if ((uint64_t)size < info->file_size)
+    {
+        // Los bytes que quedan fuera se ponen a cero para que una ampliación posterior lea ceros
+        memset(zero, 0, sizeof(zero));
+        if (pwrite(fs->fd, zero, info->file_size - size, info->data_block_number * ASSOOFS_DEFAULT_BLOCK_SIZE + size) < 0)
+            return -EIO;
+    }
+
+    afuse_usage_add(fs, afuse_parent(fs, info->inode_no), (int64_t)size - (int64_t)info->file_size, 0);
+    info->file_size = size;
+
+    return 0;
+}
+
+static void afuse_init(void *userdata, struct fuse_conn_info *conn)
+{
+    (void)userdata;
+
+    // Los datos se pasan entre /dev/fuse y la imagen con splice, sin copiarlos en la memoria del daemon
+    if (conn->capable & FUSE_CAP_SPLICE_WRITE)
+        conn->want |= FUSE_CAP_SPLICE_WRITE;
+    if (conn->capable & FUSE_CAP_SPLICE_MOVE)
+        conn->want |= FUSE_CAP_SPLICE_MOVE;
+    if (conn->capable & FUSE_CAP_SPLICE_READ)
+        conn->want |= FUSE_CAP_SPLICE_READ;
+}
+
+static void afuse_destroy(void *userdata)
+{
+    struct afuse *fs = userdata;
+
+    fsync(fs->fd);
+}
+
+static void afuse_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    struct afuse *fs = fuse_req_userdata(req);
+    struct fuse_entry_param e;
+    struct assoofs_inode_info *dir;
+    struct assoofs_inode_info *info;
+    struct assoofs_dir_record_entry *entry;
+
+    pthread_rwlock_rdlock(&fs->lock);
+    dir = afuse_inode(fs, parent);
+    entry = (dir && S_ISDIR(dir->mode)) ? assoofs_core_dir_find(afuse_dir_entries(fs, dir), dir->dir_children_count, name) : NULL;
+    info = entry ? afuse_inode(fs, entry->inode_no) : NULL;
+    if (!info)
+    {
+        pthread_rwlock_unlock(&fs->lock);
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    // Los números de inodo no se reutilizan, por lo que la generación siempre es 0
+    memset(&e, 0, sizeof(e));
+    e.ino = info->inode_no;
+    e.attr_timeout = AFUSE_TIMEOUT;
+    e.entry_timeout = AFUSE_TIMEOUT;
+    afuse_stat(info, &e.attr);
+    pthread_rwlock_unlock(&fs->lock);
+
+    fuse_reply_entry(req, &e);
+}
+
+static void afuse_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    struct afuse *fs = fuse_req_userdata(req);
+    struct assoofs_inode_info *info;
+    struct stat st;
+
+    (void)fi;
+
+    pthread_rwlock_rdlock(&fs->lock);
+    info = afuse_inode(fs, ino);
+    if (info)
+        afuse_stat(info, &st);
+    pthread_rwlock_unlock(&fs->lock);
+
+    if (!info)
+        fuse_reply_err(req, ENOENT);
+    else
+        fuse_reply_attr(req, &st, AFUSE_TIMEOUT);
+}
+
+static void afuse_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi)
+{
+    struct afuse *fs = fuse_req_userdata(req);
+    struct assoofs_inode_info *info;
+    struct stat st;
+    int64_t now;
+    int ret = 0;
+
+    (void)fi;
+
+    pthread_rwlock_wrlock(&fs->lock);
+    info = afuse_inode(fs, ino);
+    if (!info)
+        ret = -ENOENT;
+
+    // Cambiamos el tamaño, los permisos y las fechas (el formato no guarda propietario)
+    now = afuse_now();
+    if (ret == 0 && (to_set & FUSE_SET_ATTR_SIZE))
+    {
+        ret = afuse_truncate(fs, info, attr->st_size);
+        if (ret == 0)
+            info->mtime = now;
+    }
+    if (ret == 0)
+    {
+        if (to_set & FUSE_SET_ATTR_MODE)
+            info->mode = (info->mode & S_IFMT) | (attr->st_mode & 07777);
+        if (to_set & FUSE_SET_ATTR_ATIME_NOW)
+            info->atime = now;
+        else if (to_set & FUSE_SET_ATTR_ATIME)
+            info->atime = (int64_t)attr->st_atim.tv_sec * 1000000000LL + attr->st_atim.tv_nsec;
+        if (to_set & FUSE_SET_ATTR_MTIME_NOW)
+            info->mtime = now;
+        else if (to_set & FUSE_SET_ATTR_MTIME)
+            info->mtime = (int64_t)attr->st_mtim.tv_sec * 1000000000LL + attr->st_mtim.tv_nsec;
+        info->ctime = now;
+        ret = afuse_write_meta(fs, ASSOOFS_INODESTORE_BLOCK_NUMBER);
+        afuse_stat(info, &st);
+    }
+    pthread_rwlock_unlock(&fs->lock);
+
+    if (ret)
+        fuse_reply_err(req, -ret);
+    else
+        fuse_reply_attr(req, &st, AFUSE_TIMEOUT);
+}
+
+static void afuse_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    struct afuse *fs = fuse_req_userdata(req);
+    struct assoofs_inode_info *dir;
+    struct assoofs_inode_info *parent;
+    struct assoofs_inode_info *info;
+    struct assoofs_dir_record_entry *entries;
+    struct stat st;
+    char *buf;
+    size_t len = 0;
+    size_t entry_len;
+    uint64_t count;
+    uint64_t i;
+
+    (void)fi;
+
+    buf = malloc(size);
+    if (!buf)
+    {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    pthread_rwlock_rdlock(&fs->lock);
+    dir = afuse_inode(fs, ino);
+    if (!dir || !S_ISDIR(dir->mode))
+    {
+        pthread_rwlock_unlock(&fs->lock);
+        free(buf);
+        fuse_reply_err(req, dir ? ENOTDIR : ENOENT);
+        return;
+    }
+
+    // Las posiciones 0 y 1 son "." y ".."; la posición i + 2 es la entrada i del directorio
+    entries = afuse_dir_entries(fs, dir);
+    count = dir->dir_children_count + 2;
+    parent = afuse_parent(fs, dir->inode_no);
+    memset(&st, 0, sizeof(st));
+    for (i = off; i < count; i++)
+    {
+        if (i < 2)
+        {
+            info = i == 0 || !parent ? dir : parent;
+            st.st_ino = info->inode_no;
+            st.st_mode = S_IFDIR;
+            entry_len = fuse_add_direntry(req, buf + len, size - len, i == 0 ? "." : "..", &st, i + 1);
+        }
+        else
+        {
+            info = afuse_inode(fs, entries[i - 2].inode_no);
+            st.st_ino = entries[i - 2].inode_no;
+            st.st_mode = info ? info->mode & S_IFMT : 0;
+            entry_len = fuse_add_direntry(req, buf + len, size - len, entries[i - 2].filename, &st, i + 1);
+        }
+        if (entry_len > size - len)
+            break;
+        len += entry_len;
+    }
+    pthread_rwlock_unlock(&fs->lock);
+
+    fuse_reply_buf(req, buf, len);
+    free(buf);
+}
+
+static void afuse_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
+{
+    struct afuse *fs = fuse_req_userdata(req);
+    struct fuse_entry_param e;
+    int ret;
+
+    pthread_rwlock_wrlock(&fs->lock);
+    ret = afuse_make(fs, parent, name, S_IFDIR | (mode & 07777), &e);
+    pthread_rwlock_unlock(&fs->lock);
+
+    if (ret)
+        fuse_reply_err(req, -ret);
+    else
+        fuse_reply_entry(req, &e);
+}
+
+static void afuse_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi)
+{
+    struct afuse *fs = fuse_req_userdata(req);
+    struct fuse_entry_param e;
+    struct afuse_open *slot;
+    int ret;
+
+    pthread_rwlock_wrlock(&fs->lock);
+    ret = afuse_make(fs, parent, name, S_IFREG | (mode & 07777), &e);
+    // El fichero queda abierto: se apunta como en afuse_open (siempre hay sitio, hay más posiciones que inodos)
+    if (ret == 0)
+    {
+        slot = afuse_open_slot(fs, 0);
+        slot->ino = e.ino;
+        slot->count = 1;
+    }
+    pthread_rwlock_unlock(&fs->lock);
+
+    if (ret)
+        fuse_reply_err(req, -ret);
+    else
+        fuse_reply_create(req, &e, fi);
+}
+
+static void afuse_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    struct afuse *fs = fuse_req_userdata(req);
+    int ret;
+
+    pthread_rwlock_wrlock(&fs->lock);
+    ret = afuse_remove(fs, parent, name, 0);
+    pthread_rwlock_unlock(&fs->lock);
+
+    fuse_reply_err(req, -ret);
+}
+
+static void afuse_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    struct afuse *fs = fuse_req_userdata(req);
+    int ret;
+
+    pthread_rwlock_wrlock(&fs->lock);
+    ret = afuse_remove(fs, parent, name, 1);
+    pthread_rwlock_unlock(&fs->lock);
+
+    fuse_reply_err(req, -ret);
+}
+
+static void afuse_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    struct afuse *fs = fuse_req_userdata(req);
+    struct assoofs_inode_info *info;
+    struct afuse_open *slot;
+    int ret = 0;
+
+    pthread_rwlock_wrlock(&fs->lock);
+    info = afuse_inode(fs, ino);
+    if (!info)
+        ret = ENOENT;
+    else if (!S_ISREG(info->mode))
+        ret = EISDIR;
+    else
+    {
+        slot = afuse_open_slot(fs, ino);
+        if (!slot)
+        {
+            slot = afuse_open_slot(fs, 0);
+            slot->ino = ino;
+        }
+        slot->count++;
+    }
+    pthread_rwlock_unlock(&fs->lock);
+
+    if (ret)
+        fuse_reply_err(req, ret);
+    else
+        fuse_reply_open(req, fi);
+}
+
+static void afuse_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    struct afuse *fs = fuse_req_userdata(req);
+    struct assoofs_inode_info *info;
+    struct afuse_open *slot;
+    int ret = 0;
+
+    (void)fi;
+
+    // Al cerrar el último descriptor de un fichero borrado se libera su bloque y su inodo
+    pthread_rwlock_wrlock(&fs->lock);
+    slot = afuse_open_slot(fs, ino);
+    if (slot && --slot->count == 0)
+    {
+        slot->ino = 0;
+        info = afuse_inode(fs, ino);
+        if (info && (info->flags & ASSOOFS_INODE_ORPHAN))
+            ret = afuse_reclaim(fs, ino);
+    }
+    pthread_rwlock_unlock(&fs->lock);
+
+    fuse_reply_err(req, -ret);
+}
+
+static void afuse_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    struct afuse *fs = fuse_req_userdata(req);
+    struct fuse_bufvec buf = FUSE_BUFVEC_INIT(0);
+    struct assoofs_inode_info *info;
+    char *data;
+    int ret;
+
+    (void)fi;
+
+    pthread_rwlock_rdlock(&fs->lock);
+    info = afuse_inode(fs, ino);
+    if (!info)
+    {
+        pthread_rwlock_unlock(&fs->lock);
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if ((uint64_t)off >= info->file_size)
+    {
+        pthread_rwlock_unlock(&fs->lock);
+        fuse_reply_buf(req, NULL, 0);
+        return;
+    }
+    if (size > info->file_size - off)
+        size = info->file_size - off;
+
+    if (info->flags & ASSOOFS_INODE_COMPRESSED)
+    {
+        // Los ficheros comprimidos se descomprimen en memoria
+        data = malloc(ASSOOFS_MAX_COMPRESSED_FILE_SIZE);
+        ret = data ? afuse_read_compressed(fs, info, data) : -ENOMEM;
+        pthread_rwlock_unlock(&fs->lock);
+        if (ret)
+            fuse_reply_err(req, -ret);
+        else
+            fuse_reply_buf(req, data + off, size);
+        free(data);
+        return;
+    }
+
+    // El resto se pasan de la imagen a /dev/fuse con splice; el cerrojo impide que el bloque cambie mientras tanto
+    buf.buf[0].size = size;
+    buf.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+    buf.buf[0].fd = fs->fd;
+    buf.buf[0].pos = info->data_block_number * ASSOOFS_DEFAULT_BLOCK_SIZE + off;
+    fuse_reply_data(req, &buf, FUSE_BUF_SPLICE_MOVE);
+    pthread_rwlock_unlock(&fs->lock);
+}
+
+static void afuse_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv, off_t off, struct fuse_file_info *fi)
+{
+    struct afuse *fs = fuse_req_userdata(req);
+    struct fuse_bufvec dst = FUSE_BUFVEC_INIT(0);
+    struct assoofs_inode_info *info;
+    char zero[ASSOOFS_DEFAULT_BLOCK_SIZE];
+    char *data = NULL;
+    size_t len = fuse_buf_size(bufv);
+    size_t max_size;
+    uint64_t end;
+    ssize_t copied;
+    int ret = 0;
+
+    (void)fi;
+
+    pthread_rwlock_wrlock(&fs->lock);
+
+    // 1. Comprobamos que la escritura quepa y, si el bloque está compartido, escribimos sobre una copia privada
+    info = afuse_inode(fs, ino);
+    if (!info)
+        ret = -ENOENT;
+    else
+    {
+        max_size = (info->flags & ASSOOFS_INODE_COMPRESSED) ? ASSOOFS_MAX_COMPRESSED_FILE_SIZE : ASSOOFS_DEFAULT_BLOCK_SIZE;
+        if (off < 0 || off + len > max_size)
+            ret = -EFBIG;
+        else
+            ret = afuse_unshare(fs, info);
+    }
+    if (ret)
+        goto out;
+    end = off + len;
+
+    // 2. Copiamos los datos en el bloque del fichero
+    if (info->flags & ASSOOFS_INODE_COMPRESSED)
+    {
+        // Los ficheros comprimidos se descomprimen, se modifican y se vuelven a comprimir
+        data = calloc(1, ASSOOFS_MAX_COMPRESSED_FILE_SIZE);
+        ret = data ? afuse_read_compressed(fs, info, data) : -ENOMEM;
+        if (ret)
+            goto out;
+        dst.buf[0].size = len;
+        dst.buf[0].mem = data + off;
+        copied = fuse_buf_copy(&dst, bufv, 0);
+        if (copied != (ssize_t)len)
+        {
+            ret = copied < 0 ? (int)copied : -EIO;
+            goto out;
+        }
+        ret = afuse_write_compressed(fs, info, data, end > info->file_size ? end : info->file_size);
+        if (ret)
+            goto out;
+    }
+    else
+    {
+        // Si se escribe más allá del final, el hueco se lee como ceros
+        memset(zero, 0, sizeof(zero));
+        if ((uint64_t)off > info->file_size && pwrite(fs->fd, zero, off - info->file_size, info->data_block_number * ASSOOFS_DEFAULT_BLOCK_SIZE + info->file_size) < 0)
+        {
+            ret = -EIO;
+            goto out;
+        }
+        // Los datos pasan de /dev/fuse a la imagen con splice cuando libfuse ha recibido la petición así
+        dst.buf[0].size = len;
+        dst.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+        dst.buf[0].fd = fs->fd;
+        dst.buf[0].pos = info->data_block_number * ASSOOFS_DEFAULT_BLOCK_SIZE + off;
+        copied = fuse_buf_copy(&dst, bufv, FUSE_BUF_SPLICE_NONBLOCK);
+        if (copied != (ssize_t)len)
+        {
+            ret = copied < 0 ? (int)copied : -EIO;
+            goto out;
+        }
+    }
+
+    // 3. Actualizamos el tamaño, las fechas y el uso de los directorios antecesores
+    if (end > info->file_size)
+    {
+        afuse_usage_add(fs, afuse_parent(fs, info->inode_no), end - info->file_size, 0);
+        info->file_size = end;
+    }
+    info->mtime = info->ctime = afuse_now();
+    ret = afuse_write_meta(fs, ASSOOFS_INODESTORE_BLOCK_NUMBER);
+
+out:
+    pthread_rwlock_unlock(&fs->lock);
+    free(data);
+
+    if (ret)
+        fuse_reply_err(req, -ret);
+    else
+        fuse_reply_write(req, len);
+}
+
+static void afuse_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
+{
+    struct afuse *fs = fuse_req_userdata(req);
+    int ret;
+
+    (void)ino;
+    (void)fi;
+
+    // Todos los cambios se escriben en la imagen al hacerse: basta con llevarlos al disco
+    ret = datasync ? fdatasync(fs->fd) : fsync(fs->fd);
+    fuse_reply_err(req, ret ? errno : 0);
+}
+
+static void afuse_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+    struct afuse *fs = fuse_req_userdata(req);
+    struct statvfs st;
+    uint64_t mask;
+
+    (void)ino;
+
+    memset(&st, 0, sizeof(st));
+    pthread_rwlock_rdlock(&fs->lock);
+    mask = fs->sb->blocks_count >= 64 ? ~0ULL : (1ULL << fs->sb->blocks_count) - 1;
+    st.f_bsize = ASSOOFS_DEFAULT_BLOCK_SIZE;
+    st.f_frsize = ASSOOFS_DEFAULT_BLOCK_SIZE;
+    st.f_blocks = fs->sb->blocks_count;
+    st.f_bfree = __builtin_popcountll(fs->sb->free_blocks & mask);
+    st.f_bavail = st.f_bfree;
+    st.f_files = assoofs_core_max_inodes(fs->sb);
+    st.f_ffree = st.f_files > fs->sb->inodes_count ? st.f_files - fs->sb->inodes_count : 0;
+    st.f_favail = st.f_ffree;
+    st.f_namemax = ASSOOFS_FILENAME_MAXLEN - 1;
+    pthread_rwlock_unlock(&fs->lock);
+
+    fuse_reply_statfs(req, &st);
+}
+
+static int afuse_opt_proc(void *data, const char *arg, int key, struct fuse_args *outargs)
+{
+    const char **image = data;
+
+    (void)outargs;
+
+    if (key == FUSE_OPT_KEY_NONOPT && !*image)
+    {
+        *image = arg;
+        return 0;
+    }
+
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    struct fuse_cmdline_opts opts;
+    struct fuse_loop_config config;
+    struct fuse_session *se;
+    struct afuse fs;
+    const char *image = NULL;
+    int ret = 1;
+    int i;
+
+    // Interpreta los argumentos: la imagen, el punto de montaje y las opciones de libfuse (-f, -s, -o ...)
+    if (fuse_opt_parse(&args, &image, NULL, afuse_opt_proc) != 0 || fuse_parse_cmdline(&args, &opts) != 0)
+        return 1;
+    if (opts.show_help || !image || !opts.mountpoint)
+    {
+        printf("Usage: assoofs-fuse [options] <image> <mountpoint>\n");
+        fuse_cmdline_help();
+        fuse_lowlevel_help();
+        free(opts.mountpoint);
+        fuse_opt_free_args(&args);
+        return opts.show_help ? 0 : 1;
+    }
+
+    memset(&fs, 0, sizeof(fs));
+    fs.fd = -1;
+    pthread_rwlock_init(&fs.lock, NULL);
+
+    do
+    {
+        // Carga los metadatos de la imagen
+        if (afuse_load(&fs, image))
+            break;
+
+        // Crea la sesión de FUSE y monta el sistema de archivos
+        se = fuse_session_new(&args, &afuse_ops, sizeof(afuse_ops), &fs);
+        if (!se)
+            break;
+        if (fuse_set_signal_handlers(se) != 0)
+        {
+            fuse_session_destroy(se);
+            break;
+        }
+        if (fuse_session_mount(se, opts.mountpoint) != 0)
+        {
+            fuse_remove_signal_handlers(se);
+            fuse_session_destroy(se);
+            break;
+        }
+        fuse_daemonize(opts.foreground);
+
+        // Atiende las peticiones con varios hilos (salvo con -s): las lecturas se sirven en paralelo
+        if (opts.singlethread)
+            ret = fuse_session_loop(se);
+        else
+        {
+            config.clone_fd = opts.clone_fd;
+            config.max_idle_threads = opts.max_idle_threads;
+            ret = fuse_session_loop_mt(se, &config);
+        }
+        ret = ret ? 1 : 0;
+
+        fuse_session_unmount(se);
+        fuse_remove_signal_handlers(se);
+        fuse_session_destroy(se);
+    } while (0);
+
+    if (fs.fd != -1)
+        close(fs.fd);
+    for (i = 0; i < ASSOOFS_MAX_BLOCKS; i++)
+        free(fs.meta[i]);
+    free(opts.mountpoint);
+    fuse_opt_free_args(&args);
+
+    return ret;
+}
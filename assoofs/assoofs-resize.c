@@ -0,0 +1,119 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/statfs.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "assoofs.h"
+
+// **************************
+// Declaraciones de funciones
+// **************************
+
+/**
+ * Interpreta un tamaño con sufijo opcional (K, M o G) y lo convierte en número de bloques
+ *
+ * @param str La cadena con el tamaño (sin sufijo, el tamaño está en bloques)
+ * @param blocks Puntero donde se almacenará el número de bloques
+ *
+ * @return 0 si todo salió bien, -1 si la cadena no es un tamaño válido
+ */
+static int parse_size(const char *str, uint64_t *blocks);
+
+// +++++++++++++++++++++++++
+// Definiciones de funciones
+// +++++++++++++++++++++++++
+
+static int parse_size(const char *str, uint64_t *blocks)
+{
+    char *end;
+    unsigned long long value;
+    uint64_t unit;
+
+    value = strtoull(str, &end, 10);
+    if (end == str)
+        return -1;
+
+    // Sin sufijo el tamaño está en bloques; con sufijo, en bytes
+    switch (*end)
+    {
+    case '\0':
+        *blocks = value;
+        return 0;
+    case 'K':
+    case 'k':
+        unit = 1024ULL;
+        break;
+    case 'M':
+    case 'm':
+        unit = 1024ULL * 1024;
+        break;
+    case 'G':
+    case 'g':
+        unit = 1024ULL * 1024 * 1024;
+        break;
+    default:
+        return -1;
+    }
+    if (end[1] != '\0')
+        return -1;
+
+    *blocks = value * unit / ASSOOFS_DEFAULT_BLOCK_SIZE;
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct statfs st;
+    uint64_t old_blocks;
+    uint64_t blocks = 0;
+    int fd;
+    int ret;
+
+    // Comprueba que el número de argumentos sea correcto
+    if (argc != 2 && argc != 3)
+    {
+        printf("Usage: assoofs-resize <mountpoint> [size]\n");
+        printf("  size is a number of blocks, or bytes with a K, M or G suffix.\n");
+        printf("  Without size the filesystem grows to fill its device.\n");
+        printf("  Grow a loop device first with 'truncate' and 'losetup -c'.\n");
+        return -1;
+    }
+
+    if (argc == 3 && parse_size(argv[2], &blocks))
+    {
+        printf("Invalid size: %s\n", argv[2]);
+        return -1;
+    }
+
+    // Abre el punto de montaje (el ioctl se atiende en cualquier fichero o directorio de assoofs)
+    fd = open(argv[1], O_RDONLY);
+    if (fd == -1)
+    {
+        perror("Error opening the mountpoint");
+        return -1;
+    }
+
+    // Comprueba que el punto de montaje sea un sistema de archivos assoofs y obtiene su tamaño actual
+    if (fstatfs(fd, &st) == -1 || st.f_type != ASSOOFS_MAGIC)
+    {
+        printf("%s is not a mounted assoofs filesystem.\n", argv[1]);
+        close(fd);
+        return -1;
+    }
+    old_blocks = st.f_blocks;
+
+    // Amplía el sistema de archivos
+    ret = ioctl(fd, ASSOOFS_IOC_RESIZE, &blocks);
+    if (ret == -1)
+        perror("Error resizing the filesystem");
+    else
+        printf("Filesystem resized from %llu to %llu blocks.\n", (unsigned long long)old_blocks, (unsigned long long)blocks);
+
+    close(fd);
+    return ret;
+}
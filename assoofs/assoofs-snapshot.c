@@ -0,0 +1,64 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/statfs.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "assoofs.h"
+
+int main(int argc, char *argv[])
+{
+    struct statfs st;
+    int fd;
+    int image;
+    int ret;
+
+    // Comprueba que el número de argumentos sea correcto
+    if (argc != 3)
+    {
+        printf("Usage: assoofs-snapshot <mountpoint> <image>\n");
+        printf("  Saves a consistent copy of a mounted assoofs filesystem into an image file.\n");
+        printf("  The image can be mounted later through a loop device (mount -o loop,mem to load it into RAM).\n");
+        return -1;
+    }
+
+    // Abre el punto de montaje (el ioctl se atiende en cualquier fichero o directorio de assoofs)
+    fd = open(argv[1], O_RDONLY);
+    if (fd == -1)
+    {
+        perror("Error opening the mountpoint");
+        return -1;
+    }
+
+    // Comprueba que el punto de montaje sea un sistema de archivos assoofs
+    if (fstatfs(fd, &st) == -1 || st.f_type != ASSOOFS_MAGIC)
+    {
+        printf("%s is not a mounted assoofs filesystem.\n", argv[1]);
+        close(fd);
+        return -1;
+    }
+
+    // Crea el fichero imagen (el kernel escribe en él todos los bloques)
+    image = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (image == -1)
+    {
+        perror("Error creating the image");
+        close(fd);
+        return -1;
+    }
+
+    // Guarda la copia del sistema de archivos
+    ret = ioctl(fd, ASSOOFS_IOC_SNAPSHOT, &image);
+    if (ret == -1)
+        perror("Error saving the snapshot");
+    else
+        printf("Snapshot of %s saved in %s (%llu blocks).\n", argv[1], argv[2], (unsigned long long)st.f_blocks);
+
+    close(image);
+    close(fd);
+    return ret;
+}
@@ -0,0 +1,485 @@
+// Pruebas KUnit de assoofs (CONFIG_ASSOOFS_KUNIT_TEST)
+// Este fichero no se compila por separado: assoofs.c lo incluye al final para que las pruebas puedan
+// llamar a sus funciones estáticas. Cada prueba formatea y monta un disco en RAM (brd, /dev/ram0)
+#include <kunit/test.h> /* kunit                */
+#include <linux/namei.h> /* kern_path_create     */
+#include <linux/major.h> /* RAMDISK_MAJOR        */
+
+// Nodo del disco en RAM sobre el que se formatea cada prueba
+// Se crea en el sistema de archivos raíz: las pruebas se ejecutan antes de que se monte devtmpfs
+#define ASSOOFS_TEST_DEV "/assoofs-kunit-ram0"
+#define ASSOOFS_TEST_DEV_NR MKDEV(RAMDISK_MAJOR, 0)
+
+// Número de repeticiones de cada operación en la prueba de rendimiento
+#define ASSOOFS_TEST_BENCH_ROUNDS 1000
+
+// ***************************************************
+// Declaración de funciones de las pruebas KUnit
+// ***************************************************
+
+/**
+ * Crea el nodo del disco en RAM si no existe.
+ *
+ * @return 0 si el nodo existe o se ha creado, un valor negativo en caso contrario.
+ */
+static int assoofs_test_mknod(void);
+
+/**
+ * Formatea el disco en RAM como mkassoofs, pero sin welcomefile: superbloque, almacén de inodos con el
+ * directorio raíz y directorio raíz vacío, con sus sumas de comprobación. El resto de bloques queda libre.
+ *
+ * @return 0 si todo salió bien, un valor negativo en caso contrario.
+ */
+static int assoofs_test_format(void);
+
+/**
+ * Formatea y monta el disco en RAM antes de cada prueba. El montaje se guarda en test->priv.
+ *
+ * @param test La prueba.
+ *
+ * @return 0 si todo salió bien, un valor negativo en caso contrario.
+ */
+static int assoofs_test_init(struct kunit *test);
+
+/**
+ * Muestra las estadísticas de las operaciones internas (op_stats, con sus operaciones por segundo)
+ * y desmonta el disco en RAM después de cada prueba.
+ *
+ * @param test La prueba.
+ */
+static void assoofs_test_exit(struct kunit *test);
+
+/**
+ * Prueba el reparto de bloques libres (assoofs_sb_get_a_freeblock) hasta agotarlos y su liberación.
+ *
+ * @param test La prueba.
+ */
+static void assoofs_test_alloc_block(struct kunit *test);
+
+/**
+ * Prueba el almacén de inodos: añadir (assoofs_add_inode_info), leer (assoofs_get_inode_info)
+ * y guardar (assoofs_save_inode_info) la información persistente de un inodo.
+ *
+ * @param test La prueba.
+ */
+static void assoofs_test_inode_info(struct kunit *test);
+
+/**
+ * Prueba la inserción de entradas de directorio (assoofs_create) hasta llenar el bloque del directorio
+ * y su búsqueda (assoofs_lookup), sin que la caché de dentries responda por el sistema de archivos.
+ *
+ * @param test La prueba.
+ */
+static void assoofs_test_dir(struct kunit *test);
+
+/**
+ * Prueba que una creación (assoofs_create) que falla por falta de bloques no consume ningún número de inodo
+ * ni deja un dentry positivo, y que la siguiente creación recibe el número que no se llegó a usar.
+ *
+ * @param test La prueba.
+ */
+static void assoofs_test_create_nospace(struct kunit *test);
+
+/**
+ * Mide las operaciones por segundo del reparto de bloques, de la lectura de inodos y de la búsqueda en directorios.
+ *
+ * @param test La prueba.
+ */
+static void assoofs_test_bench(struct kunit *test);
+
+/**
+ * Busca un nombre en el directorio raíz del montaje. El dentry se retira de la caché de dentries
+ * para que cada búsqueda llegue a assoofs_lookup.
+ *
+ * @param mnt El montaje.
+ * @param name El nombre.
+ *
+ * @return El número de inodo de la entrada, 0 si no existe o un valor negativo en caso de error.
+ */
+static long assoofs_test_lookup(struct vfsmount *mnt, const char *name);
+
+/**
+ * Calcula las operaciones por segundo de count operaciones que han tardado ns nanosegundos.
+ *
+ * @param count El número de operaciones.
+ * @param ns El tiempo empleado, en nanosegundos.
+ *
+ * @return Las operaciones por segundo.
+ */
+static uint64_t assoofs_test_ops_per_sec(uint64_t count, uint64_t ns);
+
+// +++++++++++++++++++++++++++++++++++++++++++++++++++
+// Definición de funciones de las pruebas KUnit
+// +++++++++++++++++++++++++++++++++++++++++++++++++++
+
+static int assoofs_test_mknod(void)
+{
+    // Declaración de variables (ISO C90)
+    struct dentry *dentry;
+    struct path path;
+    int ret;
+
+    dentry = kern_path_create(AT_FDCWD, ASSOOFS_TEST_DEV, &path, 0);
+    if (IS_ERR(dentry))
+        return PTR_ERR(dentry) == -EEXIST ? 0 : PTR_ERR(dentry);
+
+    ret = vfs_mknod(&init_user_ns, d_inode(path.dentry), dentry, S_IFBLK | 0600, ASSOOFS_TEST_DEV_NR);
+    done_path_create(&path, dentry);
+
+    return ret;
+}
+
+static int assoofs_test_format(void)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_super_block_info *asb;
+    struct assoofs_inode_info *root;
+    struct file *file;
+    char *blocks;
+    loff_t pos = 0;
+    ssize_t len;
+    int ret = 0;
+
+    // 1. Preparamos en memoria el superbloque, el almacén de inodos y el directorio raíz (a cero)
+    blocks = kzalloc((ASSOOFS_LAST_RESERVED_BLOCK + 1) * ASSOOFS_DEFAULT_BLOCK_SIZE, GFP_KERNEL);
+    if (!blocks)
+        return -ENOMEM;
+
+    asb = (struct assoofs_super_block_info *)(blocks + ASSOOFS_SUPERBLOCK_BLOCK_NUMBER * ASSOOFS_DEFAULT_BLOCK_SIZE);
+    asb->version = ASSOOFS_VERSION;
+    asb->magic = ASSOOFS_MAGIC;
+    asb->block_size = ASSOOFS_DEFAULT_BLOCK_SIZE;
+    asb->inodes_count = ASSOOFS_ROOTDIR_INODE_NUMBER;
+    asb->next_inode_no = ASSOOFS_ROOTDIR_INODE_NUMBER + 1;
+    asb->free_blocks = ~0ULL << (ASSOOFS_LAST_RESERVED_BLOCK + 1);
+    asb->blocks_count = ASSOOFS_MAX_BLOCKS;
+
+    root = (struct assoofs_inode_info *)(blocks + ASSOOFS_INODESTORE_BLOCK_NUMBER * ASSOOFS_DEFAULT_BLOCK_SIZE);
+    root->mode = S_IFDIR | 0755;
+    root->inode_no = ASSOOFS_ROOTDIR_INODE_NUMBER;
+    root->data_block_number = ASSOOFS_ROOTDIR_BLOCK_NUMBER;
+    root->tree_inodes = 1;
+
+    assoofs_block_checksum_set(asb);
+    assoofs_block_checksum_set(root);
+    assoofs_block_checksum_set(blocks + ASSOOFS_ROOTDIR_BLOCK_NUMBER * ASSOOFS_DEFAULT_BLOCK_SIZE);
+
+    // 2. Los escribimos al principio del disco en RAM
+    file = filp_open(ASSOOFS_TEST_DEV, O_RDWR, 0);
+    if (IS_ERR(file))
+    {
+        kfree(blocks);
+        return PTR_ERR(file);
+    }
+    len = kernel_write(file, blocks, (ASSOOFS_LAST_RESERVED_BLOCK + 1) * ASSOOFS_DEFAULT_BLOCK_SIZE, &pos);
+    if (len != (ASSOOFS_LAST_RESERVED_BLOCK + 1) * ASSOOFS_DEFAULT_BLOCK_SIZE)
+        ret = len < 0 ? len : -EIO;
+    if (!ret)
+        ret = vfs_fsync(file, 0);
+    filp_close(file, NULL);
+    kfree(blocks);
+
+    return ret;
+}
+
+static int assoofs_test_init(struct kunit *test)
+{
+    // Declaración de variables (ISO C90)
+    struct vfsmount *mnt;
+    int ret;
+
+    ret = assoofs_test_mknod();
+    if (!ret)
+        ret = assoofs_test_format();
+    if (ret)
+    {
+        kunit_err(test, "formatting %s failed (%d)\n", ASSOOFS_TEST_DEV, ret);
+        return ret;
+    }
+
+    // SB_KERNMOUNT hace que el desmontaje (kern_unmount) sea síncrono, también desde el hilo de la prueba
+    mnt = vfs_kern_mount(&assoofs_type, SB_KERNMOUNT, ASSOOFS_TEST_DEV, NULL);
+    if (IS_ERR(mnt))
+    {
+        kunit_err(test, "mounting %s failed (%ld)\n", ASSOOFS_TEST_DEV, PTR_ERR(mnt));
+        return PTR_ERR(mnt);
+    }
+    test->priv = mnt;
+
+    return 0;
+}
+
+static void assoofs_test_exit(struct kunit *test)
+{
+    // Declaración de variables (ISO C90)
+    struct vfsmount *mnt = test->priv;
+    char *buf;
+    char *line;
+    char *p;
+
+    // KUnit llama a exit aunque init haya fallado
+    if (!mnt)
+        return;
+
+    // Las estadísticas se muestran con el mismo formato que el atributo op_stats de sysfs
+    buf = (char *)get_zeroed_page(GFP_KERNEL);
+    if (buf)
+    {
+        assoofs_op_stats_show(ASSOOFS_SB(mnt->mnt_sb), buf);
+        p = buf;
+        while ((line = strsep(&p, "\n")) != NULL)
+            if (*line)
+                kunit_info(test, "op_stats: %s\n", line);
+        free_page((unsigned long)buf);
+    }
+
+    kern_unmount(mnt);
+}
+
+static void assoofs_test_alloc_block(struct kunit *test)
+{
+    // Declaración de variables (ISO C90)
+    struct vfsmount *mnt = test->priv;
+    struct super_block *sb = mnt->mnt_sb;
+    struct assoofs_super_block_info *asb = ASSOOFS_SB(sb)->asb;
+    uint64_t free_blocks = asb->free_blocks;
+    uint64_t blocks[ASSOOFS_MAX_BLOCKS];
+    uint64_t block;
+    int count = 0;
+    int i;
+
+    // 1. El primer bloque libre es el siguiente a los reservados, y deja de estar libre
+    KUNIT_ASSERT_EQ(test, assoofs_sb_get_a_freeblock(sb, &blocks[count]), 0);
+    KUNIT_EXPECT_EQ(test, blocks[count], (uint64_t)ASSOOFS_LAST_RESERVED_BLOCK + 1);
+    KUNIT_EXPECT_FALSE(test, asb->free_blocks & (1ULL << blocks[count]));
+    count++;
+
+    // 2. Se reparten todos los bloques libres, sin repetir ninguno, y después no queda ninguno
+    while (count < ASSOOFS_MAX_BLOCKS && assoofs_sb_get_a_freeblock(sb, &blocks[count]) == 0)
+    {
+        KUNIT_EXPECT_GT(test, blocks[count], blocks[count - 1]);
+        count++;
+    }
+    KUNIT_EXPECT_EQ(test, count, (int)hweight64(free_blocks));
+    KUNIT_EXPECT_EQ(test, asb->free_blocks, (uint64_t)0);
+    KUNIT_EXPECT_NE(test, assoofs_sb_get_a_freeblock(sb, &block), 0);
+
+    // 3. Al soltarlos, el mapa de bits vuelve a estar como al principio
+    for (i = 0; i < count; i++)
+        assoofs_sb_put_block(sb, blocks[i]);
+    KUNIT_EXPECT_EQ(test, asb->free_blocks, free_blocks);
+}
+
+static void assoofs_test_inode_info(struct kunit *test)
+{
+    // Declaración de variables (ISO C90)
+    struct vfsmount *mnt = test->priv;
+    struct super_block *sb = mnt->mnt_sb;
+    struct assoofs_super_block_info *asb = ASSOOFS_SB(sb)->asb;
+    struct assoofs_inode_info info = {0};
+    struct assoofs_inode_info read = {0};
+    uint64_t inodes_count = asb->inodes_count;
+
+    // 1. Añadimos un fichero al almacén de inodos
+    info.mode = S_IFREG | 0644;
+    info.inode_no = assoofs_sb_get_inode_numbers(sb, 1);
+    KUNIT_ASSERT_EQ(test, assoofs_sb_get_a_freeblock(sb, &info.data_block_number), 0);
+    KUNIT_ASSERT_EQ(test, assoofs_add_inode_info(sb, &info), 0);
+    KUNIT_EXPECT_EQ(test, asb->inodes_count, inodes_count + 1);
+
+    // 2. Se lee tal y como se añadió
+    KUNIT_ASSERT_EQ(test, assoofs_get_inode_info(sb, info.inode_no, &read), 0);
+    KUNIT_EXPECT_EQ(test, read.mode, info.mode);
+    KUNIT_EXPECT_EQ(test, read.inode_no, info.inode_no);
+    KUNIT_EXPECT_EQ(test, read.data_block_number, info.data_block_number);
+    KUNIT_EXPECT_EQ(test, read.file_size, (uint64_t)0);
+
+    // 3. Los cambios guardados se leen en la siguiente lectura
+    read.file_size = 123;
+    KUNIT_ASSERT_EQ(test, assoofs_save_inode_info(sb, &read), 0);
+    memset(&read, 0, sizeof(read));
+    KUNIT_ASSERT_EQ(test, assoofs_get_inode_info(sb, info.inode_no, &read), 0);
+    KUNIT_EXPECT_EQ(test, read.file_size, (uint64_t)123);
+    KUNIT_EXPECT_EQ(test, asb->inodes_count, inodes_count + 1);
+
+    // 4. Un inodo que no existe no se encuentra
+    KUNIT_EXPECT_NE(test, assoofs_get_inode_info(sb, asb->next_inode_no, &read), 0);
+}
+
+static void assoofs_test_dir(struct kunit *test)
+{
+    // Declaración de variables (ISO C90)
+    struct vfsmount *mnt = test->priv;
+    struct inode *dir = d_inode(mnt->mnt_root);
+    struct assoofs_inode_info *dir_info = dir->i_private;
+    struct dentry *dentry;
+    char name[16];
+    long ino;
+    int ret;
+    int i;
+
+    // 1. Un nombre que no existe no se encuentra
+    KUNIT_EXPECT_EQ(test, assoofs_test_lookup(mnt, "missing"), 0L);
+
+    // 2. Llenamos el bloque del directorio raíz; cada entrada se encuentra después con su número de inodo
+    for (i = 0; i <= ASSOOFS_DIR_ENTRIES_PER_BLOCK; i++)
+    {
+        snprintf(name, sizeof(name), "file%02d", i);
+        inode_lock(dir);
+        dentry = lookup_one_len(name, mnt->mnt_root, strlen(name));
+        if (IS_ERR(dentry))
+        {
+            inode_unlock(dir);
+            KUNIT_FAIL(test, "lookup_one_len(%s) failed (%ld)\n", name, PTR_ERR(dentry));
+            return;
+        }
+        ret = vfs_create(&init_user_ns, dir, dentry, S_IFREG | 0644, true);
+        ino = ret ? 0 : d_inode(dentry)->i_ino;
+        inode_unlock(dir);
+        dput(dentry);
+
+        // La entrada que no cabe en el bloque se rechaza sin modificar el directorio
+        if (i == ASSOOFS_DIR_ENTRIES_PER_BLOCK)
+        {
+            KUNIT_EXPECT_EQ(test, ret, -ENOSPC);
+            KUNIT_EXPECT_EQ(test, assoofs_test_lookup(mnt, name), 0L);
+            break;
+        }
+        KUNIT_ASSERT_EQ(test, ret, 0);
+        KUNIT_EXPECT_EQ(test, assoofs_test_lookup(mnt, name), ino);
+    }
+    KUNIT_EXPECT_EQ(test, dir_info->dir_children_count, (uint64_t)ASSOOFS_DIR_ENTRIES_PER_BLOCK);
+    KUNIT_EXPECT_EQ(test, assoofs_test_lookup(mnt, "file00"), (long)(ASSOOFS_ROOTDIR_INODE_NUMBER + 1));
+}
+
+static void assoofs_test_bench(struct kunit *test)
+{
+    // Declaración de variables (ISO C90)
+    struct vfsmount *mnt = test->priv;
+    struct super_block *sb = mnt->mnt_sb;
+    struct inode *dir = d_inode(mnt->mnt_root);
+    struct assoofs_inode_info info;
+    struct dentry *dentry;
+    uint64_t block;
+    uint64_t start;
+    int i;
+
+    // 1. Reparto y liberación de un bloque
+    start = ktime_get_ns();
+    for (i = 0; i < ASSOOFS_TEST_BENCH_ROUNDS; i++)
+    {
+        KUNIT_ASSERT_EQ(test, assoofs_sb_get_a_freeblock(sb, &block), 0);
+        assoofs_sb_put_block(sb, block);
+    }
+    kunit_info(test, "alloc_block + put_block: %llu ops/s\n", assoofs_test_ops_per_sec(ASSOOFS_TEST_BENCH_ROUNDS, ktime_get_ns() - start));
+
+    // 2. Lectura de la información persistente del directorio raíz
+    start = ktime_get_ns();
+    for (i = 0; i < ASSOOFS_TEST_BENCH_ROUNDS; i++)
+        KUNIT_ASSERT_EQ(test, assoofs_get_inode_info(sb, ASSOOFS_ROOTDIR_INODE_NUMBER, &info), 0);
+    kunit_info(test, "get_inode_info: %llu ops/s\n", assoofs_test_ops_per_sec(ASSOOFS_TEST_BENCH_ROUNDS, ktime_get_ns() - start));
+
+    // 3. Búsqueda de una entrada existente en el directorio raíz, sin la caché de dentries
+    inode_lock(dir);
+    dentry = lookup_one_len("bench", mnt->mnt_root, strlen("bench"));
+    KUNIT_ASSERT_FALSE(test, IS_ERR(dentry));
+    KUNIT_EXPECT_EQ(test, vfs_create(&init_user_ns, dir, dentry, S_IFREG | 0644, true), 0);
+    inode_unlock(dir);
+    dput(dentry);
+    start = ktime_get_ns();
+    for (i = 0; i < ASSOOFS_TEST_BENCH_ROUNDS; i++)
+        KUNIT_ASSERT_GT(test, assoofs_test_lookup(mnt, "bench"), 0L);
+    kunit_info(test, "dir_lookup: %llu ops/s\n", assoofs_test_ops_per_sec(ASSOOFS_TEST_BENCH_ROUNDS, ktime_get_ns() - start));
+}
+
+static void assoofs_test_create_nospace(struct kunit *test)
+{
+    // Declaración de variables (ISO C90)
+    struct vfsmount *mnt = test->priv;
+    struct super_block *sb = mnt->mnt_sb;
+    struct assoofs_super_block_info *asb = ASSOOFS_SB(sb)->asb;
+    struct inode *dir = d_inode(mnt->mnt_root);
+    struct dentry *dentry;
+    uint64_t blocks[ASSOOFS_MAX_BLOCKS];
+    uint64_t next_inode_no = asb->next_inode_no;
+    uint64_t inodes_count = asb->inodes_count;
+    unsigned int count = 0;
+    int ret;
+
+    // 1. Ocupamos todos los bloques libres
+    while (count < ASSOOFS_MAX_BLOCKS && assoofs_sb_get_a_freeblock(sb, &blocks[count]) == 0)
+        count++;
+    KUNIT_ASSERT_GT(test, count, 0U);
+
+    // 2. La creación falla sin reservar un número de inodo ni añadir nada al almacén o al directorio
+    inode_lock(dir);
+    dentry = lookup_one_len("nospace", mnt->mnt_root, strlen("nospace"));
+    KUNIT_ASSERT_FALSE(test, IS_ERR(dentry));
+    ret = vfs_create(&init_user_ns, dir, dentry, S_IFREG | 0644, true);
+    KUNIT_EXPECT_EQ(test, ret, -ENOSPC);
+    KUNIT_EXPECT_TRUE(test, d_really_is_negative(dentry));
+    inode_unlock(dir);
+    dput(dentry);
+    KUNIT_EXPECT_EQ(test, asb->next_inode_no, next_inode_no);
+    KUNIT_EXPECT_EQ(test, asb->inodes_count, inodes_count);
+    KUNIT_EXPECT_EQ(test, assoofs_test_lookup(mnt, "nospace"), 0L);
+
+    // 3. Con un bloque libre, la creación recibe el número que no se llegó a usar
+    assoofs_sb_put_block(sb, blocks[--count]);
+    inode_lock(dir);
+    dentry = lookup_one_len("nospace", mnt->mnt_root, strlen("nospace"));
+    KUNIT_ASSERT_FALSE(test, IS_ERR(dentry));
+    KUNIT_EXPECT_EQ(test, vfs_create(&init_user_ns, dir, dentry, S_IFREG | 0644, true), 0);
+    inode_unlock(dir);
+    dput(dentry);
+    KUNIT_EXPECT_EQ(test, assoofs_test_lookup(mnt, "nospace"), (long)next_inode_no);
+
+    while (count > 0)
+        assoofs_sb_put_block(sb, blocks[--count]);
+}
+
+static long assoofs_test_lookup(struct vfsmount *mnt, const char *name)
+{
+    // Declaración de variables (ISO C90)
+    struct inode *dir = d_inode(mnt->mnt_root);
+    struct dentry *dentry;
+    long ino;
+
+    inode_lock(dir);
+    dentry = lookup_one_len(name, mnt->mnt_root, strlen(name));
+    if (IS_ERR(dentry))
+    {
+        inode_unlock(dir);
+        return PTR_ERR(dentry);
+    }
+    ino = d_really_is_positive(dentry) ? d_inode(dentry)->i_ino : 0;
+    // La siguiente búsqueda del mismo nombre no debe encontrar este dentry en la caché
+    d_drop(dentry);
+    inode_unlock(dir);
+    dput(dentry);
+
+    return ino;
+}
+
+static uint64_t assoofs_test_ops_per_sec(uint64_t count, uint64_t ns)
+{
+    return div64_u64(count * NSEC_PER_SEC, max_t(uint64_t, ns, 1));
+}
+
+static struct kunit_case assoofs_test_cases[] = {
+    KUNIT_CASE(assoofs_test_alloc_block),
+    KUNIT_CASE(assoofs_test_inode_info),
+    KUNIT_CASE(assoofs_test_dir),
+    KUNIT_CASE(assoofs_test_create_nospace),
+    KUNIT_CASE(assoofs_test_bench),
+    {},
+};
+
+static struct kunit_suite assoofs_test_suite = {
+    .name = "assoofs",
+    .init = assoofs_test_init,
+    .exit = assoofs_test_exit,
+    .test_cases = assoofs_test_cases,
+};
+
+kunit_test_suite(assoofs_test_suite);
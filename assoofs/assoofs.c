@@ -4,10 +4,28 @@
 #include <linux/fs.h>          /* libfs stuff           */
 #include <linux/buffer_head.h> /* buffer_head           */
 #include <linux/slab.h>        /* kmem_cache            */
+#include <linux/mm.h>          /* kvmalloc              */
+#include <linux/parser.h>      /* match_token           */
+#include <linux/lz4.h>         /* LZ4_compress_default  */
+#include <linux/mutex.h>       /* mutex                 */
+#include <linux/blkdev.h>      /* sb_issue_discard      */
+#include <linux/workqueue.h>   /* delayed_work          */
+#include <linux/uaccess.h>     /* copy_from_user        */
+#include <linux/sort.h>          /* sort, sort_r          */
+#include <linux/ktime.h>         /* ktime_get_ns          */
+#include <linux/kobject.h>       /* kobject, sysfs        */
+#include <linux/completion.h>    /* completion            */
+#include <linux/spinlock.h>      /* spinlock              */
+#include <linux/dcache.h>        /* dget_parent           */
+#include <linux/crc32c.h>        /* crc32c                */
+#include <linux/bio.h>           /* bio, submit_bio_wait  */
+#include <linux/math64.h>        /* div64_u64             */
 #include "assoofs.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Angel Manuel Guerrero Higueras");
+// crc32c pasa por la API criptográfica: se carga antes la implementación acelerada (SSE4.2, PMULL) si existe
+MODULE_SOFTDEP("pre: crc32c");
 
 // ******************************
 // Declaración de global de caché
@@ -15,6 +33,242 @@ MODULE_AUTHOR("Angel Manuel Guerrero Higueras");
 
 static struct kmem_cache *assoofs_inode_cache;
 
+// ***************************************************
+// Declaración de la información en memoria del montaje
+// ***************************************************
+
+// Opciones de montaje (campo mount_opt de assoofs_sb_info)
+#define ASSOOFS_MOUNT_COMPRESS 0x1 // Los ficheros que se creen se almacenan comprimidos con LZ4
+#define ASSOOFS_MOUNT_DISCARD 0x2  // Los bloques que se liberen se descartan en el dispositivo
+#define ASSOOFS_MOUNT_METACACHE 0x4 // Los metadatos se leen una vez al montar y se sirven desde memoria (solo lectura)
+#define ASSOOFS_MOUNT_MEM 0x8       // El sistema de archivos se mantiene en memoria y solo se escribe al sincronizar o desmontar
+
+// Tiempo que se acumulan los bloques liberados antes de descartarlos (opción discard)
+#define ASSOOFS_DISCARD_DELAY HZ
+
+// Estado propio de los buffers de metadatos: su suma de comprobación ya se ha comprobado (o se ha calculado al modificarlo),
+// por lo que las lecturas siguientes desde la caché de buffers no vuelven a calcularla
+enum
+{
+    BH_AssoofsVerified = BH_PrivateStart,
+};
+BUFFER_FNS(AssoofsVerified, assoofs_verified)
+
+/**
+ * Entrada de la tabla de nombres de un directorio en la caché de metadatos (opción metacache)
+ *
+ * @param name Desplazamiento del nombre (terminado en '\0') en la tabla de cadenas de la caché
+ * @param inode_no Número de inodo de la entrada
+ */
+struct assoofs_metacache_entry
+{
+    uint32_t name;
+    uint32_t inode_no;
+};
+
+/**
+ * Directorio en la caché de metadatos: un tramo de la tabla de entradas ordenado por nombre
+ *
+ * @param inode_no Número de inodo del directorio
+ * @param first Índice de su primera entrada en la tabla de entradas
+ * @param count Número de entradas del directorio
+ */
+struct assoofs_metacache_dir
+{
+    uint64_t inode_no;
+    uint32_t first;
+    uint32_t count;
+};
+
+/**
+ * Caché de metadatos en memoria de un montaje de solo lectura (opción metacache).
+ * Se construye una vez al montar y no cambia después, por lo que se consulta sin cerrojos.
+ *
+ * @param inodes Copia del almacén de inodos ordenada por número de inodo
+ * @param inodes_count Número de inodos
+ * @param dirs Directorios ordenados por número de inodo
+ * @param dirs_count Número de directorios
+ * @param entries Entradas de todos los directorios, agrupadas por directorio y ordenadas por nombre
+ * @param entries_count Número de entradas
+ * @param names Tabla de cadenas con los nombres de las entradas
+ * @param names_size Tamaño en bytes de la tabla de cadenas
+ * @param bytes Memoria total ocupada por la caché
+ * @param load_ns Tiempo empleado en construir la caché al montar, en nanosegundos
+ */
+struct assoofs_metacache
+{
+    struct assoofs_inode_info *inodes;
+    uint32_t inodes_count;
+    struct assoofs_metacache_dir *dirs;
+    uint32_t dirs_count;
+    struct assoofs_metacache_entry *entries;
+    uint32_t entries_count;
+    char *names;
+    size_t names_size;
+    size_t bytes;
+    uint64_t load_ns;
+};
+
+/**
+ * Operaciones internas de las que se cuentan las llamadas y el tiempo empleado (atributo op_stats de sysfs)
+ */
+enum assoofs_op
+{
+    ASSOOFS_OP_ALLOC_BLOCK,     // assoofs_sb_get_a_freeblock
+    ASSOOFS_OP_GET_INODE_INFO,  // assoofs_get_inode_info
+    ASSOOFS_OP_SAVE_INODE_INFO, // assoofs_save_inode_info
+    ASSOOFS_OP_ADD_INODE_INFO,  // assoofs_add_inode_info
+    ASSOOFS_OP_DIR_LOOKUP,      // assoofs_lookup
+    ASSOOFS_OP_DIR_INSERT,      // Nueva entrada de directorio en assoofs_create y assoofs_mkdir
+    ASSOOFS_OP_COUNT,
+};
+
+/**
+ * Representa la información en memoria de un sistema de archivos assoofs montado
+ *
+ * @param sb Puntero al superbloque de VFS (para los trabajos en segundo plano)
+ * @param asb Puntero a la información persistente del superbloque (apunta a sbh->b_data)
+ * @param sbh Buffer head del superbloque, retenido mientras el sistema de archivos está montado (bloqueado en cada cambio)
+ * @param mount_opt Opciones de montaje (ASSOOFS_MOUNT_*)
+ * @param bitmap_lock Protege el mapa de bits de bloques libres, las referencias de bloques compartidos y discard_pending
+ * @param discard_pending Mapa de bits de los bloques liberados pendientes de descartar (opción discard)
+ * @param discard_work Trabajo diferido que descarta los bloques pendientes agrupados en rangos contiguos
+ * @param readahead_work Trabajo que, tras el montaje, lee por adelantado los bloques de los directorios
+ * @param metacache Caché de metadatos en memoria (opción metacache), NULL si no se utiliza
+ * @param kobj Directorio del montaje en sysfs (/sys/fs/assoofs/<dispositivo>)
+ * @param kobj_unregister Se completa cuando sysfs suelta la última referencia a kobj
+ * @param mem_bh Buffers de todos los bloques, retenidos en memoria mientras está montado (opción mem)
+ * @param usage_lock Protege el uso recursivo (tree_inodes, tree_size) de la información persistente de los directorios
+ * @param istore_lock Protege el almacén de inodos, inodes_count y next_inode_no (la liberación de inodos mueve sus entradas)
+ * @param reclaim_work Trabajo que libera en segundo plano los bloques e inodos de los ficheros borrados
+ * @param reclaim_lock Protege reclaim_pending y reclaim_count
+ * @param reclaim_pending Números de los inodos huérfanos que ya nadie tiene abiertos, pendientes de liberar
+ * @param reclaim_count Número de inodos en reclaim_pending
+ * @param prefetch_work Trabajo que carga en la caché de inodos de VFS los hijos de los directorios que se acaban de listar
+ * @param prefetch_lock Protege prefetch_pending y prefetch_count
+ * @param prefetch_pending Números de los inodos pendientes de cargar en la caché de inodos
+ * @param prefetch_count Número de inodos en prefetch_pending
+ * @param checksum_errors Número de lecturas de bloques de metadatos rechazadas porque su suma de comprobación no coincide
+ * @param scrub_work Trabajo diferido que relee del disco los bloques de metadatos y comprueba sus sumas (scrub)
+ * @param scrub_rate Bloques por segundo que relee el scrub (0 si está detenido)
+ * @param scrub_blocks Bloques de metadatos de la pasada en curso del scrub
+ * @param scrub_count Número de bloques en scrub_blocks
+ * @param scrub_pos Posición en scrub_blocks del siguiente bloque que se relee
+ * @param scrub_passes Número de pasadas completas del scrub
+ * @param scrub_errors Número de bloques con una suma incorrecta en el disco encontrados por el scrub
+ * @param scrub_repaired Número de esos bloques reescritos a partir de su copia correcta en la caché de buffers
+ * @param devs Dispositivos entre los que se reparten los bloques (devs[0] es sb->s_bdev, el resto se abren al montar)
+ * @param ndevs Número de dispositivos en devs
+ * @param devs_mode Modo con el que se abren los dispositivos miembros (devs[1] en adelante)
+ * @param devs_opt Rutas de los dispositivos miembros separadas por ':' (opción devices), hasta que se abren al montar
+ * @param op_calls Número de llamadas a cada operación interna (enum assoofs_op) que han terminado bien
+ * @param op_ns Tiempo total empleado en esas llamadas, en nanosegundos
+ * @param frozen Indica si el sistema de archivos está congelado (fsfreeze): los trabajos en segundo plano no escriben
+ */
+struct assoofs_sb_info
+{
+    struct super_block *sb;
+    struct assoofs_super_block_info *asb;
+    struct buffer_head *sbh;
+    unsigned long mount_opt;
+    struct mutex bitmap_lock;
+    uint64_t discard_pending;
+    struct delayed_work discard_work;
+    struct work_struct readahead_work;
+    struct assoofs_metacache *metacache;
+    struct kobject kobj;
+    struct completion kobj_unregister;
+    struct buffer_head *mem_bh[ASSOOFS_MAX_BLOCKS];
+    spinlock_t usage_lock;
+    struct mutex istore_lock;
+    struct work_struct reclaim_work;
+    spinlock_t reclaim_lock;
+    uint64_t reclaim_pending[ASSOOFS_MAX_BLOCKS];
+    unsigned int reclaim_count;
+    struct work_struct prefetch_work;
+    spinlock_t prefetch_lock;
+    uint64_t prefetch_pending[ASSOOFS_MAX_BLOCKS];
+    unsigned int prefetch_count;
+    atomic64_t checksum_errors;
+    struct delayed_work scrub_work;
+    unsigned int scrub_rate;
+    uint64_t scrub_blocks[ASSOOFS_MAX_BLOCKS];
+    unsigned int scrub_count;
+    unsigned int scrub_pos;
+    uint64_t scrub_passes;
+    uint64_t scrub_errors;
+    uint64_t scrub_repaired;
+    struct block_device *devs[ASSOOFS_MAX_DEVICES];
+    unsigned int ndevs;
+    fmode_t devs_mode;
+    char *devs_opt;
+    atomic64_t op_calls[ASSOOFS_OP_COUNT];
+    atomic64_t op_ns[ASSOOFS_OP_COUNT];
+    bool frozen;
+};
+
+/**
+ * Obtiene la información en memoria del montaje a partir del superbloque de VFS.
+ *
+ * @param sb Puntero al superbloque del sistema de archivos.
+ *
+ * @return Puntero a la información en memoria del montaje.
+ */
+static inline struct assoofs_sb_info *ASSOOFS_SB(struct super_block *sb)
+{
+    return sb->s_fs_info;
+}
+
+/**
+ * Representa un inodo de assoofs en memoria: el inodo de VFS junto a la copia de su información persistente.
+ * Se reservan juntos en assoofs_inode_cache para que VFS libere ambos tras un periodo de gracia RCU,
+ * de modo que la búsqueda de rutas en modo RCU (LOOKUP_RCU) nunca accede a un i_private ya liberado.
+ *
+ * @param info Copia de la información persistente del inodo (apuntada por i_private)
+ * @param vfs_inode Inodo de VFS
+ */
+struct assoofs_inode
+{
+    struct assoofs_inode_info info;
+    struct inode vfs_inode;
+};
+
+/**
+ * Obtiene el inodo de assoofs en memoria a partir del inodo de VFS.
+ *
+ * @param inode Puntero al inodo de VFS.
+ *
+ * @return Puntero al inodo de assoofs que lo contiene.
+ */
+static inline struct assoofs_inode *ASSOOFS_I(struct inode *inode)
+{
+    return container_of(inode, struct assoofs_inode, vfs_inode);
+}
+
+// Tokens de las opciones de montaje
+enum
+{
+    Opt_compress,
+    Opt_discard,
+    Opt_nodiscard,
+    Opt_metacache,
+    Opt_mem,
+    Opt_scrub,
+    Opt_devices,
+    Opt_err,
+};
+
+static const match_table_t assoofs_tokens = {
+    {Opt_compress, "compress"},
+    {Opt_discard, "discard"},
+    {Opt_nodiscard, "nodiscard"},
+    {Opt_metacache, "metacache"},
+    {Opt_mem, "mem"},
+    {Opt_scrub, "scrub=%u"},
+    {Opt_devices, "devices=%s"},
+    {Opt_err, NULL},
+};
+
 // ***********************************
 // Declaración de funciones auxiliares
 // ***********************************
@@ -24,11 +278,12 @@ static struct kmem_cache *assoofs_inode_cache;
  *
  * @param sb Puntero al superbloque que contiene el sistema de archivos assoofs.
  * @param inode_no Número de inodo del cual se quiere obtener la información persistente.
+ * @param buffer Puntero donde se copiará la información persistente del inodo (normalmente i_private).
  *
- * @return Devuelve un puntero a un struct assoofs_inode_info que contiene la información persistente del inodo encontrado, o NULL si el inodo no se encuentra o hay un error.
+ * @return 0 si se ha encontrado el inodo, -1 si el inodo no se encuentra o hay un error.
  */
 
-struct assoofs_inode_info *assoofs_get_inode_info(struct super_block *sb, uint64_t inode_no);
+int assoofs_get_inode_info(struct super_block *sb, uint64_t inode_no, struct assoofs_inode_info *buffer);
 
 /**
  * Obtiene un inodo existente del sistema de archivos assoofs.
@@ -40,6 +295,36 @@ struct assoofs_inode_info *assoofs_get_inode_info(struct super_block *sb, uint64
  */
 static struct inode *assoofs_get_inode(struct super_block *sb, int ino);
 
+/**
+ * Completa un inodo nuevo de VFS (I_NEW) a partir de su información persistente, ya copiada en ASSOOFS_I(inode)->info:
+ * operaciones, fechas, propietario y permisos.
+ *
+ * @param inode Puntero al inodo que se está creando.
+ *
+ * @return 0 si todo salió bien, -1 si el inodo no es ni un fichero ni un directorio.
+ */
+static int assoofs_inode_setup(struct inode *inode);
+
+/**
+ * Busca la información persistente de un inodo (assoofs_get_inode_info sin contabilizar la operación).
+ *
+ * @param sb Puntero al superbloque que contiene el sistema de archivos assoofs.
+ * @param inode_no Número de inodo del cual se quiere obtener la información.
+ * @param buffer Puntero donde se copiará la información persistente del inodo.
+ *
+ * @return 0 si se ha encontrado el inodo, -1 si el inodo no se encuentra o hay un error.
+ */
+static int assoofs_read_inode_info(struct super_block *sb, uint64_t inode_no, struct assoofs_inode_info *buffer);
+
+/**
+ * Suma una llamada terminada y su duración a las estadísticas de una operación interna (op_stats).
+ *
+ * @param sb Puntero al superbloque del sistema de archivos.
+ * @param op Operación que ha terminado.
+ * @param start Instante en que empezó la operación (ktime_get_ns).
+ */
+static void assoofs_op_account(struct super_block *sb, enum assoofs_op op, uint64_t start);
+
 /**
  * Función para actualizar la información persistente del superbloque en el dispositivo de bloques.
  *
@@ -48,955 +333,5304 @@ static struct inode *assoofs_get_inode(struct super_block *sb, int ino);
 void assoofs_save_sb_info(struct super_block *vsb);
 
 /**
- * Función para obtener un bloque libre en el dispositivo de bloques.
- * Busca el primer bloque libre en el mapa de bits de bloques libres del superbloque.
- * Si encuentra un bloque libre, lo marca como ocupado en el mapa de bits y devuelve su número.
+ * Bloquea el buffer del superbloque antes de modificar su información persistente.
+ * Los campos del superbloque los protegen locks distintos (bitmap_lock o istore_lock), pero todos se modifican
+ * con el buffer bloqueado: ninguna escritura del buffer ve un cambio a medias ni una suma de comprobación desfasada.
  *
  * @param sb Superbloque del sistema de archivos.
- * @param block Puntero a un entero sin signo de 64 bits donde se almacenará el número de bloque libre.
+ */
+static void assoofs_sb_lock(struct super_block *sb);
+
+/**
+ * Recalcula la suma de comprobación del superbloque y desbloquea su buffer.
  *
- * @return 0 si se encuentra un bloque libre, un valor negativo en caso contrario.
+ * @param sb Superbloque del sistema de archivos.
  */
-int assoofs_sb_get_a_freeblock(struct super_block *sb, uint64_t *block);
+static void assoofs_sb_unlock(struct super_block *sb);
 
 /**
- * Función que añade un nuevo inodo al almacén de inodos.
+ * Escribe en el disco un buffer ya marcado como modificado y espera a que termine la escritura.
+ * Con la opción mem no se escribe: el buffer queda modificado en memoria hasta que se sincroniza o desmonta el sistema de archivos.
  *
- * @param sb Puntero al superbloque del sistema de ficheros.
- * @param inode Puntero al inodo que se va a añadir.
+ * @param sb Superbloque del sistema de archivos.
+ * @param bh Buffer que se va a escribir.
  */
-void assoofs_add_inode_info(struct super_block *sb, struct assoofs_inode_info *inode);
+static void assoofs_sync_dirty_buffer(struct super_block *sb, struct buffer_head *bh);
 
 /**
- * Función que obtiene un puntero a la información persistente de un inodo específico.
+ * Comprueba la suma de comprobación guardada en la cola de un bloque de metadatos.
  *
- * @param sb Puntero al superbloque del sistema de ficheros.
- * @param start Puntero al primer inodo del almacén de inodos.
- * @param search Puntero al inodo que se quiere buscar.
+ * @param data Contenido del bloque.
  *
- * @return Devuelve un puntero a la información persistente del inodo encontrado, o NULL si el inodo no se encuentra o hay un error.
+ * @return 0 si coincide, -EBADMSG en caso contrario.
  */
-struct assoofs_inode_info *assoofs_search_inode_info(struct super_block *sb, struct assoofs_inode_info *start, struct assoofs_inode_info *search);
+static int assoofs_meta_verify(const char *data);
 
 /**
- * Función que actualiza la información persistente de un inodo en el dispositivo de bloques.
+ * Lee un bloque de metadatos (almacén de inodos o bloque de directorio) y comprueba su suma de comprobación.
+ * La suma se comprueba solo la primera vez que el bloque llega a la caché de buffers.
  *
- * @param sb Puntero al superbloque del sistema de ficheros.
- * @param inode_info Puntero a la información persistente del inodo que se va a actualizar.
+ * @param sb Superbloque del sistema de archivos.
+ * @param block Número del bloque.
  *
- * @return 0 si se actualiza correctamente, un valor negativo en caso contrario.
+ * @return El buffer del bloque, o NULL si no se pudo leer o su suma no coincide (el error se anota en checksum_errors).
  */
-int assoofs_save_inode_info(struct super_block *sb, struct assoofs_inode_info *inode_info);
+static struct buffer_head *assoofs_meta_bread(struct super_block *sb, uint64_t block);
 
-// *************************************************************
-// Declaración de funciones y structs de operaciones de ficheros
-// *************************************************************
+/**
+ * Calcula la suma de comprobación de un bloque de metadatos modificado y lo marca como modificado.
+ * Sustituye a mark_buffer_dirty en todos los bloques de metadatos: la suma se calcula una vez por cambio,
+ * antes de que el buffer se escriba (en el momento o al sincronizar, con la opción mem).
+ *
+ * @param bh Buffer del bloque.
+ */
+static void assoofs_mark_meta_dirty(struct buffer_head *bh);
 
 /**
- * Función que permite leer el contenido de un fichero.
+ * Escribe el bloque vacío de un directorio nuevo, con su suma de comprobación.
  *
- * @param filp Puntero al archivo que se va a leer.
- * @param buf Puntero al buffer donde se almacenará el contenido del fichero.
- * @param len Tamaño del buffer.
- * @param ppos Puntero a la posición actual del fichero.
+ * @param sb Superbloque del sistema de archivos.
+ * @param block Número del bloque reservado para el directorio.
  *
- * @return Número de bytes leídos, o un valor negativo en caso de error.
+ * @return 0 si todo salió bien, -EIO en caso contrario.
  */
-ssize_t assoofs_read(struct file *filp, char __user *buf, size_t len, loff_t *ppos);
+static int assoofs_init_dir_block(struct super_block *sb, uint64_t block);
 
 /**
- * Función que permite escribir en un fichero.
+ * Obtiene el dispositivo y el número de bloque dentro de él de un bloque del sistema de archivos.
+ * Los bloques reservados están en el primer dispositivo; el resto se reparten por turnos entre todos,
+ * detrás de la cabecera de cada miembro (ver ASSOOFS_MAX_DEVICES).
+ *
+ * @param sb Superbloque del sistema de archivos.
+ * @param block Número de bloque del sistema de archivos.
+ * @param local Puntero donde se escribe el número de bloque dentro del dispositivo.
  *
- * @param filp Puntero al archivo que se va a escribir.
- * @param buf Puntero al buffer que contiene los datos que se van a escribir.
- * @param len Tamaño del buffer.
- * @param ppos Puntero a la posición actual del fichero.
+ * @return El dispositivo que contiene el bloque.
  */
-ssize_t assoofs_write(struct file *filp, const char __user *buf, size_t len, loff_t *ppos);
+static struct block_device *assoofs_block_map(struct super_block *sb, uint64_t block, sector_t *local);
 
-const struct file_operations assoofs_file_operations = {
-    .read = assoofs_read,
-    .write = assoofs_write,
-};
-
-// ****************************************************************
-// Declaración de funciones y structs de operaciones de directorios
-// ****************************************************************
+/**
+ * Equivalentes de sb_bread, sb_getblk, sb_breadahead y sb_find_get_block para un bloque del sistema de archivos,
+ * que puede estar en cualquiera de sus dispositivos (assoofs_block_map). Todo el acceso a bloques pasa por ellas.
+ *
+ * @param sb Superbloque del sistema de archivos.
+ * @param block Número de bloque del sistema de archivos.
+ *
+ * @return El buffer del bloque, o NULL en caso de error (o si no está en la caché, en assoofs_find_get_block).
+ */
+static struct buffer_head *assoofs_bread(struct super_block *sb, uint64_t block);
+static struct buffer_head *assoofs_getblk(struct super_block *sb, uint64_t block);
+static void assoofs_breadahead(struct super_block *sb, uint64_t block);
+static struct buffer_head *assoofs_find_get_block(struct super_block *sb, uint64_t block);
 
 /**
- * Función que permite mostrar el contenido de un directorio.
+ * Descarta un rango de bloques del sistema de archivos en los dispositivos que los contienen.
+ * Con un solo dispositivo el rango se descarta de una vez; si no, bloque a bloque, ya que los bloques consecutivos
+ * están en dispositivos distintos.
  *
- * @param filp Puntero al archivo que representa el directorio.
- * @param ctx Puntero al contexto del directorio.
+ * @param sb Superbloque del sistema de archivos.
+ * @param start Primer bloque del rango.
+ * @param count Número de bloques del rango.
  *
- * @return 0 si se muestra correctamente, un valor negativo en caso contrario.
+ * @return 0 si todo salió bien, un valor negativo en caso contrario.
  */
-static int assoofs_iterate(struct file *filp, struct dir_context *ctx);
+static int assoofs_issue_discard(struct super_block *sb, uint64_t start, uint64_t count);
 
-const struct file_operations assoofs_dir_operations = {
-    .owner = THIS_MODULE,
-    .iterate = assoofs_iterate,
-};
+/**
+ * Abre los dispositivos miembros listados en la opción devices (en orden) y comprueba que sus cabeceras
+ * pertenezcan a este sistema de archivos (set_id, posición y número de dispositivos).
+ *
+ * @param sb Superbloque del sistema de archivos.
+ *
+ * @return 0 si todo salió bien, -EINVAL si los dispositivos no coinciden con los del superbloque, u otro valor negativo.
+ */
+static int assoofs_open_devices(struct super_block *sb);
 
-// ***********************************************************
-// Declaración de funciones y structs de operaciones de inodos
-// ***********************************************************
+/**
+ * Escribe los bloques modificados de los dispositivos miembros y los cierra.
+ *
+ * @param sb Superbloque del sistema de archivos.
+ */
+static void assoofs_close_devices(struct super_block *sb);
 
 /**
- * Busca una entrada de directorio específica en el directorio padre.
- * @param parent_inode Puntero al inodo del directorio padre.
- * @param child_dentry Puntero al dentry que representa la entrada de directorio a buscar.
- * @param flags Bandera(s) adicionales para la búsqueda (no utilizado en esta implementación).
+ * Copia las fechas del inodo de VFS (i_atime, i_mtime, i_ctime) en su información persistente.
+ * Las fechas de VFS son las actuales: la información persistente se pone al día justo antes de guardarla.
  *
- * @return Devuelve siempre NULL.
+ * @param inode_info Información persistente del inodo.
+ * @param inode Inodo de VFS.
  */
-struct dentry *assoofs_lookup(struct inode *parent_inode, struct dentry *child_dentry, unsigned int flags);
+static void assoofs_inode_info_set_times(struct assoofs_inode_info *inode_info, struct inode *inode);
 
 /**
- * Crea un nuevo inodo en el directorio especificado.
+ * Convierte el almacén de inodos de una versión anterior del formato a la versión actual.
+ * Los inodos de la versión 1 no tienen fechas: se les asignan las del momento de la conversión.
+ * Tampoco tienen flags: el hueco que ocupan no se inicializaba, así que se ponen a cero.
+ * El uso recursivo de los directorios se calcula recorriendo el árbol completo una única vez.
+ * next_inode_no se calcula después, al recuperar los inodos huérfanos (assoofs_orphan_recover).
+ * Los bloques de metadatos de las versiones anteriores a la 5 no tienen suma de comprobación: se calcula al convertirlos.
  *
- * @param mnt_userns Puntero al espacio de nombres del usuario.
- * @param dir Puntero al inodo del directorio donde se creará el nuevo inodo.
- * @param dentry Puntero a la entrada del directorio padre para el nuevo archivo.
- * @param mode Permisos del nuevo archivo.
- * @param excl Bandera que indica si el archivo debe ser creado en modo exclusivo (no utilizado en esta implementación).
+ * @param sb Superbloque del sistema de archivos.
  *
- * @return 0 si el archivo se creó correctamente, un valor negativo en caso contrario.
+ * @return 0 si todo salió bien, -EFBIG si los inodos no caben en el almacén actual, u otro valor negativo en caso contrario.
  */
-static int assoofs_create(struct user_namespace *mnt_userns, struct inode *dir, struct dentry *dentry, umode_t mode, bool excl);
+static int assoofs_upgrade_inode_store(struct super_block *sb);
 
 /**
- * Crea un nuevo directorio en el directorio especificado.
+ * Calcula el uso recursivo (tree_inodes, tree_size) de todos los directorios de un almacén de inodos.
+ * Lee los bloques de los directorios para saber el padre de cada inodo y suma cada inodo a todos sus antecesores.
  *
- * @param mnt_userns Puntero al espacio de nombres del usuario.
- * @param dir Puntero al inodo del directorio donde se creará el nuevo directorio.
- * @param dentry Puntero a la entrada del directorio padre para el nuevo directorio (nombre del directorio)
- * @param mode Permisos del nuevo directorio.
+ * @param sb Superbloque del sistema de archivos.
+ * @param inodes Primer inodo del almacén de inodos.
+ * @param count Número de inodos del almacén.
  *
- * @return 0 si el directorio se creó correctamente, un valor negativo en caso contrario.
+ * @return 0 si todo salió bien, -EIO si no se pudo leer algún directorio.
  */
-static int assoofs_mkdir(struct user_namespace *mnt_userns, struct inode *dir, struct dentry *dentry, umode_t mode);
+static int assoofs_usage_compute(struct super_block *sb, struct assoofs_inode_info *inodes, uint64_t count);
 
-static struct inode_operations assoofs_inode_ops = {
-    .create = assoofs_create,
-    .lookup = assoofs_lookup,
-    .mkdir = assoofs_mkdir,
-};
-
-// ****************************************************************
-// Declaración de funciones y structs de operaciones de superbloque
-// ****************************************************************
+/**
+ * Suma bytes e inodos al uso recursivo de todos los directorios antecesores de un dentry, hasta la raíz.
+ * Solo se modifica la información en memoria y los directorios se marcan como sucios: VFS agrupa los cambios
+ * y los guarda al escribir los inodos (assoofs_write_inode), por lo que un mismo directorio se escribe una sola vez
+ * aunque cambie muchas veces.
+ *
+ * @param dentry Dentry del fichero o directorio que cambia (su propio uso no se modifica).
+ * @param bytes Bytes que se suman (negativo si el subárbol decrece).
+ * @param inodes Inodos que se suman (negativo si el subárbol decrece).
+ */
+static void assoofs_usage_add(struct dentry *dentry, int64_t bytes, int32_t inodes);
 
 /**
- * Función que libera la memoria asociada a un inodo.
+ * Lee y retiene en memoria los bloques [first, last) del sistema de archivos (opción mem).
+ * Los buffers se sueltan al desmontar (assoofs_put_super).
  *
- * @param inode Puntero al inodo que se va a liberar.
+ * @param sb Superbloque del sistema de archivos.
+ * @param first Primer bloque que se va a leer.
+ * @param last Bloque siguiente al último que se va a leer.
  *
- * @return 0 si se libera correctamente, un valor negativo en caso contrario.
+ * @return 0 si todo salió bien, -EIO si no se pudo leer algún bloque.
  */
-int assoofs_destroy_inode(struct inode *inode);
-
-static const struct super_operations assoofs_sops = {
-    .drop_inode = assoofs_destroy_inode,
-};
+static int assoofs_mem_load(struct super_block *sb, uint64_t first, uint64_t last);
 
 /**
- * Rellena el superbloque para el sistema de archivos assoofs.
+ * Función para obtener un bloque libre en el dispositivo de bloques.
+ * Busca el primer bloque libre en el mapa de bits de bloques libres del superbloque.
+ * Si encuentra un bloque libre, lo marca como ocupado en el mapa de bits y devuelve su número.
  *
- * @param sb Puntero al superbloque a rellenar.
- * @param data Puntero a los datos específicos del sistema de archivos.
- * @param silent Indica si se deben imprimir mensajes de error o no.
+ * @param sb Superbloque del sistema de archivos.
+ * @param block Puntero a un entero sin signo de 64 bits donde se almacenará el número de bloque libre.
  *
- * @return 0 si todo ha ido bien, un número negativo en caso de error.
+ * @return 0 si se encuentra un bloque libre, un valor negativo en caso contrario.
  */
-int assoofs_fill_super(struct super_block *sb, void *data, int silent);
+int assoofs_sb_get_a_freeblock(struct super_block *sb, uint64_t *block);
 
-// ***********************************
-// Declaración de funciones de montaje
-// ***********************************
+/**
+ * Función para obtener un bloque libre a partir de un bloque dado (objetivo).
+ * Igual que assoofs_sb_get_a_freeblock, pero la búsqueda empieza en el bloque goal.
+ *
+ * @param sb Superbloque del sistema de archivos.
+ * @param goal Bloque a partir del cual se busca el primer bloque libre.
+ * @param block Puntero a un entero sin signo de 64 bits donde se almacenará el número de bloque libre.
+ *
+ * @return 0 si se encuentra un bloque libre, un valor negativo en caso contrario.
+ */
+static int assoofs_sb_get_a_freeblock_from(struct super_block *sb, uint64_t goal, uint64_t *block);
 
 /**
- * Función que permite montar dispositivos del sistema de archivos assoofs.
+ * Función para obtener varios bloques libres de una vez, guardando el superbloque una sola vez.
+ * Si no hay bastantes bloques libres, no se reserva ninguno.
  *
- * @param fs_type Estructura file_system_type que contiene información sobre el sistema de archivos.
- * @param flags Flags adicionales de montaje.
- * @param dev_name cadena de caracteres con el nombre del dispositivo.
- * @param data Puntero a una cadena de caracteres con información adicional.
+ * @param sb Superbloque del sistema de archivos.
+ * @param blocks Vector en el que se almacenan los números de los bloques reservados.
+ * @param count Número de bloques a reservar.
  *
- * @return Puntero a una estructura dentry que representa el directorio raíz del sistema de archivos montado.
+ * @return 0 si se reservan todos los bloques, -ENOSPC en caso contrario.
  */
-static struct dentry *assoofs_mount(struct file_system_type *fs_type, int flags, const char *dev_name, void *data);
+static int assoofs_sb_get_free_blocks(struct super_block *sb, uint64_t *blocks, unsigned int count);
 
-// **************************************************************************
-// Declaración de funciones y structs de inicialización y descarga del módulo
-// **************************************************************************
+/**
+ * Función para obtener números de inodo nuevos. Los números no se reutilizan, por lo que un inodo borrado
+ * que siga en la caché de inodos de VFS nunca se confunde con uno nuevo.
+ * El contador se guarda con el superbloque en la siguiente escritura (al añadir los inodos al almacén).
+ *
+ * @param sb Superbloque del sistema de archivos.
+ * @param count Número de inodos consecutivos que se van a crear.
+ *
+ * @return El número del primero de los inodos.
+ */
+static uint64_t assoofs_sb_get_inode_numbers(struct super_block *sb, unsigned int count);
 
 /**
- * Definición de la estructura file_system_type utilizada para registrar y gestionar sistemas de archivos en el kernel de Linux.
+ * Función para devolver números de inodo obtenidos con assoofs_sb_get_inode_numbers que no se han llegado a usar.
+ * Solo se devuelven si nadie ha obtenido otros después (son los últimos del contador); si no, se pierden.
+ *
+ * @param sb Superbloque del sistema de archivos.
+ * @param first El número del primero de los inodos.
+ * @param count Número de inodos consecutivos obtenidos.
  */
-static struct file_system_type assoofs_type = {
-    .owner = THIS_MODULE,        // Propietario del módulo
-    .name = "assoofs",           // Nombre del sistema de archivos
-    .mount = assoofs_mount,      // Función de montaje del sistema de archivos
-    .kill_sb = kill_block_super, // Función para eliminar el superbloque
-};
+static void assoofs_sb_put_inode_numbers(struct super_block *sb, uint64_t first, unsigned int count);
 
 /**
- * Función de inicialización del módulo del sistema de archivos assoofs.
- * Se ejecuta cuando se carga el módulo en el kernel.
- * Registra el nuevo sistema de archivos en el kernel utilizando la función register_filesystem.
+ * Función que copia el contenido de un bloque en otro y lo sincroniza con el disco.
  *
- * @return 0 si la inicialización se realiza correctamente, un valor negativo en caso de error.
+ * @param sb Superbloque del sistema de archivos.
+ * @param from Número del bloque origen.
+ * @param to Número del bloque destino.
+ *
+ * @return 0 si se copia correctamente, un valor negativo en caso contrario.
  */
-static int __init assoofs_init(void);
+static int assoofs_copy_block(struct super_block *sb, uint64_t from, uint64_t to);
 
 /**
- * Función de salida del módulo del sistema de archivos assoofs.
- * Se ejecuta cuando se borra el módulo del kernel.
- * Elimina la información del sistema de archivos del kernel utilizando la función unregister_filesystem.
+ * Función para tomar una referencia adicional sobre un bloque ocupado (bloque compartido entre ficheros).
+ *
+ * @param sb Superbloque del sistema de archivos.
+ * @param block Número del bloque a compartir.
+ *
+ * @return 0 si se toma la referencia, un valor negativo si el bloque ya tiene el máximo de referencias.
  */
-static void __exit assoofs_exit(void);
+static int assoofs_sb_get_block_ref(struct super_block *sb, uint64_t block);
 
-// ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^
-// ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^
-// ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^
-// ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^
-// ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^
-// ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^
+/**
+ * Función para soltar una referencia sobre un bloque.
+ * Si el bloque no estaba compartido, se marca como libre en el mapa de bits de bloques libres.
+ *
+ * @param sb Superbloque del sistema de archivos.
+ * @param block Número del bloque a soltar.
+ */
+static void assoofs_sb_put_block(struct super_block *sb, uint64_t block);
+
+/**
+ * Función que rompe la compartición del bloque de datos de un fichero antes de escribir en él (copy-on-write).
+ * Si el bloque está compartido, copia su contenido en un bloque libre y el fichero pasa a apuntar a la copia.
+ *
+ * @param sb Superbloque del sistema de archivos.
+ * @param inode_info Puntero a la información persistente del inodo del fichero.
+ *
+ * @return 0 si el bloque ya es exclusivo del fichero o se ha copiado correctamente, un valor negativo en caso contrario.
+ */
+static int assoofs_unshare_block(struct super_block *sb, struct assoofs_inode_info *inode_info);
+
+/**
+ * Función que obtiene el número de bloques del sistema de archivos.
+ *
+ * @param sb Superbloque del sistema de archivos.
+ *
+ * @return Número de bloques del sistema de archivos.
+ */
+static uint64_t assoofs_sb_nr_blocks(struct super_block *sb);
+
+/**
+ * Función que obtiene el número máximo de bloques que puede tener el sistema de archivos en su dispositivo.
+ * Es el mínimo entre los bloques del dispositivo y los bloques que caben en el mapa de bits.
+ *
+ * @param sb Superbloque del sistema de archivos.
+ *
+ * @return Número máximo de bloques.
+ */
+static uint64_t assoofs_bdev_nr_blocks(struct super_block *sb);
+
+/**
+ * Función que descarta en el dispositivo los rangos contiguos de bloques libres.
+ * Debe llamarse con bitmap_lock tomado, para que ningún bloque se reserve mientras se descarta.
+ *
+ * @param sb Superbloque del sistema de archivos.
+ * @param mask Mapa de bits de los bloques candidatos (se descartan los que además estén libres).
+ * @param first Primer bloque del rango a recorrer.
+ * @param last Bloque siguiente al último del rango a recorrer.
+ * @param minlen Longitud mínima (en bloques) de los rangos a descartar.
+ * @param trimmed Puntero donde se almacenará el número de bloques descartados.
+ *
+ * @return 0 si se descartan correctamente, un valor negativo en caso contrario.
+ */
+static int assoofs_discard_free_runs(struct super_block *sb, uint64_t mask, uint64_t first, uint64_t last, uint64_t minlen, uint64_t *trimmed);
+
+/**
+ * Función del trabajo diferido que descarta los bloques liberados pendientes (opción discard).
+ *
+ * @param work Puntero al trabajo (campo discard_work de assoofs_sb_info).
+ */
+static void assoofs_discard_worker(struct work_struct *work);
+
+/**
+ * Trabajo que lee por adelantado, sin esperar, los bloques de datos de todos los directorios.
+ * El montaje solo lee el superbloque y el almacén de inodos; el resto de metadatos se leen al usarse,
+ * y este trabajo hace que las primeras búsquedas y listados los encuentren ya en la caché de buffers.
+ *
+ * @param work Puntero al campo readahead_work de la información en memoria del montaje.
+ */
+static void assoofs_readahead_worker(struct work_struct *work);
+
+/**
+ * Libera un inodo huérfano: lo quita del almacén de inodos (la última entrada ocupa su hueco) y suelta su bloque.
+ * El almacén se escribe antes que el superbloque: si el sistema se detiene entre ambas escrituras, el bloque
+ * queda ocupado, pero nunca se libera un bloque al que todavía apunte un inodo.
+ *
+ * @param sb Superbloque del sistema de archivos.
+ * @param inode_no Número del inodo huérfano (no se hace nada si ya no existe o no es huérfano).
+ */
+static void assoofs_reclaim_inode(struct super_block *sb, uint64_t inode_no);
+
+/**
+ * Trabajo que libera los inodos huérfanos pendientes (reclaim_pending).
+ * assoofs_evict_inode los añade cuando se suelta la última referencia a un fichero o directorio borrado,
+ * por lo que unlink y rmdir terminan sin esperar a la liberación.
+ *
+ * @param work Puntero al campo reclaim_work de la información en memoria del montaje.
+ */
+static void assoofs_reclaim_worker(struct work_struct *work);
+
+/**
+ * Trabajo que carga en la caché de inodos de VFS los inodos pendientes (prefetch_pending), que assoofs_iterate
+ * añade al listar un directorio. El almacén de inodos se lee una sola vez para todos ellos, de modo que las
+ * búsquedas y los stat que suelen seguir a un listado (ls -l, find) encuentran los inodos ya en memoria.
+ *
+ * @param work Puntero al campo prefetch_work de la información en memoria del montaje.
+ */
+static void assoofs_prefetch_worker(struct work_struct *work);
+
+/**
+ * Trabajo del scrub: relee del disco los bloques de metadatos a un ritmo de scrub_rate bloques por segundo y comprueba
+ * sus sumas. Cada ejecución relee scrub_rate / HZ bloques (al menos uno) y se vuelve a programar, de modo que las lecturas
+ * se reparten en el tiempo y no compiten con las del resto de procesos. Se detiene al poner scrub_rate a 0.
+ *
+ * @param work Puntero al campo scrub_work.work de la información en memoria del montaje.
+ */
+static void assoofs_scrub_worker(struct work_struct *work);
+
+/**
+ * Anota los bloques de metadatos actuales: el superbloque, el almacén de inodos y los bloques de los directorios.
+ * Se debe llamar con istore_lock tomado.
+ *
+ * @param sb Superbloque del sistema de archivos.
+ * @param blocks Vector de ASSOOFS_MAX_BLOCKS elementos donde se escriben los números de bloque.
+ *
+ * @return El número de bloques anotados.
+ */
+static unsigned int assoofs_scrub_list(struct super_block *sb, uint64_t *blocks);
+
+/**
+ * Lee un bloque de metadatos directamente del disco, sin pasar por la caché de buffers, y comprueba su suma.
+ * Los bloques con cambios en la caché pendientes de escribir se omiten: el disco aún no está al día.
+ *
+ * @param sb Superbloque del sistema de archivos.
+ * @param block Número del bloque.
+ * @param page Página donde se lee el bloque.
+ *
+ * @return 0 si la suma coincide o el bloque se omite, -EBADMSG si no coincide, u otro valor negativo si falla la lectura.
+ */
+static int assoofs_scrub_block(struct super_block *sb, uint64_t block, struct page *page);
+
+/**
+ * Reescribe en el disco un bloque de metadatos dañado a partir de su copia en la caché de buffers, si la hay y es correcta.
+ * assoofs no guarda copias redundantes de los metadatos, por lo que es la única reparación posible.
+ *
+ * @param sb Superbloque del sistema de archivos (montado en modo lectura-escritura).
+ * @param block Número del bloque.
+ *
+ * @return 0 si el bloque se ha reescrito, un valor negativo en caso contrario.
+ */
+static int assoofs_scrub_repair(struct super_block *sb, uint64_t block);
+
+/**
+ * Termina al montar las liberaciones que quedaron a medias al detenerse el sistema: libera los inodos marcados
+ * como huérfanos (ASSOOFS_INODE_ORPHAN), quita las entradas vacías del final del almacén de inodos y calcula
+ * next_inode_no si la imagen no lo guarda.
+ *
+ * @param sb Superbloque del sistema de archivos (montado en modo lectura-escritura).
+ *
+ * @return 0 si todo salió bien, -EIO si no se pudo leer el almacén de inodos.
+ */
+static int assoofs_orphan_recover(struct super_block *sb);
+
+/**
+ * Función que comprueba si dos ficheros tienen exactamente el mismo contenido (deduplicación).
+ * Los ficheros comprimidos se comparan por su contenido comprimido (cabecera incluida).
+ *
+ * @param sb Superbloque del sistema de archivos.
+ * @param a Puntero a la información persistente del inodo del primer fichero.
+ * @param b Puntero a la información persistente del inodo del segundo fichero.
+ *
+ * @return 0 si el contenido es idéntico, -EBADE si difiere, u otro valor negativo en caso de error.
+ */
+static int assoofs_compare_file_blocks(struct super_block *sb, struct assoofs_inode_info *a, struct assoofs_inode_info *b);
+
+/**
+ * Función que añade un nuevo inodo al almacén de inodos.
+ *
+ * @param sb Puntero al superbloque del sistema de ficheros.
+ * @param inode Puntero al inodo que se va a añadir.
+ *
+ * @return 0 si todo salió bien, -ENOSPC si el almacén de inodos está lleno o -EIO si no se pudo leer.
+ */
+int assoofs_add_inode_info(struct super_block *sb, struct assoofs_inode_info *inode);
+
+/**
+ * Función que añade varios inodos consecutivos al almacén de inodos con una sola escritura del almacén
+ * y otra del superbloque.
+ *
+ * @param sb Puntero al superbloque del sistema de ficheros.
+ * @param inodes Vector con los inodos que se van a añadir.
+ * @param count Número de inodos del vector.
+ *
+ * @return 0 si todo salió bien, -ENOSPC si no caben en el almacén de inodos o -EIO si no se pudo leer.
+ */
+static int assoofs_add_inode_infos(struct super_block *sb, struct assoofs_inode_info *inodes, unsigned int count);
+
+/**
+ * Escribe en el disco un grupo de buffers modificados: envía todas las escrituras y después espera a que terminen,
+ * en lugar de esperar a cada una antes de enviar la siguiente. Con la opción mem los buffers se quedan en memoria.
+ *
+ * @param sb Puntero al superbloque del sistema de ficheros.
+ * @param bhs Vector de buffers (ya marcados como modificados).
+ * @param count Número de buffers del vector.
+ *
+ * @return 0 si todo salió bien, -EIO si alguna escritura falló.
+ */
+static int assoofs_write_buffers(struct super_block *sb, struct buffer_head **bhs, unsigned int count);
+
+/**
+ * Función que obtiene un puntero a la información persistente de un inodo específico.
+ *
+ * @param sb Puntero al superbloque del sistema de ficheros.
+ * @param start Puntero al primer inodo del almacén de inodos.
+ * @param search Puntero al inodo que se quiere buscar.
+ *
+ * @return Devuelve un puntero a la información persistente del inodo encontrado, o NULL si el inodo no se encuentra o hay un error.
+ */
+struct assoofs_inode_info *assoofs_search_inode_info(struct super_block *sb, struct assoofs_inode_info *start, struct assoofs_inode_info *search);
+
+/**
+ * Función que actualiza la información persistente de un inodo en el dispositivo de bloques.
+ *
+ * @param sb Puntero al superbloque del sistema de ficheros.
+ * @param inode_info Puntero a la información persistente del inodo que se va a actualizar.
+ *
+ * @return 0 si se actualiza correctamente, un valor negativo en caso contrario.
+ */
+int assoofs_save_inode_info(struct super_block *sb, struct assoofs_inode_info *inode_info);
+
+/**
+ * Actualiza la información persistente de un inodo (assoofs_save_inode_info sin contabilizar la operación).
+ *
+ * @param sb Puntero al superbloque del sistema de ficheros.
+ * @param inode_info Puntero a la información persistente del inodo que se va a actualizar.
+ *
+ * @return 0 si se actualiza correctamente, un valor negativo en caso contrario.
+ */
+static int assoofs_write_inode_info(struct super_block *sb, struct assoofs_inode_info *inode_info);
+
+/**
+ * Función que interpreta las opciones de montaje (separadas por comas).
+ *
+ * @param sbi Puntero a la información en memoria del montaje.
+ * @param options Cadena de caracteres con las opciones de montaje (puede ser NULL).
+ *
+ * @return 0 si todas las opciones son válidas, un valor negativo en caso contrario.
+ */
+static int assoofs_parse_options(struct assoofs_sb_info *sbi, char *options);
+
+/**
+ * Función que descomprime el contenido de un bloque de datos comprimido con LZ4.
+ *
+ * @param bh Buffer head del bloque de datos (cabecera + datos comprimidos).
+ * @param dst Buffer donde se almacenará el contenido descomprimido.
+ * @param size Tamaño esperado del contenido descomprimido (tamaño lógico del fichero).
+ *
+ * @return 0 si se descomprime correctamente, un valor negativo en caso contrario.
+ */
+static int assoofs_decompress_block(struct buffer_head *bh, char *dst, size_t size);
+
+/**
+ * Función que escribe en un fichero comprimido.
+ * Descomprime el contenido actual, aplica la escritura y vuelve a comprimirlo en el bloque de datos.
+ *
+ * @param bh Buffer head del bloque de datos del fichero.
+ * @param inode_info Puntero a la información persistente del inodo del fichero.
+ * @param from Buffers que contienen los datos que se van a escribir.
+ * @param len Número de bytes a escribir.
+ * @param pos Posición del fichero a partir de la cual se escribe.
+ *
+ * @return 0 si se escribe correctamente, un valor negativo en caso contrario.
+ */
+static int assoofs_compressed_write(struct buffer_head *bh, struct assoofs_inode_info *inode_info, struct iov_iter *from, size_t len, loff_t pos);
+
+/**
+ * Función que comprime un contenido en el bloque de datos de un fichero comprimido (cabecera y datos).
+ * Si el contenido comprimido no cabe, el bloque no se modifica.
+ *
+ * @param bh Buffer head del bloque de datos del fichero.
+ * @param data El contenido descomprimido.
+ * @param size Número de bytes del contenido.
+ *
+ * @return 0 si se comprime correctamente, un valor negativo en caso contrario.
+ */
+static int assoofs_compress_block(struct buffer_head *bh, const char *data, size_t size);
+
+/**
+ * Función que cambia el tamaño de un fichero (truncate). Cada fichero conserva su único bloque de datos:
+ * los bytes que quedan fuera del nuevo tamaño se ponen a cero para que una ampliación posterior lea ceros.
+ * Debe llamarse con el inodo bloqueado.
+ *
+ * @param dentry Dentry del fichero.
+ * @param size Nuevo tamaño del fichero.
+ *
+ * @return 0 si todo salió bien, un valor negativo en caso contrario.
+ */
+static int assoofs_truncate(struct dentry *dentry, loff_t size);
+
+// *************************************************************
+// Declaración de funciones y structs de operaciones de ficheros
+// *************************************************************
+
+/**
+ * Función que permite leer el contenido de un fichero (read, readv, pread, splice y sendfile).
+ * Todos los segmentos del iov_iter se rellenan con una sola lectura del bloque de datos (y una sola descompresión).
+ *
+ * @param iocb Petición de E/S: fichero (ki_filp) y posición actual (ki_pos).
+ * @param to Buffers donde se almacenará el contenido del fichero.
+ *
+ * @return Número de bytes leídos, o un valor negativo en caso de error.
+ */
+ssize_t assoofs_read_iter(struct kiocb *iocb, struct iov_iter *to);
+
+/**
+ * Función que permite escribir en un fichero (write, writev, pwrite y splice).
+ * Todos los segmentos del iov_iter se escriben en el bloque de datos con una sola escritura del bloque y del inodo.
+ *
+ * @param iocb Petición de E/S: fichero (ki_filp) y posición actual (ki_pos).
+ * @param from Buffers que contienen los datos que se van a escribir.
+ *
+ * @return Número de bytes escritos, o un valor negativo en caso de error.
+ */
+ssize_t assoofs_write_iter(struct kiocb *iocb, struct iov_iter *from);
+
+/**
+ * Función que escribe en un fichero con su inodo bloqueado (ver assoofs_write_iter).
+ * El bloqueo impide que el bloque de datos cambie (copy-on-write, desfragmentación) durante la escritura.
+ *
+ * @param iocb Petición de E/S: fichero (ki_filp) y posición actual (ki_pos).
+ * @param from Buffers que contienen los datos que se van a escribir.
+ */
+static ssize_t assoofs_write_locked(struct kiocb *iocb, struct iov_iter *from);
+
+/**
+ * Función que comparte los bloques de un fichero con otro (FICLONE/FICLONERANGE) sin copiar los datos.
+ * Con REMAP_FILE_DEDUP (FIDEDUPERANGE) solo se comparten si el contenido de ambos ficheros es idéntico.
+ * Como cada fichero ocupa un único bloque, solo se pueden compartir ficheros completos.
+ *
+ * @param file_in Puntero al fichero origen.
+ * @param pos_in Posición de inicio en el fichero origen (debe ser 0).
+ * @param file_out Puntero al fichero destino.
+ * @param pos_out Posición de inicio en el fichero destino (debe ser 0).
+ * @param len Número de bytes a compartir (0 para todo el fichero origen).
+ * @param remap_flags Flags REMAP_FILE_* de la operación.
+ *
+ * @return Número de bytes compartidos, o un valor negativo en caso de error.
+ */
+loff_t assoofs_remap_file_range(struct file *file_in, loff_t pos_in, struct file *file_out, loff_t pos_out, loff_t len, unsigned int remap_flags);
+
+/**
+ * Función que copia el contenido de un fichero en otro (copy_file_range) compartiendo su bloque de datos.
+ * Las copias que no se pueden compartir (parciales o entre dos sistemas de archivos) se hacen con generic_copy_file_range.
+ *
+ * @param file_in Puntero al fichero origen.
+ * @param pos_in Posición de inicio en el fichero origen.
+ * @param file_out Puntero al fichero destino.
+ * @param pos_out Posición de inicio en el fichero destino.
+ * @param len Número de bytes a copiar.
+ * @param flags Flags de la operación (se pasan a generic_copy_file_range).
+ *
+ * @return Número de bytes copiados, o un valor negativo en caso de error.
+ */
+ssize_t assoofs_copy_file_range(struct file *file_in, loff_t pos_in, struct file *file_out, loff_t pos_out, size_t len, unsigned int flags);
+
+// **************************************
+// Declaración de funciones de ioctl
+// **************************************
+
+/**
+ * Función que atiende las peticiones ioctl sobre ficheros y directorios de assoofs.
+ *
+ * @param filp Puntero al archivo sobre el que se realiza la petición.
+ * @param cmd Código de la petición.
+ * @param arg Argumento de la petición (normalmente un puntero de usuario).
+ *
+ * @return 0 (o un valor positivo) si se atiende correctamente, un valor negativo en caso contrario.
+ */
+long assoofs_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
+
+/**
+ * Función que descarta los bloques libres del dispositivo (FITRIM).
+ *
+ * @param sb Superbloque del sistema de archivos.
+ * @param urange Puntero de usuario al rango a descartar; al terminar, su campo len indica los bytes descartados.
+ *
+ * @return 0 si se descartan correctamente, un valor negativo en caso contrario.
+ */
+static int assoofs_ioctl_fitrim(struct super_block *sb, struct fstrim_range __user *urange);
+
+/**
+ * Función que amplía el sistema de archivos montado (ASSOOFS_IOC_RESIZE).
+ * Los bloques añadidos se marcan como libres en el mapa de bits; no se admite reducir el sistema de archivos.
+ *
+ * @param sb Superbloque del sistema de archivos.
+ * @param ucount Puntero de usuario al nuevo número de bloques (0 para ocupar todo el dispositivo); al terminar contiene el número de bloques resultante.
+ *
+ * @return 0 si se amplía correctamente, un valor negativo en caso contrario.
+ */
+static int assoofs_ioctl_resize(struct super_block *sb, uint64_t __user *ucount);
+
+/**
+ * Función que traslada el bloque de datos de un fichero o directorio a otro bloque libre (ASSOOFS_IOC_MOVE_BLOCK).
+ * El inodo permanece bloqueado durante el traslado, por lo que es atómico respecto a las escrituras.
+ *
+ * @param filp Puntero al archivo cuyo bloque se traslada.
+ * @param umove Puntero de usuario a la petición de traslado.
+ *
+ * @return 0 si se traslada correctamente, un valor negativo en caso contrario.
+ */
+static int assoofs_ioctl_move_block(struct file *filp, struct assoofs_move_block __user *umove);
+
+/**
+ * Función que guarda una copia del sistema de archivos en un fichero imagen (ASSOOFS_IOC_SNAPSHOT).
+ * El sistema de archivos se congela durante la copia, por lo que la imagen es coherente y se puede montar después.
+ *
+ * @param sb Superbloque del sistema de archivos.
+ * @param ufd Puntero de usuario al descriptor del fichero imagen, abierto para escritura.
+ *
+ * @return 0 si la copia se guarda correctamente, un valor negativo en caso contrario.
+ */
+static int assoofs_ioctl_snapshot(struct super_block *sb, int __user *ufd);
+
+/**
+ * Devuelve el uso recursivo de un directorio (o el tamaño de un fichero) sin recorrer el subárbol (ASSOOFS_IOC_GET_USAGE).
+ *
+ * @param inode Inodo del fichero o directorio sobre el que se hace la petición.
+ * @param uusage Puntero de usuario en el que se devuelve el uso.
+ *
+ * @return 0 si todo salió bien, -EFAULT si no se pudo copiar el resultado.
+ */
+static int assoofs_ioctl_get_usage(struct inode *inode, struct assoofs_usage __user *uusage);
+
+/**
+ * Función que crea un grupo de ficheros y directorios en un directorio (ASSOOFS_IOC_BULK_CREATE).
+ * Todas las comprobaciones se hacen antes de modificar nada, por lo que se crean todas las entradas o ninguna.
+ * Los bloques de datos se escriben a la vez y los metadatos (superbloque, almacén de inodos, bloque del directorio
+ * e inodo del directorio) se escriben una sola vez para todo el grupo.
+ *
+ * @param filp Puntero al directorio en el que se crean las entradas.
+ * @param ureq Puntero de usuario a la petición.
+ *
+ * @return El número de entradas creadas, o un valor negativo si no se creó ninguna.
+ */
+static int assoofs_ioctl_bulk_create(struct file *filp, struct assoofs_bulk_create __user *ureq);
+
+const struct file_operations assoofs_file_operations = {
+    .read_iter = assoofs_read_iter,
+    .write_iter = assoofs_write_iter,
+    .splice_read = generic_file_splice_read,
+    .splice_write = iter_file_splice_write,
+    .remap_file_range = assoofs_remap_file_range,
+    .copy_file_range = assoofs_copy_file_range,
+    .unlocked_ioctl = assoofs_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+};
+
+// ****************************************************************
+// Declaración de funciones y structs de operaciones de directorios
+// ****************************************************************
+
+/**
+ * Función que permite mostrar el contenido de un directorio.
+ *
+ * @param filp Puntero al archivo que representa el directorio.
+ * @param ctx Puntero al contexto del directorio.
+ *
+ * @return 0 si se muestra correctamente, un valor negativo en caso contrario.
+ */
+static int assoofs_iterate(struct file *filp, struct dir_context *ctx);
+
+const struct file_operations assoofs_dir_operations = {
+    .owner = THIS_MODULE,
+    .iterate = assoofs_iterate,
+    .unlocked_ioctl = assoofs_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+};
+
+// ***********************************************************
+// Declaración de funciones y structs de operaciones de inodos
+// ***********************************************************
+
+/**
+ * Busca una entrada de directorio específica en el directorio padre.
+ * @param parent_inode Puntero al inodo del directorio padre.
+ * @param child_dentry Puntero al dentry que representa la entrada de directorio a buscar.
+ * @param flags Bandera(s) adicionales para la búsqueda (no utilizado en esta implementación).
+ *
+ * @return Devuelve siempre NULL.
+ */
+struct dentry *assoofs_lookup(struct inode *parent_inode, struct dentry *child_dentry, unsigned int flags);
+
+/**
+ * Busca una entrada en el directorio padre y asocia su inodo al dentry (assoofs_lookup sin contabilizar la operación).
+ *
+ * @param parent_inode Puntero al inodo del directorio padre.
+ * @param child_dentry Puntero al dentry que representa la entrada de directorio a buscar.
+ */
+static void assoofs_lookup_entry(struct inode *parent_inode, struct dentry *child_dentry);
+
+/**
+ * Crea un nuevo inodo en el directorio especificado.
+ *
+ * @param mnt_userns Puntero al espacio de nombres del usuario.
+ * @param dir Puntero al inodo del directorio donde se creará el nuevo inodo.
+ * @param dentry Puntero a la entrada del directorio padre para el nuevo archivo.
+ * @param mode Permisos del nuevo archivo.
+ * @param excl Bandera que indica si el archivo debe ser creado en modo exclusivo (no utilizado en esta implementación).
+ *
+ * @return 0 si el archivo se creó correctamente, un valor negativo en caso contrario.
+ */
+static int assoofs_create(struct user_namespace *mnt_userns, struct inode *dir, struct dentry *dentry, umode_t mode, bool excl);
+
+/**
+ * Crea un nuevo directorio en el directorio especificado.
+ *
+ * @param mnt_userns Puntero al espacio de nombres del usuario.
+ * @param dir Puntero al inodo del directorio donde se creará el nuevo directorio.
+ * @param dentry Puntero a la entrada del directorio padre para el nuevo directorio (nombre del directorio)
+ * @param mode Permisos del nuevo directorio.
+ *
+ * @return 0 si el directorio se creó correctamente, un valor negativo en caso contrario.
+ */
+static int assoofs_mkdir(struct user_namespace *mnt_userns, struct inode *dir, struct dentry *dentry, umode_t mode);
+
+/**
+ * Informa de la ubicación en disco de los datos de un inodo (ioctl FS_IOC_FIEMAP).
+ * Cada fichero o directorio ocupa un único bloque, por lo que se notifica como mucho una extensión.
+ *
+ * @param inode Puntero al inodo.
+ * @param fieinfo Puntero a la información de la petición, donde se añaden las extensiones.
+ * @param start Desplazamiento lógico desde el que se piden las extensiones.
+ * @param len Longitud del rango pedido.
+ *
+ * @return 0 si todo salió bien, un valor negativo en caso contrario.
+ */
+static int assoofs_fiemap(struct inode *inode, struct fiemap_extent_info *fieinfo, u64 start, u64 len);
+
+/**
+ * Función que borra un fichero de un directorio.
+ * Quita su entrada del directorio y lo marca como huérfano; su bloque y su inodo se liberan en segundo plano
+ * cuando nadie lo tenga abierto (assoofs_evict_inode).
+ *
+ * @param dir Inodo del directorio padre.
+ * @param dentry Dentry del fichero que se borra.
+ *
+ * @return 0 si todo salió bien, un valor negativo en caso contrario.
+ */
+static int assoofs_unlink(struct inode *dir, struct dentry *dentry);
+
+/**
+ * Función que borra un directorio vacío. Se libera igual que un fichero (assoofs_unlink).
+ *
+ * @param dir Inodo del directorio padre.
+ * @param dentry Dentry del directorio que se borra.
+ *
+ * @return 0 si todo salió bien, -ENOTEMPTY si el directorio no está vacío, u otro valor negativo en caso de error.
+ */
+static int assoofs_rmdir(struct inode *dir, struct dentry *dentry);
+
+/**
+ * Función que quita la entrada de un dentry del bloque de su directorio padre y actualiza la información persistente
+ * del padre (número de hijos, fechas y uso recursivo). La última entrada ocupa el hueco para que sigan siendo contiguas.
+ *
+ * @param dir Inodo del directorio padre.
+ * @param dentry Dentry cuya entrada se quita.
+ *
+ * @return 0 si todo salió bien, -ENOENT si la entrada no existe, u otro valor negativo en caso de error.
+ */
+static int assoofs_remove_dir_record(struct inode *dir, struct dentry *dentry);
+
+/**
+ * Función que cambia los atributos de un fichero o directorio (chmod, utimes, truncate...).
+ * El tamaño se cambia con assoofs_truncate y el resto de cambios se guardan al escribir el inodo.
+ *
+ * @param mnt_userns Espacio de nombres de usuario del montaje.
+ * @param dentry Dentry del fichero o directorio.
+ * @param attr Atributos que se cambian.
+ *
+ * @return 0 si todo salió bien, un valor negativo en caso contrario.
+ */
+static int assoofs_setattr(struct user_namespace *mnt_userns, struct dentry *dentry, struct iattr *attr);
+
+static struct inode_operations assoofs_inode_ops = {
+    .create = assoofs_create,
+    .lookup = assoofs_lookup,
+    .mkdir = assoofs_mkdir,
+    .unlink = assoofs_unlink,
+    .rmdir = assoofs_rmdir,
+    .setattr = assoofs_setattr,
+    .fiemap = assoofs_fiemap,
+};
+
+// *************************************************************
+// Declaración de funciones de la caché de metadatos (metacache)
+// *************************************************************
+
+/**
+ * Construye la caché de metadatos de un montaje de solo lectura: lee una sola vez el almacén de inodos
+ * y el bloque de cada directorio, y los guarda en tablas compactas ordenadas.
+ *
+ * @param sb Puntero al superbloque del sistema de archivos.
+ *
+ * @return 0 si la caché se construyó correctamente, un valor negativo en caso contrario.
+ */
+static int assoofs_metacache_build(struct super_block *sb);
+
+/**
+ * Libera la caché de metadatos.
+ *
+ * @param mc Puntero a la caché (puede ser NULL).
+ */
+static void assoofs_metacache_free(struct assoofs_metacache *mc);
+
+/**
+ * Busca un inodo en la caché de metadatos (búsqueda binaria).
+ *
+ * @param mc Puntero a la caché.
+ * @param inode_no Número del inodo buscado.
+ *
+ * @return Puntero a la información persistente del inodo, o NULL si no existe.
+ */
+static struct assoofs_inode_info *assoofs_metacache_inode(struct assoofs_metacache *mc, uint64_t inode_no);
+
+/**
+ * Busca un directorio en la caché de metadatos (búsqueda binaria).
+ *
+ * @param mc Puntero a la caché.
+ * @param inode_no Número de inodo del directorio.
+ *
+ * @return Puntero al directorio, o NULL si no existe.
+ */
+static struct assoofs_metacache_dir *assoofs_metacache_dir(struct assoofs_metacache *mc, uint64_t inode_no);
+
+/**
+ * Busca una entrada por nombre en un directorio de la caché de metadatos (búsqueda binaria).
+ *
+ * @param mc Puntero a la caché.
+ * @param dir Puntero al directorio.
+ * @param name Nombre buscado.
+ *
+ * @return Puntero a la entrada, o NULL si el directorio no la contiene.
+ */
+static struct assoofs_metacache_entry *assoofs_metacache_lookup(struct assoofs_metacache *mc, struct assoofs_metacache_dir *dir, const char *name);
+
+/**
+ * Compara dos inodos por su número (para sort).
+ *
+ * @param a Puntero al primer inodo.
+ * @param b Puntero al segundo inodo.
+ *
+ * @return Un valor negativo, cero o positivo según el orden de los inodos.
+ */
+static int assoofs_metacache_cmp_inode(const void *a, const void *b);
+
+/**
+ * Compara dos entradas de directorio por su nombre (para sort_r).
+ *
+ * @param a Puntero a la primera entrada.
+ * @param b Puntero a la segunda entrada.
+ * @param names Tabla de cadenas de la caché.
+ *
+ * @return Un valor negativo, cero o positivo según el orden de las entradas.
+ */
+static int assoofs_metacache_cmp_entry(const void *a, const void *b, const void *names);
+
+// *******************************************
+// Declaración de funciones y structs de sysfs
+// *******************************************
+
+/**
+ * Atributo de sysfs de un montaje de assoofs (/sys/fs/assoofs/<dispositivo>/<atributo>)
+ *
+ * @param attr Atributo de sysfs
+ * @param show Función que escribe el valor del atributo en buf
+ * @param store Función que interpreta el valor escrito en el atributo (NULL si es de solo lectura)
+ */
+struct assoofs_attr
+{
+    struct attribute attr;
+    ssize_t (*show)(struct assoofs_sb_info *sbi, char *buf);
+    ssize_t (*store)(struct assoofs_sb_info *sbi, const char *buf, size_t len);
+};
+
+// Directorio de assoofs en sysfs (/sys/fs/assoofs)
+static struct kobject *assoofs_kobj;
+
+/**
+ * Registra el directorio del montaje en sysfs.
+ *
+ * @param sb Puntero al superbloque del sistema de archivos.
+ *
+ * @return 0 si todo salió bien, un valor negativo en caso contrario.
+ */
+static int assoofs_sysfs_register(struct super_block *sb);
+
+/**
+ * Elimina el directorio del montaje de sysfs y espera a que se suelte la última referencia.
+ *
+ * @param sb Puntero al superbloque del sistema de archivos.
+ */
+static void assoofs_sysfs_unregister(struct super_block *sb);
+
+/**
+ * Función que lee un atributo de sysfs del montaje.
+ *
+ * @param kobj Puntero al directorio del montaje en sysfs.
+ * @param attr Puntero al atributo.
+ * @param buf Buffer donde se escribe el valor.
+ *
+ * @return El número de bytes escritos, o un valor negativo en caso de error.
+ */
+static ssize_t assoofs_attr_show(struct kobject *kobj, struct attribute *attr, char *buf);
+
+/**
+ * Función que escribe un atributo de sysfs del montaje.
+ *
+ * @param kobj Puntero al directorio del montaje en sysfs.
+ * @param attr Puntero al atributo.
+ * @param buf Valor escrito.
+ * @param len Longitud del valor escrito.
+ *
+ * @return El número de bytes consumidos, o un valor negativo en caso de error.
+ */
+static ssize_t assoofs_attr_store(struct kobject *kobj, struct attribute *attr, const char *buf, size_t len);
+
+/**
+ * Función que se llama cuando sysfs suelta la última referencia al directorio del montaje.
+ *
+ * @param kobj Puntero al directorio del montaje en sysfs.
+ */
+static void assoofs_sb_release(struct kobject *kobj);
+
+/**
+ * Funciones que muestran los atributos de la caché de metadatos: la memoria que ocupa, el tiempo que costó
+ * construirla al montar (en microsegundos) y el número de inodos y de entradas de directorio que contiene.
+ * Sin la opción metacache todos valen 0.
+ *
+ * @param sbi Puntero a la información en memoria del montaje.
+ * @param buf Buffer donde se escribe el valor.
+ *
+ * @return El número de bytes escritos.
+ */
+static ssize_t assoofs_metacache_bytes_show(struct assoofs_sb_info *sbi, char *buf);
+static ssize_t assoofs_metacache_load_us_show(struct assoofs_sb_info *sbi, char *buf);
+static ssize_t assoofs_metacache_inodes_show(struct assoofs_sb_info *sbi, char *buf);
+static ssize_t assoofs_metacache_dirents_show(struct assoofs_sb_info *sbi, char *buf);
+
+/**
+ * Funciones que muestran las sumas de comprobación incorrectas encontradas al leer metadatos y el estado del scrub:
+ * pasadas completas, bloques dañados en el disco y bloques reparados.
+ *
+ * @param sbi Puntero a la información en memoria del montaje.
+ * @param buf Buffer donde se escribe el valor.
+ *
+ * @return El número de bytes escritos.
+ */
+static ssize_t assoofs_checksum_errors_show(struct assoofs_sb_info *sbi, char *buf);
+static ssize_t assoofs_scrub_passes_show(struct assoofs_sb_info *sbi, char *buf);
+static ssize_t assoofs_scrub_errors_show(struct assoofs_sb_info *sbi, char *buf);
+static ssize_t assoofs_scrub_repaired_show(struct assoofs_sb_info *sbi, char *buf);
+
+/**
+ * Funciones que muestran y cambian el ritmo del scrub, en bloques por segundo (0 lo detiene).
+ *
+ * @param sbi Puntero a la información en memoria del montaje.
+ * @param buf Buffer donde se escribe o del que se lee el valor.
+ * @param len Longitud del valor escrito.
+ *
+ * @return El número de bytes escritos o consumidos, o -EINVAL si el valor no es un número.
+ */
+static ssize_t assoofs_scrub_rate_show(struct assoofs_sb_info *sbi, char *buf);
+static ssize_t assoofs_scrub_rate_store(struct assoofs_sb_info *sbi, const char *buf, size_t len);
+
+/**
+ * Funciones que muestran y ponen a cero las estadísticas de las operaciones internas: una línea por operación
+ * con su nombre, las llamadas terminadas, el tiempo total en nanosegundos y las operaciones por segundo.
+ * Escribir 0 pone a cero todos los contadores (por ejemplo, antes de medir una carga de trabajo).
+ *
+ * @param sbi Puntero a la información en memoria del montaje.
+ * @param buf Buffer donde se escribe o del que se lee el valor.
+ * @param len Longitud del valor escrito.
+ *
+ * @return El número de bytes escritos o consumidos, o -EINVAL si el valor no es 0.
+ */
+static ssize_t assoofs_op_stats_show(struct assoofs_sb_info *sbi, char *buf);
+static ssize_t assoofs_op_stats_store(struct assoofs_sb_info *sbi, const char *buf, size_t len);
+
+#define ASSOOFS_ATTR_RO(_name) static struct assoofs_attr assoofs_attr_##_name = __ATTR(_name, 0444, assoofs_##_name##_show, NULL)
+#define ASSOOFS_ATTR_RW(_name) static struct assoofs_attr assoofs_attr_##_name = __ATTR(_name, 0644, assoofs_##_name##_show, assoofs_##_name##_store)
+
+ASSOOFS_ATTR_RO(metacache_bytes);
+ASSOOFS_ATTR_RO(metacache_load_us);
+ASSOOFS_ATTR_RO(metacache_inodes);
+ASSOOFS_ATTR_RO(metacache_dirents);
+ASSOOFS_ATTR_RO(checksum_errors);
+ASSOOFS_ATTR_RO(scrub_passes);
+ASSOOFS_ATTR_RO(scrub_errors);
+ASSOOFS_ATTR_RO(scrub_repaired);
+ASSOOFS_ATTR_RW(scrub_rate);
+ASSOOFS_ATTR_RW(op_stats);
+
+static struct attribute *assoofs_attrs[] = {
+    &assoofs_attr_metacache_bytes.attr,
+    &assoofs_attr_metacache_load_us.attr,
+    &assoofs_attr_metacache_inodes.attr,
+    &assoofs_attr_metacache_dirents.attr,
+    &assoofs_attr_checksum_errors.attr,
+    &assoofs_attr_scrub_passes.attr,
+    &assoofs_attr_scrub_errors.attr,
+    &assoofs_attr_scrub_repaired.attr,
+    &assoofs_attr_scrub_rate.attr,
+    &assoofs_attr_op_stats.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(assoofs);
+
+static const struct sysfs_ops assoofs_attr_ops = {
+    .show = assoofs_attr_show,
+    .store = assoofs_attr_store,
+};
+
+static struct kobj_type assoofs_sb_ktype = {
+    .default_groups = assoofs_groups,
+    .sysfs_ops = &assoofs_attr_ops,
+    .release = assoofs_sb_release,
+};
+
+// ****************************************************************
+// Declaración de funciones y structs de operaciones de superbloque
+// ****************************************************************
+
+/**
+ * Reserva un inodo de VFS junto a la copia de su información persistente (struct assoofs_inode).
+ *
+ * @param sb Puntero al superbloque del sistema de archivos.
+ *
+ * @return Puntero al inodo de VFS reservado, o NULL si no hay memoria.
+ */
+static struct inode *assoofs_alloc_inode(struct super_block *sb);
+
+/**
+ * Libera un inodo y su información persistente. VFS la llama tras un periodo de gracia RCU,
+ * cuando ninguna búsqueda de rutas en modo RCU puede estar accediendo al inodo.
+ *
+ * @param inode Puntero al inodo que se va a liberar.
+ */
+static void assoofs_free_inode(struct inode *inode);
+
+/**
+ * Función que libera las páginas y el estado de VFS de un inodo cuando se expulsa de la caché de inodos.
+ *
+ * @param inode Puntero al inodo que se va a expulsar.
+ */
+static void assoofs_evict_inode(struct inode *inode);
+
+/**
+ * Función que guarda en el disco un inodo modificado en memoria (llamada por la escritura diferida de VFS).
+ * Así se guardan los cambios que solo afectan a las fechas (atime, utimes, lazytime) sin escribir en el momento.
+ *
+ * @param inode Puntero al inodo que se va a guardar.
+ * @param wbc Control de la escritura diferida (no utilizado en esta implementación).
+ *
+ * @return 0 si se guarda correctamente, un valor negativo en caso contrario.
+ */
+static int assoofs_write_inode(struct inode *inode, struct writeback_control *wbc);
+
+/**
+ * Función que libera la información en memoria del montaje al desmontar el sistema de archivos.
+ *
+ * @param sb Puntero al superbloque del sistema de archivos.
+ */
+static void assoofs_put_super(struct super_block *sb);
+
+/**
+ * Función que obtiene las estadísticas del sistema de archivos (statfs, df).
+ *
+ * @param dentry Puntero a un dentry del sistema de archivos.
+ * @param buf Puntero a la estructura donde se almacenarán las estadísticas.
+ *
+ * @return 0 siempre.
+ */
+static int assoofs_statfs(struct dentry *dentry, struct kstatfs *buf);
+
+/**
+ * Función que cambia las opciones de un sistema de archivos montado (mount -o remount).
+ *
+ * @param sb Puntero al superbloque del sistema de archivos.
+ * @param flags Puntero a los nuevos flags de montaje (SB_*).
+ * @param data Nuevas opciones de montaje (no se reinterpretan).
+ *
+ * @return 0 si todo salió bien, -EINVAL si se intenta montar en lectura/escritura con la opción metacache.
+ */
+static int assoofs_remount(struct super_block *sb, int *flags, char *data);
+
+/**
+ * Función que escribe los bloques modificados de los dispositivos miembros (sync, syncfs, congelación, desmontaje).
+ * VFS solo escribe los del dispositivo montado (sb->s_bdev). Al esperar, termina antes de liberar los ficheros
+ * borrados pendientes, para que sus cambios también se escriban.
+ *
+ * @param sb Puntero al superbloque del sistema de archivos.
+ * @param wait Si es 0 solo se inician las escrituras; si no, se espera a que terminen.
+ *
+ * @return 0 si todo salió bien, el primer error de escritura en caso contrario.
+ */
+static int assoofs_sync_fs(struct super_block *sb, int wait);
+
+/**
+ * Congela el sistema de archivos (fsfreeze, instantáneas de LVM, ASSOOFS_IOC_SNAPSHOT).
+ * VFS ya ha bloqueado las nuevas modificaciones y escrito los inodos y buffers modificados; aquí se detienen
+ * los trabajos en segundo plano que escriben en el disco (liberación de ficheros borrados, descartes y scrub)
+ * y se escribe lo que hayan dejado pendiente, de modo que el disco no cambia hasta descongelarlo.
+ *
+ * @param sb Puntero al superbloque del sistema de archivos.
+ *
+ * @return 0 si todo salió bien, el primer error de escritura en caso contrario (el sistema sigue sin congelar).
+ */
+static int assoofs_freeze_fs(struct super_block *sb);
+
+/**
+ * Descongela el sistema de archivos: vuelve a programar los trabajos en segundo plano con lo que quedó pendiente.
+ *
+ * @param sb Puntero al superbloque del sistema de archivos.
+ *
+ * @return Siempre 0.
+ */
+static int assoofs_unfreeze_fs(struct super_block *sb);
+
+static const struct super_operations assoofs_sops = {
+    .alloc_inode = assoofs_alloc_inode,
+    .free_inode = assoofs_free_inode,
+    .evict_inode = assoofs_evict_inode,
+    .write_inode = assoofs_write_inode,
+    .put_super = assoofs_put_super,
+    .statfs = assoofs_statfs,
+    .remount_fs = assoofs_remount,
+    .sync_fs = assoofs_sync_fs,
+    .freeze_fs = assoofs_freeze_fs,
+    .unfreeze_fs = assoofs_unfreeze_fs,
+};
+
+/**
+ * Rellena el superbloque para el sistema de archivos assoofs.
+ *
+ * @param sb Puntero al superbloque a rellenar.
+ * @param data Puntero a los datos específicos del sistema de archivos.
+ * @param silent Indica si se deben imprimir mensajes de error o no.
+ *
+ * @return 0 si todo ha ido bien, un número negativo en caso de error.
+ */
+int assoofs_fill_super(struct super_block *sb, void *data, int silent);
+
+// ***********************************
+// Declaración de funciones de montaje
+// ***********************************
+
+/**
+ * Función que permite montar dispositivos del sistema de archivos assoofs.
+ *
+ * @param fs_type Estructura file_system_type que contiene información sobre el sistema de archivos.
+ * @param flags Flags adicionales de montaje.
+ * @param dev_name cadena de caracteres con el nombre del dispositivo.
+ * @param data Puntero a una cadena de caracteres con información adicional.
+ *
+ * @return Puntero a una estructura dentry que representa el directorio raíz del sistema de archivos montado.
+ */
+static struct dentry *assoofs_mount(struct file_system_type *fs_type, int flags, const char *dev_name, void *data);
+
+/**
+ * Desmonta el sistema de archivos assoofs: espera a la carga anticipada de inodos antes de que VFS libere
+ * la caché de inodos del montaje (kill_block_super) y después libera el superbloque.
+ *
+ * @param sb Puntero al superbloque del sistema de archivos.
+ */
+static void assoofs_kill_sb(struct super_block *sb);
+
+// **************************************************************************
+// Declaración de funciones y structs de inicialización y descarga del módulo
+// **************************************************************************
+
+/**
+ * Definición de la estructura file_system_type utilizada para registrar y gestionar sistemas de archivos en el kernel de Linux.
+ */
+static struct file_system_type assoofs_type = {
+    .owner = THIS_MODULE,        // Propietario del módulo
+    .name = "assoofs",           // Nombre del sistema de archivos
+    .mount = assoofs_mount,      // Función de montaje del sistema de archivos
+    .kill_sb = assoofs_kill_sb,  // Función para eliminar el superbloque
+};
+
+/**
+ * Inicializa una sola vez el inodo de VFS de cada objeto de la caché de inodos (constructor del slab).
+ *
+ * @param obj Puntero al struct assoofs_inode que se va a inicializar.
+ */
+static void assoofs_inode_init_once(void *obj);
+
+/**
+ * Función de inicialización del módulo del sistema de archivos assoofs.
+ * Se ejecuta cuando se carga el módulo en el kernel.
+ * Registra el nuevo sistema de archivos en el kernel utilizando la función register_filesystem.
+ *
+ * @return 0 si la inicialización se realiza correctamente, un valor negativo en caso de error.
+ */
+static int __init assoofs_init(void);
+
+/**
+ * Función de salida del módulo del sistema de archivos assoofs.
+ * Se ejecuta cuando se borra el módulo del kernel.
+ * Elimina la información del sistema de archivos del kernel utilizando la función unregister_filesystem.
+ */
+static void __exit assoofs_exit(void);
+
+// ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^
+// ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^
+// ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^
+// ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^
+// ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^
+// ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^
 
 // +++++++++++++++++++++++++++++++++
 // Definicón de funciones auxiliares
 // +++++++++++++++++++++++++++++++++
 
-struct assoofs_inode_info *assoofs_get_inode_info(struct super_block *sb, uint64_t inode_no)
+int assoofs_get_inode_info(struct super_block *sb, uint64_t inode_no, struct assoofs_inode_info *buffer)
+{
+    // Declaración de variables (ISO C90)
+    uint64_t start = ktime_get_ns();
+    int ret;
+
+    ret = assoofs_read_inode_info(sb, inode_no, buffer);
+    if (ret == 0)
+        assoofs_op_account(sb, ASSOOFS_OP_GET_INODE_INFO, start);
+
+    return ret;
+}
+
+static int assoofs_read_inode_info(struct super_block *sb, uint64_t inode_no, struct assoofs_inode_info *buffer)
+{
+    // Declaración de variables (ISO C90)
+    int i;
+    int ret = -1;
+    struct assoofs_super_block_info *afs_sb;
+    struct assoofs_inode_info *inode_info;
+    struct buffer_head *bh;
+
+    printk(KERN_INFO "assoofs_get_inode_info: request\n");
+
+    // Con la opción metacache el inodo se copia de la caché de metadatos, sin leer el almacén de inodos
+    if (ASSOOFS_SB(sb)->metacache)
+    {
+        inode_info = assoofs_metacache_inode(ASSOOFS_SB(sb)->metacache, inode_no);
+        if (!inode_info)
+            return -1;
+        memcpy(buffer, inode_info, sizeof(*buffer));
+        return 0;
+    }
+
+    // 1. Leer el bloque que contiene el almacén de inodos del dispositivo de bloques
+    // El almacén no debe cambiar mientras se recorre (la liberación de inodos mueve sus entradas)
+    mutex_lock(&ASSOOFS_SB(sb)->istore_lock);
+    // assoofs_meta_bread (sb_bread y comprobación de la suma crc32c) se utiliza aquí para leer el almacén de inodos del dispositivo de bloques (el bloque 1)
+    bh = assoofs_meta_bread(sb, ASSOOFS_INODESTORE_BLOCK_NUMBER);
+    if (!bh)
+    {
+        mutex_unlock(&ASSOOFS_SB(sb)->istore_lock);
+        printk(KERN_ERR "assoofs_get_inode_info: reading the inode store failed\n");
+        return -1;
+    }
+    // Para acceder a los campos del bloque, primero hay que asignar bh->b_data a un puntero de tipo assoofs_inode_info
+    inode_info = (struct assoofs_inode_info *)bh->b_data;
+
+    // 2. Recorrer el almacén de inodos en busca del inodo cuya información se quiere obtener (inode_no)
+    // Declaramos un puntero con la información persistente del superbloque
+    afs_sb = ASSOOFS_SB(sb)->asb;
+    for (i = 0; i < afs_sb->inodes_count; i++)
+    {
+        if (inode_info->inode_no == inode_no)
+        {
+            // Hemos encontrado el inodo que buscábamos
+            // Copiamos la información persistente del inodo en el buffer
+            memcpy(buffer, inode_info, sizeof(*buffer));
+            ret = 0;
+            break;
+        }
+        inode_info++;
+    }
+
+    // Ya podemos liberar el buffer_head con brelse
+    brelse(bh);
+    mutex_unlock(&ASSOOFS_SB(sb)->istore_lock);
+
+    return ret;
+};
+
+static struct inode *assoofs_get_inode(struct super_block *sb, int ino)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_inode_info *inode_info;
+    struct inode *inode;
+
+    printk(KERN_INFO "assoofs_get_inode: request\n");
+
+    // 1. Buscamos el inodo en la caché de inodos de VFS
+    // Así todos los ficheros abiertos de un mismo inodo comparten su información persistente (i_private)
+    inode = iget_locked(sb, ino);
+    if (!inode)
+        return NULL;
+    if (!(inode->i_state & I_NEW))
+        return inode;
+
+    // 2. Si no estaba en la caché, obtenemos la información persistente del inodo ino
+    // La copia se guarda junto al inodo de VFS (assoofs_alloc_inode)
+    inode_info = &ASSOOFS_I(inode)->info;
+    if (assoofs_get_inode_info(sb, ino, inode_info))
+    {
+        printk(KERN_ERR "assoofs_get_inode_info: Inode not found\n");
+        iget_failed(inode);
+        return NULL;
+    }
+
+    // 3. Asignamos los campos correspondientes del nuevo inodo (iget_locked ya ha asignado el número de inodo)
+    if (assoofs_inode_setup(inode))
+    {
+        iget_failed(inode);
+        return NULL;
+    }
+
+    // 4. Devolver el inodo recién creado, ya visible para el resto de búsquedas
+    unlock_new_inode(inode);
+    return inode;
+}
+
+static int assoofs_inode_setup(struct inode *inode)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_inode_info *inode_info = &ASSOOFS_I(inode)->info;
+
+    // Asignamos las operaciones sobre inodos (iget_locked ya ha asignado el superbloque)
+    inode->i_op = &assoofs_inode_ops;
+
+    // Determinamos si el inodo es un fichero o un directorio y asignamos la operación correspondiente
+    if (S_ISDIR(inode_info->mode))
+        inode->i_fop = &assoofs_dir_operations;
+    else if (S_ISREG(inode_info->mode))
+    {
+        inode->i_fop = &assoofs_file_operations;
+        // El VFS (stat, copy_file_range, deduplicación) toma el tamaño de i_size, no de la información persistente
+        i_size_write(inode, inode_info->file_size);
+    }
+    else
+    {
+        printk(KERN_ERR "assoofs_get_inode: Unknown inode type. Neither a directory nor a file.");
+        return -1;
+    }
+
+    // Asignar las fechas guardadas en el disco a los campos i_atime, i_mtime, i_ctime
+    inode->i_atime = ns_to_timespec64(inode_info->atime);
+    inode->i_mtime = ns_to_timespec64(inode_info->mtime);
+    inode->i_ctime = ns_to_timespec64(inode_info->ctime);
+
+    // Asignamos propietario y permisos solo al crear el inodo en memoria: la búsqueda en modo RCU
+    // lee i_mode, i_uid e i_gid sin cerrojos, por lo que no deben cambiar en un inodo ya visible
+    inode_init_owner(inode->i_sb->s_user_ns, inode, NULL, inode_info->mode);
+
+    // Guardar la información persistente del inodo en el campo i_private
+    inode->i_private = inode_info;
+
+    return 0;
+}
+
+void assoofs_save_sb_info(struct super_block *vsb)
+{
+    // Declaración de variables (ISO C90)
+    struct buffer_head *bh;
+
+    printk(KERN_INFO "assoofs_save_sb_info: request\n");
+
+    // El buffer del superbloque (bloque 0) se retiene durante todo el montaje y la información persistente
+    // apunta a su contenido, por lo que basta con marcarlo como modificado
+    bh = ASSOOFS_SB(vsb)->sbh;
+
+    // Actualizamos la suma de comprobación con el buffer bloqueado y lo marcamos como modificado
+    assoofs_sb_lock(vsb);
+    assoofs_sb_unlock(vsb);
+    mark_buffer_dirty(bh);
+
+    // Sincrionizamos el buffer con el disco para reflejar los cambios
+    assoofs_sync_dirty_buffer(vsb, bh);
+}
+
+static void assoofs_sb_lock(struct super_block *sb)
+{
+    // sync_dirty_buffer y la escritura en segundo plano bloquean el buffer mientras se escribe
+    lock_buffer(ASSOOFS_SB(sb)->sbh);
+}
+
+static void assoofs_sb_unlock(struct super_block *sb)
+{
+    assoofs_block_checksum_set(ASSOOFS_SB(sb)->sbh->b_data);
+    unlock_buffer(ASSOOFS_SB(sb)->sbh);
+}
+
+static void assoofs_sync_dirty_buffer(struct super_block *sb, struct buffer_head *bh)
+{
+    // Con la opción mem el buffer se queda modificado en memoria: se escribe al sincronizar (sync) o desmontar
+    if (ASSOOFS_SB(sb)->mount_opt & ASSOOFS_MOUNT_MEM)
+        return;
+
+    sync_dirty_buffer(bh);
+}
+
+static void assoofs_op_account(struct super_block *sb, enum assoofs_op op, uint64_t start)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(sb);
+
+    // El inodo raíz se lee antes de que exista la información en memoria del montaje
+    if (!sbi)
+        return;
+
+    atomic64_inc(&sbi->op_calls[op]);
+    atomic64_add(ktime_get_ns() - start, &sbi->op_ns[op]);
+}
+
+static int assoofs_meta_verify(const char *data)
+{
+    return assoofs_block_checksum_ok(data) ? 0 : -EBADMSG;
+}
+
+static struct buffer_head *assoofs_meta_bread(struct super_block *sb, uint64_t block)
+{
+    // Declaración de variables (ISO C90)
+    struct buffer_head *bh;
+
+    bh = assoofs_bread(sb, block);
+    if (!bh || buffer_assoofs_verified(bh))
+        return bh;
+
+    // Primera lectura del bloque desde el disco: comprobamos su suma antes de que nadie utilice su contenido
+    if (assoofs_meta_verify(bh->b_data))
+    {
+        atomic64_inc(&ASSOOFS_SB(sb)->checksum_errors);
+        printk(KERN_ERR "assoofs: %s: checksum mismatch in metadata block %llu\n", sb->s_id, block);
+        brelse(bh);
+        return NULL;
+    }
+    set_buffer_assoofs_verified(bh);
+
+    return bh;
+}
+
+static void assoofs_mark_meta_dirty(struct buffer_head *bh)
+{
+    assoofs_block_checksum_set(bh->b_data);
+    set_buffer_assoofs_verified(bh);
+    mark_buffer_dirty(bh);
+}
+
+static int assoofs_init_dir_block(struct super_block *sb, uint64_t block)
+{
+    // Declaración de variables (ISO C90)
+    struct buffer_head *bh;
+
+    // El contenido anterior del bloque no importa: no hace falta leerlo del disco
+    bh = assoofs_getblk(sb, block);
+    if (!bh)
+        return -EIO;
+    lock_buffer(bh);
+    memset(bh->b_data, 0, bh->b_size);
+    set_buffer_uptodate(bh);
+    unlock_buffer(bh);
+
+    assoofs_mark_meta_dirty(bh);
+    assoofs_sync_dirty_buffer(sb, bh);
+    brelse(bh);
+
+    return 0;
+}
+
+static struct block_device *assoofs_block_map(struct super_block *sb, uint64_t block, sector_t *local)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(sb);
+    unsigned int dev;
+
+    // Con un solo dispositivo (o mientras se monta, antes de abrir los miembros) el número de bloque no cambia
+    if (!sbi || sbi->ndevs <= 1)
+    {
+        *local = block;
+        return sb->s_bdev;
+    }
+
+    *local = assoofs_core_layout_map(block, sbi->ndevs, &dev);
+    return sbi->devs[dev];
+}
+
+static struct buffer_head *assoofs_bread(struct super_block *sb, uint64_t block)
+{
+    // Declaración de variables (ISO C90)
+    struct block_device *bdev;
+    sector_t local;
+
+    bdev = assoofs_block_map(sb, block, &local);
+    return __bread(bdev, local, sb->s_blocksize);
+}
+
+static struct buffer_head *assoofs_getblk(struct super_block *sb, uint64_t block)
+{
+    // Declaración de variables (ISO C90)
+    struct block_device *bdev;
+    sector_t local;
+
+    bdev = assoofs_block_map(sb, block, &local);
+    return __getblk(bdev, local, sb->s_blocksize);
+}
+
+static void assoofs_breadahead(struct super_block *sb, uint64_t block)
+{
+    // Declaración de variables (ISO C90)
+    struct block_device *bdev;
+    sector_t local;
+
+    bdev = assoofs_block_map(sb, block, &local);
+    __breadahead(bdev, local, sb->s_blocksize);
+}
+
+static struct buffer_head *assoofs_find_get_block(struct super_block *sb, uint64_t block)
+{
+    // Declaración de variables (ISO C90)
+    struct block_device *bdev;
+    sector_t local;
+
+    bdev = assoofs_block_map(sb, block, &local);
+    return __find_get_block(bdev, local, sb->s_blocksize);
+}
+
+static int assoofs_issue_discard(struct super_block *sb, uint64_t start, uint64_t count)
+{
+    // Declaración de variables (ISO C90)
+    struct block_device *bdev;
+    sector_t local;
+    uint64_t i;
+    int ret;
+
+    if (ASSOOFS_SB(sb)->ndevs <= 1)
+        return sb_issue_discard(sb, start, count, GFP_NOFS, 0);
+
+    for (i = start; i < start + count; i++)
+    {
+        bdev = assoofs_block_map(sb, i, &local);
+        ret = blkdev_issue_discard(bdev, local << (sb->s_blocksize_bits - SECTOR_SHIFT), sb->s_blocksize >> SECTOR_SHIFT, GFP_NOFS);
+        // Un miembro que no admita descartes no impide descartar en el resto
+        if (ret && ret != -EOPNOTSUPP)
+            return ret;
+    }
+
+    return 0;
+}
+
+static int assoofs_open_devices(struct super_block *sb)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(sb);
+    struct assoofs_member_info *member;
+    struct block_device *bdev;
+    struct buffer_head *bh;
+    uint64_t count;
+    char *paths = sbi->devs_opt;
+    char *path;
+    int ret = -EINVAL;
+
+    printk(KERN_INFO "assoofs_open_devices: request\n");
+
+    sbi->devs[0] = sb->s_bdev;
+    sbi->ndevs = 1;
+    sbi->devs_mode = FMODE_READ | FMODE_EXCL | (sb_rdonly(sb) ? 0 : FMODE_WRITE);
+
+    // 1. Los sistemas de archivos de un solo dispositivo no admiten la opción devices, y el resto la necesitan
+    count = sbi->asb->devices_count > 1 ? sbi->asb->devices_count : 1;
+    if (count > ASSOOFS_MAX_DEVICES)
+    {
+        printk(KERN_ERR "assoofs_open_devices: too many devices (%llu)\n", count);
+        return -EINVAL;
+    }
+    if (count == 1)
+    {
+        if (paths)
+            printk(KERN_ERR "assoofs_open_devices: %s is not a multi-device filesystem\n", sb->s_id);
+        return paths ? -EINVAL : 0;
+    }
+    if (!paths)
+    {
+        printk(KERN_ERR "assoofs_open_devices: %s spans %llu devices, list the other ones with devices=<dev>:<dev>...\n", sb->s_id, count);
+        return -EINVAL;
+    }
+
+    // 2. Abrimos los miembros en el orden de la opción y comprobamos que cada uno ocupe esa posición
+    while ((path = strsep(&paths, ":")) != NULL)
+    {
+        if (!*path)
+            continue;
+        if (sbi->ndevs == count)
+        {
+            printk(KERN_ERR "assoofs_open_devices: %s has only %llu devices\n", sb->s_id, count);
+            ret = -EINVAL;
+            goto out_close;
+        }
+
+        bdev = blkdev_get_by_path(path, sbi->devs_mode, &assoofs_type);
+        if (IS_ERR(bdev))
+        {
+            printk(KERN_ERR "assoofs_open_devices: can't open %s\n", path);
+            ret = PTR_ERR(bdev);
+            goto out_close;
+        }
+        sbi->devs[sbi->ndevs++] = bdev;
+        if (set_blocksize(bdev, sb->s_blocksize))
+        {
+            printk(KERN_ERR "assoofs_open_devices: %s does not support %lu byte blocks\n", path, sb->s_blocksize);
+            ret = -EINVAL;
+            goto out_close;
+        }
+
+        bh = __bread(bdev, 0, sb->s_blocksize);
+        if (!bh)
+        {
+            printk(KERN_ERR "assoofs_open_devices: unable to read the header of %s\n", path);
+            ret = -EIO;
+            goto out_close;
+        }
+        member = (struct assoofs_member_info *)bh->b_data;
+        if (member->magic != ASSOOFS_MAGIC || assoofs_meta_verify(bh->b_data) || member->set_id != sbi->asb->set_id ||
+            member->devices_count != count || member->index != sbi->ndevs - 1)
+        {
+            printk(KERN_ERR "assoofs_open_devices: %s is not device %u of %s\n", path, sbi->ndevs - 1, sb->s_id);
+            brelse(bh);
+            ret = -EINVAL;
+            goto out_close;
+        }
+        brelse(bh);
+    }
+    if (sbi->ndevs != count)
+    {
+        printk(KERN_ERR "assoofs_open_devices: %s spans %llu devices, but only %u were given\n", sb->s_id, count, sbi->ndevs);
+        ret = -EINVAL;
+        goto out_close;
+    }
+
+    printk(KERN_INFO "assoofs: %s spans %u devices\n", sb->s_id, sbi->ndevs);
+    return 0;
+
+out_close:
+    assoofs_close_devices(sb);
+    return ret;
+}
+
+static void assoofs_close_devices(struct super_block *sb)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(sb);
+    unsigned int i;
+
+    for (i = 1; i < sbi->ndevs; i++)
+    {
+        sync_blockdev(sbi->devs[i]);
+        blkdev_put(sbi->devs[i], sbi->devs_mode);
+        sbi->devs[i] = NULL;
+    }
+    sbi->ndevs = 1;
+}
+
+static void assoofs_inode_info_set_times(struct assoofs_inode_info *inode_info, struct inode *inode)
+{
+    inode_info->atime = timespec64_to_ns(&inode->i_atime);
+    inode_info->mtime = timespec64_to_ns(&inode->i_mtime);
+    inode_info->ctime = timespec64_to_ns(&inode->i_ctime);
+}
+
+static int assoofs_upgrade_inode_store(struct super_block *sb)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_super_block_info *assoofs_sb = ASSOOFS_SB(sb)->asb;
+    struct assoofs_inode_info *inode_info;
+    struct buffer_head *bh;
+    struct buffer_head *dir_bh;
+    char *old;
+    int64_t now;
+    uint64_t count;
+    uint64_t i;
+    size_t old_size;
+    int ret;
+
+    printk(KERN_INFO "assoofs_upgrade_inode_store: request\n");
+
+    // 1. Leemos el almacén de inodos y guardamos una copia de los inodos antiguos
+    // Con el tamaño actual caben como mucho ASSOOFS_MAX_INODES: más inodos ocuparían la cola con la suma de comprobación
+    if (assoofs_sb->inodes_count > ASSOOFS_MAX_INODES)
+    {
+        printk(KERN_ERR "assoofs_upgrade_inode_store: %llu inodes do not fit in the format version %d inode store (at most %d)\n",
+               assoofs_sb->inodes_count, ASSOOFS_VERSION, ASSOOFS_MAX_INODES);
+        return -EFBIG;
+    }
+    bh = assoofs_bread(sb, ASSOOFS_INODESTORE_BLOCK_NUMBER);
+    if (!bh)
+        return -EIO;
+    // Desde la versión 3 el tamaño de los inodos no ha cambiado
+    if (assoofs_sb->version == 1)
+        old_size = ASSOOFS_INODE_SIZE_V1;
+    else if (assoofs_sb->version == 2)
+        old_size = ASSOOFS_INODE_SIZE_V2;
+    else
+        old_size = sizeof(struct assoofs_inode_info);
+    count = assoofs_sb->inodes_count;
+    old = kmemdup(bh->b_data, bh->b_size, GFP_KERNEL);
+    if (!old)
+    {
+        brelse(bh);
+        return -ENOMEM;
+    }
+
+    // 2. Reescribimos cada inodo con el tamaño actual: los campos antiguos son el principio del inodo nuevo
+    memset(bh->b_data, 0, bh->b_size);
+    now = ktime_get_real_ns();
+    inode_info = (struct assoofs_inode_info *)bh->b_data;
+    for (i = 0; i < count; i++, inode_info++)
+    {
+        memcpy(inode_info, old + i * old_size, old_size);
+        // La versión 1 no tiene flags: el hueco de alineación tras mode no se inicializaba y puede contener
+        // cualquier valor, que se tomaría por un fichero comprimido o huérfano
+        if (assoofs_sb->version == 1)
+        {
+            inode_info->atime = inode_info->mtime = inode_info->ctime = now;
+            inode_info->flags = 0;
+        }
+    }
+
+    // 3. Calculamos el uso recursivo de los directorios (a partir de ahora se mantiene en cada cambio)
+    ret = assoofs_usage_compute(sb, (struct assoofs_inode_info *)bh->b_data, count);
+    if (ret)
+    {
+        // Restauramos el bloque en memoria: el dispositivo sigue en la versión antigua
+        memcpy(bh->b_data, old, bh->b_size);
+        kfree(old);
+        brelse(bh);
+        return ret;
+    }
+
+    // 4. Escribimos la suma de comprobación de cada bloque de directorio (la cola no la utilizaba ninguna versión)
+    inode_info = (struct assoofs_inode_info *)bh->b_data;
+    for (i = 0; i < count; i++, inode_info++)
+    {
+        if (!S_ISDIR(inode_info->mode))
+            continue;
+        dir_bh = assoofs_bread(sb, inode_info->data_block_number);
+        if (!dir_bh)
+        {
+            memcpy(bh->b_data, old, bh->b_size);
+            kfree(old);
+            brelse(bh);
+            return -EIO;
+        }
+        assoofs_mark_meta_dirty(dir_bh);
+        sync_dirty_buffer(dir_bh);
+        brelse(dir_bh);
+    }
+    kfree(old);
+
+    // 5. Guardamos el almacén de inodos y después la nueva versión en el superbloque (ambos con su suma de comprobación)
+    assoofs_mark_meta_dirty(bh);
+    sync_dirty_buffer(bh);
+    brelse(bh);
+
+    assoofs_sb_lock(sb);
+    assoofs_sb->version = ASSOOFS_VERSION;
+    assoofs_sb_unlock(sb);
+    assoofs_save_sb_info(sb);
+
+    printk(KERN_INFO "assoofs: %s upgraded to format version %d (%llu inodes)\n", sb->s_id, ASSOOFS_VERSION, count);
+    return 0;
+}
+
+static int assoofs_usage_compute(struct super_block *sb, struct assoofs_inode_info *inodes, uint64_t count)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_dir_record_entry *record;
+    struct buffer_head *bh;
+    int parent[ASSOOFS_MAX_BLOCKS];
+    uint64_t children;
+    uint64_t i;
+    uint64_t j;
+    uint64_t k;
+    int pos;
+
+    printk(KERN_INFO "assoofs_usage_compute: request\n");
+
+    // 1. Vaciamos el uso de todos los inodos; parent guarda la posición del padre de cada inodo (-1 si no tiene)
+    count = min_t(uint64_t, count, ASSOOFS_MAX_BLOCKS);
+    for (i = 0; i < count; i++)
+    {
+        parent[i] = -1;
+        inodes[i].tree_inodes = 0;
+        inodes[i].tree_size = 0;
+    }
+
+    // 2. Leemos cada directorio para saber cuál es el padre de cada uno de sus hijos
+    for (i = 0; i < count; i++)
+    {
+        if (!S_ISDIR(inodes[i].mode))
+            continue;
+        bh = assoofs_bread(sb, inodes[i].data_block_number);
+        if (!bh)
+        {
+            printk(KERN_ERR "assoofs_usage_compute: Reading the block number [%llu] failed\n", inodes[i].data_block_number);
+            return -EIO;
+        }
+        record = (struct assoofs_dir_record_entry *)bh->b_data;
+        children = min_t(uint64_t, inodes[i].dir_children_count, ASSOOFS_DIR_ENTRIES_PER_BLOCK);
+        for (j = 0; j < children; j++, record++)
+            for (k = 0; k < count; k++)
+                if (inodes[k].inode_no == record->inode_no)
+                    parent[k] = i;
+        brelse(bh);
+    }
+
+    // 3. Cada inodo se suma a sí mismo (si es un directorio) y a todos sus antecesores
+    // El número de saltos se acota por count para no entrar en un ciclo si el árbol estuviera dañado
+    for (i = 0; i < count; i++)
+    {
+        if (S_ISDIR(inodes[i].mode))
+            inodes[i].tree_inodes++;
+        for (pos = parent[i], j = 0; pos >= 0 && j < count; pos = parent[pos], j++)
+        {
+            inodes[pos].tree_inodes++;
+            if (S_ISREG(inodes[i].mode))
+                inodes[pos].tree_size += inodes[i].file_size;
+        }
+    }
+
+    return 0;
+}
+
+static int assoofs_orphan_recover(struct super_block *sb)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_super_block_info *assoofs_sb = ASSOOFS_SB(sb)->asb;
+    struct assoofs_inode_info *inodes;
+    struct buffer_head *bh;
+    uint64_t orphans[ASSOOFS_MAX_BLOCKS];
+    uint64_t norphans = 0;
+    uint64_t max_no = ASSOOFS_ROOTDIR_INODE_NUMBER;
+    uint64_t count;
+    uint64_t i;
+    int dirty = 0;
+
+    printk(KERN_INFO "assoofs_orphan_recover: request\n");
+
+    bh = assoofs_meta_bread(sb, ASSOOFS_INODESTORE_BLOCK_NUMBER);
+    if (!bh)
+    {
+        printk(KERN_ERR "assoofs_orphan_recover: Reading the inode store failed\n");
+        return -EIO;
+    }
+    inodes = (struct assoofs_inode_info *)bh->b_data;
+    count = min_t(uint64_t, assoofs_sb->inodes_count, ASSOOFS_MAX_FILESYSTEM_OBJECTS_SUPPORTED);
+
+    // 1. Una liberación interrumpida entre la escritura del almacén y la del superbloque deja una entrada vacía al final
+    while (count > 0 && inodes[count - 1].inode_no == 0)
+        count--;
+    if (count != assoofs_sb->inodes_count)
+    {
+        assoofs_sb_lock(sb);
+        assoofs_sb->inodes_count = count;
+        assoofs_sb_unlock(sb);
+        dirty = 1;
+    }
+
+    // 2. Anotamos los huérfanos y el mayor número de inodo en uso
+    for (i = 0; i < count; i++)
+    {
+        if (inodes[i].flags & ASSOOFS_INODE_ORPHAN)
+            orphans[norphans++] = inodes[i].inode_no;
+        max_no = max_t(uint64_t, max_no, inodes[i].inode_no);
+    }
+    brelse(bh);
+
+    // 3. Los números nuevos deben ser mayores que todos los existentes (las imágenes antiguas no guardan el contador)
+    if (assoofs_sb->next_inode_no <= max_no)
+    {
+        assoofs_sb_lock(sb);
+        assoofs_sb->next_inode_no = max_no + 1;
+        assoofs_sb_unlock(sb);
+        dirty = 1;
+    }
+    if (dirty)
+        assoofs_save_sb_info(sb);
+
+    // 4. Los huérfanos ya no están abiertos por nadie: se liberan ahora
+    for (i = 0; i < norphans; i++)
+        assoofs_reclaim_inode(sb, orphans[i]);
+    if (norphans > 0)
+        printk(KERN_INFO "assoofs: %s: released %llu orphan inodes\n", sb->s_id, norphans);
+
+    return 0;
+}
+
+static void assoofs_usage_add(struct dentry *dentry, int64_t bytes, int32_t inodes)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(dentry->d_sb);
+    struct assoofs_inode_info *inode_info;
+    struct dentry *parent;
+    struct dentry *next;
+    struct inode *dir;
+
+    if (bytes == 0 && inodes == 0)
+        return;
+
+    // Recorremos los antecesores hasta la raíz: assoofs no admite renombrar, por lo que d_parent no cambia
+    // mientras el dentry exista, y sus inodos están en memoria porque los dentry los retienen
+    parent = dget_parent(dentry);
+    for (;;)
+    {
+        dir = d_inode(parent);
+        inode_info = dir->i_private;
+
+        spin_lock(&sbi->usage_lock);
+        inode_info->tree_size += bytes;
+        inode_info->tree_inodes += inodes;
+        spin_unlock(&sbi->usage_lock);
+
+        // El directorio se guarda más tarde, junto con el resto de cambios pendientes (assoofs_write_inode)
+        mark_inode_dirty(dir);
+
+        if (IS_ROOT(parent))
+            break;
+        next = dget_parent(parent);
+        dput(parent);
+        parent = next;
+    }
+    dput(parent);
+}
+
+static int assoofs_mem_load(struct super_block *sb, uint64_t first, uint64_t last)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(sb);
+    uint64_t i;
+
+    printk(KERN_INFO "assoofs_mem_load: request\n");
+
+    // Pedimos primero todas las lecturas sin esperar: así se leen a la vez de todos los dispositivos
+    for (i = first; i < last && i < ASSOOFS_MAX_BLOCKS; i++)
+        if (!sbi->mem_bh[i])
+            assoofs_breadahead(sb, i);
+
+    for (i = first; i < last && i < ASSOOFS_MAX_BLOCKS; i++)
+    {
+        if (sbi->mem_bh[i])
+            continue;
+        sbi->mem_bh[i] = assoofs_bread(sb, i);
+        if (!sbi->mem_bh[i])
+        {
+            printk(KERN_ERR "assoofs_mem_load: Reading the block number [%llu] failed\n", i);
+            return -EIO;
+        }
+    }
+
+    return 0;
+}
+
+int assoofs_sb_get_a_freeblock(struct super_block *sb, uint64_t *block)
+{
+    // Declaración de variables (ISO C90)
+    uint64_t start = ktime_get_ns();
+    int ret;
+
+    printk(KERN_INFO "assoofs_sb_get_a_freeblock: request\n");
+
+    // Empezamos por el bloque 2 porque el bloque 0 es el superbloque y el bloque 1 es el almacén de inodos)
+    ret = assoofs_sb_get_a_freeblock_from(sb, 2, block);
+    if (ret == 0)
+        assoofs_op_account(sb, ASSOOFS_OP_ALLOC_BLOCK, start);
+
+    return ret;
+}
+
+static int assoofs_sb_get_a_freeblock_from(struct super_block *sb, uint64_t goal, uint64_t *block)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_super_block_info *assoofs_sb;
+    int ret;
+
+    // Asignamos la información persistente del superbloque a una variable
+    assoofs_sb = ASSOOFS_SB(sb)->asb;
+
+    mutex_lock(&ASSOOFS_SB(sb)->bitmap_lock);
+
+    // Buscamos el primer bloque libre (bit a 1) desde goal y lo marcamos como ocupado (bit a 0) y sin compartir
+    assoofs_sb_lock(sb);
+    ret = assoofs_core_alloc_block(assoofs_sb, goal, block);
+    assoofs_sb_unlock(sb);
+    if (ret)
+    {
+        mutex_unlock(&ASSOOFS_SB(sb)->bitmap_lock);
+        printk(KERN_ERR "assoofs_sb_get_a_freeblock: No more free blocks available\n");
+        return -1;
+    }
+
+    // Guardamos la información persistente del superbloque
+    assoofs_save_sb_info(sb);
+
+    mutex_unlock(&ASSOOFS_SB(sb)->bitmap_lock);
+
+    // Devolvemos 0 para indicar que todo ha ido bien
+    return 0;
+}
+
+static int assoofs_sb_get_free_blocks(struct super_block *sb, uint64_t *blocks, unsigned int count)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_super_block_info *assoofs_sb;
+    int ret;
+
+    assoofs_sb = ASSOOFS_SB(sb)->asb;
+
+    mutex_lock(&ASSOOFS_SB(sb)->bitmap_lock);
+
+    // Recorremos el mapa de bits una sola vez y reservamos los primeros count bloques libres (todos o ninguno)
+    assoofs_sb_lock(sb);
+    ret = assoofs_core_alloc_blocks(assoofs_sb, blocks, count);
+    assoofs_sb_unlock(sb);
+    if (ret)
+    {
+        mutex_unlock(&ASSOOFS_SB(sb)->bitmap_lock);
+        printk(KERN_ERR "assoofs_sb_get_free_blocks: Fewer than %u free blocks available\n", count);
+        return -ENOSPC;
+    }
+
+    // Guardamos el superbloque una sola vez
+    assoofs_save_sb_info(sb);
+
+    mutex_unlock(&ASSOOFS_SB(sb)->bitmap_lock);
+
+    return 0;
+}
+
+static uint64_t assoofs_sb_get_inode_numbers(struct super_block *sb, unsigned int count)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(sb);
+    uint64_t first;
+
+    mutex_lock(&sbi->istore_lock);
+    assoofs_sb_lock(sb);
+    first = sbi->asb->next_inode_no;
+    sbi->asb->next_inode_no += count;
+    assoofs_sb_unlock(sb);
+    mutex_unlock(&sbi->istore_lock);
+
+    return first;
+}
+
+static void assoofs_sb_put_inode_numbers(struct super_block *sb, uint64_t first, unsigned int count)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(sb);
+
+    mutex_lock(&sbi->istore_lock);
+    assoofs_sb_lock(sb);
+    if (sbi->asb->next_inode_no == first + count)
+        sbi->asb->next_inode_no = first;
+    assoofs_sb_unlock(sb);
+    mutex_unlock(&sbi->istore_lock);
+}
+
+static int assoofs_sb_get_block_ref(struct super_block *sb, uint64_t block)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_super_block_info *assoofs_sb;
+    int ret = 0;
+
+    printk(KERN_INFO "assoofs_sb_get_block_ref: request\n");
+
+    assoofs_sb = ASSOOFS_SB(sb)->asb;
+
+    mutex_lock(&ASSOOFS_SB(sb)->bitmap_lock);
+
+    // El contador de referencias es de 8 bits: no se puede compartir un bloque más de 256 veces
+    assoofs_sb_lock(sb);
+    ret = assoofs_core_get_block_ref(assoofs_sb, block);
+    assoofs_sb_unlock(sb);
+    if (ret)
+        printk(KERN_ERR "assoofs_sb_get_block_ref: Block [%llu] has too many references\n", block);
+    else
+        assoofs_save_sb_info(sb);
+
+    mutex_unlock(&ASSOOFS_SB(sb)->bitmap_lock);
+
+    return ret;
+}
+
+static void assoofs_sb_put_block(struct super_block *sb, uint64_t block)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_super_block_info *assoofs_sb;
+    int freed;
+
+    printk(KERN_INFO "assoofs_sb_put_block: request\n");
+
+    assoofs_sb = ASSOOFS_SB(sb)->asb;
+
+    mutex_lock(&ASSOOFS_SB(sb)->bitmap_lock);
+
+    // Si el bloque está compartido basta con soltar una referencia; si no, se marca como libre (bit a 1)
+    // y, con la opción discard, se descarta más tarde junto con los que se liberen entretanto
+    assoofs_sb_lock(sb);
+    freed = assoofs_core_put_block(assoofs_sb, block);
+    assoofs_sb_unlock(sb);
+    if (freed && (ASSOOFS_SB(sb)->mount_opt & ASSOOFS_MOUNT_DISCARD))
+    {
+        ASSOOFS_SB(sb)->discard_pending |= (1ULL << block);
+        schedule_delayed_work(&ASSOOFS_SB(sb)->discard_work, ASSOOFS_DISCARD_DELAY);
+    }
+
+    // Guardamos la información persistente del superbloque
+    assoofs_save_sb_info(sb);
+
+    mutex_unlock(&ASSOOFS_SB(sb)->bitmap_lock);
+}
+
+static uint64_t assoofs_sb_nr_blocks(struct super_block *sb)
+{
+    return ASSOOFS_SB(sb)->asb->blocks_count;
+}
+
+static uint64_t assoofs_bdev_nr_blocks(struct super_block *sb)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(sb);
+    uint64_t nr[ASSOOFS_MAX_DEVICES];
+    unsigned int i;
+
+    if (!sbi || sbi->ndevs <= 1)
+    {
+        nr[0] = bdev_nr_bytes(sb->s_bdev) >> sb->s_blocksize_bits;
+        return assoofs_core_layout_blocks(nr, 1);
+    }
+
+    for (i = 0; i < sbi->ndevs; i++)
+        nr[i] = bdev_nr_bytes(sbi->devs[i]) >> sb->s_blocksize_bits;
+
+    return assoofs_core_layout_blocks(nr, sbi->ndevs);
+}
+
+static int assoofs_discard_free_runs(struct super_block *sb, uint64_t mask, uint64_t first, uint64_t last, uint64_t minlen, uint64_t *trimmed)
+{
+    // Declaración de variables (ISO C90)
+    uint64_t candidates;
+    uint64_t start;
+    uint64_t i;
+    int ret;
+
+    // Solo se descartan los bloques candidatos que siguen libres
+    candidates = mask & ASSOOFS_SB(sb)->asb->free_blocks;
+    *trimmed = 0;
+
+    // Recorremos el rango agrupando los bloques candidatos consecutivos
+    i = first;
+    while (i < last)
+    {
+        // Buscamos el comienzo del siguiente rango de bloques candidatos
+        if (!(candidates & (1ULL << i)))
+        {
+            i++;
+            continue;
+        }
+
+        // Buscamos el final del rango
+        start = i;
+        while (i < last && (candidates & (1ULL << i)))
+            i++;
+
+        // Descartamos el rango si alcanza la longitud mínima
+        if (i - start >= minlen)
+        {
+            ret = assoofs_issue_discard(sb, start, i - start);
+            if (ret != 0)
+            {
+                printk(KERN_ERR "assoofs_discard_free_runs: Discarding blocks [%llu, %llu) failed\n", start, i);
+                return ret;
+            }
+            *trimmed += i - start;
+        }
+    }
+
+    return 0;
+}
+
+static void assoofs_discard_worker(struct work_struct *work)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi;
+    struct super_block *sb;
+    uint64_t trimmed;
+
+    sbi = container_of(to_delayed_work(work), struct assoofs_sb_info, discard_work);
+    sb = sbi->sb;
+
+    printk(KERN_INFO "assoofs_discard_worker: request\n");
+
+    // Congelado: los bloques siguen pendientes hasta que assoofs_unfreeze_fs vuelva a programar el trabajo
+    if (READ_ONCE(sbi->frozen))
+        return;
+
+    // Descartamos de una vez todos los bloques liberados desde la última ejecución
+    mutex_lock(&sbi->bitmap_lock);
+    assoofs_discard_free_runs(sb, sbi->discard_pending, 0, assoofs_sb_nr_blocks(sb), 1, &trimmed);
+    sbi->discard_pending = 0;
+    mutex_unlock(&sbi->bitmap_lock);
+}
+
+static void assoofs_readahead_worker(struct work_struct *work)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = container_of(work, struct assoofs_sb_info, readahead_work);
+    struct super_block *sb = sbi->sb;
+    struct assoofs_inode_info *inode_info;
+    struct buffer_head *bh;
+    uint64_t i;
+
+    printk(KERN_INFO "assoofs_readahead_worker: request\n");
+
+    // 1. Leemos el almacén de inodos (normalmente ya está en la caché, lo ha leído el montaje)
+    bh = assoofs_meta_bread(sb, ASSOOFS_INODESTORE_BLOCK_NUMBER);
+    if (!bh)
+        return;
+
+    // 2. Pedimos la lectura de los bloques de los directorios sin esperar a que termine
+    // Es solo una sugerencia: si otro proceso crea o traslada un directorio a la vez, como mucho se lee un bloque de más
+    inode_info = (struct assoofs_inode_info *)bh->b_data;
+    for (i = 0; i < sbi->asb->inodes_count && i < ASSOOFS_MAX_FILESYSTEM_OBJECTS_SUPPORTED; i++, inode_info++)
+        if (S_ISDIR(inode_info->mode) && inode_info->data_block_number < assoofs_sb_nr_blocks(sb))
+            assoofs_breadahead(sb, inode_info->data_block_number);
+
+    brelse(bh);
+}
+
+static void assoofs_reclaim_inode(struct super_block *sb, uint64_t inode_no)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(sb);
+    struct assoofs_inode_info *inodes;
+    struct assoofs_inode_info *inode_info;
+    struct buffer_head *bh;
+    uint64_t block;
+    uint64_t count;
+
+    printk(KERN_INFO "assoofs_reclaim_inode: request\n");
+
+    mutex_lock(&sbi->istore_lock);
+
+    // 1. Buscamos el inodo en el almacén de inodos
+    bh = assoofs_meta_bread(sb, ASSOOFS_INODESTORE_BLOCK_NUMBER);
+    if (!bh)
+    {
+        // Sigue marcado como huérfano: se liberará al volver a montar
+        mutex_unlock(&sbi->istore_lock);
+        printk(KERN_ERR "assoofs_reclaim_inode: Reading the inode store failed\n");
+        return;
+    }
+    inodes = (struct assoofs_inode_info *)bh->b_data;
+    count = min_t(uint64_t, sbi->asb->inodes_count, ASSOOFS_MAX_FILESYSTEM_OBJECTS_SUPPORTED);
+    inode_info = assoofs_core_inode_find(inodes, count, inode_no);
+    if (!inode_info || !(inode_info->flags & ASSOOFS_INODE_ORPHAN))
+    {
+        brelse(bh);
+        mutex_unlock(&sbi->istore_lock);
+        return;
+    }
+    block = inode_info->data_block_number;
+
+    // 2. Quitamos el inodo del almacén: la última entrada ocupa su hueco para que sigan siendo contiguas
+    assoofs_core_inode_remove(inodes, count, inode_info);
+    assoofs_mark_meta_dirty(bh);
+    assoofs_sync_dirty_buffer(sb, bh);
+    brelse(bh);
+
+    // 3. Soltamos su bloque: assoofs_sb_put_block guarda a la vez el nuevo número de inodos y el mapa de bits
+    assoofs_sb_lock(sb);
+    sbi->asb->inodes_count--;
+    assoofs_sb_unlock(sb);
+    assoofs_sb_put_block(sb, block);
+
+    mutex_unlock(&sbi->istore_lock);
+}
+
+static void assoofs_reclaim_worker(struct work_struct *work)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = container_of(work, struct assoofs_sb_info, reclaim_work);
+    uint64_t pending[ASSOOFS_MAX_BLOCKS];
+    unsigned int count;
+    unsigned int i;
+
+    printk(KERN_INFO "assoofs_reclaim_worker: request\n");
+
+    // Congelado: los inodos siguen pendientes hasta que assoofs_unfreeze_fs vuelva a programar el trabajo
+    if (READ_ONCE(sbi->frozen))
+        return;
+
+    // Tomamos los inodos pendientes; los que se añadan mientras tanto vuelven a programar el trabajo
+    spin_lock(&sbi->reclaim_lock);
+    count = sbi->reclaim_count;
+    memcpy(pending, sbi->reclaim_pending, count * sizeof(*pending));
+    sbi->reclaim_count = 0;
+    spin_unlock(&sbi->reclaim_lock);
+
+    for (i = 0; i < count; i++)
+        assoofs_reclaim_inode(sbi->sb, pending[i]);
+}
+
+static void assoofs_prefetch_worker(struct work_struct *work)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = container_of(work, struct assoofs_sb_info, prefetch_work);
+    struct super_block *sb = sbi->sb;
+    uint64_t pending[ASSOOFS_MAX_BLOCKS];
+    struct inode *inodes[ASSOOFS_MAX_BLOCKS];
+    bool loaded[ASSOOFS_MAX_BLOCKS];
+    struct assoofs_inode_info *store;
+    struct buffer_head *bh;
+    struct inode *inode;
+    unsigned int count;
+    unsigned int nnew = 0;
+    unsigned int i;
+    uint64_t stored;
+    uint64_t j;
+
+    printk(KERN_INFO "assoofs_prefetch_worker: request\n");
+
+    // 1. Tomamos los inodos pendientes; los que se añadan mientras tanto vuelven a programar el trabajo
+    spin_lock(&sbi->prefetch_lock);
+    count = sbi->prefetch_count;
+    memcpy(pending, sbi->prefetch_pending, count * sizeof(*pending));
+    sbi->prefetch_count = 0;
+    spin_unlock(&sbi->prefetch_lock);
+
+    // 2. Creamos en la caché de VFS los inodos que aún no están en ella; los que ya estaban se sueltan sin más
+    for (i = 0; i < count; i++)
+    {
+        inode = iget_locked(sb, pending[i]);
+        if (!inode)
+            continue;
+        if (!(inode->i_state & I_NEW))
+        {
+            iput(inode);
+            continue;
+        }
+        loaded[nnew] = false;
+        inodes[nnew++] = inode;
+    }
+    if (!nnew)
+        return;
+
+    // 3. Copiamos la información persistente de todos ellos con una sola lectura del almacén de inodos
+    mutex_lock(&sbi->istore_lock);
+    bh = assoofs_meta_bread(sb, ASSOOFS_INODESTORE_BLOCK_NUMBER);
+    if (bh)
+    {
+        store = (struct assoofs_inode_info *)bh->b_data;
+        stored = min_t(uint64_t, sbi->asb->inodes_count, ASSOOFS_MAX_FILESYSTEM_OBJECTS_SUPPORTED);
+        for (i = 0; i < nnew; i++)
+        {
+            for (j = 0; j < stored && store[j].inode_no != inodes[i]->i_ino; j++)
+                ;
+            // Un inodo borrado entre el listado y ahora (huérfano) ya no está en ningún directorio: no se carga
+            if (j == stored || (store[j].flags & ASSOOFS_INODE_ORPHAN))
+                continue;
+            memcpy(&ASSOOFS_I(inodes[i])->info, &store[j], sizeof(store[j]));
+            loaded[i] = true;
+        }
+        brelse(bh);
+    }
+    mutex_unlock(&sbi->istore_lock);
+
+    // 4. Terminamos de crear los inodos y los dejamos en la caché de VFS
+    // Mientras el montaje está activo, iput mantiene en la caché (en la lista LRU) los inodos que no se han borrado
+    for (i = 0; i < nnew; i++)
+    {
+        if (!loaded[i] || assoofs_inode_setup(inodes[i]))
+        {
+            iget_failed(inodes[i]);
+            continue;
+        }
+        unlock_new_inode(inodes[i]);
+        iput(inodes[i]);
+    }
+}
+
+static void assoofs_scrub_worker(struct work_struct *work)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = container_of(to_delayed_work(work), struct assoofs_sb_info, scrub_work);
+    struct super_block *sb = sbi->sb;
+    uint64_t current_blocks[ASSOOFS_MAX_BLOCKS];
+    struct page *page;
+    unsigned int rate;
+    unsigned int batch;
+    unsigned int count;
+    unsigned int i;
+    uint64_t block;
+    int ret;
+
+    // Congelado, el scrub no podría reparar bloques; assoofs_unfreeze_fs lo vuelve a programar
+    rate = READ_ONCE(sbi->scrub_rate);
+    if (rate == 0 || READ_ONCE(sbi->frozen))
+        return;
+    // Cada ejecución relee rate / HZ bloques (al menos uno) y espera después lo que corresponde a ese ritmo
+    batch = max_t(unsigned int, rate / HZ, 1);
+
+    page = alloc_page(GFP_KERNEL);
+    if (!page)
+        goto out_requeue;
+
+    while (batch-- > 0)
+    {
+        // 1. Al comienzo de cada pasada anotamos los bloques de metadatos actuales
+        if (sbi->scrub_pos >= sbi->scrub_count)
+        {
+            mutex_lock(&sbi->istore_lock);
+            sbi->scrub_count = assoofs_scrub_list(sb, sbi->scrub_blocks);
+            mutex_unlock(&sbi->istore_lock);
+            sbi->scrub_pos = 0;
+        }
+        block = sbi->scrub_blocks[sbi->scrub_pos++];
+
+        // 2. Releemos el bloque del disco y comprobamos su suma
+        ret = assoofs_scrub_block(sb, block, page);
+
+        // 3. Si no coincide, el directorio puede haberse borrado o trasladado desde que se anotó: con istore_lock
+        // tomado ningún bloque de metadatos se libera, así que comprobamos que lo siga siendo y lo releemos
+        if (ret == -EBADMSG)
+        {
+            mutex_lock(&sbi->istore_lock);
+            count = assoofs_scrub_list(sb, current_blocks);
+            for (i = 0; i < count && current_blocks[i] != block; i++)
+                ;
+            ret = i < count ? assoofs_scrub_block(sb, block, page) : 0;
+            mutex_unlock(&sbi->istore_lock);
+        }
+        if (ret == -EBADMSG)
+        {
+            sbi->scrub_errors++;
+            printk(KERN_ERR "assoofs: %s: scrub found a checksum mismatch in metadata block %llu\n", sb->s_id, block);
+            if (assoofs_scrub_repair(sb, block) == 0)
+            {
+                sbi->scrub_repaired++;
+                printk(KERN_INFO "assoofs: %s: metadata block %llu rewritten from its cached copy\n", sb->s_id, block);
+            }
+        }
+        else if (ret)
+            printk(KERN_ERR "assoofs: %s: scrub could not read block %llu (%d)\n", sb->s_id, block, ret);
+
+        if (sbi->scrub_pos == sbi->scrub_count)
+            sbi->scrub_passes++;
+    }
+    __free_page(page);
+
+out_requeue:
+    batch = max_t(unsigned int, rate / HZ, 1);
+    schedule_delayed_work(&sbi->scrub_work, max_t(unsigned long, HZ * batch / rate, 1));
+}
+
+static unsigned int assoofs_scrub_list(struct super_block *sb, uint64_t *blocks)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(sb);
+    struct assoofs_inode_info *inode_info;
+    struct buffer_head *bh;
+    unsigned int count = 0;
+    uint64_t i;
+
+    blocks[count++] = ASSOOFS_SUPERBLOCK_BLOCK_NUMBER;
+    blocks[count++] = ASSOOFS_INODESTORE_BLOCK_NUMBER;
+
+    // Si el almacén de inodos no se puede leer, la pasada se limita a él y al superbloque
+    bh = assoofs_meta_bread(sb, ASSOOFS_INODESTORE_BLOCK_NUMBER);
+    if (!bh)
+        return count;
+    inode_info = (struct assoofs_inode_info *)bh->b_data;
+    for (i = 0; i < sbi->asb->inodes_count && i < ASSOOFS_MAX_FILESYSTEM_OBJECTS_SUPPORTED && count < ASSOOFS_MAX_BLOCKS; i++, inode_info++)
+        if (S_ISDIR(inode_info->mode) && inode_info->data_block_number < assoofs_sb_nr_blocks(sb))
+            blocks[count++] = inode_info->data_block_number;
+    brelse(bh);
+
+    return count;
+}
+
+static int assoofs_scrub_block(struct super_block *sb, uint64_t block, struct page *page)
+{
+    // Declaración de variables (ISO C90)
+    struct block_device *bdev;
+    struct buffer_head *bh;
+    struct bio *bio;
+    sector_t local;
+    int ret;
+
+    // 1. Si el bloque está en la caché con cambios sin escribir, el disco aún no está al día: se omite en esta pasada
+    // Mientras se lee del disco el buffer permanece bloqueado, para que no se escriba a la vez
+    bh = assoofs_find_get_block(sb, block);
+    if (bh)
+    {
+        lock_buffer(bh);
+        if (buffer_dirty(bh))
+        {
+            unlock_buffer(bh);
+            brelse(bh);
+            return 0;
+        }
+    }
+
+    // 2. Leemos el bloque en la página del scrub con una bio propia: sb_bread devolvería la copia de la caché
+    bdev = assoofs_block_map(sb, block, &local);
+    bio = bio_alloc(bdev, 1, REQ_OP_READ, GFP_KERNEL);
+    bio->bi_iter.bi_sector = local << (sb->s_blocksize_bits - SECTOR_SHIFT);
+    __bio_add_page(bio, page, sb->s_blocksize, 0);
+    ret = submit_bio_wait(bio);
+    bio_put(bio);
+
+    if (bh)
+    {
+        unlock_buffer(bh);
+        brelse(bh);
+    }
+    if (ret)
+        return ret;
+
+    // 3. Comprobamos la suma de comprobación de la copia del disco
+    return assoofs_meta_verify(page_address(page));
+}
+
+static int assoofs_scrub_repair(struct super_block *sb, uint64_t block)
+{
+    // Declaración de variables (ISO C90)
+    struct buffer_head *bh;
+    int ret;
+
+    if (sb_rdonly(sb))
+        return -EROFS;
+
+    // Solo se puede reparar si la caché conserva una copia del bloque y su suma es correcta
+    bh = assoofs_find_get_block(sb, block);
+    if (!bh)
+        return -ENOENT;
+    if (!buffer_uptodate(bh) || assoofs_meta_verify(bh->b_data))
+    {
+        brelse(bh);
+        return -EIO;
+    }
+
+    mark_buffer_dirty(bh);
+    ret = sync_dirty_buffer(bh);
+    brelse(bh);
+
+    return ret;
+}
+
+static int assoofs_copy_block(struct super_block *sb, uint64_t from, uint64_t to)
+{
+    // Declaración de variables (ISO C90)
+    struct buffer_head *from_bh;
+    struct buffer_head *to_bh;
+
+    from_bh = assoofs_bread(sb, from);
+    to_bh = assoofs_bread(sb, to);
+    if (!from_bh || !to_bh)
+    {
+        printk(KERN_ERR "assoofs_copy_block: Reading blocks [%llu] and [%llu] failed\n", from, to);
+        brelse(from_bh);
+        brelse(to_bh);
+        return -EIO;
+    }
+
+    memcpy(to_bh->b_data, from_bh->b_data, to_bh->b_size);
+    mark_buffer_dirty(to_bh);
+    assoofs_sync_dirty_buffer(sb, to_bh);
+
+    brelse(to_bh);
+    brelse(from_bh);
+
+    return 0;
+}
+
+static int assoofs_unshare_block(struct super_block *sb, struct assoofs_inode_info *inode_info)
+{
+    // Declaración de variables (ISO C90)
+    uint64_t old_block;
+    uint64_t new_block;
+
+    // Si el bloque no está compartido no hay nada que copiar
+    old_block = inode_info->data_block_number;
+    if (READ_ONCE(ASSOOFS_SB(sb)->asb->block_shared_refs[old_block]) == 0)
+        return 0;
+
+    printk(KERN_INFO "assoofs_unshare_block: request\n");
+
+    // 1. Obtenemos un bloque libre para la copia privada del fichero
+    if (assoofs_sb_get_a_freeblock(sb, &new_block) != 0)
+        return -ENOSPC;
+
+    // 2. Copiamos el contenido del bloque compartido en el nuevo bloque
+    if (assoofs_copy_block(sb, old_block, new_block) != 0)
+    {
+        assoofs_sb_put_block(sb, new_block);
+        return -EIO;
+    }
+
+    // 3. El fichero pasa a apuntar a su copia y suelta la referencia sobre el bloque compartido
+    inode_info->data_block_number = new_block;
+    if (assoofs_save_inode_info(sb, inode_info) != 0)
+        return -EIO;
+    assoofs_sb_put_block(sb, old_block);
+
+    return 0;
+}
+
+int assoofs_add_inode_info(struct super_block *sb, struct assoofs_inode_info *inode)
+{
+    // Declaración de variables (ISO C90)
+    uint64_t start = ktime_get_ns();
+    int ret;
+
+    printk(KERN_INFO "assoofs_add_inode_info: request\n");
+
+    ret = assoofs_add_inode_infos(sb, inode, 1);
+    if (ret == 0)
+        assoofs_op_account(sb, ASSOOFS_OP_ADD_INODE_INFO, start);
+    return ret;
+}
+
+static int assoofs_add_inode_infos(struct super_block *sb, struct assoofs_inode_info *inodes, unsigned int count)
+{
+    // Declaración de variables (ISO C90)
+    struct buffer_head *bh;
+    struct assoofs_super_block_info *assoofs_sb;
+    struct assoofs_inode_info *inode_info;
+
+    // Asignamos la información persistente del superbloque a una variable
+    assoofs_sb = ASSOOFS_SB(sb)->asb;
+
+    mutex_lock(&ASSOOFS_SB(sb)->istore_lock);
+
+    // Los llamantes comprueban el límite de inodos sin istore_lock: otra creación concurrente (en otro directorio)
+    // puede haber ocupado el sitio, así que se vuelve a comprobar aquí antes de escribir en el almacén
+    if (assoofs_sb->inodes_count + count > assoofs_core_max_inodes(assoofs_sb))
+    {
+        mutex_unlock(&ASSOOFS_SB(sb)->istore_lock);
+        printk(KERN_ERR "assoofs_add_inode_infos: Maximum number of objects supported reached\n");
+        return -ENOSPC;
+    }
+
+    // assoofs_meta_bread (sb_bread y comprobación de la suma crc32c) se utiliza aquí para leer el bloque que contiene el almacén de inodos (el bloque 1)
+    bh = assoofs_meta_bread(sb, ASSOOFS_INODESTORE_BLOCK_NUMBER);
+    if (!bh)
+    {
+        mutex_unlock(&ASSOOFS_SB(sb)->istore_lock);
+        printk(KERN_ERR "assoofs_add_inode_infos: Reading the inode store failed\n");
+        return -EIO;
+    }
+
+    // Obtenemos un puntero al primer inodo del almacén de inodos
+    inode_info = (struct assoofs_inode_info *)bh->b_data;
+    // Movemos el puntero al final del almacén de inodos para añadir los nuevos inodos
+    inode_info += assoofs_sb->inodes_count;
+    // Copiamos la información persistente de los inodos en el almacén de inodos
+    memcpy(inode_info, inodes, count * sizeof(struct assoofs_inode_info));
+
+    // Actualizamos la suma de comprobación y marcamos el buffer como modificado
+    assoofs_mark_meta_dirty(bh);
+
+    // Sinconizamos el buffer con el disco para reflejar los cambios (una sola escritura para todos los inodos)
+    assoofs_sync_dirty_buffer(sb, bh);
+
+    // Actualizamos el contador de inodos del superbloque
+    assoofs_sb_lock(sb);
+    assoofs_sb->inodes_count += count;
+    assoofs_sb_unlock(sb);
+
+    // Guardamos la información persistente del superbloque (también next_inode_no)
+    assoofs_save_sb_info(sb);
+
+    // Liberamos el buffer con brelse
+    brelse(bh);
+    mutex_unlock(&ASSOOFS_SB(sb)->istore_lock);
+
+    return 0;
+}
+
+static int assoofs_write_buffers(struct super_block *sb, struct buffer_head **bhs, unsigned int count)
+{
+    // Declaración de variables (ISO C90)
+    unsigned int i;
+    int ret = 0;
+
+    // Con la opción mem los buffers se quedan modificados en memoria, igual que en assoofs_sync_dirty_buffer
+    if (ASSOOFS_SB(sb)->mount_opt & ASSOOFS_MOUNT_MEM)
+        return 0;
+
+    // 1. Enviamos todas las escrituras sin esperar a que terminen
+    for (i = 0; i < count; i++)
+        write_dirty_buffer(bhs[i], REQ_SYNC);
+
+    // 2. Esperamos a que terminen todas y comprobamos el resultado
+    for (i = 0; i < count; i++)
+    {
+        wait_on_buffer(bhs[i]);
+        if (!buffer_uptodate(bhs[i]))
+            ret = -EIO;
+    }
+
+    return ret;
+}
+
+struct assoofs_inode_info *assoofs_search_inode_info(struct super_block *sb, struct assoofs_inode_info *start, struct assoofs_inode_info *search)
+{
+    // Declaración de variables (ISO C90)
+    uint64_t count = 0;
+
+    printk(KERN_INFO "assoofs_search_inode_info: request\n");
+
+    // Recorremos el almacén de inodos desde el inicio hasta encontrar el inodo buscado o hasta llegar al final
+    while (start->inode_no != search->inode_no && count < ASSOOFS_SB(sb)->asb->inodes_count)
+    {
+        count++;
+        start++;
+    }
+
+    // Verificamos que el inodo buscado se haya encontrado
+    if (start->inode_no == search->inode_no)
+        return start;
+    else
+        return NULL;
+}
+
+int assoofs_save_inode_info(struct super_block *sb, struct assoofs_inode_info *inode_info)
+{
+    // Declaración de variables (ISO C90)
+    uint64_t start = ktime_get_ns();
+    int ret;
+
+    ret = assoofs_write_inode_info(sb, inode_info);
+    if (ret == 0)
+        assoofs_op_account(sb, ASSOOFS_OP_SAVE_INODE_INFO, start);
+
+    return ret;
+}
+
+static int assoofs_write_inode_info(struct super_block *sb, struct assoofs_inode_info *inode_info)
+{
+    // Declaración de variables (ISO C90)
+    struct buffer_head *bh;
+    struct assoofs_inode_info *inode_pos;
+
+    printk(KERN_INFO "assoofs_save_inode_info: request\n");
+
+    // La posición del inodo en el almacén no debe cambiar hasta que se haya guardado
+    mutex_lock(&ASSOOFS_SB(sb)->istore_lock);
+
+    // assoofs_meta_bread (sb_bread y comprobación de la suma crc32c) se utiliza aquí para leer el bloque que contiene el almacén de inodos (el bloque 1)
+    bh = assoofs_meta_bread(sb, ASSOOFS_INODESTORE_BLOCK_NUMBER);
+    if (!bh)
+    {
+        mutex_unlock(&ASSOOFS_SB(sb)->istore_lock);
+        printk(KERN_ERR "assoofs_save_inode_info: Reading the inode store failed\n");
+        return -1;
+    }
+
+    // Buscamos los datos del inodo en el almacén de inodos
+    inode_pos = assoofs_search_inode_info(sb, (struct assoofs_inode_info *)bh->b_data, inode_info);
+    if (!inode_pos)
+    {
+        brelse(bh);
+        mutex_unlock(&ASSOOFS_SB(sb)->istore_lock);
+        printk(KERN_ERR "assooofs_save_inode_info: Inode not found\n");
+        return -1;
+    }
+
+    // Actualizamos el inodo en el almacén de inodos
+    memcpy(inode_pos, inode_info, sizeof(*inode_pos));
+
+    // Actualizamos la suma de comprobación y marcamos el buffer como modificado
+    assoofs_mark_meta_dirty(bh);
+
+    // Sinconizamos el buffer con el disco para reflejar los cambios
+    assoofs_sync_dirty_buffer(sb, bh);
+
+    // Liberamos el buffer con brelse
+    brelse(bh);
+    mutex_unlock(&ASSOOFS_SB(sb)->istore_lock);
+
+    // Devolvemos 0 para indicar que todo ha ido bien
+    return 0;
+}
+
+static int assoofs_compare_file_blocks(struct super_block *sb, struct assoofs_inode_info *a, struct assoofs_inode_info *b)
+{
+    // Declaración de variables (ISO C90)
+    struct buffer_head *bh_a;
+    struct buffer_head *bh_b;
+    size_t nbytes;
+    int ret;
+
+    printk(KERN_INFO "assoofs_compare_file_blocks: request\n");
+
+    // 1. Ficheros con distinto tamaño o formato no pueden tener el mismo contenido en disco
+    if (a->file_size != b->file_size || (a->flags & ASSOOFS_INODE_COMPRESSED) != (b->flags & ASSOOFS_INODE_COMPRESSED))
+        return -EBADE;
+    if (a->data_block_number == b->data_block_number)
+        return 0;
+
+    // 2. Leemos los bloques de datos de ambos ficheros
+    bh_a = assoofs_bread(sb, a->data_block_number);
+    bh_b = assoofs_bread(sb, b->data_block_number);
+    if (!bh_a || !bh_b)
+    {
+        printk(KERN_ERR "assoofs_compare_file_blocks: Reading blocks [%llu] and [%llu] failed\n", a->data_block_number, b->data_block_number);
+        brelse(bh_a);
+        brelse(bh_b);
+        return -EIO;
+    }
+
+    // 3. Calculamos los bytes significativos del bloque: el contenido del fichero o la cabecera más los datos comprimidos
+    if (a->flags & ASSOOFS_INODE_COMPRESSED)
+        nbytes = min_t(size_t, bh_a->b_size, sizeof(struct assoofs_compressed_header) + ((struct assoofs_compressed_header *)bh_a->b_data)->compressed_size);
+    else
+        nbytes = a->file_size;
+
+    // 4. Comparamos el contenido
+    ret = memcmp(bh_a->b_data, bh_b->b_data, nbytes) == 0 ? 0 : -EBADE;
+
+    brelse(bh_a);
+    brelse(bh_b);
+
+    return ret;
+}
+
+static int assoofs_parse_options(struct assoofs_sb_info *sbi, char *options)
+{
+    // Declaración de variables (ISO C90)
+    char *p;
+    substring_t args[MAX_OPT_ARGS];
+
+    printk(KERN_INFO "assoofs_parse_options: request\n");
+
+    // Si no hay opciones de montaje no hay nada que hacer
+    if (!options)
+        return 0;
+
+    // Recorremos las opciones separadas por comas
+    while ((p = strsep(&options, ",")) != NULL)
+    {
+        // Ignoramos las opciones vacías (por ejemplo, "compress,,")
+        if (!*p)
+            continue;
+
+        switch (match_token(p, assoofs_tokens, args))
+        {
+        case Opt_compress:
+            sbi->mount_opt |= ASSOOFS_MOUNT_COMPRESS;
+            break;
+        case Opt_discard:
+            sbi->mount_opt |= ASSOOFS_MOUNT_DISCARD;
+            break;
+        case Opt_nodiscard:
+            sbi->mount_opt &= ~ASSOOFS_MOUNT_DISCARD;
+            break;
+        case Opt_metacache:
+            sbi->mount_opt |= ASSOOFS_MOUNT_METACACHE;
+            break;
+        case Opt_mem:
+            sbi->mount_opt |= ASSOOFS_MOUNT_MEM;
+            break;
+        case Opt_scrub:
+            if (match_uint(&args[0], &sbi->scrub_rate))
+                return -EINVAL;
+            break;
+        case Opt_devices:
+            kfree(sbi->devs_opt);
+            sbi->devs_opt = match_strdup(&args[0]);
+            if (!sbi->devs_opt)
+                return -ENOMEM;
+            break;
+        default:
+            printk(KERN_ERR "assoofs_parse_options: unknown mount option \"%s\"\n", p);
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+static int assoofs_decompress_block(struct buffer_head *bh, char *dst, size_t size)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_compressed_header *header;
+    int ret;
+
+    // La cabecera está al comienzo del bloque y los datos comprimidos a continuación
+    header = (struct assoofs_compressed_header *)bh->b_data;
+
+    // Comprobamos que el tamaño comprimido no exceda el bloque (bloque corrupto)
+    if (header->compressed_size > bh->b_size - sizeof(*header))
+    {
+        printk(KERN_ERR "assoofs_decompress_block: invalid compressed size (%u)\n", header->compressed_size);
+        return -EIO;
+    }
+
+    // Descomprimimos y comprobamos que se obtiene exactamente el tamaño lógico del fichero
+    ret = LZ4_decompress_safe(bh->b_data + sizeof(*header), dst, header->compressed_size, size);
+    if (ret < 0 || ret != size)
+    {
+        printk(KERN_ERR "assoofs_decompress_block: block number [%llu] is corrupted\n", (unsigned long long)bh->b_blocknr);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+static int assoofs_compressed_write(struct buffer_head *bh, struct assoofs_inode_info *inode_info, struct iov_iter *from, size_t len, loff_t pos)
+{
+    // Declaración de variables (ISO C90)
+    char *data;
+    int ret;
+
+    // 1. Reservamos memoria para el contenido descomprimido
+    // kvzalloc deja a cero los huecos si se escribe más allá del final del fichero
+    data = kvzalloc(ASSOOFS_MAX_COMPRESSED_FILE_SIZE, GFP_KERNEL);
+    if (!data)
+        return -ENOMEM;
+
+    // 2. Descomprimimos el contenido actual del fichero (si lo hay)
+    if (inode_info->file_size > 0)
+    {
+        ret = assoofs_decompress_block(bh, data, inode_info->file_size);
+        if (ret != 0)
+            goto out;
+    }
+
+    // 3. Aplicamos la escritura sobre el contenido descomprimido
+    if (copy_from_iter(data + pos, len, from) != len)
+    {
+        printk(KERN_ERR "assoofs_compressed_write: Error copying file contents from user buffer\n");
+        ret = -EFAULT;
+        goto out;
+    }
+
+    // 4. Comprimimos el nuevo contenido en el bloque de datos
+    // Como en POSIX, el fichero solo cambia de tamaño si la escritura termina más allá de su final
+    ret = assoofs_compress_block(bh, data, max_t(uint64_t, inode_info->file_size, pos + len));
+
+out:
+    kvfree(data);
+    return ret;
+}
+
+static int assoofs_compress_block(struct buffer_head *bh, const char *data, size_t size)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_compressed_header *header;
+    char *compressed;
+    void *wrkmem;
+    int compressed_size;
+    int ret;
+
+    // 1. Reservamos memoria para el contenido comprimido y el espacio de trabajo de LZ4
+    compressed = kvmalloc(bh->b_size, GFP_KERNEL);
+    wrkmem = kvmalloc(LZ4_MEM_COMPRESS, GFP_KERNEL);
+    if (!compressed || !wrkmem)
+    {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    // 2. Comprimimos el contenido en un buffer temporal para no dañar el bloque si no cabe
+    compressed_size = LZ4_compress_default(data, compressed, size, bh->b_size - sizeof(*header), wrkmem);
+    if (compressed_size <= 0)
+    {
+        printk(KERN_ERR "assoofs_compress_block: Compressed data does not fit in a block\n");
+        ret = -ENOSPC;
+        goto out;
+    }
+
+    // 3. Copiamos la cabecera y los datos comprimidos al bloque de datos
+    header = (struct assoofs_compressed_header *)bh->b_data;
+    header->compressed_size = compressed_size;
+    header->reserved = 0;
+    memcpy(bh->b_data + sizeof(*header), compressed, compressed_size);
+    ret = 0;
+
+out:
+    kvfree(wrkmem);
+    kvfree(compressed);
+    return ret;
+}
+
+static int assoofs_truncate(struct dentry *dentry, loff_t size)
+{
+    // Declaración de variables (ISO C90)
+    struct inode *inode = d_inode(dentry);
+    struct super_block *sb = inode->i_sb;
+    struct assoofs_inode_info *inode_info = inode->i_private;
+    struct buffer_head *bh;
+    char *data;
+    size_t max_size;
+    uint64_t old_size;
+    int ret;
+
+    printk(KERN_INFO "assoofs_truncate: request\n");
+
+    // 1. Comprobamos el nuevo tamaño (los ficheros comprimidos pueden superar el tamaño de bloque)
+    if (!S_ISREG(inode_info->mode))
+        return -EISDIR;
+    max_size = (inode_info->flags & ASSOOFS_INODE_COMPRESSED) ? ASSOOFS_MAX_COMPRESSED_FILE_SIZE : ASSOOFS_DEFAULT_BLOCK_SIZE;
+    if (size > max_size)
+        return -EFBIG;
+    old_size = inode_info->file_size;
+
+    // 2. Si el bloque de datos está compartido con otro fichero (reflink), modificamos una copia privada
+    if (assoofs_unshare_block(sb, inode_info) != 0)
+        return -EIO;
+    bh = assoofs_bread(sb, inode_info->data_block_number);
+    if (!bh)
+    {
+        printk(KERN_ERR "assoofs_truncate: Reading the block number [%llu] failed\n", inode_info->data_block_number);
+        return -EIO;
+    }
+
+    // 3. Ajustamos el contenido al nuevo tamaño
+    if (inode_info->flags & ASSOOFS_INODE_COMPRESSED)
+    {
+        // Los ficheros comprimidos se descomprimen y se vuelven a comprimir con el nuevo tamaño
+        // kvzalloc deja a cero lo que quede entre el tamaño antiguo y el nuevo
+        data = kvzalloc(ASSOOFS_MAX_COMPRESSED_FILE_SIZE, GFP_KERNEL);
+        ret = data ? 0 : -ENOMEM;
+        if (!ret && old_size > 0)
+            ret = assoofs_decompress_block(bh, data, old_size);
+        if (!ret)
+            ret = assoofs_compress_block(bh, data, size);
+        kvfree(data);
+        if (ret)
+        {
+            brelse(bh);
+            return ret;
+        }
+    }
+    else
+        // Los bytes entre ambos tamaños se ponen a cero: al ampliar se leen ceros y no datos antiguos
+        memset(bh->b_data + min_t(uint64_t, old_size, size), 0, max_t(uint64_t, old_size, size) - min_t(uint64_t, old_size, size));
+    mark_buffer_dirty(bh);
+    assoofs_sync_dirty_buffer(sb, bh);
+    brelse(bh);
+
+    // 4. Guardamos el nuevo tamaño y lo sumamos al uso recursivo de los antecesores
+    inode_info->file_size = size;
+    if (assoofs_save_inode_info(sb, inode_info) != 0)
+        return -EIO;
+    assoofs_usage_add(dentry, (int64_t)size - (int64_t)old_size, 0);
+
+    return 0;
+}
+
+// +++++++++++++++++++++++++++++++++++++++++++++++++++++
+// Definición de funciones de operaciones sobre ficheros
+// +++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+ssize_t assoofs_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    // Declaración de variables (ISO C90)
+    struct file *filp = iocb->ki_filp;
+    loff_t *ppos = &iocb->ki_pos;
+    size_t nbytes;
+    struct super_block *sb;
+    struct inode *inode;
+    struct assoofs_inode_info *inode_info;
+    struct buffer_head *bh;
+    uint64_t file_size;
+    uint64_t block;
+    char *buffer;
+    char *data;
+    ssize_t ret;
+
+    printk(KERN_INFO "assoofs_read_iter: request\n");
+
+    // 1. Obtenemos la información persistente del superbloque
+    inode = file_inode(filp);
+    sb = inode->i_sb;
+
+    // 2. Obtenemos la información persistente del inodo
+    // Las escrituras, el truncado y los cambios de bloque (COW, MOVE_BLOCK) se hacen con el inodo bloqueado:
+    // leemos el tamaño y el bloque una sola vez, con el inodo bloqueado para lectura, y los usamos en toda la lectura
+    inode_info = inode->i_private;
+    inode_lock_shared(inode);
+    file_size = inode_info->file_size;
+    block = inode_info->data_block_number;
+
+    // 3. Comprobamos que no hayamos llegado al final del fichero con el puntero de posición
+    if (*ppos >= file_size)
+    {
+        ret = 0;
+        goto out_unlock;
+    }
+
+    // 4. Accedemos al contenido del fichero y obtenemos un puntero al contenido del fichero
+    bh = assoofs_bread(sb, block);
+    if (!bh)
+    {
+        printk(KERN_ERR "assoofs_read_iter: Reading the block number [%llu] failed\n", block);
+        ret = -EIO;
+        goto out_unlock;
+    }
+    buffer = (char *)bh->b_data;
+
+    // Si el fichero está comprimido, lo descomprimimos completo en un buffer temporal y leemos de él
+    data = NULL;
+    if (inode_info->flags & ASSOOFS_INODE_COMPRESSED)
+    {
+        data = kvmalloc(file_size, GFP_KERNEL);
+        if (!data || assoofs_decompress_block(bh, data, file_size) != 0)
+        {
+            printk(KERN_ERR "assoofs_read_iter: Decompressing the block number [%llu] failed\n", block);
+            ret = -EIO;
+            goto out_free;
+        }
+        buffer = data;
+    }
+
+    // 5. Copiamos el contenido del fichero a los buffers de usuario
+    // Incrementamos el buffer para que lea a partir de donde se quedó
+    buffer += *ppos;
+    // Calculamos el número de bytes que podemos leer a partir de la posición actual (mínimo entre la cantidad restante en el fichero y el tamaño de los buffers)
+    nbytes = min((size_t)file_size - (size_t)*ppos, iov_iter_count(to));
+    // Copiamos los bytes del fichero a todos los segmentos de una vez
+    if (copy_to_iter(buffer, nbytes, to) != nbytes)
+    {
+        printk(KERN_ERR "assoofs_read_iter: Error copying file contents to user buffer\n");
+        ret = -EFAULT;
+        goto out_free;
+    }
+
+    // 6. Actualizamos el puntero de posición
+    *ppos += nbytes;
+    ret = nbytes;
+
+    // 7. Actualizamos la fecha de acceso según las opciones de montaje (relatime, noatime, lazytime)
+    // Solo cambia en memoria: se guarda cuando se escribe el inodo (assoofs_write_inode)
+    file_accessed(filp);
+
+out_free:
+    // 8. Liberamos el buffer temporal de descompresión (kvfree admite NULL) y el buffer con brelse
+    kvfree(data);
+    brelse(bh);
+out_unlock:
+    inode_unlock_shared(inode);
+
+    // 9. Devolvemos el número de bytes leídos
+    return ret;
+}
+
+ssize_t assoofs_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    // Declaración de variables (ISO C90)
+    struct inode *inode;
+    ssize_t ret;
+
+    printk(KERN_INFO "assoofs_write_iter: request\n");
+
+    inode = file_inode(iocb->ki_filp);
+
+    inode_lock(inode);
+    ret = assoofs_write_locked(iocb, from);
+    inode_unlock(inode);
+
+    return ret;
+}
+
+static ssize_t assoofs_write_locked(struct kiocb *iocb, struct iov_iter *from)
+{
+    // Declaración de variables (ISO C90)
+    struct file *filp = iocb->ki_filp;
+    loff_t *ppos = &iocb->ki_pos;
+    size_t len = iov_iter_count(from);
+    struct inode *inode;
+    struct super_block *sb;
+    struct assoofs_inode_info *inode_info;
+    struct buffer_head *bh;
+    char *buffer;
+    size_t max_size;
+    int64_t delta;
+
+    // 1. Obtenemos la información persistente del superbloque
+    sb = filp->f_path.dentry->d_inode->i_sb;
+
+    // 2. Obtenemos la información persistente del inodo
+    inode_info = filp->f_path.dentry->d_inode->i_private;
+
+    // 3. Comprobamos que el valor de ppos sumado a al tamaño de los datos a escribir no supere el tamaño máximo de un fichero
+    // Los ficheros comprimidos pueden superar el tamaño de bloque siempre que su versión comprimida quepa en él
+    max_size = (inode_info->flags & ASSOOFS_INODE_COMPRESSED) ? ASSOOFS_MAX_COMPRESSED_FILE_SIZE : ASSOOFS_DEFAULT_BLOCK_SIZE;
+    if (*ppos + len > max_size)
+    {
+        printk(KERN_ERR "assooofs_write: The file is too large to write it completely\n");
+        return -1;
+    }
+
+    // 4. Si el bloque de datos está compartido con otro fichero (reflink), escribimos sobre una copia privada
+    if (assoofs_unshare_block(sb, inode_info) != 0)
+    {
+        printk(KERN_ERR "assooofs_write: Copy-on-write of block [%llu] failed\n", inode_info->data_block_number);
+        return -1;
+    }
+
+    // Accedemos al contenido del fichero y obtenemos un puntero al contenido del fichero
+    bh = assoofs_bread(sb, inode_info->data_block_number);
+    if (!bh)
+    {
+        printk(KERN_ERR "assooofs_write: Reading the block number [%llu] failed\n", inode_info->data_block_number);
+        return -1;
+    }
+    buffer = (char *)bh->b_data;
+    // Incrementamos el buffer para que escriba a partir de donde se quedó
+    buffer += *ppos;
+
+    // 5. Copiamos el contenido del buffer de usuario al fichero
+    if (inode_info->flags & ASSOOFS_INODE_COMPRESSED)
+    {
+        // Los ficheros comprimidos se descomprimen, se modifican y se vuelven a comprimir en el bloque
+        if (assoofs_compressed_write(bh, inode_info, from, len, *ppos) != 0)
+        {
+            printk(KERN_ERR "assooofs_write: Error writing compressed file contents\n");
+            brelse(bh);
+            return -1;
+        }
+    }
+    else
+    {
+        // Si se escribe más allá del final, el hueco se lee como ceros
+        if (*ppos > inode_info->file_size)
+            memset(bh->b_data + inode_info->file_size, 0, *ppos - inode_info->file_size);
+        if (copy_from_iter(buffer, len, from) != len)
+        {
+            printk(KERN_ERR "assooofs_write: Error copying file contents from user buffer\n");
+            brelse(bh);
+            return -EFAULT;
+        }
+    }
+
+    // 6. Actualizamos el puntero de posición
+    *ppos += len;
+
+    // 7. Marcamos el buffer como modificado y sincronizamos el buffer con el disco para reflejar los cambios
+    mark_buffer_dirty(bh);
+    assoofs_sync_dirty_buffer(sb, bh);
+
+    // 8. Actualizamos el tamaño y las fechas de modificación y cambio del fichero
+    // Como en POSIX, el fichero solo crece si la escritura termina más allá de su final (una escritura en medio no lo trunca)
+    // Las fechas se guardan con el resto de la información del inodo, sin escrituras adicionales
+    delta = max_t(int64_t, (int64_t)*ppos - (int64_t)inode_info->file_size, 0);
+    inode_info->file_size += delta;
+    inode = filp->f_path.dentry->d_inode;
+    i_size_write(inode, inode_info->file_size);
+    inode->i_mtime = inode->i_ctime = current_time(inode);
+    assoofs_inode_info_set_times(inode_info, inode);
+    if (assoofs_save_inode_info(sb, inode_info) != 0)
+    {
+        printk(KERN_ERR "assooofs_write: Error saving inode info\n");
+        return -1;
+    }
+    // El cambio de tamaño se suma al uso recursivo de los directorios antecesores
+    assoofs_usage_add(filp->f_path.dentry, delta, 0);
+
+    // 9. Liberamos el buffer con brelse
+    brelse(bh);
+
+    // 10. Devolvemos el número de bytes escritos
+    return len;
+}
+
+loff_t assoofs_remap_file_range(struct file *file_in, loff_t pos_in, struct file *file_out, loff_t pos_out, loff_t len, unsigned int remap_flags)
+{
+    // Declaración de variables (ISO C90)
+    struct inode *inode_in;
+    struct inode *inode_out;
+    struct super_block *sb;
+    struct assoofs_inode_info *in_info;
+    struct assoofs_inode_info *out_info;
+    uint64_t old_block;
+    int ret;
+
+    printk(KERN_INFO "assoofs_remap_file_range: request\n");
+
+    // 1. Obtenemos los inodos
+    inode_in = file_inode(file_in);
+    inode_out = file_inode(file_out);
+    sb = inode_in->i_sb;
+
+    // 2. Comprobamos los parámetros de la operación
+    // copy_file_range llega aquí también entre dos montajes de assoofs (las operaciones coinciden),
+    // pero los números de bloque de un sistema de archivos no significan nada en el otro
+    if (inode_out->i_sb != sb)
+        return -EXDEV;
+    if (remap_flags & ~(REMAP_FILE_DEDUP | REMAP_FILE_CAN_SHORTEN | REMAP_FILE_ADVISORY))
+        return -EOPNOTSUPP;
+    if (!S_ISREG(inode_in->i_mode) || !S_ISREG(inode_out->i_mode))
+        return -EINVAL;
+
+    lock_two_nondirectories(inode_in, inode_out);
+
+    // 3. Comprobaciones comunes del VFS: límites y tamaños (i_size), ficheros inmutables o de solo añadir,
+    // len == 0 (FICLONE) como "hasta el final del origen" y recorte con REMAP_FILE_CAN_SHORTEN.
+    // La comparación de contenidos de la deduplicación no se delega: el VFS la hace a través de la page cache,
+    // que assoofs no utiliza para los datos de los ficheros (se hace en el paso 5 con assoofs_compare_file_blocks)
+    ret = generic_remap_file_range_prep(file_in, pos_in, file_out, pos_out, &len, remap_flags & ~REMAP_FILE_DEDUP);
+    if (ret < 0 || len == 0)
+        goto out;
+
+    // 4. Con los dos inodos bloqueados, su tamaño y su bloque de datos ya no pueden cambiar
+    in_info = inode_in->i_private;
+    out_info = inode_out->i_private;
+    // Cada fichero ocupa un único bloque, por lo que solo se pueden compartir ficheros completos
+    // y sin perder datos que el destino tenga más allá del final del origen
+    if (pos_in != 0 || pos_out != 0 || len != in_info->file_size || out_info->file_size > len)
+    {
+        ret = -EINVAL;
+        goto out;
+    }
+    if (inode_in == inode_out || in_info->data_block_number == out_info->data_block_number)
+        goto out;
+
+    // 5. En la deduplicación ambos ficheros deben tener el mismo contenido (-EBADE indica al VFS que difieren)
+    if (remap_flags & REMAP_FILE_DEDUP)
+    {
+        ret = assoofs_compare_file_blocks(sb, in_info, out_info);
+        if (ret != 0)
+            goto out;
+    }
+
+    // 6. Tomamos una referencia sobre el bloque del origen
+    ret = assoofs_sb_get_block_ref(sb, in_info->data_block_number);
+    if (ret != 0)
+        goto out;
+
+    // 7. El destino pasa a apuntar al bloque del origen (con su mismo formato, comprimido o no)
+    assoofs_usage_add(file_out->f_path.dentry, (int64_t)in_info->file_size - (int64_t)out_info->file_size, 0);
+    old_block = out_info->data_block_number;
+    out_info->data_block_number = in_info->data_block_number;
+    out_info->file_size = in_info->file_size;
+    i_size_write(inode_out, out_info->file_size);
+    out_info->flags = (out_info->flags & ~ASSOOFS_INODE_COMPRESSED) | (in_info->flags & ASSOOFS_INODE_COMPRESSED);
+    if (assoofs_save_inode_info(sb, out_info) != 0)
+    {
+        printk(KERN_ERR "assoofs_remap_file_range: Error saving inode info\n");
+        ret = -EIO;
+        goto out;
+    }
+
+    // 8. Soltamos el bloque que tenía el destino (se libera si no estaba compartido)
+    assoofs_sb_put_block(sb, old_block);
+
+out:
+    unlock_two_nondirectories(inode_in, inode_out);
+    return ret < 0 ? ret : len;
+}
+
+ssize_t assoofs_copy_file_range(struct file *file_in, loff_t pos_in, struct file *file_out, loff_t pos_out, size_t len, unsigned int flags)
+{
+    // Declaración de variables (ISO C90)
+    loff_t ret;
+
+    printk(KERN_INFO "assoofs_copy_file_range: request\n");
+
+    // Intentamos copiar el fichero completo compartiendo su bloque de datos
+    ret = assoofs_remap_file_range(file_in, pos_in, file_out, pos_out, len, REMAP_FILE_CAN_SHORTEN);
+
+    // Si no se puede compartir (copia parcial o entre dos sistemas de archivos), copiamos el contenido con splice.
+    // El VFS devuelve directamente el resultado de copy_file_range: no recurre por su cuenta a la copia convencional
+    if (ret == -EINVAL || ret == -EXDEV || ret == -EOPNOTSUPP)
+        return generic_copy_file_range(file_in, pos_in, file_out, pos_out, len, flags);
+
+    return ret;
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// Definición de funciones de operaciones sobre directorios
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+static int assoofs_iterate(struct file *filp, struct dir_context *ctx)
+{
+    // Declaración de variables (ISO C90)
+    int i;
+    struct inode *inode;
+    struct super_block *sb;
+    struct assoofs_inode_info *inode_info;
+    struct buffer_head *bh;
+    struct assoofs_dir_record_entry *record;
+    struct assoofs_metacache *mc;
+    struct assoofs_metacache_dir *mc_dir;
+    struct assoofs_metacache_entry *mc_entry;
+    struct assoofs_sb_info *sbi;
+    uint64_t children[ASSOOFS_DIR_ENTRIES_PER_BLOCK];
+    int count = 0;
+
+    printk(KERN_INFO "assoofs_iterate: request\n");
+
+    // 1. Obtenemos el inodo y el superbloque
+    inode = filp->f_path.dentry->d_inode;
+    sb = inode->i_sb;
+    // Obtenemos la información persistente del inodo
+    inode_info = inode->i_private;
+
+    // 2. Comprobamos que el contexto del directorio ya ha sido creado
+    // Esto asegura que no se repitan entradas del directorio al llamar a la función repetidas veces (bucle infinito)
+    if (ctx->pos != 0)
+        return 0;
+
+    // 3. Comprobamos que el inodo es un directorio
+    if ((!S_ISDIR(inode_info->mode)))
+        return -1;
+
+    // Con la opción metacache las entradas se obtienen de la tabla de nombres del directorio, sin leer su bloque
+    mc = ASSOOFS_SB(sb)->metacache;
+    if (mc)
+    {
+        mc_dir = assoofs_metacache_dir(mc, inode_info->inode_no);
+        for (i = 0; mc_dir && i < mc_dir->count; i++)
+        {
+            mc_entry = &mc->entries[mc_dir->first + i];
+            dir_emit(ctx, mc->names + mc_entry->name, strlen(mc->names + mc_entry->name), mc_entry->inode_no, DT_UNKNOWN);
+            ctx->pos += sizeof(struct assoofs_dir_record_entry);
+        }
+        return 0;
+    }
+
+    // 4. Rellenamos el contexto del directorio con las entradas del directorio
+    // Accedemos al bloque de disco con el contenido del directorio
+    bh = assoofs_meta_bread(sb, inode_info->data_block_number);
+    if (!bh)
+    {
+        printk(KERN_ERR "assoofs_iterate: Reading the block number [%llu] failed\n", inode_info->data_block_number);
+        return -1;
+    }
+    // Declaramos un puntero a la primera entrada del directorio (permite acceder a las demás entradas)
+    record = (struct assoofs_dir_record_entry *)bh->b_data;
+
+    // Recorremos las entradas del directorio
+    for (i = 0; i < inode_info->dir_children_count; i++)
+    {
+        // Agregamos la entrada del directorio al contexto del directorio
+        dir_emit(ctx, record->filename, ASSOOFS_FILENAME_MAXLEN, record->inode_no, DT_UNKNOWN);
+
+        // Incrementamos la posición con el tamaño de la nueva entrada para que el contexto del directorio apunte a la siguiente entrada
+        ctx->pos += sizeof(struct assoofs_dir_record_entry);
+
+        // Apuntamos el hijo para cargarlo después en segundo plano
+        if (count < ASSOOFS_DIR_ENTRIES_PER_BLOCK)
+            children[count++] = record->inode_no;
+
+        // Incrementamos el puntero a la siguiente entrada
+        record++;
+    }
+
+    // Liberamos el buffer con brelse
+    brelse(bh);
+
+    // Los hijos se añaden a la lista de carga en la caché de inodos en segundo plano (assoofs_prefetch_worker)
+    // El cerrojo no se toma durante dir_emit: copia las entradas al espacio de usuario y puede dormir
+    // Si la lista de pendientes está llena, el hijo se cargará al buscarlo, como hasta ahora
+    sbi = ASSOOFS_SB(sb);
+    spin_lock(&sbi->prefetch_lock);
+    for (i = 0; i < count && sbi->prefetch_count < ASSOOFS_MAX_BLOCKS; i++)
+        sbi->prefetch_pending[sbi->prefetch_count++] = children[i];
+    spin_unlock(&sbi->prefetch_lock);
+
+    // 5. Pedimos la lectura del almacén de inodos sin esperar a que termine y programamos la carga de los hijos
+    // Con la caché de metadatos (metacache) no hace falta: los inodos ya se copian de memoria
+    if (inode_info->dir_children_count)
+    {
+        assoofs_breadahead(sb, ASSOOFS_INODESTORE_BLOCK_NUMBER);
+        schedule_work(&sbi->prefetch_work);
+    }
+
+    // Si todo ha ido bien, devolvemos 0
+    return 0;
+}
+
+// +++++++++++++++++++++++++++++++++++++++++++++++++++
+// Definición de funciones de operaciones sobre inodos
+// +++++++++++++++++++++++++++++++++++++++++++++++++++
+
+struct dentry *assoofs_lookup(struct inode *parent_inode, struct dentry *child_dentry, unsigned int flags)
+{
+    // Declaración de variables (ISO C90)
+    uint64_t start = ktime_get_ns();
+
+    assoofs_lookup_entry(parent_inode, child_dentry);
+    assoofs_op_account(parent_inode->i_sb, ASSOOFS_OP_DIR_LOOKUP, start);
+
+    // La entrada (o un dentry negativo) ya se ha añadido a la caché de dentries
+    return NULL;
+}
+
+static void assoofs_lookup_entry(struct inode *parent_inode, struct dentry *child_dentry)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_inode_info *parent_info;
+    struct super_block *sb;
+    struct buffer_head *bh;
+    struct assoofs_dir_record_entry *record;
+    struct assoofs_metacache_dir *mc_dir;
+    struct assoofs_metacache_entry *mc_entry;
+    struct inode *inode;
+
+    printk(KERN_INFO "assoofs_lookup: request\n");
+
+    // 1. Acceder al bloque de disco con el contenido del directorio apuntado por parent_inode
+    // Declaramos un puntero con la información persistente del inodo padre
+    parent_info = parent_inode->i_private;
+    // Preparamos un puntero al superbloque
+    sb = parent_inode->i_sb;
+
+    // Con la opción metacache la entrada se busca en la tabla de nombres ordenada del directorio, sin leer su bloque
+    if (ASSOOFS_SB(sb)->metacache)
+    {
+        mc_dir = assoofs_metacache_dir(ASSOOFS_SB(sb)->metacache, parent_info->inode_no);
+        mc_entry = mc_dir ? assoofs_metacache_lookup(ASSOOFS_SB(sb)->metacache, mc_dir, child_dentry->d_name.name) : NULL;
+        inode = NULL;
+        if (mc_entry)
+        {
+            inode = assoofs_get_inode(sb, mc_entry->inode_no);
+            if (!inode)
+            {
+                printk(KERN_ERR "assooofs_lookup: inode not found\n");
+                return;
+            }
+        }
+        d_add(child_dentry, inode);
+        return;
+    }
+    // assoofs_meta_bread (sb_bread y comprobación de la suma crc32c) se utiliza aquí para leer el bloque de disco con el contenido del directorio apuntado por parent_inode
+    bh = assoofs_meta_bread(sb, parent_info->data_block_number);
+    if (!bh)
+    {
+        printk(KERN_ERR "assoofs_lookup: Reading the block number [%llu] failed\n", parent_info->data_block_number);
+        return;
+    }
+
+    // 2. Buscar entre las entradas del directorio la entrada que coincide con child_dentry
+    record = assoofs_core_dir_find((struct assoofs_dir_record_entry *)bh->b_data, parent_info->dir_children_count, child_dentry->d_name.name);
+    if (record)
+    {
+        // Obtenemos el inodo del hijo
+        inode = assoofs_get_inode(sb, record->inode_no);
+        brelse(bh);
+        if (!inode)
+        {
+            printk(KERN_ERR "assooofs_lookup: inode not found\n");
+            return;
+        }
+        // Agregamos el directorio hijo al directorio padre
+        // (assoofs_get_inode ya ha asignado propietario y permisos al crear el inodo)
+        d_add(child_dentry, inode);
+
+        return;
+    }
+
+    // Si no existe, guardamos un dentry negativo para que las siguientes búsquedas del mismo nombre
+    // se resuelvan en la caché de dentries (también en modo RCU) sin volver a leer el directorio
+    brelse(bh);
+    d_add(child_dentry, NULL);
+}
+
+static int assoofs_create(struct user_namespace *mnt_userns, struct inode *dir, struct dentry *dentry, umode_t mode, bool excl)
+{
+    // Declaración de variables (ISO C90)
+    struct super_block *sb;
+    struct buffer_head *bh;
+    struct assoofs_inode_info *parent_inode_info;
+    struct assoofs_dir_record_entry *dir_contents;
+    struct inode *inode;
+    struct assoofs_inode_info *inode_info;
+    uint64_t start;
+    int ret;
+
+    printk(KERN_INFO "assoofs_create: request\n");
+
+    // 0. Comprobamos que el nombre quepa en una entrada y que quede sitio en el bloque del directorio padre
+    if (dentry->d_name.len >= ASSOOFS_FILENAME_MAXLEN)
+        return -ENAMETOOLONG;
+    if (((struct assoofs_inode_info *)dir->i_private)->dir_children_count >= ASSOOFS_DIR_ENTRIES_PER_BLOCK)
+        return -ENOSPC;
+
+    // 1. Comprobamos si se ha alcanzado el número máximo de inodos del sistema de archivos (el del formato o el fijado al formatear)
+    // Se vuelve a comprobar bajo istore_lock al añadir el inodo al almacén (paso 4)
+    sb = dir->i_sb;
+    parent_inode_info = dir->i_private;
+    if (ASSOOFS_SB(sb)->asb->inodes_count >= assoofs_core_max_inodes(ASSOOFS_SB(sb)->asb))
+    {
+        printk(KERN_ERR "assoofs_create: Maximum number of objects supported reached\n");
+        return -ENOSPC;
+    }
+
+    // 2. Creamos el nuevo inodo
+    inode = new_inode(sb);
+    if (!inode)
+        return -ENOMEM;
+    // Asignamos el superbloque
+    inode->i_sb = sb;
+    // Asignamos las operaciones sobre inodos
+    inode->i_op = &assoofs_inode_ops;
+    // Asignar fecha del sistema a los campos i_atime, i_mtime, i_ctime
+    inode->i_atime = inode->i_mtime = inode->i_ctime = current_time(inode);
+
+    // 2.1. Preparamos la información persistente del inodo en el campo i_private (reservada junto al inodo, a cero)
+    inode_info = &ASSOOFS_I(inode)->info;
+    inode_info->mode = mode;
+    inode_info->file_size = 0;
+    assoofs_inode_info_set_times(inode_info, inode);
+    // Si se ha montado con la opción compress, el fichero se almacena comprimido
+    inode_info->flags = (ASSOOFS_SB(sb)->mount_opt & ASSOOFS_MOUNT_COMPRESS) ? ASSOOFS_INODE_COMPRESSED : 0;
+    inode->i_private = inode_info;
+
+    // 2.2. Asignamos las operaciones sobre ficheros al inodo
+    inode->i_fop = &assoofs_file_operations;
+
+    // 2.3. Asignamos el propietario del inodo y los permisos
+    inode_init_owner(sb->s_user_ns, inode, dir, mode);
+
+    // 3. Reservamos lo que necesita el nuevo inodo. El número de inodo se reserva el último: el contador se guarda
+    // en el disco y solo se puede devolver si nadie ha reservado otro después
+    // 3.1. Asignamos al inodo un bloque de datos
+    if (assoofs_sb_get_a_freeblock(sb, &inode_info->data_block_number) != 0)
+    {
+        printk(KERN_ERR "assoofs_create: No more free blocks\n");
+        iput(inode);
+        return -ENOSPC;
+    }
+    // 3.2. Leemos el bloque de disco con el contenido del directorio padre
+    // assoofs_meta_bread (sb_bread y comprobación de la suma crc32c) se utiliza aquí para leer el bloque de disco con el contenido del directorio apuntado por parent_inode
+    bh = assoofs_meta_bread(sb, parent_inode_info->data_block_number);
+    if (!bh)
+    {
+        printk(KERN_ERR "assoofs_create: Reading the block number [%llu] failed\n", parent_inode_info->data_block_number);
+        ret = -EIO;
+        goto out_put_block;
+    }
+    // 3.3. Asignamos el número de inodo
+    inode->i_ino = assoofs_sb_get_inode_numbers(sb, 1);
+    inode_info->inode_no = inode->i_ino;
+
+    // 4. Guardamos la información persistente del inodo en el almacén de inodos
+    ret = assoofs_add_inode_info(sb, inode_info);
+    if (ret != 0)
+        goto out_put_ino;
+
+    // 5. Creamos una nueva entrada al final del directorio padre con el nombre y el número del nuevo inodo
+    start = ktime_get_ns();
+    // El paso 0 ya ha comprobado, con el directorio bloqueado, que el nombre cabe y que queda sitio: no puede fallar
+    dir_contents = (struct assoofs_dir_record_entry *)bh->b_data;
+    assoofs_core_dir_add(dir_contents, parent_inode_info->dir_children_count, dentry->d_name.name, inode_info->inode_no);
+    // assoofs_mark_meta_dirty se utiliza para actualizar la suma de comprobación y marcar el buffer como modificado
+    assoofs_mark_meta_dirty(bh);
+    // assoofs_sync_dirty_buffer se utiliza para sincronizar el buffer con el disco (es decir, escribir el buffer en el disco)
+    assoofs_sync_dirty_buffer(sb, bh);
+    // Liberamos el buffer
+    brelse(bh);
+    assoofs_op_account(sb, ASSOOFS_OP_DIR_INSERT, start);
+
+    // 6. Agregamos el inodo al árbol de inodos del sistema de archivos, ahora que ya está en el disco
+    // Lo añadimos a la caché de inodos para que assoofs_get_inode lo encuentre
+    insert_inode_hash(inode);
+    // assoofs_lookup ya ha añadido el dentry (negativo) a la caché, por lo que basta con asociarle el inodo
+    d_instantiate(dentry, inode);
+
+    // 7. Actualizamos la información persistente del directorio padre
+    // 7.1. Incrementamos el número de ficheros hijo del directorio padre y actualizamos sus fechas de modificación y cambio
+    parent_inode_info->dir_children_count++;
+    dir->i_mtime = dir->i_ctime = current_time(dir);
+    assoofs_inode_info_set_times(parent_inode_info, dir);
+    // El nuevo inodo se suma al uso recursivo de todos los antecesores (el padre se guarda a continuación)
+    assoofs_usage_add(dentry, 0, 1);
+    // 7.2. Escribimos en el disco la información persistente del directorio padre
+    if (assoofs_save_inode_info(sb, parent_inode_info) != 0)
+    {
+        printk(KERN_ERR "assoofs_create: Error while saving inode info\n");
+        return -EIO;
+    }
+
+    // Si todo ha ido bien, devolvemos 0
+    return 0;
+
+out_put_ino:
+    // Devolvemos lo reservado en orden inverso; el inodo aún no está en la caché de inodos ni en ningún dentry
+    assoofs_sb_put_inode_numbers(sb, inode_info->inode_no, 1);
+    brelse(bh);
+out_put_block:
+    assoofs_sb_put_block(sb, inode_info->data_block_number);
+    iput(inode);
+    return ret;
+}
+
+static int assoofs_mkdir(struct user_namespace *mnt_userns, struct inode *dir, struct dentry *dentry, umode_t mode)
+{
+    // Declaración de variables (ISO C90)
+    struct super_block *sb;
+    struct buffer_head *bh;
+    struct assoofs_inode_info *parent_inode_info;
+    struct assoofs_dir_record_entry *dir_contents;
+    struct inode *inode;
+    struct assoofs_inode_info *inode_info;
+    uint64_t start;
+    int ret;
+
+    printk(KERN_INFO "assoofs_mkdir: request\n");
+
+    // 0. Comprobamos que el nombre quepa en una entrada y que quede sitio en el bloque del directorio padre
+    if (dentry->d_name.len >= ASSOOFS_FILENAME_MAXLEN)
+        return -ENAMETOOLONG;
+    if (((struct assoofs_inode_info *)dir->i_private)->dir_children_count >= ASSOOFS_DIR_ENTRIES_PER_BLOCK)
+        return -ENOSPC;
+
+    // 1. Comprobamos si se ha alcanzado el número máximo de inodos del sistema de archivos (el del formato o el fijado al formatear)
+    // Se vuelve a comprobar bajo istore_lock al añadir el inodo al almacén (paso 4)
+    sb = dir->i_sb;
+    parent_inode_info = dir->i_private;
+    if (ASSOOFS_SB(sb)->asb->inodes_count >= assoofs_core_max_inodes(ASSOOFS_SB(sb)->asb))
+    {
+        printk(KERN_ERR "assoofs_mkdir: Maximum number of objects supported reached\n");
+        return -ENOSPC;
+    }
+
+    // 2. Creamos el nuevo inodo
+    inode = new_inode(sb);
+    if (!inode)
+        return -ENOMEM;
+    // Asignamos el superbloque
+    inode->i_sb = sb;
+    // Asignamos las operaciones sobre inodos
+    inode->i_op = &assoofs_inode_ops;
+    // Asignar fecha del sistema a los campos i_atime, i_mtime, i_ctime
+    inode->i_atime = inode->i_mtime = inode->i_ctime = current_time(inode);
+
+    // 2.1. Preparamos la información persistente del inodo en el campo i_private (reservada junto al inodo, a cero)
+    inode_info = &ASSOOFS_I(inode)->info;
+    inode_info->mode = S_IFDIR | mode;
+    inode_info->flags = 0;
+    inode_info->dir_children_count = 0;
+    // El subárbol del nuevo directorio solo lo contiene a él
+    inode_info->tree_inodes = 1;
+    inode_info->tree_size = 0;
+    assoofs_inode_info_set_times(inode_info, inode);
+    inode->i_private = inode_info;
+
+    // 2.2. Asignamos las operaciones sobre directorios al inodo
+    inode->i_fop = &assoofs_dir_operations;
+
+    // 2.3. Asignamos el propietario del inodo y los permisos
+    inode_init_owner(sb->s_user_ns, inode, dir, inode_info->mode);
+
+    // 3. Reservamos lo que necesita el nuevo inodo. El número de inodo se reserva el último: el contador se guarda
+    // en el disco y solo se puede devolver si nadie ha reservado otro después
+    // 3.1. Asignamos al inodo un bloque de datos
+    if (assoofs_sb_get_a_freeblock(sb, &inode_info->data_block_number) != 0)
+    {
+        printk(KERN_ERR "assoofs_mkdir: No more free blocks\n");
+        iput(inode);
+        return -ENOSPC;
+    }
+    // El bloque del directorio se escribe vacío antes de que ningún inodo apunte a él, para que su suma sea válida
+    if (assoofs_init_dir_block(sb, inode_info->data_block_number) != 0)
+    {
+        printk(KERN_ERR "assoofs_mkdir: Writing the directory block failed\n");
+        ret = -EIO;
+        goto out_put_block;
+    }
+    // 3.2. Leemos el bloque de disco con el contenido del directorio padre
+    // assoofs_meta_bread (sb_bread y comprobación de la suma crc32c) se utiliza aquí para leer el bloque de disco con el contenido del directorio apuntado por parent_inode
+    bh = assoofs_meta_bread(sb, parent_inode_info->data_block_number);
+    if (!bh)
+    {
+        printk(KERN_ERR "assoofs_mkdir: Reading the block number [%llu] failed\n", parent_inode_info->data_block_number);
+        ret = -EIO;
+        goto out_put_block;
+    }
+    // 3.3. Asignamos el número de inodo
+    inode->i_ino = assoofs_sb_get_inode_numbers(sb, 1);
+    inode_info->inode_no = inode->i_ino;
+
+    // 4. Guardamos la información persistente del inodo en el almacén de inodos
+    ret = assoofs_add_inode_info(sb, inode_info);
+    if (ret != 0)
+        goto out_put_ino;
+
+    // 5. Creamos una nueva entrada al final del directorio padre con el nombre y el número del nuevo inodo
+    start = ktime_get_ns();
+    // El paso 0 ya ha comprobado, con el directorio bloqueado, que el nombre cabe y que queda sitio: no puede fallar
+    dir_contents = (struct assoofs_dir_record_entry *)bh->b_data;
+    assoofs_core_dir_add(dir_contents, parent_inode_info->dir_children_count, dentry->d_name.name, inode_info->inode_no);
+    // assoofs_mark_meta_dirty se utiliza para actualizar la suma de comprobación y marcar el buffer como modificado
+    assoofs_mark_meta_dirty(bh);
+    // assoofs_sync_dirty_buffer se utiliza para sincronizar el buffer con el disco (es decir, escribir el buffer en el disco)
+    assoofs_sync_dirty_buffer(sb, bh);
+    // Liberamos el buffer
+    brelse(bh);
+    assoofs_op_account(sb, ASSOOFS_OP_DIR_INSERT, start);
+
+    // 6. Agregamos el inodo al árbol de inodos del sistema de archivos, ahora que ya está en el disco
+    // Lo añadimos a la caché de inodos para que assoofs_get_inode lo encuentre
+    insert_inode_hash(inode);
+    // assoofs_lookup ya ha añadido el dentry (negativo) a la caché, por lo que basta con asociarle el inodo
+    d_instantiate(dentry, inode);
+
+    // 7. Actualizamos la información persistente del directorio padre
+    // 7.1. Incrementamos el número de ficheros hijo del directorio padre y actualizamos sus fechas de modificación y cambio
+    parent_inode_info->dir_children_count++;
+    dir->i_mtime = dir->i_ctime = current_time(dir);
+    assoofs_inode_info_set_times(parent_inode_info, dir);
+    // El nuevo inodo se suma al uso recursivo de todos los antecesores (el padre se guarda a continuación)
+    assoofs_usage_add(dentry, 0, 1);
+    // 7.2. Escribimos en el disco la información persistente del directorio padre
+    if (assoofs_save_inode_info(sb, parent_inode_info) != 0)
+    {
+        printk(KERN_ERR "assoofs_mkdir: Error while saving inode info\n");
+        return -EIO;
+    }
+
+    // Si todo ha ido bien, devolvemos 0
+    return 0;
+
+out_put_ino:
+    // Devolvemos lo reservado en orden inverso; el inodo aún no está en la caché de inodos ni en ningún dentry
+    assoofs_sb_put_inode_numbers(sb, inode_info->inode_no, 1);
+    brelse(bh);
+out_put_block:
+    assoofs_sb_put_block(sb, inode_info->data_block_number);
+    iput(inode);
+    return ret;
+}
+
+static int assoofs_unlink(struct inode *dir, struct dentry *dentry)
+{
+    // Declaración de variables (ISO C90)
+    struct inode *inode = d_inode(dentry);
+    struct assoofs_inode_info *inode_info = inode->i_private;
+    int ret;
+
+    printk(KERN_INFO "assoofs_unlink: request\n");
+
+    // 1. Restamos el fichero del uso recursivo de los antecesores (el padre se guarda en el paso 2)
+    assoofs_usage_add(dentry, -(int64_t)(S_ISREG(inode_info->mode) ? inode_info->file_size : 0), -1);
+
+    // 2. Quitamos la entrada del directorio padre
+    // Se hace antes de marcar el inodo como huérfano: si el sistema se detiene entre ambos pasos,
+    // el inodo queda ocupado pero nunca se libera uno al que todavía apunte un directorio
+    ret = assoofs_remove_dir_record(dir, dentry);
+    if (ret)
+    {
+        assoofs_usage_add(dentry, S_ISREG(inode_info->mode) ? inode_info->file_size : 0, 1);
+        return ret;
+    }
+
+    // 3. Marcamos el inodo como huérfano: su bloque y su entrada del almacén se liberan en segundo plano
+    // cuando se suelte la última referencia (assoofs_evict_inode), o al montar si el sistema se detiene antes
+    inode->i_ctime = dir->i_ctime;
+    drop_nlink(inode);
+    inode_info->flags |= ASSOOFS_INODE_ORPHAN;
+    assoofs_inode_info_set_times(inode_info, inode);
+    if (assoofs_save_inode_info(dir->i_sb, inode_info) != 0)
+    {
+        printk(KERN_ERR "assoofs_unlink: Error while saving inode info\n");
+        return -EIO;
+    }
+
+    return 0;
+}
+
+static int assoofs_rmdir(struct inode *dir, struct dentry *dentry)
 {
     // Declaración de variables (ISO C90)
-    int i;
-    struct assoofs_super_block_info *afs_sb;
-    struct assoofs_inode_info *buffer;
-    struct assoofs_inode_info *inode_info;
-    struct buffer_head *bh;
+    struct assoofs_inode_info *inode_info = d_inode(dentry)->i_private;
 
-    printk(KERN_INFO "assoofs_get_inode_info: request\n");
+    printk(KERN_INFO "assoofs_rmdir: request\n");
 
-    // 1. Leer el bloque que contiene el almacén de inodos del dispositivo de bloques
-    inode_info = kmem_cache_alloc(assoofs_inode_cache, GFP_KERNEL);
-    // sb_bread se utiliza aquí para leer el almacén de inodos del dispositivo de bloques (el bloque 1)
-    bh = sb_bread(sb, ASSOOFS_INODESTORE_BLOCK_NUMBER);
+    // Solo se pueden borrar los directorios vacíos; a partir de ahí se borran igual que un fichero
+    if (inode_info->dir_children_count != 0)
+        return -ENOTEMPTY;
+
+    return assoofs_unlink(dir, dentry);
+}
+
+static int assoofs_remove_dir_record(struct inode *dir, struct dentry *dentry)
+{
+    // Declaración de variables (ISO C90)
+    struct super_block *sb = dir->i_sb;
+    struct assoofs_inode_info *parent_inode_info = dir->i_private;
+    struct assoofs_dir_record_entry *record;
+    struct assoofs_dir_record_entry *entry;
+    struct buffer_head *bh;
+    uint64_t count;
+
+    // 1. Buscamos la entrada en el bloque del directorio padre
+    bh = assoofs_meta_bread(sb, parent_inode_info->data_block_number);
     if (!bh)
     {
-        printk(KERN_ERR "assoofs_get_inode_info: reading the inode store failed\n");
-        return NULL;
+        printk(KERN_ERR "assoofs_remove_dir_record: Reading the block number [%llu] failed\n", parent_inode_info->data_block_number);
+        return -EIO;
     }
-    // Para acceder a los campos del bloque, primero hay que asignar bh->b_data a un puntero de tipo assoofs_inode_info
-    inode_info = (struct assoofs_inode_info *)bh->b_data;
-
-    // 2. Recorrer el almacén de inodos en busca del inodo cuya información se quiere obtener (inode_no)
-    // Declaramos un puntero con la información persistente del superbloque
-    afs_sb = sb->s_fs_info;
-    // Preparamos un buffer para copiar la información del inodo
-    buffer = NULL;
-    for (i = 0; i < afs_sb->inodes_count; i++)
+    record = (struct assoofs_dir_record_entry *)bh->b_data;
+    count = min_t(uint64_t, parent_inode_info->dir_children_count, ASSOOFS_DIR_ENTRIES_PER_BLOCK);
+    entry = assoofs_core_dir_find(record, count, dentry->d_name.name);
+    if (!entry)
     {
-        if (inode_info->inode_no == inode_no)
-        {
-            // Hemos encontrado el inodo que buscábamos
-            // Copiamos la información persistente del inodo en el buffer
-            buffer = kmalloc(sizeof(struct assoofs_inode_info), GFP_KERNEL);
-            memcpy(buffer, inode_info, sizeof(*buffer));
-            break;
-        }
-        inode_info++;
+        brelse(bh);
+        return -ENOENT;
     }
 
-    // Ya podemos liberar el buffer_head con brelse
+    // 2. La última entrada ocupa el hueco, de modo que las entradas siguen siendo contiguas
+    assoofs_core_dir_remove(record, count, entry);
+    assoofs_mark_meta_dirty(bh);
+    assoofs_sync_dirty_buffer(sb, bh);
     brelse(bh);
 
-    return buffer;
-};
+    // 3. Actualizamos el número de hijos y las fechas del directorio padre, y lo guardamos
+    parent_inode_info->dir_children_count = count - 1;
+    dir->i_mtime = dir->i_ctime = current_time(dir);
+    assoofs_inode_info_set_times(parent_inode_info, dir);
+    if (assoofs_save_inode_info(sb, parent_inode_info) != 0)
+    {
+        printk(KERN_ERR "assoofs_remove_dir_record: Error while saving inode info\n");
+        return -EIO;
+    }
 
-static struct inode *assoofs_get_inode(struct super_block *sb, int ino)
+    return 0;
+}
+
+static int assoofs_setattr(struct user_namespace *mnt_userns, struct dentry *dentry, struct iattr *attr)
 {
     // Declaración de variables (ISO C90)
-    struct assoofs_inode_info *inode_info;
-    struct inode *inode;
+    struct inode *inode = d_inode(dentry);
+    struct assoofs_inode_info *inode_info = inode->i_private;
+    int ret;
 
-    printk(KERN_INFO "assoofs_get_inode: request\n");
+    printk(KERN_INFO "assoofs_setattr: request\n");
+
+    // 1. Comprobamos que se puedan hacer los cambios
+    ret = setattr_prepare(mnt_userns, dentry, attr);
+    if (ret)
+        return ret;
 
-    // 1. Obtenemos la información persistente del inodo ino
-    inode_info = kmem_cache_alloc(assoofs_inode_cache, GFP_KERNEL);
-    inode_info = assoofs_get_inode_info(sb, ino);
-    if (!inode_info)
+    // 2. Cambiamos el tamaño del fichero (truncate)
+    if ((attr->ia_valid & ATTR_SIZE) && attr->ia_size != inode_info->file_size)
     {
-        printk(KERN_ERR "assoofs_get_inode_info: Inode not found\n");
-        return NULL;
+        ret = assoofs_truncate(dentry, attr->ia_size);
+        if (ret)
+            return ret;
+        truncate_setsize(inode, attr->ia_size);
     }
 
-    // 2. Creamos un nuevo inodo y asignamos los campos correspondientes
-    // Inicializamos el inodo
-    inode = new_inode(sb);
-    // Asignamos el número de inodo
-    inode->i_ino = ino;
-    // Asignamos el superbloque
-    inode->i_sb = sb;
-    // Asignamos las operaciones sobre inodos
-    inode->i_op = &assoofs_inode_ops;
+    // 3. Aplicamos el resto de cambios al inodo de VFS; el modo también se guarda en la información persistente
+    // El inodo se guarda más tarde, con las fechas (assoofs_write_inode)
+    setattr_copy(mnt_userns, inode, attr);
+    if (attr->ia_valid & ATTR_MODE)
+        inode_info->mode = inode->i_mode;
+    mark_inode_dirty(inode);
 
-    // Determinamos si el inodo es un fichero o un directorio y asignamos la operación correspondiente
+    return 0;
+}
+
+static int assoofs_fiemap(struct inode *inode, struct fiemap_extent_info *fieinfo, u64 start, u64 len)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(inode->i_sb);
+    struct assoofs_inode_info *inode_info;
+    u64 length;
+    u32 flags = FIEMAP_EXTENT_LAST;
+    int ret;
+
+    printk(KERN_INFO "assoofs_fiemap: request\n");
+
+    // 1. Comprobamos la petición (no se admiten flags como FIEMAP_FLAG_XATTR)
+    ret = fiemap_prep(inode, fieinfo, start, &len, 0);
+    if (ret)
+        return ret;
+
+    // El bloque de datos puede cambiar con ASSOOFS_IOC_MOVE_BLOCK o al copiarse al escribir
+    inode_lock_shared(inode);
+    inode_info = inode->i_private;
+
+    // 2. Calculamos la longitud lógica de la extensión: el bloque de un directorio o los bloques que ocupa el fichero
     if (S_ISDIR(inode_info->mode))
-        inode->i_fop = &assoofs_dir_operations;
-    else if (S_ISREG(inode_info->mode))
-        inode->i_fop = &assoofs_file_operations;
+        length = ASSOOFS_DEFAULT_BLOCK_SIZE;
     else
+        length = round_up(inode_info->file_size, ASSOOFS_DEFAULT_BLOCK_SIZE);
+
+    // 3. Un fichero comprimido guarda más datos lógicos que su único bloque físico
+    if (inode_info->flags & ASSOOFS_INODE_COMPRESSED)
+        flags |= FIEMAP_EXTENT_ENCODED;
+    mutex_lock(&sbi->bitmap_lock);
+    if (sbi->asb->block_shared_refs[inode_info->data_block_number])
+        flags |= FIEMAP_EXTENT_SHARED;
+    mutex_unlock(&sbi->bitmap_lock);
+
+    // 4. Notificamos la extensión si el rango pedido la alcanza (un fichero vacío no tiene extensiones)
+    if (length > 0 && start < length)
+        ret = fiemap_fill_next_extent(fieinfo, 0, (u64)inode_info->data_block_number * ASSOOFS_DEFAULT_BLOCK_SIZE, length, flags);
+
+    inode_unlock_shared(inode);
+
+    // fiemap_fill_next_extent devuelve 1 cuando no caben más extensiones o se ha notificado la última
+    return ret < 0 ? ret : 0;
+}
+
+// ++++++++++++++++++++++++++++++++++
+// Definición de funciones de ioctl
+// ++++++++++++++++++++++++++++++++++
+
+long assoofs_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    // Declaración de variables (ISO C90)
+    struct super_block *sb;
+    long ret;
+
+    printk(KERN_INFO "assoofs_ioctl: request\n");
+
+    sb = file_inode(filp)->i_sb;
+
+    switch (cmd)
     {
-        printk(KERN_ERR "assoofs_get_inode: Unknown inode type. Neither a directory nor a file.");
-        return NULL;
+    // Las peticiones que modifican el disco esperan mientras el sistema de archivos está congelado
+    case FITRIM:
+        sb_start_write(sb);
+        ret = assoofs_ioctl_fitrim(sb, (struct fstrim_range __user *)arg);
+        sb_end_write(sb);
+        return ret;
+    case ASSOOFS_IOC_RESIZE:
+        sb_start_write(sb);
+        ret = assoofs_ioctl_resize(sb, (uint64_t __user *)arg);
+        sb_end_write(sb);
+        return ret;
+    case ASSOOFS_IOC_MOVE_BLOCK:
+        sb_start_write(sb);
+        ret = assoofs_ioctl_move_block(filp, (struct assoofs_move_block __user *)arg);
+        sb_end_write(sb);
+        return ret;
+    case ASSOOFS_IOC_SNAPSHOT:
+        return assoofs_ioctl_snapshot(sb, (int __user *)arg);
+    case ASSOOFS_IOC_GET_USAGE:
+        return assoofs_ioctl_get_usage(file_inode(filp), (struct assoofs_usage __user *)arg);
+    case ASSOOFS_IOC_BULK_CREATE:
+        sb_start_write(sb);
+        ret = assoofs_ioctl_bulk_create(filp, (struct assoofs_bulk_create __user *)arg);
+        sb_end_write(sb);
+        return ret;
+    default:
+        return -ENOTTY;
     }
+}
 
-    // Asignar fecha del sistema a los campos i_atime, i_mtime, i_ctime
-    inode->i_atime = inode->i_mtime = inode->i_ctime = current_time(inode);
+static int assoofs_ioctl_fitrim(struct super_block *sb, struct fstrim_range __user *urange)
+{
+    // Declaración de variables (ISO C90)
+    struct fstrim_range range;
+    uint64_t nr_blocks;
+    uint64_t first;
+    uint64_t last;
+    uint64_t minlen;
+    uint64_t trimmed;
+    int ret;
 
-    // Guardar la información persistente del inodo en el campo i_private
-    inode->i_private = inode_info;
+    printk(KERN_INFO "assoofs_ioctl_fitrim: request\n");
+
+    // 1. Comprobamos los permisos y que el dispositivo admita descartes
+    if (!capable(CAP_SYS_ADMIN))
+        return -EPERM;
+    if (!bdev_max_discard_sectors(sb->s_bdev))
+        return -EOPNOTSUPP;
+    if (copy_from_user(&range, urange, sizeof(range)) != 0)
+        return -EFAULT;
+
+    // 2. Convertimos el rango de bytes en un rango de bloques dentro del dispositivo
+    nr_blocks = assoofs_sb_nr_blocks(sb);
+    first = range.start >> sb->s_blocksize_bits;
+    if (first >= nr_blocks)
+        return -EINVAL;
+    // range.len suele ser ULLONG_MAX (todo el dispositivo), por lo que no se suma a range.start para evitar desbordamientos
+    last = (range.len >> sb->s_blocksize_bits) >= nr_blocks - first ? nr_blocks : first + (range.len >> sb->s_blocksize_bits);
+    minlen = max_t(uint64_t, range.minlen, bdev_discard_granularity(sb->s_bdev));
+    minlen = max_t(uint64_t, 1, DIV_ROUND_UP(minlen, sb->s_blocksize));
+
+    // 3. Descartamos los rangos libres sin que el asignador pueda reservar bloques mientras tanto
+    mutex_lock(&ASSOOFS_SB(sb)->bitmap_lock);
+    ret = assoofs_discard_free_runs(sb, ~0ULL, first, last, minlen, &trimmed);
+    mutex_unlock(&ASSOOFS_SB(sb)->bitmap_lock);
+    if (ret != 0)
+        return ret;
 
-    // 3. Devolver el inodo recién creado
-    return inode;
+    // 4. Devolvemos el número de bytes descartados
+    range.len = trimmed << sb->s_blocksize_bits;
+    if (copy_to_user(urange, &range, sizeof(range)) != 0)
+        return -EFAULT;
+
+    return 0;
 }
 
-void assoofs_save_sb_info(struct super_block *vsb)
+static int assoofs_ioctl_resize(struct super_block *sb, uint64_t __user *ucount)
 {
     // Declaración de variables (ISO C90)
-    struct buffer_head *bh;
-    struct assoofs_super_block_info *sb;
+    struct assoofs_super_block_info *assoofs_sb;
+    uint64_t count;
+    uint64_t old_count;
+    uint64_t max_count;
+    uint64_t i;
+
+    printk(KERN_INFO "assoofs_ioctl_resize: request\n");
+
+    // 1. Comprobamos los permisos y leemos el nuevo número de bloques
+    if (!capable(CAP_SYS_ADMIN))
+        return -EPERM;
+    if (sb_rdonly(sb))
+        return -EROFS;
+    if (copy_from_user(&count, ucount, sizeof(count)) != 0)
+        return -EFAULT;
+
+    // 2. El sistema de archivos no puede superar el tamaño actual del dispositivo ni el del mapa de bits
+    max_count = assoofs_bdev_nr_blocks(sb);
+    if (count == 0)
+        count = max_count;
+    if (count > max_count)
+    {
+        printk(KERN_ERR "assoofs_ioctl_resize: %llu blocks requested but at most %llu fit\n", count, max_count);
+        return -EINVAL;
+    }
 
-    printk(KERN_INFO "assoofs_save_sb_info: request\n");
+    mutex_lock(&ASSOOFS_SB(sb)->bitmap_lock);
 
-    // Cargamos la información persistente del superbloque
-    sb = vsb->s_fs_info;
+    // 3. Solo se admite ampliar el sistema de archivos
+    assoofs_sb = ASSOOFS_SB(sb)->asb;
+    old_count = assoofs_sb->blocks_count;
+    if (count < old_count)
+    {
+        mutex_unlock(&ASSOOFS_SB(sb)->bitmap_lock);
+        printk(KERN_ERR "assoofs_ioctl_resize: shrinking is not supported\n");
+        return -EINVAL;
+    }
 
-    // sb_bread se utiliza aquí para leer el superbloque del dispositivo de bloques (el bloque 0)
-    bh = sb_bread(vsb, ASSOOFS_SUPERBLOCK_BLOCK_NUMBER);
-    if (!bh)
+    // 4. Con la opción mem, los bloques añadidos también se retienen en memoria
+    if ((ASSOOFS_SB(sb)->mount_opt & ASSOOFS_MOUNT_MEM) && assoofs_mem_load(sb, old_count, count) != 0)
     {
-        printk(KERN_ERR "assoofs_save_sb_info: Reading the superblock failed\n");
-        return;
+        mutex_unlock(&ASSOOFS_SB(sb)->bitmap_lock);
+        return -EIO;
+    }
+
+    // 5. Marcamos los bloques añadidos como libres y sin compartir y guardamos el superbloque
+    assoofs_sb_lock(sb);
+    for (i = old_count; i < count; i++)
+    {
+        assoofs_sb->free_blocks |= (1ULL << i);
+        assoofs_sb->block_shared_refs[i] = 0;
     }
+    assoofs_sb->blocks_count = count;
+    assoofs_sb_unlock(sb);
+    assoofs_save_sb_info(sb);
 
-    // Sobreescribimos el contenido del buffer con la información persistente del superbloque
-    bh->b_data = (char *)sb;
+    mutex_unlock(&ASSOOFS_SB(sb)->bitmap_lock);
 
-    // Marcamos el buffer como modificado
-    mark_buffer_dirty(bh);
+    printk(KERN_INFO "assoofs_ioctl_resize: resized from %llu to %llu blocks\n", old_count, count);
 
-    // Sincrionizamos el buffer con el disco para reflejar los cambios
-    sync_dirty_buffer(bh);
+    // 6. Devolvemos el número de bloques resultante
+    if (copy_to_user(ucount, &count, sizeof(count)) != 0)
+        return -EFAULT;
 
-    // Liberamos el buffer con brelse
-    brelse(bh);
+    return 0;
 }
 
-int assoofs_sb_get_a_freeblock(struct super_block *sb, uint64_t *block)
+static int assoofs_ioctl_move_block(struct file *filp, struct assoofs_move_block __user *umove)
 {
     // Declaración de variables (ISO C90)
-    struct assoofs_super_block_info *assoofs_sb;
-    int i;
+    struct assoofs_move_block move;
+    struct assoofs_inode_info *inode_info;
+    struct inode *inode;
+    struct super_block *sb;
+    uint64_t old_block;
+    uint64_t new_block;
+    int ret;
 
-    printk(KERN_INFO "assoofs_sb_get_a_freeblock: request\n");
+    printk(KERN_INFO "assoofs_ioctl_move_block: request\n");
 
-    // Asignamos la información persistente del superbloque a una variable
-    assoofs_sb = sb->s_fs_info;
+    // 1. Comprobamos los permisos y leemos la petición
+    inode = file_inode(filp);
+    sb = inode->i_sb;
+    inode_info = inode->i_private;
+    if (!capable(CAP_SYS_ADMIN))
+        return -EPERM;
+    if (sb_rdonly(sb))
+        return -EROFS;
+    if (copy_from_user(&move, umove, sizeof(move)) != 0)
+        return -EFAULT;
+
+    // El inodo permanece bloqueado hasta que apunte al nuevo bloque (las escrituras y la creación de entradas esperan)
+    inode_lock(inode);
+
+    // 2. Los bloques compartidos (reflink) no se trasladan: habría que actualizar todos los inodos que los comparten
+    old_block = inode_info->data_block_number;
+    if (READ_ONCE(ASSOOFS_SB(sb)->asb->block_shared_refs[old_block]) > 0)
+    {
+        ret = -EBUSY;
+        goto out;
+    }
 
-    // Recorremos el mapa de bits de bloques libres en busca del primer bloque libre (bit a 1)
-    // Empezamos por el bloque 2 porque el bloque 0 es el superbloque y el bloque 1 es el almacén de inodos)
-    for (i = 2; i < ASSOOFS_MAX_FILESYSTEM_OBJECTS_SUPPORTED; i++)
-        // Si el bit i-ésimo es 1, hemos encontrado un bloque libre
-        if (assoofs_sb->free_blocks & (1 << i))
+    // 3. Reservamos el bloque de destino y copiamos en él el contenido actual
+    ret = assoofs_sb_get_a_freeblock_from(sb, move.goal, &new_block);
+    if (ret != 0)
+    {
+        ret = -ENOSPC;
+        goto out;
+    }
+    ret = assoofs_copy_block(sb, old_block, new_block);
+    if (ret != 0)
+    {
+        assoofs_sb_put_block(sb, new_block);
+        goto out;
+    }
+
+    // 4. El inodo pasa a apuntar al nuevo bloque y se libera el antiguo
+    inode_info->data_block_number = new_block;
+    if (assoofs_save_inode_info(sb, inode_info) != 0)
+    {
+        inode_info->data_block_number = old_block;
+        assoofs_sb_put_block(sb, new_block);
+        ret = -EIO;
+        goto out;
+    }
+    assoofs_sb_put_block(sb, old_block);
+
+    // 5. Devolvemos el bloque en el que ha quedado el fichero
+    move.block = new_block;
+    if (copy_to_user(umove, &move, sizeof(move)) != 0)
+        ret = -EFAULT;
+
+out:
+    inode_unlock(inode);
+    return ret;
+}
+
+static int assoofs_ioctl_snapshot(struct super_block *sb, int __user *ufd)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(sb);
+    struct assoofs_super_block_info *copy = NULL;
+    struct buffer_head *bh;
+    struct file *image;
+    const void *data;
+    uint64_t i;
+    loff_t pos;
+    ssize_t written;
+    int fd;
+    int ret = 0;
+
+    printk(KERN_INFO "assoofs_ioctl_snapshot: request\n");
+
+    // 1. Comprobamos los permisos y obtenemos el fichero imagen
+    if (!capable(CAP_SYS_ADMIN))
+        return -EPERM;
+    if (copy_from_user(&fd, ufd, sizeof(fd)) != 0)
+        return -EFAULT;
+    image = fget(fd);
+    if (!image)
+        return -EBADF;
+    // La imagen no puede estar en el propio sistema de archivos: se escribe con él congelado
+    if (!(image->f_mode & FMODE_WRITE) || file_inode(image)->i_sb == sb)
+    {
+        fput(image);
+        return -EINVAL;
+    }
+
+    // 2. Congelamos el sistema de archivos para que ninguna operación lo modifique durante la copia
+    ret = freeze_super(sb);
+    if (ret)
+    {
+        fput(image);
+        return ret;
+    }
+
+    // 3. Copiamos todos los bloques en la imagen (desde memoria con la opción mem)
+    // La imagen ocupa un solo dispositivo: en su copia del superbloque no figuran los dispositivos miembros
+    if (sbi->ndevs > 1)
+    {
+        copy = kmemdup(sbi->asb, ASSOOFS_DEFAULT_BLOCK_SIZE, GFP_KERNEL);
+        if (!copy)
+            ret = -ENOMEM;
+        else
+        {
+            copy->devices_count = 0;
+            copy->set_id = 0;
+            assoofs_block_checksum_set(copy);
+        }
+    }
+    // Pedimos primero todas las lecturas sin esperar: así se leen a la vez de todos los dispositivos
+    for (i = 0; ret == 0 && i < assoofs_sb_nr_blocks(sb); i++)
+        if (!sbi->mem_bh[i])
+            assoofs_breadahead(sb, i);
+    for (i = 0; ret == 0 && i < assoofs_sb_nr_blocks(sb); i++)
+    {
+        bh = sbi->mem_bh[i] ? sbi->mem_bh[i] : assoofs_bread(sb, i);
+        if (!bh)
+        {
+            printk(KERN_ERR "assoofs_ioctl_snapshot: Reading the block number [%llu] failed\n", i);
+            ret = -EIO;
+            break;
+        }
+
+        pos = i * ASSOOFS_DEFAULT_BLOCK_SIZE;
+        data = (i == ASSOOFS_SUPERBLOCK_BLOCK_NUMBER && copy) ? (const void *)copy : (const void *)bh->b_data;
+        written = kernel_write(image, data, ASSOOFS_DEFAULT_BLOCK_SIZE, &pos);
+        if (bh != sbi->mem_bh[i])
+            brelse(bh);
+        if (written != ASSOOFS_DEFAULT_BLOCK_SIZE)
+        {
+            printk(KERN_ERR "assoofs_ioctl_snapshot: Writing the block number [%llu] failed\n", i);
+            ret = written < 0 ? written : -EIO;
             break;
+        }
+    }
+
+    // 4. Descongelamos el sistema de archivos y nos aseguramos de que la imagen llega al disco
+    thaw_super(sb);
+    kfree(copy);
+    if (ret == 0)
+        ret = vfs_fsync(image, 0);
+    fput(image);
+
+    if (ret == 0)
+        printk(KERN_INFO "assoofs_ioctl_snapshot: %llu blocks saved\n", assoofs_sb_nr_blocks(sb));
+    return ret;
+}
+
+static int assoofs_ioctl_get_usage(struct inode *inode, struct assoofs_usage __user *uusage)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(inode->i_sb);
+    struct assoofs_inode_info *inode_info = inode->i_private;
+    struct assoofs_usage usage;
+
+    printk(KERN_INFO "assoofs_ioctl_get_usage: request\n");
+
+    // Un fichero es un subárbol de un solo inodo; un directorio guarda el uso de todo su subárbol
+    memset(&usage, 0, sizeof(usage));
+    if (S_ISDIR(inode_info->mode))
+    {
+        spin_lock(&sbi->usage_lock);
+        usage.bytes = inode_info->tree_size;
+        usage.inodes = inode_info->tree_inodes;
+        spin_unlock(&sbi->usage_lock);
+    }
+    else
+    {
+        usage.bytes = inode_info->file_size;
+        usage.inodes = 1;
+    }
+
+    if (copy_to_user(uusage, &usage, sizeof(usage)) != 0)
+        return -EFAULT;
+    return 0;
+}
+
+static int assoofs_ioctl_bulk_create(struct file *filp, struct assoofs_bulk_create __user *ureq)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_bulk_create req;
+    struct assoofs_bulk_entry *entries;
+    struct assoofs_inode_info *inodes = NULL;
+    struct assoofs_inode_info *dir_info;
+    struct assoofs_dir_record_entry *record;
+    struct buffer_head **bhs = NULL;
+    struct buffer_head *bh;
+    struct dentry *dentry;
+    struct dentry *child;
+    struct iov_iter iter;
+    struct iovec iov;
+    struct inode *dir;
+    struct super_block *sb;
+    struct timespec64 now;
+    struct qstr qname;
+    uint64_t *blocks = NULL;
+    uint64_t children;
+    uint64_t first;
+    int64_t bytes = 0;
+    size_t max_size;
+    size_t len;
+    unsigned int i;
+    unsigned int j;
+    int ret;
+
+    printk(KERN_INFO "assoofs_ioctl_bulk_create: request\n");
+
+    // 1. Comprobamos los permisos y leemos la petición
+    dentry = filp->f_path.dentry;
+    dir = file_inode(filp);
+    sb = dir->i_sb;
+    dir_info = dir->i_private;
+    if (!S_ISDIR(dir_info->mode))
+        return -ENOTDIR;
+    if (sb_rdonly(sb))
+        return -EROFS;
+    ret = file_permission(filp, MAY_WRITE | MAY_EXEC);
+    if (ret)
+        return ret;
+    if (copy_from_user(&req, ureq, sizeof(req)) != 0)
+        return -EFAULT;
+    if (req.reserved != 0 || req.count > ASSOOFS_MAX_FILESYSTEM_OBJECTS_SUPPORTED)
+        return -EINVAL;
+    if (req.count == 0)
+        return 0;
+
+    // 2. Copiamos las entradas y reservamos los vectores de trabajo
+    entries = memdup_user(u64_to_user_ptr(req.entries), req.count * sizeof(*entries));
+    if (IS_ERR(entries))
+        return PTR_ERR(entries);
+    inodes = kcalloc(req.count, sizeof(*inodes), GFP_KERNEL);
+    bhs = kcalloc(req.count, sizeof(*bhs), GFP_KERNEL);
+    blocks = kcalloc(req.count, sizeof(*blocks), GFP_KERNEL);
+    if (!inodes || !bhs || !blocks)
+    {
+        ret = -ENOMEM;
+        goto out_free;
+    }
+
+    // El directorio permanece bloqueado durante toda la creación, igual que en assoofs_create
+    inode_lock(dir);
+
+    // 3. Comprobamos todas las entradas antes de modificar nada
+    // 3.1. Debe haber sitio para todas en el almacén de inodos y en el bloque del directorio
+    // El almacén de inodos se vuelve a comprobar bajo istore_lock al añadirlas (paso 6)
+    if (ASSOOFS_SB(sb)->asb->inodes_count + req.count > assoofs_core_max_inodes(ASSOOFS_SB(sb)->asb) ||
+        dir_info->dir_children_count + req.count > ASSOOFS_DIR_ENTRIES_PER_BLOCK)
+    {
+        ret = -ENOSPC;
+        goto out_unlock;
+    }
+
+    // 3.2. Nombres válidos y sin repetir, tipos admitidos y contenidos que quepan en un bloque
+    max_size = (ASSOOFS_SB(sb)->mount_opt & ASSOOFS_MOUNT_COMPRESS) ? ASSOOFS_MAX_COMPRESSED_FILE_SIZE : ASSOOFS_DEFAULT_BLOCK_SIZE;
+    for (i = 0; i < req.count; i++)
+    {
+        len = strnlen(entries[i].filename, ASSOOFS_FILENAME_MAXLEN);
+        if (len == 0 || len >= ASSOOFS_FILENAME_MAXLEN || strchr(entries[i].filename, '/') ||
+            strcmp(entries[i].filename, ".") == 0 || strcmp(entries[i].filename, "..") == 0)
+        {
+            ret = -EINVAL;
+            goto out_unlock;
+        }
+        if ((entries[i].mode & S_IFMT) == 0)
+            entries[i].mode |= S_IFREG;
+        if ((!S_ISREG(entries[i].mode) && !S_ISDIR(entries[i].mode)) || (S_ISDIR(entries[i].mode) && entries[i].size != 0))
+        {
+            ret = -EINVAL;
+            goto out_unlock;
+        }
+        if (entries[i].size > max_size)
+        {
+            ret = -EFBIG;
+            goto out_unlock;
+        }
+        for (j = 0; j < i; j++)
+        {
+            if (strcmp(entries[i].filename, entries[j].filename) == 0)
+            {
+                ret = -EEXIST;
+                goto out_unlock;
+            }
+        }
+    }
+
+    // 3.3. Ningún nombre puede existir ya en el directorio
+    bh = assoofs_meta_bread(sb, dir_info->data_block_number);
+    if (!bh)
+    {
+        printk(KERN_ERR "assoofs_ioctl_bulk_create: Reading the block number [%llu] failed\n", dir_info->data_block_number);
+        ret = -EIO;
+        goto out_unlock;
+    }
+    record = (struct assoofs_dir_record_entry *)bh->b_data;
+    children = min_t(uint64_t, dir_info->dir_children_count, ASSOOFS_DIR_ENTRIES_PER_BLOCK);
+    for (j = 0; j < children; j++, record++)
+    {
+        for (i = 0; i < req.count; i++)
+        {
+            if (strcmp(record->filename, entries[i].filename) == 0)
+            {
+                brelse(bh);
+                ret = -EEXIST;
+                goto out_unlock;
+            }
+        }
+    }
+    brelse(bh);
+
+    // 4. Reservamos los bloques de datos de todas las entradas (una sola escritura del superbloque)
+    ret = assoofs_sb_get_free_blocks(sb, blocks, req.count);
+    if (ret)
+        goto out_unlock;
+
+    // 5. Preparamos los inodos y el contenido de sus bloques de datos
+    // Los números de inodo se obtienen en el paso 6: el contador se guarda en disco, y un fallo aquí los perdería
+    now = current_time(dir);
+    for (i = 0; i < req.count; i++)
+    {
+        inodes[i].mode = entries[i].mode;
+        inodes[i].data_block_number = blocks[i];
+        inodes[i].atime = inodes[i].mtime = inodes[i].ctime = timespec64_to_ns(&now);
+        if (S_ISDIR(entries[i].mode))
+        {
+            inodes[i].dir_children_count = 0;
+            inodes[i].tree_inodes = 1;
+        }
+        else if (ASSOOFS_SB(sb)->mount_opt & ASSOOFS_MOUNT_COMPRESS)
+            inodes[i].flags = ASSOOFS_INODE_COMPRESSED;
+
+        bhs[i] = assoofs_bread(sb, blocks[i]);
+        if (!bhs[i])
+        {
+            printk(KERN_ERR "assoofs_ioctl_bulk_create: Reading the block number [%llu] failed\n", blocks[i]);
+            ret = -EIO;
+            goto out_put;
+        }
+        memset(bhs[i]->b_data, 0, bhs[i]->b_size);
+
+        // El contenido se copia igual que en assoofs_write_iter (comprimido si el fichero se almacena comprimido)
+        if (entries[i].size > 0)
+        {
+            if (inodes[i].flags & ASSOOFS_INODE_COMPRESSED)
+            {
+                // assoofs_compressed_write lee el contenido de un iov_iter, igual que desde assoofs_write_iter
+                ret = import_single_range(WRITE, u64_to_user_ptr(entries[i].data), entries[i].size, &iov, &iter);
+                if (ret == 0)
+                    ret = assoofs_compressed_write(bhs[i], &inodes[i], &iter, entries[i].size, 0);
+            }
+            else if (copy_from_user(bhs[i]->b_data, u64_to_user_ptr(entries[i].data), entries[i].size) != 0)
+                ret = -EFAULT;
+            if (ret)
+                goto out_put;
+            inodes[i].file_size = entries[i].size;
+            bytes += entries[i].size;
+        }
+        // Los bloques de los directorios son metadatos: se escriben vacíos y con su suma de comprobación
+        if (S_ISDIR(entries[i].mode))
+            assoofs_mark_meta_dirty(bhs[i]);
+        else
+            mark_buffer_dirty(bhs[i]);
+    }
 
-    // Comprobamos que no hayamos alcanzado el límite de bloques de objetos soportados por el sistema de ficheros (restamos 2 por el superbloque y el almacén de inodos)
-    if (i >= ASSOOFS_MAX_FILESYSTEM_OBJECTS_SUPPORTED - 2)
+    // 5.1. Escribimos todos los bloques de datos a la vez, antes de que ningún inodo apunte a ellos
+    ret = assoofs_write_buffers(sb, bhs, req.count);
+    if (ret)
+        goto out_put;
+
+    // 6. Numeramos los inodos y los añadimos todos al almacén de inodos (una escritura del almacén y otra del superbloque)
+    // Si no se pueden añadir, los números se devuelven antes de que el superbloque se vuelva a guardar (out_put)
+    first = assoofs_sb_get_inode_numbers(sb, req.count);
+    for (i = 0; i < req.count; i++)
+        inodes[i].inode_no = first + i;
+    ret = assoofs_add_inode_infos(sb, inodes, req.count);
+    if (ret)
     {
-        printk(KERN_ERR "assoofs_sb_get_a_freeblock: No more free blocks available");
-        return -1;
+        assoofs_sb_put_inode_numbers(sb, first, req.count);
+        goto out_put;
     }
 
-    // Asignamos el bloque libre encontrado a la variable block
-    *block = i;
+    // 7. Añadimos todas las entradas al bloque del directorio (una sola escritura)
+    bh = assoofs_meta_bread(sb, dir_info->data_block_number);
+    if (!bh)
+    {
+        printk(KERN_ERR "assoofs_ioctl_bulk_create: Reading the block number [%llu] failed\n", dir_info->data_block_number);
+        ret = -EIO;
+        goto out_release;
+    }
+    record = (struct assoofs_dir_record_entry *)bh->b_data;
+    record += dir_info->dir_children_count;
+    for (i = 0; i < req.count; i++, record++)
+    {
+        strcpy(record->filename, entries[i].filename);
+        record->inode_no = inodes[i].inode_no;
+    }
+    assoofs_mark_meta_dirty(bh);
+    assoofs_sync_dirty_buffer(sb, bh);
+    brelse(bh);
 
-    // Marcamos el bloque como ocupado (bit a 0)
-    assoofs_sb->free_blocks &= ~(1 << i);
+    // 8. Actualizamos el directorio: número de hijos, fechas y uso recursivo (una sola escritura de su inodo)
+    dir_info->dir_children_count += req.count;
+    dir->i_mtime = dir->i_ctime = now;
+    assoofs_inode_info_set_times(dir_info, dir);
+    spin_lock(&ASSOOFS_SB(sb)->usage_lock);
+    dir_info->tree_inodes += req.count;
+    dir_info->tree_size += bytes;
+    spin_unlock(&ASSOOFS_SB(sb)->usage_lock);
+    if (assoofs_save_inode_info(sb, dir_info) != 0)
+    {
+        printk(KERN_ERR "assoofs_ioctl_bulk_create: Error while saving inode info\n");
+        ret = -EIO;
+        goto out_release;
+    }
+    // Los antecesores se actualizan en memoria y se guardan más tarde (assoofs_usage_add)
+    if (!IS_ROOT(dentry))
+        assoofs_usage_add(dentry, bytes, req.count);
 
-    // Guardamos la información persistente del superbloque
-    assoofs_save_sb_info(sb);
+    // 9. Las búsquedas anteriores pueden haber dejado dentries negativos con estos nombres: los retiramos
+    // para que la siguiente búsqueda lea el directorio y encuentre la nueva entrada
+    for (i = 0; i < req.count; i++)
+    {
+        qname.name = entries[i].filename;
+        qname.len = strlen(entries[i].filename);
+        child = d_hash_and_lookup(dentry, &qname);
+        if (IS_ERR_OR_NULL(child))
+            continue;
+        if (d_really_is_negative(child))
+            d_drop(child);
+        dput(child);
+    }
 
-    // Devolvemos 0 para indicar que todo ha ido bien
-    return 0;
+    ret = req.count;
+    goto out_release;
+
+out_put:
+    // Soltamos los bloques reservados: ningún inodo apunta todavía a ellos
+    for (i = 0; i < req.count; i++)
+        assoofs_sb_put_block(sb, blocks[i]);
+out_release:
+    for (i = 0; i < req.count; i++)
+        brelse(bhs[i]);
+out_unlock:
+    inode_unlock(dir);
+out_free:
+    kfree(blocks);
+    kfree(bhs);
+    kfree(inodes);
+    kfree(entries);
+    return ret;
 }
 
-void assoofs_add_inode_info(struct super_block *sb, struct assoofs_inode_info *inode)
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// Definición de funciones de la caché de metadatos (metacache)
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+static int assoofs_metacache_build(struct super_block *sb)
 {
     // Declaración de variables (ISO C90)
-    struct buffer_head *bh;
-    struct assoofs_super_block_info *assoofs_sb;
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(sb);
+    struct assoofs_metacache *mc;
+    struct assoofs_metacache_dir *dir;
     struct assoofs_inode_info *inode_info;
-
-    printk(KERN_INFO "assoofs_add_inode_info: request\n");
-
-    // Asignamos la información persistente del superbloque a una variable
-    assoofs_sb = sb->s_fs_info;
-
-    // sb_bread se utiliza aquí para leer el bloque que contiene el almacén de inodos (el bloque 1)
-    bh = sb_bread(sb, ASSOOFS_INODESTORE_BLOCK_NUMBER);
+    struct assoofs_dir_record_entry *record;
+    struct buffer_head *bh;
+    uint64_t start = ktime_get_ns();
+    uint64_t children;
+    char *names;
+    size_t len;
+    uint32_t i;
+    uint32_t j;
+    int ret = -ENOMEM;
+
+    printk(KERN_INFO "assoofs_metacache_build: request\n");
+
+    mc = kzalloc(sizeof(*mc), GFP_KERNEL);
+    if (!mc)
+        return -ENOMEM;
+
+    // 1. Copiamos el almacén de inodos y lo ordenamos por número de inodo
+    bh = assoofs_meta_bread(sb, ASSOOFS_INODESTORE_BLOCK_NUMBER);
     if (!bh)
     {
-        printk(KERN_ERR "assoofs_add_inode_info: Reading the inode store failed\n");
-        return;
+        printk(KERN_ERR "assoofs_metacache_build: reading the inode store failed\n");
+        ret = -EIO;
+        goto fail;
     }
+    mc->inodes_count = min_t(uint64_t, sbi->asb->inodes_count, ASSOOFS_MAX_FILESYSTEM_OBJECTS_SUPPORTED);
+    mc->inodes = kvmalloc_array(mc->inodes_count, sizeof(*mc->inodes), GFP_KERNEL);
+    if (!mc->inodes)
+    {
+        brelse(bh);
+        goto fail;
+    }
+    memcpy(mc->inodes, bh->b_data, mc->inodes_count * sizeof(*mc->inodes));
+    brelse(bh);
+    sort(mc->inodes, mc->inodes_count, sizeof(*mc->inodes), assoofs_metacache_cmp_inode, NULL);
 
-    // Obtenemos un puntero al primer inodo del almacén de inodos
-    inode_info = kmem_cache_alloc(assoofs_inode_cache, GFP_KERNEL);
-    inode_info = (struct assoofs_inode_info *)bh->b_data;
-    // Movemos el puntero al final del almacén de inodos para añadir el nuevo inodo
-    inode_info += assoofs_sb->inodes_count;
-    // Copiamos la información persistente del inodo en el almacén de inodos
-    memcpy(inode_info, inode, sizeof(struct assoofs_inode_info));
+    // 2. Contamos los directorios y sus entradas para reservar las tablas de una vez
+    children = 0;
+    for (i = 0; i < mc->inodes_count; i++)
+    {
+        if (S_ISDIR(mc->inodes[i].mode))
+        {
+            mc->dirs_count++;
+            children += min_t(uint64_t, mc->inodes[i].dir_children_count, ASSOOFS_DIR_ENTRIES_PER_BLOCK);
+        }
+    }
+    mc->dirs = kvmalloc_array(mc->dirs_count, sizeof(*mc->dirs), GFP_KERNEL);
+    mc->entries = kvmalloc_array(children, sizeof(*mc->entries), GFP_KERNEL);
+    // Los nombres se copian primero en una tabla del tamaño máximo y después en una del tamaño justo
+    mc->names = kvmalloc(children * (ASSOOFS_FILENAME_MAXLEN + 1), GFP_KERNEL);
+    if (!mc->dirs || !mc->entries || !mc->names)
+        goto fail;
+
+    // 3. Leemos el bloque de cada directorio y copiamos sus entradas, ordenadas por nombre
+    // Los directorios quedan ordenados por número de inodo porque el almacén de inodos ya lo está
+    dir = mc->dirs;
+    for (i = 0; i < mc->inodes_count; i++)
+    {
+        inode_info = &mc->inodes[i];
+        if (!S_ISDIR(inode_info->mode))
+            continue;
 
-    // Marcamos el buffer como modificado
-    mark_buffer_dirty(bh);
+        bh = assoofs_meta_bread(sb, inode_info->data_block_number);
+        if (!bh)
+        {
+            printk(KERN_ERR "assoofs_metacache_build: Reading the block number [%llu] failed\n", inode_info->data_block_number);
+            ret = -EIO;
+            goto fail;
+        }
 
-    // Sinconizamos el buffer con el disco para reflejar los cambios
-    sync_dirty_buffer(bh);
+        dir->inode_no = inode_info->inode_no;
+        dir->first = mc->entries_count;
+        dir->count = min_t(uint64_t, inode_info->dir_children_count, ASSOOFS_DIR_ENTRIES_PER_BLOCK);
+        record = (struct assoofs_dir_record_entry *)bh->b_data;
+        for (j = 0; j < dir->count; j++, record++)
+        {
+            len = strnlen(record->filename, ASSOOFS_FILENAME_MAXLEN);
+            memcpy(mc->names + mc->names_size, record->filename, len);
+            mc->names[mc->names_size + len] = '\0';
+            mc->entries[mc->entries_count].name = mc->names_size;
+            mc->entries[mc->entries_count].inode_no = record->inode_no;
+            mc->names_size += len + 1;
+            mc->entries_count++;
+        }
+        brelse(bh);
 
-    // Actualizamos el contador de inodos del superbloque
-    assoofs_sb->inodes_count++;
+        sort_r(&mc->entries[dir->first], dir->count, sizeof(*mc->entries), assoofs_metacache_cmp_entry, NULL, mc->names);
+        dir++;
+    }
 
-    // Guardamos la información persistente del superbloque
-    assoofs_save_sb_info(sb);
+    // 4. Ajustamos la tabla de cadenas a su tamaño real
+    names = kvmalloc(mc->names_size, GFP_KERNEL);
+    if (!names)
+        goto fail;
+    memcpy(names, mc->names, mc->names_size);
+    kvfree(mc->names);
+    mc->names = names;
+
+    // 5. Anotamos la memoria ocupada y el tiempo de construcción
+    mc->bytes = sizeof(*mc) + mc->inodes_count * sizeof(*mc->inodes) + mc->dirs_count * sizeof(*mc->dirs) +
+                mc->entries_count * sizeof(*mc->entries) + mc->names_size;
+    mc->load_ns = ktime_get_ns() - start;
+    sbi->metacache = mc;
+
+    printk(KERN_INFO "assoofs: metacache of %s loaded in %llu us: %u inodes, %u directories, %u entries, %zu bytes\n",
+           sb->s_id, mc->load_ns / NSEC_PER_USEC, mc->inodes_count, mc->dirs_count, mc->entries_count, mc->bytes);
+    return 0;
 
-    // Liberamos el buffer con brelse
-    brelse(bh);
+fail:
+    assoofs_metacache_free(mc);
+    return ret;
 }
 
-struct assoofs_inode_info *assoofs_search_inode_info(struct super_block *sb, struct assoofs_inode_info *start, struct assoofs_inode_info *search)
+static void assoofs_metacache_free(struct assoofs_metacache *mc)
 {
-    // Declaración de variables (ISO C90)
-    uint64_t count = 0;
+    if (!mc)
+        return;
 
-    printk(KERN_INFO "assoofs_search_inode_info: request\n");
+    kvfree(mc->inodes);
+    kvfree(mc->dirs);
+    kvfree(mc->entries);
+    kvfree(mc->names);
+    kfree(mc);
+}
 
-    // Recorremos el almacén de inodos desde el inicio hasta encontrar el inodo buscado o hasta llegar al final
-    while (start->inode_no != search->inode_no && count < ((struct assoofs_super_block_info *)sb->s_fs_info)->inodes_count)
+static struct assoofs_inode_info *assoofs_metacache_inode(struct assoofs_metacache *mc, uint64_t inode_no)
+{
+    // Declaración de variables (ISO C90)
+    uint32_t lo = 0;
+    uint32_t hi = mc->inodes_count;
+    uint32_t mid;
+
+    while (lo < hi)
     {
-        count++;
-        start++;
+        mid = lo + (hi - lo) / 2;
+        if (mc->inodes[mid].inode_no < inode_no)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
 
-    // Verificamos que el inodo buscado se haya encontrado
-    if (start->inode_no == search->inode_no)
-        return start;
-    else
-        return NULL;
+    return (lo < mc->inodes_count && mc->inodes[lo].inode_no == inode_no) ? &mc->inodes[lo] : NULL;
 }
 
-int assoofs_save_inode_info(struct super_block *sb, struct assoofs_inode_info *inode_info)
+static struct assoofs_metacache_dir *assoofs_metacache_dir(struct assoofs_metacache *mc, uint64_t inode_no)
 {
     // Declaración de variables (ISO C90)
-    struct buffer_head *bh;
-    struct assoofs_inode_info *inode_pos;
-
-    printk(KERN_INFO "assoofs_save_inode_info: request\n");
+    uint32_t lo = 0;
+    uint32_t hi = mc->dirs_count;
+    uint32_t mid;
 
-    // sb_bread se utiliza aquí para leer el bloque que contiene el almacén de inodos (el bloque 1)
-    bh = sb_bread(sb, ASSOOFS_INODESTORE_BLOCK_NUMBER);
-    if (!bh)
+    while (lo < hi)
     {
-        printk(KERN_ERR "assoofs_save_inode_info: Reading the inode store failed\n");
-        return -1;
+        mid = lo + (hi - lo) / 2;
+        if (mc->dirs[mid].inode_no < inode_no)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
 
-    // Buscamos los datos del inodo en el almacén de inodos
-    inode_pos = assoofs_search_inode_info(sb, (struct assoofs_inode_info *)bh->b_data, inode_info);
-    if (!inode_pos)
-    {
-        printk(KERN_ERR "assooofs_save_inode_info: Inode not found\n");
-        return -1;
-    }
+    return (lo < mc->dirs_count && mc->dirs[lo].inode_no == inode_no) ? &mc->dirs[lo] : NULL;
+}
 
-    // Actualizamos el inodo en el almacén de inodos
-    memcpy(inode_pos, inode_info, sizeof(*inode_pos));
+static struct assoofs_metacache_entry *assoofs_metacache_lookup(struct assoofs_metacache *mc, struct assoofs_metacache_dir *dir, const char *name)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_metacache_entry *entries = &mc->entries[dir->first];
+    uint32_t lo = 0;
+    uint32_t hi = dir->count;
+    uint32_t mid;
+    int cmp;
 
-    // Marcamos el buffer como modificado
-    mark_buffer_dirty(bh);
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        cmp = strcmp(mc->names + entries[mid].name, name);
+        if (cmp == 0)
+            return &entries[mid];
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
 
-    // Sinconizamos el buffer con el disco para reflejar los cambios
-    sync_dirty_buffer(bh);
+    return NULL;
+}
 
-    // Liberamos el buffer con brelse
-    brelse(bh);
+static int assoofs_metacache_cmp_inode(const void *a, const void *b)
+{
+    // Declaración de variables (ISO C90)
+    const struct assoofs_inode_info *ia = a;
+    const struct assoofs_inode_info *ib = b;
 
-    // Devolvemos 0 para indicar que todo ha ido bien
-    return 0;
+    if (ia->inode_no == ib->inode_no)
+        return 0;
+    return ia->inode_no < ib->inode_no ? -1 : 1;
 }
 
-// +++++++++++++++++++++++++++++++++++++++++++++++++++++
-// Definición de funciones de operaciones sobre ficheros
-// +++++++++++++++++++++++++++++++++++++++++++++++++++++
-
-ssize_t assoofs_read(struct file *filp, char __user *buf, size_t len, loff_t *ppos)
+static int assoofs_metacache_cmp_entry(const void *a, const void *b, const void *names)
 {
     // Declaración de variables (ISO C90)
-    int nbytes;
-    struct super_block *sb;
-    struct assoofs_inode_info *inode_info;
-    struct buffer_head *bh;
-    char *buffer;
-
-    printk(KERN_INFO "assoofs_read: request\n");
+    const struct assoofs_metacache_entry *ea = a;
+    const struct assoofs_metacache_entry *eb = b;
 
-    // 1. Obtenemos la información persistente del superbloque
-    sb = filp->f_path.dentry->d_inode->i_sb;
+    return strcmp((const char *)names + ea->name, (const char *)names + eb->name);
+}
 
-    // 2. Obtenemos la información persistente del inodo
-    inode_info = kmem_cache_alloc(assoofs_inode_cache, GFP_KERNEL);
-    inode_info = filp->f_path.dentry->d_inode->i_private;
+// ++++++++++++++++++++++++++++++++
+// Definición de funciones de sysfs
+// ++++++++++++++++++++++++++++++++
 
-    // 3. Comprobamos que no hayamos llegado al final del fichero con el puntero de posición
-    if (*ppos >= inode_info->file_size)
-        return 0;
+static int assoofs_sysfs_register(struct super_block *sb)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(sb);
+    int ret;
 
-    // 4. Accedemos al contenido del fichero y obtenemos un puntero al contenido del fichero
-    bh = sb_bread(sb, inode_info->data_block_number);
-    if (!bh)
+    init_completion(&sbi->kobj_unregister);
+    ret = kobject_init_and_add(&sbi->kobj, &assoofs_sb_ktype, assoofs_kobj, "%s", sb->s_id);
+    if (ret)
     {
-        printk(KERN_ERR "assoofs_read: Reading the block number [%llu] failed\n", inode_info->data_block_number);
-        return -1;
+        printk(KERN_ERR "assoofs_sysfs_register: can't register %s in sysfs\n", sb->s_id);
+        kobject_put(&sbi->kobj);
+        wait_for_completion(&sbi->kobj_unregister);
     }
-    buffer = (char *)bh->b_data;
 
-    // 5. Copiamos el contenido del fichero al buffer de usuario
-    // Incrementamos el buffer para que lea a partir de donde se quedó
-    buffer += *ppos;
-    // Calculamos el número de bytes que podemos leer a partir de la posición actual (mínimo entre la cantidad restante en el fichero y len)
-    nbytes = min((size_t)inode_info->file_size - (size_t)*ppos, len);
-    // Copiamos los bytes del fichero al buffer de usuario (argumento buf)
-    if (copy_to_user(buf, buffer, nbytes) != 0)
-    {
-        printk(KERN_ERR "assoofs_read: Error copying file contents to user buffer\n");
-        return -1;
-    }
+    return ret;
+}
 
-    // 7. Actualizamos el puntero de posición
-    *ppos += nbytes;
+static void assoofs_sysfs_unregister(struct super_block *sb)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(sb);
 
-    // 8. Liberamos el buffer con brelse
-    brelse(bh);
+    // Los lectores de los atributos mantienen referencias: esperamos a que las suelten antes de liberar sbi
+    kobject_del(&sbi->kobj);
+    kobject_put(&sbi->kobj);
+    wait_for_completion(&sbi->kobj_unregister);
+}
 
-    // 9. Devolvemos el número de bytes leídos
-    return nbytes;
+static ssize_t assoofs_attr_show(struct kobject *kobj, struct attribute *attr, char *buf)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = container_of(kobj, struct assoofs_sb_info, kobj);
+    struct assoofs_attr *a = container_of(attr, struct assoofs_attr, attr);
+
+    return a->show ? a->show(sbi, buf) : -EIO;
 }
 
-ssize_t assoofs_write(struct file *filp, const char __user *buf, size_t len, loff_t *ppos)
+static ssize_t assoofs_attr_store(struct kobject *kobj, struct attribute *attr, const char *buf, size_t len)
 {
     // Declaración de variables (ISO C90)
-    struct super_block *sb;
-    struct assoofs_inode_info *inode_info;
-    struct buffer_head *bh;
-    char *buffer;
+    struct assoofs_sb_info *sbi = container_of(kobj, struct assoofs_sb_info, kobj);
+    struct assoofs_attr *a = container_of(attr, struct assoofs_attr, attr);
 
-    printk(KERN_INFO "assoofs_write: request\n");
+    return a->store ? a->store(sbi, buf, len) : -EIO;
+}
 
-    // 1. Obtenemos la información persistente del superbloque
-    sb = filp->f_path.dentry->d_inode->i_sb;
+static void assoofs_sb_release(struct kobject *kobj)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = container_of(kobj, struct assoofs_sb_info, kobj);
 
-    // 2. Obtenemos la información persistente del inodo
-    inode_info = kmem_cache_alloc(assoofs_inode_cache, GFP_KERNEL);
-    inode_info = filp->f_path.dentry->d_inode->i_private;
+    complete(&sbi->kobj_unregister);
+}
 
-    // 3. Comprobamos que el valor de ppos sumado a al tamaño de los datos a escribir no supere el tamaño máximo de un fichero
-    if (*ppos + len > ASSOOFS_DEFAULT_BLOCK_SIZE)
-    {
-        printk(KERN_ERR "assooofs_write: The file is too large to write it completely\n");
-        return -1;
-    }
+static ssize_t assoofs_metacache_bytes_show(struct assoofs_sb_info *sbi, char *buf)
+{
+    return sysfs_emit(buf, "%zu\n", sbi->metacache ? sbi->metacache->bytes : 0);
+}
 
-    // 4. Accedemos al contenido del fichero y obtenemos un puntero al contenido del fichero
-    bh = sb_bread(sb, inode_info->data_block_number);
-    if (!bh)
-    {
-        printk(KERN_ERR "assooofs_write: Reading the block number [%llu] failed\n", inode_info->data_block_number);
-        return -1;
-    }
-    buffer = (char *)bh->b_data;
-    // Incrementamos el buffer para que escriba a partir de donde se quedó
-    buffer += *ppos;
+static ssize_t assoofs_metacache_load_us_show(struct assoofs_sb_info *sbi, char *buf)
+{
+    return sysfs_emit(buf, "%llu\n", sbi->metacache ? sbi->metacache->load_ns / NSEC_PER_USEC : 0);
+}
 
-    // 5. Copiamos el contenido del buffer de usuario al fichero
-    if (copy_from_user(buffer, buf, len) != 0)
-    {
-        printk(KERN_ERR "assooofs_write: Error copying file contents from user buffer\n");
-        return -1;
-    }
+static ssize_t assoofs_metacache_inodes_show(struct assoofs_sb_info *sbi, char *buf)
+{
+    return sysfs_emit(buf, "%u\n", sbi->metacache ? sbi->metacache->inodes_count : 0);
+}
 
-    // 6. Actualizamos el puntero de posición
-    *ppos += len;
+static ssize_t assoofs_metacache_dirents_show(struct assoofs_sb_info *sbi, char *buf)
+{
+    return sysfs_emit(buf, "%u\n", sbi->metacache ? sbi->metacache->entries_count : 0);
+}
 
-    // 7. Marcamos el buffer como modificado y sincronizamos el buffer con el disco para reflejar los cambios
-    mark_buffer_dirty(bh);
-    sync_dirty_buffer(bh);
+static ssize_t assoofs_checksum_errors_show(struct assoofs_sb_info *sbi, char *buf)
+{
+    return sysfs_emit(buf, "%lld\n", (long long)atomic64_read(&sbi->checksum_errors));
+}
 
-    // 8. Actualizamos el tamaño del fichero
-    inode_info->file_size = *ppos;
-    if (assoofs_save_inode_info(sb, inode_info) != 0)
-    {
-        printk(KERN_ERR "assooofs_write: Error saving inode info\n");
-        return -1;
-    }
+static ssize_t assoofs_scrub_passes_show(struct assoofs_sb_info *sbi, char *buf)
+{
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(sbi->scrub_passes));
+}
 
-    // 9. Liberamos el buffer con brelse
-    brelse(bh);
+static ssize_t assoofs_scrub_errors_show(struct assoofs_sb_info *sbi, char *buf)
+{
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(sbi->scrub_errors));
+}
 
-    // 10. Devolvemos el número de bytes escritos
-    return len;
+static ssize_t assoofs_scrub_repaired_show(struct assoofs_sb_info *sbi, char *buf)
+{
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(sbi->scrub_repaired));
 }
 
-// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-// Definición de funciones de operaciones sobre directorios
-// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+static ssize_t assoofs_scrub_rate_show(struct assoofs_sb_info *sbi, char *buf)
+{
+    return sysfs_emit(buf, "%u\n", READ_ONCE(sbi->scrub_rate));
+}
 
-static int assoofs_iterate(struct file *filp, struct dir_context *ctx)
+static ssize_t assoofs_scrub_rate_store(struct assoofs_sb_info *sbi, const char *buf, size_t len)
 {
     // Declaración de variables (ISO C90)
-    int i;
-    struct inode *inode;
-    struct super_block *sb;
-    struct assoofs_inode_info *inode_info;
-    struct buffer_head *bh;
-    struct assoofs_dir_record_entry *record;
-
-    printk(KERN_INFO "assoofs_iterate: request\n");
+    unsigned int rate;
 
-    // 1. Obtenemos el inodo y el superbloque
-    inode = filp->f_path.dentry->d_inode;
-    sb = inode->i_sb;
-    // Obtenemos la información persistente del inodo
-    inode_info = kmem_cache_alloc(assoofs_inode_cache, GFP_KERNEL);
-    inode_info = inode->i_private;
+    if (kstrtouint(buf, 0, &rate))
+        return -EINVAL;
 
-    // 2. Comprobamos que el contexto del directorio ya ha sido creado
-    // Esto asegura que no se repitan entradas del directorio al llamar a la función repetidas veces (bucle infinito)
-    if (ctx->pos != 0)
-        return 0;
+    // El trabajo lee scrub_rate en cada ejecución: con 0 deja de programarse; si no, empieza ya con el nuevo ritmo
+    WRITE_ONCE(sbi->scrub_rate, rate);
+    if (rate > 0)
+        mod_delayed_work(system_wq, &sbi->scrub_work, 0);
 
-    // 3. Comprobamos que el inodo es un directorio
-    if ((!S_ISDIR(inode_info->mode)))
-        return -1;
+    return len;
+}
 
-    // 4. Rellenamos el contexto del directorio con las entradas del directorio
-    // Accedemos al bloque de disco con el contenido del directorio
-    bh = sb_bread(sb, inode_info->data_block_number);
-    if (!bh)
-    {
-        printk(KERN_ERR "assoofs_iterate: Reading the block number [%llu] failed\n", inode_info->data_block_number);
-        return -1;
-    }
-    // Declaramos un puntero a la primera entrada del directorio (permite acceder a las demás entradas)
-    record = (struct assoofs_dir_record_entry *)bh->b_data;
+static ssize_t assoofs_op_stats_show(struct assoofs_sb_info *sbi, char *buf)
+{
+    // Declaración de variables (ISO C90)
+    static const char *const names[ASSOOFS_OP_COUNT] = {
+        [ASSOOFS_OP_ALLOC_BLOCK] = "alloc_block",
+        [ASSOOFS_OP_GET_INODE_INFO] = "get_inode_info",
+        [ASSOOFS_OP_SAVE_INODE_INFO] = "save_inode_info",
+        [ASSOOFS_OP_ADD_INODE_INFO] = "add_inode_info",
+        [ASSOOFS_OP_DIR_LOOKUP] = "dir_lookup",
+        [ASSOOFS_OP_DIR_INSERT] = "dir_insert",
+    };
+    uint64_t calls;
+    uint64_t ns;
+    int len = 0;
+    int i;
 
-    // Recorremos las entradas del directorio
-    for (i = 0; i < inode_info->dir_children_count; i++)
+    for (i = 0; i < ASSOOFS_OP_COUNT; i++)
     {
-        // Agregamos la entrada del directorio al contexto del directorio
-        dir_emit(ctx, record->filename, ASSOOFS_FILENAME_MAXLEN, record->inode_no, DT_UNKNOWN);
-
-        // Incrementamos la posición con el tamaño de la nueva entrada para que el contexto del directorio apunte a la siguiente entrada
-        ctx->pos += sizeof(struct assoofs_dir_record_entry);
-
-        // Incrementamos el puntero a la siguiente entrada
-        record++;
+        calls = atomic64_read(&sbi->op_calls[i]);
+        ns = atomic64_read(&sbi->op_ns[i]);
+        len += sysfs_emit_at(buf, len, "%s %llu %llu %llu\n", names[i], calls, ns, ns ? div64_u64(calls * NSEC_PER_SEC, ns) : 0);
     }
 
-    // Liberamos el buffer con brelse
-    brelse(bh);
-
-    // Si todo ha ido bien, devolvemos 0
-    return 0;
+    return len;
 }
 
-// +++++++++++++++++++++++++++++++++++++++++++++++++++
-// Definición de funciones de operaciones sobre inodos
-// +++++++++++++++++++++++++++++++++++++++++++++++++++
-
-struct dentry *assoofs_lookup(struct inode *parent_inode, struct dentry *child_dentry, unsigned int flags)
+static ssize_t assoofs_op_stats_store(struct assoofs_sb_info *sbi, const char *buf, size_t len)
 {
     // Declaración de variables (ISO C90)
+    unsigned int value;
     int i;
-    struct assoofs_inode_info *parent_info;
-    struct super_block *sb;
-    struct buffer_head *bh;
-    struct assoofs_dir_record_entry *record;
-    struct inode *inode;
 
-    printk(KERN_INFO "assoofs_lookup: request\n");
+    if (kstrtouint(buf, 0, &value) || value != 0)
+        return -EINVAL;
 
-    // 1. Acceder al bloque de disco con el contenido del directorio apuntado por parent_inode
-    // Declaramos un puntero con la información persistente del inodo padre
-    parent_info = parent_inode->i_private;
-    // Preparamos un puntero al superbloque
-    sb = parent_inode->i_sb;
-    // sb_bread se utiliza aquí para leer el bloque de disco con el contenido del directorio apuntado por parent_inode
-    bh = sb_bread(sb, parent_info->data_block_number);
-    if (!bh)
+    for (i = 0; i < ASSOOFS_OP_COUNT; i++)
     {
-        printk(KERN_ERR "assoofs_lookup: Reading the block number [%llu] failed\n", parent_info->data_block_number);
-        return NULL;
+        atomic64_set(&sbi->op_calls[i], 0);
+        atomic64_set(&sbi->op_ns[i], 0);
     }
 
-    // 2. Recorrer las entradas del directorio en busca de la entrada que coincide con child_dentry
-    // Declaramos un puntero a la primera entrada del directorio (permite acceder a las demás entradas)
-    record = (struct assoofs_dir_record_entry *)bh->b_data;
-    // Recorremos las entradas del directorio en busca de la entrada que coincide con child_dentry
-    for (i = 0; i < parent_info->dir_children_count; i++)
-    {
-        // Comprobamos si el nombre de la entrada coincide con el nombre del dentry hijo
-        if (strcmp(record->filename, child_dentry->d_name.name) == 0)
-        {
-            // Obtenemos el inodo del hijo
-            inode = assoofs_get_inode(sb, record->inode_no);
-            if (!inode)
-            {
-                printk(KERN_ERR "assooofs_lookup: inode not found\n");
-                return NULL;
-            }
-            // Inicializamos el inodo, asignando propietario y permisos
-            inode_init_owner(sb->s_user_ns, inode, parent_inode, ((struct assoofs_inode_info *)inode->i_private)->mode);
-            // Agregamos el directorio hijo al directorio padre
-            d_add(child_dentry, inode);
+    return len;
+}
 
-            return NULL;
-        }
-        record++;
-    }
+// +++++++++++++++++++++++++++++++++++++++++++++++++++++
+// Definición de funciones de operaciones de superbloque
+// +++++++++++++++++++++++++++++++++++++++++++++++++++++
 
-    return NULL;
+static struct inode *assoofs_alloc_inode(struct super_block *sb)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_inode *ai;
+
+    ai = alloc_inode_sb(sb, assoofs_inode_cache, GFP_KERNEL);
+    if (!ai)
+        return NULL;
+
+    memset(&ai->info, 0, sizeof(ai->info));
+    return &ai->vfs_inode;
 }
 
-static int assoofs_create(struct user_namespace *mnt_userns, struct inode *dir, struct dentry *dentry, umode_t mode, bool excl)
+static void assoofs_free_inode(struct inode *inode)
+{
+    printk(KERN_INFO "Freeing private data of inode %p ( %lu)\n", inode->i_private, inode->i_ino);
+
+    // La información persistente se libera junto al inodo de VFS
+    kmem_cache_free(assoofs_inode_cache, ASSOOFS_I(inode));
+}
+
+static int assoofs_write_inode(struct inode *inode, struct writeback_control *wbc)
 {
     // Declaración de variables (ISO C90)
-    struct super_block *sb;
-    struct buffer_head *bh;
-    struct assoofs_inode_info *parent_inode_info;
-    struct assoofs_dir_record_entry *dir_contents;
-    struct inode *inode;
-    struct assoofs_inode_info *inode_info;
-    uint64_t count;
+    struct assoofs_inode_info *inode_info = inode->i_private;
 
-    printk(KERN_INFO "assoofs_create: request\n");
+    printk(KERN_INFO "assoofs_write_inode: request\n");
 
-    // 1. Creamos el nuevo inodo
-    // 1.1. Preparamos un puntero al superbloque
-    sb = dir->i_sb;
-    count = ((struct assoofs_super_block_info *)sb->s_fs_info)->inodes_count;
-    // Creamos un nuevo inodo
-    inode = new_inode(sb);
-    // Asignamos el número de inodo
-    inode->i_ino = count + 1;
-    // Asignamos el superbloque
-    inode->i_sb = sb;
-    // Asignamos las operaciones sobre inodos
-    inode->i_op = &assoofs_inode_ops;
-    // Asignar fecha del sistema a los campos i_atime, i_mtime, i_ctime
-    inode->i_atime = inode->i_mtime = inode->i_ctime = current_time(inode);
+    // Las fechas de VFS pueden haber cambiado solo en memoria; el resto de campos ya están al día
+    assoofs_inode_info_set_times(inode_info, inode);
+    if (assoofs_save_inode_info(inode->i_sb, inode_info) != 0)
+        return -EIO;
+
+    return 0;
+}
+
+static void assoofs_evict_inode(struct inode *inode)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(inode->i_sb);
+
+    // Liberamos las páginas y el estado de VFS del inodo
+    // i_private se mantiene hasta assoofs_free_inode, ya que puede haber búsquedas en modo RCU accediendo a él
+    truncate_inode_pages_final(&inode->i_data);
+    clear_inode(inode);
 
-    // 1.2. Comprobamos si count a superado el número máximo de objetos soportados por el sistema de archivos (restamos 2 por el superbloque y el almacén de inodos)
-    if (count >= (ASSOOFS_MAX_FILESYSTEM_OBJECTS_SUPPORTED - 2))
+    // Si el inodo se había borrado, su bloque y su entrada del almacén se liberan ya en segundo plano
+    // Si no cabe en la lista de pendientes, sigue marcado como huérfano y se libera al volver a montar
+    if (!inode->i_nlink && sbi)
     {
-        printk(KERN_ERR "assoofs_create: Maximum number of objects supported reached\n");
-        return -1;
+        spin_lock(&sbi->reclaim_lock);
+        if (sbi->reclaim_count < ASSOOFS_MAX_BLOCKS)
+            sbi->reclaim_pending[sbi->reclaim_count++] = inode->i_ino;
+        spin_unlock(&sbi->reclaim_lock);
+        schedule_work(&sbi->reclaim_work);
     }
+}
 
-    // 1.3. Guardamos la información persistente del inodo en el campo i_private
-    inode_info = kmem_cache_alloc(assoofs_inode_cache, GFP_KERNEL);
-    inode_info->inode_no = inode->i_ino;
-    inode_info->mode = mode;
-    inode_info->file_size = 0;
-
-    inode->i_private = inode_info;
+static void assoofs_put_super(struct super_block *sb)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(sb);
+    uint64_t i;
 
-    // 1.4. Asignamos las operaciones sobre ficheros al inodo
-    inode->i_fop = &assoofs_file_operations;
+    printk(KERN_INFO "assoofs_put_super: request\n");
 
-    // 1.5. Asignamos el propietario del inodo y los permisos
-    inode_init_owner(sb->s_user_ns, inode, dir, mode);
+    // Esperamos a que termine la lectura anticipada de los metadatos, si sigue en curso
+    cancel_work_sync(&sbi->readahead_work);
 
-    // 1.6. Agregamos el inodo al árbol de inodos del sistema de archivos
-    d_add(dentry, inode);
+    // Terminamos de liberar los ficheros borrados (VFS ya ha soltado todos los inodos)
+    flush_work(&sbi->reclaim_work);
 
-    // 1.7. Asignamos al inodo un bloque de datos
-    if (assoofs_sb_get_a_freeblock(sb, &inode_info->data_block_number) != 0)
-    {
-        printk(KERN_ERR "assoofs_create: No more free blocks\n");
-        return -1;
-    }
+    // Descartamos ya los bloques liberados pendientes en lugar de esperar al trabajo diferido
+    if (cancel_delayed_work_sync(&sbi->discard_work))
+        assoofs_discard_worker(&sbi->discard_work.work);
 
-    // 1.8. Guardamos la información persistente del inodo en el almacén de inodos
-    assoofs_add_inode_info(sb, inode_info);
+    // Eliminamos el montaje de sysfs antes de liberar la información que muestran sus atributos
+    assoofs_sysfs_unregister(sb);
 
-    // 2. Creamos una entrada en el directorio padre para el nuevo inodo
-    // 2.1. Leemos el bloque de disco con el contenido del directorio padre
-    parent_inode_info = dir->i_private;
-    // sb_bread se utiliza aquí para leer el bloque de disco con el contenido del directorio apuntado por parent_inode
-    bh = sb_bread(sb, parent_inode_info->data_block_number);
-    if (!bh)
-    {
-        printk(KERN_ERR "assoofs_create: Reading the block number [%llu] failed\n", parent_inode_info->data_block_number);
-        return -1;
-    }
-    // 2.2. Creamos una nueva entrada en el directorio padre con los datos del nuevo inodo
-    dir_contents = (struct assoofs_dir_record_entry *)bh->b_data;
-    // Desplazamos el puntero dir_contents hasta la última entrada del directorio
-    dir_contents += parent_inode_info->dir_children_count;
-    // inode_info es la información persistente del inodo creado en el paso 2.
-    dir_contents->inode_no = inode_info->inode_no;
-
-    // Copiamos el nombre del fichero en la entrada del directorio
-    strcpy(dir_contents->filename, dentry->d_name.name);
-    // mark_buffer_dirty se utiliza para marcar el buffer como modificado
-    mark_buffer_dirty(bh);
-    // sync_dirty_buffer se utiliza para sincronizar el buffer con el disco (es decir, escribir el buffer en el disco)
-    sync_dirty_buffer(bh);
-    // Liberamos el buffer
-    brelse(bh);
+    // Detenemos el scrub (ya nadie puede volver a programarlo desde sysfs)
+    WRITE_ONCE(sbi->scrub_rate, 0);
+    cancel_delayed_work_sync(&sbi->scrub_work);
+    assoofs_metacache_free(sbi->metacache);
 
-    // 3. Actualizamos la información persistente del directorio padre
-    // 3.1. Incrementamos el número de ficheros hijo del directorio padre
-    parent_inode_info->dir_children_count++;
-    // 3.2. Escribimos en el disco la información persistente del directorio padre
-    if (assoofs_save_inode_info(sb, parent_inode_info) != 0)
-    {
-        printk(KERN_ERR "assoofs_create: Error while saving inode info\n");
-        return -1;
-    }
+    // Soltamos los bloques retenidos en memoria (opción mem); los modificados ya se han escrito al sincronizar
+    for (i = 0; i < ASSOOFS_MAX_BLOCKS; i++)
+        brelse(sbi->mem_bh[i]);
 
-    // Si todo ha ido bien, devolvemos 0
-    return 0;
+    // Liberamos el buffer del superbloque retenido durante el montaje, cerramos los dispositivos miembros
+    // (después de soltar sus bloques) y liberamos la información en memoria
+    brelse(sbi->sbh);
+    assoofs_close_devices(sb);
+    kfree(sbi);
+    sb->s_fs_info = NULL;
 }
 
-static int assoofs_mkdir(struct user_namespace *mnt_userns, struct inode *dir, struct dentry *dentry, umode_t mode)
+static int assoofs_statfs(struct dentry *dentry, struct kstatfs *buf)
 {
     // Declaración de variables (ISO C90)
-    struct super_block *sb;
-    struct buffer_head *bh;
-    struct assoofs_inode_info *parent_inode_info;
-    struct assoofs_dir_record_entry *dir_contents;
-    struct inode *inode;
-    struct assoofs_inode_info *inode_info;
-    uint64_t count;
+    struct super_block *sb = dentry->d_sb;
+    struct assoofs_super_block_info *assoofs_sb = ASSOOFS_SB(sb)->asb;
+
+    buf->f_type = ASSOOFS_MAGIC;
+    buf->f_bsize = ASSOOFS_DEFAULT_BLOCK_SIZE;
+    buf->f_namelen = ASSOOFS_FILENAME_MAXLEN;
+    // Solo cuentan como libres los bloques del mapa de bits que pertenecen al sistema de archivos
+    buf->f_blocks = assoofs_sb->blocks_count;
+    buf->f_bfree = hweight64(assoofs_sb->free_blocks & GENMASK_ULL(assoofs_sb->blocks_count - 1, 0));
+    buf->f_bavail = buf->f_bfree;
+    buf->f_files = assoofs_core_max_inodes(assoofs_sb);
+    buf->f_ffree = buf->f_files > assoofs_sb->inodes_count ? buf->f_files - assoofs_sb->inodes_count : 0;
 
-    printk(KERN_INFO "assoofs_mkdir: request\n");
+    return 0;
+}
 
-    // 1. Creamos el nuevo inodo
-    // 1.1. Preparamos un puntero al superbloque
-    sb = dir->i_sb;
-    count = ((struct assoofs_super_block_info *)sb->s_fs_info)->inodes_count;
-    // Creamos un nuevo inodo
-    inode = new_inode(sb);
-    // Asignamos el número de inodo
-    inode->i_ino = count + 1;
-    // Asignamos el superbloque
-    inode->i_sb = sb;
-    // Asignamos las operaciones sobre inodos
-    inode->i_op = &assoofs_inode_ops;
-    // Asignar fecha del sistema a los campos i_atime, i_mtime, i_ctime
-    inode->i_atime = inode->i_mtime = inode->i_ctime = current_time(inode);
+static int assoofs_remount(struct super_block *sb, int *flags, char *data)
+{
+    printk(KERN_INFO "assoofs_remount: request\n");
 
-    // 1.2. Comprobamos si count a superado el número máximo de objetos soportados por el sistema de archivos (restamos 2 por el superbloque y el almacén de inodos)
-    if (count >= (ASSOOFS_MAX_FILESYSTEM_OBJECTS_SUPPORTED - 2))
+    sync_filesystem(sb);
+
+    // La caché de metadatos no se actualiza al escribir, por lo que el montaje debe seguir siendo de solo lectura
+    if ((ASSOOFS_SB(sb)->mount_opt & ASSOOFS_MOUNT_METACACHE) && !(*flags & SB_RDONLY))
     {
-        printk(KERN_ERR "assoofs_mkdir: Maximum number of objects supported reached\n");
-        return -1;
+        printk(KERN_ERR "assoofs_remount: can't remount read-write with metacache\n");
+        return -EINVAL;
     }
 
-    // 1.3. Guardamos la información persistente del inodo en el campo i_private
-    inode_info = kmem_cache_alloc(assoofs_inode_cache, GFP_KERNEL);
-    inode_info->inode_no = inode->i_ino;
-    inode_info->mode = S_IFDIR | mode;
-    inode_info->file_size = 0;
-
-    inode->i_private = inode_info;
+    // Los dispositivos miembros de un montaje de solo lectura se abren sin permiso de escritura
+    if (ASSOOFS_SB(sb)->ndevs > 1 && !(ASSOOFS_SB(sb)->devs_mode & FMODE_WRITE) && !(*flags & SB_RDONLY))
+    {
+        printk(KERN_ERR "assoofs_remount: can't remount read-write a multi-device filesystem mounted read-only\n");
+        return -EINVAL;
+    }
 
-    inode_info->dir_children_count = 0;
+    return 0;
+}
 
-    // 1.4. Asignamos las operaciones sobre directorios al inodo
-    inode->i_fop = &assoofs_dir_operations;
+static int assoofs_sync_fs(struct super_block *sb, int wait)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(sb);
+    unsigned int i;
+    int err = 0;
+    int ret;
 
-    // 1.5. Asignamos el propietario del inodo y los permisos
-    inode_init_owner(sb->s_user_ns, inode, dir, inode_info->mode);
+    printk(KERN_INFO "assoofs_sync_fs: request\n");
 
-    // 1.6. Agregamos el inodo al árbol de inodos del sistema de archivos
-    d_add(dentry, inode);
+    // Los ficheros borrados que se están liberando modifican el almacén de inodos y el superbloque
+    // VFS escribe los buffers del dispositivo montado después de esta llamada
+    if (wait)
+        flush_work(&sbi->reclaim_work);
 
-    // 1.7. Asignamos al inodo un bloque de datos
-    if (assoofs_sb_get_a_freeblock(sb, &inode_info->data_block_number) != 0)
+    for (i = 1; i < sbi->ndevs; i++)
     {
-        printk(KERN_ERR "assoofs_mkdir: No more free blocks\n");
-        return -1;
+        ret = wait ? sync_blockdev(sbi->devs[i]) : sync_blockdev_nowait(sbi->devs[i]);
+        if (ret && !err)
+            err = ret;
     }
 
-    // 1.8. Guardamos la información persistente del inodo en el almacén de inodos
-    assoofs_add_inode_info(sb, inode_info);
+    return err;
+}
 
-    // 2. Creamos una entrada en el directorio padre para el nuevo inodo
-    // 2.1. Leemos el bloque de disco con el contenido del directorio padre
-    parent_inode_info = dir->i_private;
-    // sb_bread se utiliza aquí para leer el bloque de disco con el contenido del directorio apuntado por parent_inode
-    bh = sb_bread(sb, parent_inode_info->data_block_number);
-    if (!bh)
-    {
-        printk(KERN_ERR "assoofs_mkdir: Reading the block bitmap failed\n");
-        return -1;
-    }
-    // 2.2. Creamos una nueva entrada en el directorio padre con los datos del nuevo inodo
-    dir_contents = (struct assoofs_dir_record_entry *)bh->b_data;
-    // Desplazamos el puntero dir_contents hasta la última entrada del directorio
-    dir_contents += parent_inode_info->dir_children_count;
-    // inode_info es la información persistente del inodo creado en el paso 2.
-    dir_contents->inode_no = inode_info->inode_no;
-
-    // Copiamos el nombre del fichero en la entrada del directorio
-    strcpy(dir_contents->filename, dentry->d_name.name);
-    // mark_buffer_dirty se utiliza para marcar el buffer como modificado
-    mark_buffer_dirty(bh);
-    // sync_dirty_buffer se utiliza para sincronizar el buffer con el disco (es decir, escribir el buffer en el disco)
-    sync_dirty_buffer(bh);
-    // Liberamos el buffer
-    brelse(bh);
+static int assoofs_freeze_fs(struct super_block *sb)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(sb);
+    int ret;
 
-    // 3. Actualizamos la información persistente del directorio padre
-    // 3.1. Incrementamos el número de ficheros hijo del directorio padre
-    parent_inode_info->dir_children_count++;
-    // 3.2. Escribimos en el disco la información persistente del directorio padre
-    if (assoofs_save_inode_info(sb, parent_inode_info) != 0)
+    printk(KERN_INFO "assoofs_freeze_fs: request\n");
+
+    // 1. Detenemos los trabajos que escriben en el disco; los que se programen mientras tanto no hacen nada
+    // Lo pendiente (reclaim_pending, discard_pending) se conserva y se retoma al descongelar
+    WRITE_ONCE(sbi->frozen, true);
+    cancel_work_sync(&sbi->reclaim_work);
+    cancel_delayed_work_sync(&sbi->discard_work);
+    cancel_delayed_work_sync(&sbi->scrub_work);
+
+    // 2. Escribimos lo que haya modificado un trabajo que terminase después de que VFS sincronizara
+    // (con la opción mem los buffers no se escriben al modificarse)
+    ret = sync_blockdev(sb->s_bdev);
+    if (ret == 0)
+        ret = assoofs_sync_fs(sb, 1);
+    if (ret != 0)
     {
-        printk(KERN_ERR "assoofs_mkdir: Error while saving inode info\n");
-        return -1;
+        printk(KERN_ERR "assoofs_freeze_fs: Writing the dirty blocks failed\n");
+        assoofs_unfreeze_fs(sb);
+        return ret;
     }
 
-    // Si todo ha ido bien, devolvemos 0
     return 0;
 }
 
-// +++++++++++++++++++++++++++++++++++++++++++++++++++++
-// Definición de funciones de operaciones de superbloque
-// +++++++++++++++++++++++++++++++++++++++++++++++++++++
-
-int assoofs_destroy_inode(struct inode *inode)
+static int assoofs_unfreeze_fs(struct super_block *sb)
 {
-    struct assoofs_inode *inode_info = inode->i_private;
+    // Declaración de variables (ISO C90)
+    struct assoofs_sb_info *sbi = ASSOOFS_SB(sb);
+    bool pending;
+
+    printk(KERN_INFO "assoofs_unfreeze_fs: request\n");
+
+    WRITE_ONCE(sbi->frozen, false);
+
+    // Volvemos a programar los trabajos que tengan algo pendiente
+    spin_lock(&sbi->reclaim_lock);
+    pending = sbi->reclaim_count > 0;
+    spin_unlock(&sbi->reclaim_lock);
+    if (pending)
+        schedule_work(&sbi->reclaim_work);
 
-    printk(KERN_INFO "Freeing private data of inode %p ( %lu)\n", inode_info, inode->i_ino);
+    mutex_lock(&sbi->bitmap_lock);
+    pending = sbi->discard_pending != 0;
+    mutex_unlock(&sbi->bitmap_lock);
+    if (pending)
+        schedule_delayed_work(&sbi->discard_work, ASSOOFS_DISCARD_DELAY);
 
-    kmem_cache_free(assoofs_inode_cache, inode_info);
+    if (READ_ONCE(sbi->scrub_rate) > 0)
+        mod_delayed_work(system_wq, &sbi->scrub_work, 0);
 
     return 0;
 }
@@ -1006,7 +5640,10 @@ int assoofs_fill_super(struct super_block *sb, void *data, int silent)
     // Declaración de variables (ISO C90)
     struct buffer_head *bh;
     struct assoofs_super_block_info *assoofs_sb;
+    struct assoofs_sb_info *sbi;
     struct inode *root_inode;
+    uint64_t i;
+    int ret;
 
     printk(KERN_INFO "assoofs_fill_super request\n");
     // 1.- Leer la información persistente del superbloque del dispositivo de bloques
@@ -1018,9 +5655,8 @@ int assoofs_fill_super(struct super_block *sb, void *data, int silent)
         return -1;
     }
     // Para acceder a los campos del superbloque, primero hay que asignar bh->b_data a un puntero de tipo assoofs_super_block_info
+    // El buffer_head no se libera: se retiene hasta el desmontaje (assoofs_put_super)
     assoofs_sb = (struct assoofs_super_block_info *)bh->b_data;
-    // Ya podemos liberar el buffer_head con brelse
-    brelse(bh);
 
     // 2.- Comprobar los parámetros del superbloque
     // Esto es necesario para comprobar que el superbloque que se ha leído es realmente un superbloque de assoofs
@@ -1028,29 +5664,196 @@ int assoofs_fill_super(struct super_block *sb, void *data, int silent)
     if (assoofs_sb->magic != ASSOOFS_MAGIC)
     {
         printk(KERN_ERR "assoofs_fill_super: wrong magic number (0x%llx)\n", assoofs_sb->magic);
+        brelse(bh);
         return -1;
     }
     // 2.2.- Comprobar el tamaño del bloque
     if (assoofs_sb->block_size != ASSOOFS_DEFAULT_BLOCK_SIZE)
     {
         printk(KERN_ERR "assoofs_fill_super: wrong block size (%llu)\n", assoofs_sb->block_size);
+        brelse(bh);
+        return -1;
+    }
+
+    // 2.3.- Comprobar la versión del formato (la versión 1 se actualiza más adelante)
+    if (assoofs_sb->version == 0 || assoofs_sb->version > ASSOOFS_VERSION)
+    {
+        printk(KERN_ERR "assoofs_fill_super: unsupported format version (%llu)\n", assoofs_sb->version);
+        brelse(bh);
+        return -EINVAL;
+    }
+    if (assoofs_sb->version < ASSOOFS_VERSION && sb_rdonly(sb))
+    {
+        printk(KERN_ERR "assoofs_fill_super: format version %llu must be mounted read-write once to upgrade it\n", assoofs_sb->version);
+        brelse(bh);
+        return -EINVAL;
+    }
+
+    // 2.4.- Comprobar la suma de comprobación del superbloque (las versiones anteriores a la 5 no la tienen)
+    if (assoofs_sb->version >= 5 && assoofs_meta_verify(bh->b_data))
+    {
+        printk(KERN_ERR "assoofs_fill_super: superblock checksum mismatch\n");
+        brelse(bh);
+        return -EBADMSG;
+    }
+
+    // 2.5.- Reservar la información en memoria del montaje e interpretar las opciones de montaje
+    sbi = kzalloc(sizeof(*sbi), GFP_KERNEL);
+    if (!sbi)
+    {
+        brelse(bh);
+        return -ENOMEM;
+    }
+    sbi->sb = sb;
+    sbi->asb = assoofs_sb;
+    sbi->sbh = bh;
+    mutex_init(&sbi->bitmap_lock);
+    spin_lock_init(&sbi->usage_lock);
+    mutex_init(&sbi->istore_lock);
+    INIT_WORK(&sbi->reclaim_work, assoofs_reclaim_worker);
+    spin_lock_init(&sbi->reclaim_lock);
+    INIT_WORK(&sbi->prefetch_work, assoofs_prefetch_worker);
+    spin_lock_init(&sbi->prefetch_lock);
+    INIT_DELAYED_WORK(&sbi->discard_work, assoofs_discard_worker);
+    INIT_WORK(&sbi->readahead_work, assoofs_readahead_worker);
+    atomic64_set(&sbi->checksum_errors, 0);
+    INIT_DELAYED_WORK(&sbi->scrub_work, assoofs_scrub_worker);
+    if (assoofs_parse_options(sbi, data) != 0)
+    {
+        kfree(sbi->devs_opt);
+        kfree(sbi);
+        brelse(bh);
+        return -EINVAL;
+    }
+    // La opción discard no tiene efecto si el dispositivo no admite descartes
+    if ((sbi->mount_opt & ASSOOFS_MOUNT_DISCARD) && !bdev_max_discard_sectors(sb->s_bdev))
+    {
+        printk(KERN_WARNING "assoofs_fill_super: device does not support discard, ignoring discard option\n");
+        sbi->mount_opt &= ~ASSOOFS_MOUNT_DISCARD;
+    }
+
+    // 2.6.- Abrir el resto de dispositivos si el sistema de archivos ocupa varios (opción devices)
+    // El campo s_fs_info es un puntero a la información en memoria del montaje, que incluye la información persistente del superbloque
+    // Esto evita tener que acceder continuamente al bloque 0 (menos lecturas)
+    sb->s_fs_info = sbi;
+    ret = assoofs_open_devices(sb);
+    kfree(sbi->devs_opt);
+    sbi->devs_opt = NULL;
+    if (ret)
+    {
+        sb->s_fs_info = NULL;
+        kfree(sbi);
+        brelse(bh);
+        return ret;
+    }
+
+    // 2.7.- Comprobar el número de bloques (entre todos los dispositivos)
+    // Las imágenes antiguas no lo almacenan: ocupan todos los bloques del mapa de bits que quepan en el dispositivo
+    if (assoofs_sb->blocks_count == 0)
+    {
+        assoofs_sb_lock(sb);
+        assoofs_sb->blocks_count = assoofs_bdev_nr_blocks(sb);
+        assoofs_sb_unlock(sb);
+    }
+    if (assoofs_sb->blocks_count < ASSOOFS_MIN_BLOCKS || assoofs_sb->blocks_count > assoofs_bdev_nr_blocks(sb))
+    {
+        printk(KERN_ERR "assoofs_fill_super: wrong block count (%llu)\n", assoofs_sb->blocks_count);
+        assoofs_close_devices(sb);
+        sb->s_fs_info = NULL;
+        kfree(sbi);
+        brelse(bh);
         return -1;
     }
 
     // 3.- Escribir la información persistente leída del dispositivo de bloques en el superbloque sb
     // El campo s_magic es el número mágico que identifica el sistema de ficheros
     sb->s_magic = ASSOOFS_MAGIC;
-    // El campo s_maxbytes es el tamaño máximo de fichero
-    sb->s_maxbytes = ASSOOFS_DEFAULT_BLOCK_SIZE;
+    // El campo s_maxbytes es el tamaño máximo de fichero (mayor si los ficheros se comprimen)
+    sb->s_maxbytes = (sbi->mount_opt & ASSOOFS_MOUNT_COMPRESS) ? ASSOOFS_MAX_COMPRESSED_FILE_SIZE : ASSOOFS_DEFAULT_BLOCK_SIZE;
     // El campo s_op define las operaciones que se pueden realizar en el sistema de ficheros
     sb->s_op = &assoofs_sops;
-    // El campo s_fs_info es un puntero a una estructura que contiene información persistente del superbloque
-    // Esto evita tener que acceder continuamente al bloque 0 (menos lecturas)
-    sb->s_fs_info = assoofs_sb;
+    // Las fechas se guardan con precisión de nanosegundos
+    sb->s_time_gran = 1;
+
+    // 3.1.- Actualizar el formato de las imágenes antiguas (inodos sin fechas)
+    if (assoofs_sb->version < ASSOOFS_VERSION)
+    {
+        ret = assoofs_upgrade_inode_store(sb);
+        if (ret)
+        {
+            assoofs_close_devices(sb);
+            sb->s_fs_info = NULL;
+            kfree(sbi);
+            brelse(bh);
+            return ret;
+        }
+    }
+    // Terminar de liberar los ficheros borrados que seguían abiertos cuando se detuvo el sistema
+    if (!sb_rdonly(sb))
+    {
+        ret = assoofs_orphan_recover(sb);
+        if (ret)
+        {
+            assoofs_close_devices(sb);
+            sb->s_fs_info = NULL;
+            kfree(sbi);
+            brelse(bh);
+            return ret;
+        }
+    }
+
+    // 3.2.- Con la opción metacache, construir la caché de metadatos (solo en montajes de solo lectura)
+    if (sbi->mount_opt & ASSOOFS_MOUNT_METACACHE)
+    {
+        ret = sb_rdonly(sb) ? assoofs_metacache_build(sb) : -EINVAL;
+        if (ret)
+        {
+            if (ret == -EINVAL)
+                printk(KERN_ERR "assoofs_fill_super: metacache requires a read-only mount (-o ro,metacache)\n");
+            assoofs_close_devices(sb);
+            sb->s_fs_info = NULL;
+            kfree(sbi);
+            brelse(bh);
+            return ret;
+        }
+    }
+
+    // 3.3.- Con la opción mem, leer y retener en memoria todos los bloques del sistema de archivos
+    // A partir de aquí ninguna operación espera al disco: los cambios se escriben al sincronizar o desmontar
+    if ((sbi->mount_opt & ASSOOFS_MOUNT_MEM) && assoofs_mem_load(sb, 0, assoofs_sb_nr_blocks(sb)) != 0)
+    {
+        for (i = 0; i < ASSOOFS_MAX_BLOCKS; i++)
+            brelse(sbi->mem_bh[i]);
+        assoofs_metacache_free(sbi->metacache);
+        assoofs_close_devices(sb);
+        sb->s_fs_info = NULL;
+        kfree(sbi);
+        brelse(bh);
+        return -EIO;
+    }
+
+    // 3.4.- Registrar el montaje en sysfs (/sys/fs/assoofs/<dispositivo>)
+    ret = assoofs_sysfs_register(sb);
+    if (ret)
+    {
+        for (i = 0; i < ASSOOFS_MAX_BLOCKS; i++)
+            brelse(sbi->mem_bh[i]);
+        assoofs_metacache_free(sbi->metacache);
+        assoofs_close_devices(sb);
+        sb->s_fs_info = NULL;
+        kfree(sbi);
+        brelse(bh);
+        return ret;
+    }
 
     // 4.- Crear el inodo raíz y asignarle operaciones sobre inodos (i_op) y sobre directorios (i_fop)
     // 4.1.- Creamos el inodo raíz
     root_inode = new_inode(sb);
+    if (!root_inode)
+    {
+        assoofs_put_super(sb);
+        return -ENOMEM;
+    }
 
     // 4.2.- Inicializamos el inodo raíz, asignando propietario y permisos
     // El inodo no tiene padre, por lo que se le pasa NULL
@@ -1066,14 +5869,38 @@ int assoofs_fill_super(struct super_block *sb, void *data, int silent)
     root_inode->i_op = &assoofs_inode_ops;
     // Asignamos las operaciones de directorio
     root_inode->i_fop = &assoofs_dir_operations;
-    // Establecemos las fechas de acceso, modificación y cambio del inodo al tiempo actual
-    root_inode->i_atime = root_inode->i_mtime = root_inode->i_ctime = current_time(root_inode);
-    // Almacena la información persistente del inodo raíz
-    root_inode->i_private = assoofs_get_inode_info(sb, ASSOOFS_ROOTDIR_INODE_NUMBER);
+    // Almacena la información persistente del inodo raíz (reservada junto al inodo)
+    root_inode->i_private = &ASSOOFS_I(root_inode)->info;
+    if (assoofs_get_inode_info(sb, ASSOOFS_ROOTDIR_INODE_NUMBER, root_inode->i_private))
+    {
+        printk(KERN_ERR "assoofs_fill_super: root inode not found\n");
+        iput(root_inode);
+        assoofs_put_super(sb);
+        return -EIO;
+    }
+    // Establecemos las fechas de acceso, modificación y cambio del inodo a las guardadas en el disco
+    root_inode->i_atime = ns_to_timespec64(ASSOOFS_I(root_inode)->info.atime);
+    root_inode->i_mtime = ns_to_timespec64(ASSOOFS_I(root_inode)->info.mtime);
+    root_inode->i_ctime = ns_to_timespec64(ASSOOFS_I(root_inode)->info.ctime);
 
     // 5. - Guardar el inodo raíz en el superbloque y marcarlo como raíz
     // Se marca como tal y se guarda en el campo s_root del superbloque
     sb->s_root = d_make_root(root_inode);
+    if (!sb->s_root)
+    {
+        assoofs_put_super(sb);
+        return -ENOMEM;
+    }
+
+    // 6.- Leer por adelantado en segundo plano los bloques de los directorios
+    // El montaje no espera a estas lecturas: cada bloque se lee al usarse si el trabajo aún no lo ha traído
+    // Con la opción metacache no hace falta: los directorios ya están en memoria
+    if (!sbi->metacache)
+        schedule_work(&sbi->readahead_work);
+
+    // 7.- Con la opción scrub=<bloques por segundo>, empezar a comprobar en segundo plano las sumas de los metadatos
+    if (sbi->scrub_rate > 0)
+        schedule_delayed_work(&sbi->scrub_work, 0);
 
     return 0;
 }
@@ -1099,10 +5926,30 @@ static struct dentry *assoofs_mount(struct file_system_type *fs_type, int flags,
     return ret;
 }
 
+static void assoofs_kill_sb(struct super_block *sb)
+{
+    printk(KERN_INFO "assoofs_kill_sb: request\n");
+
+    // Un inodo cargado por adelantado después de que VFS vacíe la caché de inodos quedaría ocupado al desmontar
+    // Ya no hay ficheros abiertos, por lo que assoofs_iterate no puede volver a programar el trabajo
+    if (ASSOOFS_SB(sb))
+        cancel_work_sync(&ASSOOFS_SB(sb)->prefetch_work);
+
+    kill_block_super(sb);
+}
+
 // +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 // Definición de funciones de inicialización y descarga del módulo
 // +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 
+static void assoofs_inode_init_once(void *obj)
+{
+    // Declaración de variables (ISO C90)
+    struct assoofs_inode *ai = obj;
+
+    inode_init_once(&ai->vfs_inode);
+}
+
 static int __init assoofs_init(void)
 {
     // Declaración de variables (ISO C90)
@@ -1110,6 +5957,20 @@ static int __init assoofs_init(void)
 
     printk(KERN_INFO "assoofs_init: request\n");
 
+    // Inicializamos la caché de inodos antes de registrar el sistema de archivos, que la utiliza al montar
+    // Cada objeto es un struct assoofs_inode: el inodo de VFS y la copia de su información persistente
+    assoofs_inode_cache = kmem_cache_create("assoofs_inode_cache", sizeof(struct assoofs_inode), 0, (SLAB_RECLAIM_ACCOUNT | SLAB_MEM_SPREAD | SLAB_ACCOUNT), assoofs_inode_init_once);
+    if (!assoofs_inode_cache)
+        return -ENOMEM;
+
+    // Creamos el directorio de assoofs en sysfs (/sys/fs/assoofs), donde se registra cada montaje
+    assoofs_kobj = kobject_create_and_add("assoofs", fs_kobj);
+    if (!assoofs_kobj)
+    {
+        kmem_cache_destroy(assoofs_inode_cache);
+        return -ENOMEM;
+    }
+
     // Registrar el sistema de archivos en el kernel
     ret = register_filesystem(&assoofs_type);
 
@@ -1117,12 +5978,11 @@ static int __init assoofs_init(void)
     if (ret != 0)
     {
         printk(KERN_ERR "assoofs_init: can't register filesystem\n");
+        kobject_put(assoofs_kobj);
+        kmem_cache_destroy(assoofs_inode_cache);
         return ret;
     }
 
-    // Inicializamos la caché de inodos
-    assoofs_inode_cache = kmem_cache_create("assoofs_inode_cache", sizeof(struct assoofs_inode_info), 0, (SLAB_RECLAIM_ACCOUNT | SLAB_MEM_SPREAD), NULL);
-
     return ret;
 }
 
@@ -1142,9 +6002,18 @@ static void __exit assoofs_exit(void)
         printk(KERN_ERR "assoofs_exit: can't unregister filesystem\n");
     }
 
-    // Destruimos la caché de inodos
+    // Eliminamos el directorio de assoofs de sysfs
+    kobject_put(assoofs_kobj);
+
+    // Esperamos a que se liberen los inodos pendientes de un periodo de gracia RCU y destruimos la caché de inodos
+    rcu_barrier();
     kmem_cache_destroy(assoofs_inode_cache);
 }
 
 module_init(assoofs_init);
 module_exit(assoofs_exit);
+
+// Las pruebas KUnit se compilan con el módulo para poder llamar a sus funciones estáticas
+#if IS_ENABLED(CONFIG_ASSOOFS_KUNIT_TEST)
+#include "assoofs-test.c"
+#endif
@@ -1,15 +1,74 @@
+#include <linux/ioctl.h>
+
 #define ASSOOFS_MAGIC 0x20200406
 #define ASSOOFS_DEFAULT_BLOCK_SIZE 4096
 #define ASSOOFS_FILENAME_MAXLEN 255
 #define ASSOOFS_LAST_RESERVED_BLOCK ASSOOFS_ROOTDIR_BLOCK_NUMBER
 #define ASSOOFS_LAST_RESERVED_INODE ASSOOFS_ROOTDIR_INODE_NUMBER
 
+// Flags de inodo (campo flags de assoofs_inode_info)
+#define ASSOOFS_INODE_COMPRESSED 0x1 // El bloque de datos se almacena comprimido con LZ4
+#define ASSOOFS_INODE_ORPHAN 0x2     // Borrado: su bloque y su inodo se liberan en cuanto nadie lo tenga abierto
+
+// Tamaño lógico máximo de un fichero comprimido (su versión comprimida debe caber en un bloque)
+#define ASSOOFS_MAX_COMPRESSED_FILE_SIZE (4 * ASSOOFS_DEFAULT_BLOCK_SIZE)
+
 const int ASSOOFS_SUPERBLOCK_BLOCK_NUMBER = 0;
 const int ASSOOFS_INODESTORE_BLOCK_NUMBER = 1;
 const int ASSOOFS_ROOTDIR_BLOCK_NUMBER = 2;
 const int ASSOOFS_ROOTDIR_INODE_NUMBER = 1;
 const int ASSOOFS_MAX_FILESYSTEM_OBJECTS_SUPPORTED = 64;
 
+// Número máximo de bloques del sistema de archivos (uno por cada bit del mapa de bits free_blocks)
+#define ASSOOFS_MAX_BLOCKS 64
+
+// Número mínimo de bloques: superbloque, almacén de inodos, directorio raíz y welcomefile
+#define ASSOOFS_MIN_BLOCKS 4
+
+// Número máximo de dispositivos de un sistema de archivos repartido entre varios dispositivos (el primero incluido).
+// Los bloques reservados (superbloque, almacén de inodos y directorio raíz) están siempre en el primero;
+// el resto se reparte por turnos: el bloque ASSOOFS_LAST_RESERVED_BLOCK + 1 + k está en el dispositivo k % n
+#define ASSOOFS_MAX_DEVICES 8
+
+// Versión del formato en disco. Las versiones antiguas se actualizan al montar en modo lectura-escritura:
+// la versión 1 no guarda fechas (inodos de 32 bytes) ni flags (su hueco puede contener basura),
+// la 2 no guarda el uso recursivo de los directorios (56 bytes),
+// la 3 asigna a cada inodo nuevo el número inodes_count + 1, que deja de ser único al borrar inodos
+// y la 4 no guarda sumas de comprobación en los bloques de metadatos
+#define ASSOOFS_VERSION 5
+#define ASSOOFS_INODE_SIZE_V1 32
+#define ASSOOFS_INODE_SIZE_V2 56
+
+// Peticiones ioctl propias de assoofs
+#define ASSOOFS_IOC_MAGIC 0xA5
+// Amplía el sistema de archivos montado hasta el número de bloques indicado (0 para ocupar todo el dispositivo)
+#define ASSOOFS_IOC_RESIZE _IOWR(ASSOOFS_IOC_MAGIC, 1, uint64_t)
+// Traslada el bloque de datos de un fichero o directorio al primer bloque libre a partir de uno dado
+#define ASSOOFS_IOC_MOVE_BLOCK _IOWR(ASSOOFS_IOC_MAGIC, 2, struct assoofs_move_block)
+// Guarda una copia coherente del sistema de archivos montado en el fichero imagen abierto con el descriptor indicado
+#define ASSOOFS_IOC_SNAPSHOT _IOW(ASSOOFS_IOC_MAGIC, 3, int)
+// Obtiene el uso recursivo (bytes e inodos) de un directorio, o el de un fichero, con una sola lectura
+#define ASSOOFS_IOC_GET_USAGE _IOR(ASSOOFS_IOC_MAGIC, 4, struct assoofs_usage)
+// Crea de una vez un grupo de ficheros y directorios (con su contenido) en el directorio sobre el que se hace la petición
+#define ASSOOFS_IOC_BULK_CREATE _IOW(ASSOOFS_IOC_MAGIC, 5, struct assoofs_bulk_create)
+
+/**
+ * Cola de los bloques de metadatos (superbloque, almacén de inodos y bloques de directorio): ocupa sus últimos 8 bytes,
+ * que ninguno de ellos utiliza (caben como mucho 62 inodos y 15 entradas de directorio por bloque)
+ *
+ * @param reserved Reservado (debe ser 0, está incluido en la suma de comprobación)
+ * @param checksum Suma crc32c (semilla ~0, sin invertir el resultado) de todos los bytes anteriores del bloque
+ */
+struct assoofs_block_tail
+{
+    uint32_t reserved;
+    uint32_t checksum;
+};
+
+// Desplazamiento de la cola dentro del bloque y número de bytes cubiertos por la suma de comprobación
+#define ASSOOFS_BLOCK_TAIL_OFFSET (ASSOOFS_DEFAULT_BLOCK_SIZE - sizeof(struct assoofs_block_tail))
+#define ASSOOFS_BLOCK_CHECKSUM_SIZE (ASSOOFS_DEFAULT_BLOCK_SIZE - sizeof(uint32_t))
+
 /**
  * Representa la información del superbloque del sistema de archivos
  *
@@ -18,7 +77,14 @@ const int ASSOOFS_MAX_FILESYSTEM_OBJECTS_SUPPORTED = 64;
  * @param block_size El tamaño de bloque del sistema de archivos
  * @param inodes_count El número de inodos en el sistema de archivos
  * @param free_blocks El número de bloques libres en el sistema de archivos
+ * @param block_shared_refs Referencias adicionales de cada bloque compartido entre ficheros (0 si el bloque no está compartido)
+ * @param blocks_count El número de bloques del sistema de archivos (0 en imágenes antiguas: se calcula al montar)
+ * @param next_inode_no El número del siguiente inodo que se cree (los números de los inodos borrados no se reutilizan)
+ * @param devices_count El número de dispositivos entre los que se reparten los bloques (0 o 1 si solo hay uno)
+ * @param set_id Identificador aleatorio del sistema de archivos, repetido en la cabecera de cada dispositivo miembro
+ * @param inodes_max El número máximo de inodos fijado al formatear (mkassoofs -i); 0 para el máximo del formato
  * @param padding Relleno adicional para que coincida con el tamaño de bloque (4096 bytes)
+ * @param tail Cola con la suma de comprobación del superbloque (desde la versión 5)
  */
 struct assoofs_super_block_info
 {
@@ -27,8 +93,37 @@ struct assoofs_super_block_info
     uint64_t block_size;
     uint64_t inodes_count;
     uint64_t free_blocks;
+    uint8_t block_shared_refs[ASSOOFS_MAX_BLOCKS];
+    uint64_t blocks_count;
+    uint64_t next_inode_no;
+    uint64_t devices_count;
+    uint64_t set_id;
+    uint64_t inodes_max;
+
+    char padding[3944];
+    struct assoofs_block_tail tail;
+};
+
+/**
+ * Cabecera del primer bloque de cada dispositivo miembro (todos salvo el primero, que contiene el superbloque).
+ * El resto de bloques del miembro contienen, en orden, los bloques del sistema de archivos que le corresponden
+ *
+ * @param magic El número mágico del sistema de archivos
+ * @param set_id El identificador del sistema de archivos al que pertenece (set_id del superbloque)
+ * @param index La posición del dispositivo en el sistema de archivos (de 1 a devices_count - 1)
+ * @param devices_count El número de dispositivos del sistema de archivos
+ * @param padding Relleno adicional para que coincida con el tamaño de bloque (4096 bytes)
+ * @param tail Cola con la suma de comprobación de la cabecera
+ */
+struct assoofs_member_info
+{
+    uint64_t magic;
+    uint64_t set_id;
+    uint64_t index;
+    uint64_t devices_count;
 
     char padding[4056];
+    struct assoofs_block_tail tail;
 };
 
 /**
@@ -43,18 +138,37 @@ struct assoofs_dir_record_entry
     uint64_t inode_no;
 };
 
+/**
+ * Cabecera al comienzo del bloque de datos de un fichero comprimido
+ *
+ * @param compressed_size El número de bytes comprimidos que siguen a la cabecera
+ * @param reserved Reservado (alinea los datos a 8 bytes)
+ */
+struct assoofs_compressed_header
+{
+    uint32_t compressed_size;
+    uint32_t reserved;
+};
+
 /**
  * Representa la información de un inodo en el sistema de archivos
  *
  * @param mode El modo del archivo (directorio o archivo)
+ * @param flags Flags del inodo (ASSOOFS_INODE_*), ocupa el hueco de alineación tras mode (desde la versión 2)
  * @param inode_no El número de inodo del archivo
  * @param data_block_number El número de bloque de datos del archivo (donde se almacenan los datos)
  * @param file_size El tamaño del archivo (si el inodo describe un archivo)
  * @param dir_children_count El número de hijos del directorio (si el inodo describe un directorio)
+ * @param atime Fecha del último acceso, en nanosegundos desde el 1 de enero de 1970 (desde la versión 2)
+ * @param mtime Fecha de la última modificación del contenido, en nanosegundos desde el 1 de enero de 1970 (desde la versión 2)
+ * @param ctime Fecha del último cambio del inodo, en nanosegundos desde el 1 de enero de 1970 (desde la versión 2)
+ * @param tree_inodes Número de inodos del subárbol, incluido el propio directorio (si el inodo describe un directorio, desde la versión 3)
+ * @param tree_size Suma de los tamaños de los ficheros del subárbol (si el inodo describe un directorio, desde la versión 3)
  */
 struct assoofs_inode_info
 {
     mode_t mode;
+    uint32_t flags;
     uint64_t inode_no;
     uint64_t data_block_number;
 
@@ -63,4 +177,68 @@ struct assoofs_inode_info
         uint64_t file_size;
         uint64_t dir_children_count;
     };
+
+    int64_t atime;
+    int64_t mtime;
+    int64_t ctime;
+
+    uint32_t tree_inodes;
+    uint32_t tree_size;
 };
+
+/**
+ * Representa una petición de traslado de bloque (ASSOOFS_IOC_MOVE_BLOCK)
+ *
+ * @param goal El bloque a partir del cual se busca el bloque libre de destino
+ * @param block El bloque en el que queda el fichero tras el traslado (salida)
+ */
+struct assoofs_move_block
+{
+    uint64_t goal;
+    uint64_t block;
+};
+
+/**
+ * Representa el uso de un subárbol del sistema de archivos (ASSOOFS_IOC_GET_USAGE)
+ *
+ * @param bytes Suma de los tamaños de los ficheros del subárbol
+ * @param inodes Número de inodos del subárbol, incluida su raíz
+ */
+struct assoofs_usage
+{
+    uint64_t bytes;
+    uint64_t inodes;
+};
+
+/**
+ * Representa un fichero o directorio de una petición de creación en bloque
+ *
+ * @param filename El nombre, terminado en '\0' (como en las entradas de directorio, admite hasta 254 caracteres)
+ * @param mode El tipo (S_IFREG o S_IFDIR, un fichero si se omite) y los permisos
+ * @param size El número de bytes del contenido (0 en los directorios)
+ * @param data Puntero de usuario al contenido (no se utiliza si size es 0)
+ */
+struct assoofs_bulk_entry
+{
+    char filename[ASSOOFS_FILENAME_MAXLEN + 1];
+    uint32_t mode;
+    uint32_t size;
+    uint64_t data;
+};
+
+/**
+ * Representa una petición de creación en bloque (ASSOOFS_IOC_BULK_CREATE)
+ *
+ * @param entries Puntero de usuario al vector de entradas (struct assoofs_bulk_entry)
+ * @param count El número de entradas del vector
+ * @param reserved Reservado (debe ser 0)
+ */
+struct assoofs_bulk_create
+{
+    uint64_t entries;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+// Lógica del formato común al módulo y a las herramientas (reserva de bloques, almacén de inodos, directorios, sumas)
+#include "assoofs-core.h"
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <stdio.h>
 #include <sys/types.h>
@@ -6,264 +7,968 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/random.h>
+#include <sys/uio.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <linux/fs.h>
 #include "assoofs.h"
 
-#define WELCOMEFILE_DATABLOCK_NUMBER (ASSOOFS_LAST_RESERVED_BLOCK + 1)
 #define WELCOMEFILE_INODE_NUMBER (ASSOOFS_LAST_RESERVED_INODE + 1)
 
+/**
+ * Representa un fichero del directorio de origen (mkassoofs -d) cuyo contenido se copia en la imagen
+ *
+ * @param fd El descriptor de archivo del fichero, abierto al planificar la imagen
+ * @param path La ruta del fichero (para los mensajes de error)
+ * @param block El bloque de datos que se le ha asignado
+ * @param size El número de bytes que se copian
+ */
+struct image_file
+{
+    int fd;
+    char *path;
+    uint64_t block;
+    uint64_t size;
+};
+
+/**
+ * Representa la imagen del sistema de archivos, que se prepara en memoria antes de escribirla en los dispositivos
+ *
+ * @param blocks Los bloques de metadatos y los de datos de welcomefile, indexados por número de bloque
+ * @param meta Mapa de bits de los bloques de blocks que son metadatos (llevan suma de comprobación)
+ * @param used Mapa de bits de los bloques de blocks que se escriben
+ * @param asb El superbloque (bloque ASSOOFS_SUPERBLOCK_BLOCK_NUMBER de blocks)
+ * @param inodes El almacén de inodos (bloque ASSOOFS_INODESTORE_BLOCK_NUMBER de blocks)
+ * @param goal El primer bloque que se intenta reservar, para que los bloques queden en el orden en que se recorre el árbol
+ * @param fds Los descriptores de archivo de los dispositivos, en los que se copia el contenido de los ficheros
+ * @param count El número de dispositivos
+ * @param files Los ficheros cuyo contenido se copia en la imagen una vez planificada (uno por bloque como mucho)
+ * @param files_count El número de ficheros de files
+ */
+struct image
+{
+    char blocks[ASSOOFS_MAX_BLOCKS][ASSOOFS_DEFAULT_BLOCK_SIZE];
+    uint64_t meta;
+    uint64_t used;
+    struct assoofs_super_block_info *asb;
+    struct assoofs_inode_info *inodes;
+    uint64_t goal;
+    const int *fds;
+    int count;
+    struct image_file files[ASSOOFS_MAX_BLOCKS];
+    int files_count;
+};
+
 // **************************
 // Declaraciones de funciones
 // **************************
 
 /**
- * Escribe el superbloque del sistema de archivos
- * en el primer bloque del dispositivo
+ * Interpreta un tamaño en bytes con un sufijo opcional K, M o G (potencias de 1024)
  *
- * @param fd El descriptor de archivo del dispositivo
+ * @param arg El tamaño
+ * @param value Puntero donde se almacenará el tamaño en bytes
+ *
+ * @return 0 si todo salió bien, -1 si el tamaño no es válido
+ */
+static int parse_size(const char *arg, uint64_t *value);
+
+/**
+ * Calcula el número de bloques del sistema de archivos. Sin size, los dispositivos se ocupan completos
+ * (como máximo, los bloques que caben en el mapa de bits de bloques libres); los bloques no reservados se reparten
+ * por turnos, por lo que cada dispositivo aporta tantos como el más pequeño. Con size, un fichero imagen más pequeño
+ * que su parte del sistema de archivos se amplía sin escribir datos (queda disperso)
+ *
+ * @param fds Los descriptores de archivo de los dispositivos, empezando por el que contiene el superbloque
+ * @param count El número de dispositivos
+ * @param size El tamaño del sistema de archivos en bytes (0 para ocupar los dispositivos completos)
+ * @param blocks_count Puntero donde se almacenará el número de bloques
+ *
+ * @return 0 si todo salió bien, -1 si algún dispositivo es demasiado pequeño o no se puede obtener su tamaño
+ */
+static int device_blocks(const int *fds, int count, uint64_t size, uint64_t *blocks_count);
+
+/**
+ * Amplía los ficheros imagen que no llegan a contener su parte del sistema de archivos (quedan dispersos).
+ * Se llama una vez planificada la imagen completa: hasta entonces no se modifica ningún dispositivo
+ *
+ * @param fds Los descriptores de archivo de los dispositivos, empezando por el que contiene el superbloque
+ * @param count El número de dispositivos
+ * @param blocks_count El número de bloques del sistema de archivos
+ *
+ * @return 0 si todo salió bien, -1 si algún fichero imagen no se pudo ampliar
+ */
+static int extend_devices(const int *fds, int count, uint64_t blocks_count);
+
+/**
+ * Prepara el superbloque del sistema de archivos
+ *
+ * @param sb Puntero al bloque del superbloque (a cero)
+ * @param blocks_count El número de bloques del sistema de archivos
+ * @param devices_count El número de dispositivos entre los que se reparten los bloques
+ * @param set_id El identificador del sistema de archivos (0 si solo ocupa un dispositivo)
+ * @param inodes_max El número máximo de inodos (0 para el máximo del formato)
+ */
+static void build_superblock(struct assoofs_super_block_info *sb, uint64_t blocks_count, int devices_count, uint64_t set_id, uint64_t inodes_max);
+
+/**
+ * Prepara el almacén de inodos y el bloque del directorio raíz (vacío)
+ *
+ * @param img Puntero a la imagen (con el superbloque ya preparado)
+ * @param mode El modo del directorio raíz
+ * @param time La fecha de acceso, modificación y cambio del directorio raíz
+ */
+static void build_root(struct image *img, mode_t mode, int64_t time);
+
+/**
+ * Crea un inodo con un bloque de datos y lo añade a un directorio de la imagen
+ *
+ * @param img Puntero a la imagen
+ * @param dir Puntero al inodo del directorio
+ * @param name El nombre de la entrada
+ * @param mode El modo del nuevo inodo
+ * @param time La fecha de acceso, modificación y cambio del nuevo inodo
+ *
+ * @return Puntero al nuevo inodo, o NULL si no queda sitio (se informa del motivo)
+ */
+static struct assoofs_inode_info *image_add(struct image *img, struct assoofs_inode_info *dir, const char *name, mode_t mode, int64_t time);
+
+/**
+ * Añade welcomefile (README.txt) al directorio raíz de la imagen
+ *
+ * @param img Puntero a la imagen (con el directorio raíz ya preparado)
  *
  * @return 0 si todo salió bien, -1 en caso contrario
  */
-static int write_superblock(int fd);
+static int add_welcomefile(struct image *img);
 
 /**
- * Almacena el inodo del directorio raíz en el almacén de inodos
+ * Planifica en la imagen el contenido de un directorio del anfitrión, recursivamente (mkassoofs -d).
+ * Las entradas se recorren por orden de nombre y los inodos y los bloques se asignan en ese orden, de modo que
+ * el mismo árbol produce siempre la misma imagen y el contenido de cada directorio queda en bloques consecutivos.
+ * No se escribe nada en los dispositivos: los ficheros se apuntan en img->files y se copian con copy_files
  *
- * @param fd El descriptor de archivo del dispositivo
+ * @param img Puntero a la imagen
+ * @param dir Puntero al inodo del directorio de la imagen
+ * @param dirfd El descriptor de archivo del directorio del anfitrión
+ * @param path La ruta del directorio del anfitrión (para los mensajes de error)
  *
  * @return 0 si todo salió bien, -1 en caso contrario
  */
-static int write_root_inode(int fd);
+static int populate_dir(struct image *img, struct assoofs_inode_info *dir, int dirfd, const char *path);
 
 /**
- * Almacena el inodo de welcomefile en el almacén de inodos
+ * Compara dos nombres byte a byte, para ordenar las entradas de un directorio con qsort
  *
- * @param fd El descriptor de archivo del dispositivo
- * @param i Puntero al inodo de welcomefile
+ * @param a Puntero al primer nombre
+ * @param b Puntero al segundo nombre
+ *
+ * @return Un número negativo, 0 o positivo si el primero es menor, igual o mayor que el segundo
+ */
+static int compare_names(const void *a, const void *b);
+
+/**
+ * Copia el contenido de un fichero en un bloque de la imagen con copy_file_range,
+ * o con pread y pwrite si el núcleo no puede copiar entre esos dos sistemas de archivos
+ *
+ * @param img Puntero a la imagen
+ * @param src El descriptor de archivo del fichero
+ * @param block El número de bloque de la imagen
+ * @param size El número de bytes que se copian (como mucho, un bloque)
  *
  * @return 0 si todo salió bien, -1 en caso contrario
  */
-static int write_welcome_inode(int fd, const struct assoofs_inode_info *i);
+static int copy_data(struct image *img, int src, uint64_t block, uint64_t size);
 
 /**
- * Escribe una entrada de directorio en un descriptor de archivo
+ * Copia en la imagen el contenido de todos los ficheros planificados por populate_dir
  *
- * @param fd El descriptor de archivo del dispositivo
- * @param record Puntero a la entrada de directorio
+ * @param img Puntero a la imagen
+ *
+ * @return 0 si todo salió bien, -1 en caso contrario
+ */
+static int copy_files(struct image *img);
+
+/**
+ * Cierra los ficheros planificados por populate_dir
+ *
+ * @param img Puntero a la imagen
+ */
+static void release_files(struct image *img);
+
+/**
+ * Escribe la cabecera de un dispositivo miembro en su primer bloque
+ *
+ * @param fd El descriptor de archivo del dispositivo miembro
+ * @param index La posición del dispositivo (de 1 a devices_count - 1)
+ * @param devices_count El número de dispositivos del sistema de archivos
+ * @param set_id El identificador del sistema de archivos
  *
  * @return 0 si todo salió bien, -1 en caso contrario
  */
-int write_dirent(int fd, const struct assoofs_dir_record_entry *record);
+static int write_member(int fd, int index, int devices_count, uint64_t set_id);
 
 /**
- * Escribe un bloque en un descriptor de archivo
+ * Escribe los bloques de la imagen preparados en memoria: cada serie de bloques consecutivos en un mismo
+ * dispositivo se escribe con una sola llamada a pwritev (más las necesarias si la escritura queda a medias)
+ *
+ * @param img Puntero a la imagen
+ *
+ * @return 0 si todo salió bien, -1 en caso contrario
+ */
+static int write_image(struct image *img);
+
+/**
+ * Escribe varios bloques consecutivos de un dispositivo con pwritev
  *
  * @param fd El descriptor de archivo del dispositivo
- * @param block Puntero al bloque
- * @param len Tamaño del bloque en bytes
+ * @param iov Los bloques (se modifica si la escritura queda a medias)
+ * @param count El número de bloques
+ * @param offset La posición del primer bloque en el dispositivo
  *
  * @return 0 si todo salió bien, -1 en caso contrario
  */
-int write_block(int fd, char *block, size_t len);
+static int write_run(int fd, struct iovec *iov, int count, off_t offset);
+
+/**
+ * Descarta el contenido previo de los bloques del sistema de archivos (BLKDISCARD en dispositivos de bloques,
+ * FALLOC_FL_PUNCH_HOLE en ficheros), para que el almacenamiento subyacente recupere el espacio.
+ * Solo se descartan los blocks_count primeros bloques: el resto del dispositivo nunca se utiliza,
+ * y descartarlo entero haría que formatear un dispositivo grande tardase segundos o minutos
+ *
+ * @param fd El descriptor de archivo del dispositivo
+ * @param blocks_count El número de bloques del sistema de archivos
+ *
+ * @return 0 si todo salió bien, -1 si el dispositivo no admite descartes
+ */
+static int discard_device(int fd, uint64_t blocks_count);
+
+/**
+ * Obtiene la fecha actual para las fechas de los inodos
+ *
+ * @return Nanosegundos transcurridos desde el 1 de enero de 1970
+ */
+static int64_t now_ns(void);
 
 // +++++++++++++++++++++++++
 // Definiciones de funciones
 // +++++++++++++++++++++++++
 
-static int write_superblock(int fd)
+static int parse_size(const char *arg, uint64_t *value)
 {
-    // Crear el superbloque
-    struct assoofs_super_block_info sb = {
-        .version = 1,
-        .magic = ASSOOFS_MAGIC,
-        .block_size = ASSOOFS_DEFAULT_BLOCK_SIZE,
-        .inodes_count = WELCOMEFILE_INODE_NUMBER,
-        // Bloques libres = Todos los bloques - (superbloque + almacenamiento de inodos + directorio raíz + welcomefile)
-        .free_blocks = (~0) & ~(15),
-    };
-
-    // ret representa el número de bytes escritos
-    ssize_t ret;
+    char *end;
+    unsigned long long n;
+    int shift = 0;
+
+    errno = 0;
+    n = strtoull(arg, &end, 10);
+    if (errno || end == arg)
+        return -1;
+
+    if (*end == 'K' || *end == 'k')
+        shift = 10;
+    else if (*end == 'M' || *end == 'm')
+        shift = 20;
+    else if (*end == 'G' || *end == 'g')
+        shift = 30;
+    if (shift)
+        end++;
+    if (*end != '\0' || n > (UINT64_MAX >> shift))
+        return -1;
+
+    *value = (uint64_t)n << shift;
+    return 0;
+}
+
+static int device_blocks(const int *fds, int count, uint64_t size, uint64_t *blocks_count)
+{
+    struct stat st;
+    uint64_t bytes;
+    uint64_t needed;
+    uint64_t nr[ASSOOFS_MAX_DEVICES];
+    int i;
+
+    // Con un tamaño pedido, el número de bloques es ese (debe caber en el mapa de bits de bloques libres)
+    if (size)
+    {
+        *blocks_count = size / ASSOOFS_DEFAULT_BLOCK_SIZE;
+        if (*blocks_count < ASSOOFS_MIN_BLOCKS || *blocks_count > ASSOOFS_MAX_BLOCKS)
+        {
+            printf("The size must be between %d and %d blocks of %d bytes.\n", ASSOOFS_MIN_BLOCKS, ASSOOFS_MAX_BLOCKS, ASSOOFS_DEFAULT_BLOCK_SIZE);
+            return -1;
+        }
+    }
 
-    // Escribe el superbloque en el primer bloque
-    ret = write(fd, &sb, sizeof(sb));
-    if (ret != ASSOOFS_DEFAULT_BLOCK_SIZE)
+    for (i = 0; i < count; i++)
     {
-        printf("Bytes written [%d] are not equal to the default block size.\n", (int)ret);
+        // Obtenemos el tamaño en bytes del dispositivo de bloques o del fichero imagen
+        if (fstat(fds[i], &st) == -1)
+            return -1;
+        if (S_ISBLK(st.st_mode))
+        {
+            if (ioctl(fds[i], BLKGETSIZE64, &bytes) == -1)
+                return -1;
+        }
+        else
+            bytes = st.st_size;
+        nr[i] = bytes / ASSOOFS_DEFAULT_BLOCK_SIZE;
+
+        if (!size)
+            continue;
+
+        // El dispositivo debe contener su parte del sistema de archivos; un fichero imagen se amplía más tarde (extend_devices)
+        needed = assoofs_core_layout_device_blocks(*blocks_count, count, i);
+        if (nr[i] < needed && !S_ISREG(st.st_mode))
+        {
+            printf("Device %d is too small: %llu blocks of %d bytes are needed.\n", i, (unsigned long long)needed, ASSOOFS_DEFAULT_BLOCK_SIZE);
+            return -1;
+        }
+    }
+    if (size)
+        return 0;
+
+    // El sistema de archivos ocupa los dispositivos completos, hasta el tamaño del mapa de bits
+    *blocks_count = assoofs_core_layout_blocks(nr, count);
+
+    if (*blocks_count < ASSOOFS_MIN_BLOCKS)
+    {
+        printf("The device is too small: at least %d blocks of %d bytes are needed.\n", ASSOOFS_MIN_BLOCKS, ASSOOFS_DEFAULT_BLOCK_SIZE);
         return -1;
     }
 
-    printf("Super block written succesfully.\n");
     return 0;
 }
 
-static int write_root_inode(int fd)
+static int extend_devices(const int *fds, int count, uint64_t blocks_count)
 {
-    // ret representa el número de bytes escritos
-    ssize_t ret;
+    struct stat st;
+    uint64_t needed;
+    int i;
 
-    // Crear el inodo del directorio raíz
-    struct assoofs_inode_info root_inode;
+    for (i = 0; i < count; i++)
+    {
+        // device_blocks ya ha comprobado que los dispositivos de bloques son suficientemente grandes
+        needed = assoofs_core_layout_device_blocks(blocks_count, count, i);
+        if (fstat(fds[i], &st) == -1)
+            return -1;
+        if (!S_ISREG(st.st_mode) || (uint64_t)st.st_size >= needed * ASSOOFS_DEFAULT_BLOCK_SIZE)
+            continue;
+        if (ftruncate(fds[i], needed * ASSOOFS_DEFAULT_BLOCK_SIZE) == -1)
+        {
+            printf("Device %d is too small: %llu blocks of %d bytes are needed.\n", i, (unsigned long long)needed, ASSOOFS_DEFAULT_BLOCK_SIZE);
+            return -1;
+        }
+    }
 
-    root_inode.mode = S_IFDIR;
-    root_inode.inode_no = ASSOOFS_ROOTDIR_INODE_NUMBER;
-    root_inode.data_block_number = ASSOOFS_ROOTDIR_BLOCK_NUMBER;
-    root_inode.dir_children_count = 1;
+    return 0;
+}
 
-    // Escribe el inodo del directorio raíz en el almacén de inodos
-    ret = write(fd, &root_inode, sizeof(root_inode));
+static void build_superblock(struct assoofs_super_block_info *sb, uint64_t blocks_count, int devices_count, uint64_t set_id, uint64_t inodes_max)
+{
+    // Mapa de bits con un bit a 1 por cada bloque del sistema de archivos
+    uint64_t all_blocks = blocks_count >= ASSOOFS_MAX_BLOCKS ? ~0ULL : (1ULL << blocks_count) - 1;
+
+    sb->version = ASSOOFS_VERSION;
+    sb->magic = ASSOOFS_MAGIC;
+    sb->block_size = ASSOOFS_DEFAULT_BLOCK_SIZE;
+    // Al principio solo existe el directorio raíz
+    sb->inodes_count = ASSOOFS_ROOTDIR_INODE_NUMBER;
+    sb->next_inode_no = ASSOOFS_ROOTDIR_INODE_NUMBER + 1;
+    // Bloques libres = Todos los bloques - (superbloque + almacenamiento de inodos + directorio raíz)
+    sb->free_blocks = all_blocks & ~((1ULL << (ASSOOFS_LAST_RESERVED_BLOCK + 1)) - 1);
+    sb->blocks_count = blocks_count;
+    sb->devices_count = devices_count > 1 ? devices_count : 0;
+    sb->set_id = set_id;
+    sb->inodes_max = inodes_max;
+}
 
-    if (ret != sizeof(root_inode))
+static void build_root(struct image *img, mode_t mode, int64_t time)
+{
+    struct assoofs_inode_info *root = &img->inodes[0];
+
+    // Inodo del directorio raíz: de momento, su subárbol solo lo contiene a él
+    root->mode = mode;
+    root->inode_no = ASSOOFS_ROOTDIR_INODE_NUMBER;
+    root->data_block_number = ASSOOFS_ROOTDIR_BLOCK_NUMBER;
+    root->dir_children_count = 0;
+    root->atime = root->mtime = root->ctime = time;
+    root->tree_inodes = 1;
+    root->tree_size = 0;
+
+    // El superbloque, el almacén de inodos y el directorio raíz son bloques de metadatos
+    img->meta = (1ULL << (ASSOOFS_LAST_RESERVED_BLOCK + 1)) - 1;
+    img->used = img->meta;
+}
+
+static struct assoofs_inode_info *image_add(struct image *img, struct assoofs_inode_info *dir, const char *name, mode_t mode, int64_t time)
+{
+    struct assoofs_inode_info *inode_info;
+    uint64_t block;
+    int err;
+
+    // 1. Comprobamos que quede sitio para el inodo y reservamos su bloque de datos
+    if (img->asb->inodes_count >= assoofs_core_max_inodes(img->asb))
     {
-        printf("The inode store was not written properly.\n");
-        return -1;
+        printf("%s: the filesystem has no free inodes left.\n", name);
+        return NULL;
+    }
+    if (assoofs_core_alloc_block(img->asb, img->goal, &block))
+    {
+        printf("%s: the filesystem has no free blocks left.\n", name);
+        return NULL;
     }
+    img->goal = block + 1;
+
+    // 2. Añadimos la entrada al bloque del directorio
+    err = assoofs_core_dir_add((struct assoofs_dir_record_entry *)img->blocks[dir->data_block_number], dir->dir_children_count, name, img->asb->next_inode_no);
+    if (err)
+    {
+        printf("%s: %s.\n", name, err == -ENAMETOOLONG ? "the name is too long" : "the directory is full");
+        return NULL;
+    }
+    dir->dir_children_count++;
+
+    // 3. Añadimos el inodo al almacén de inodos
+    inode_info = &img->inodes[img->asb->inodes_count++];
+    memset(inode_info, 0, sizeof(*inode_info));
+    inode_info->mode = mode;
+    inode_info->inode_no = img->asb->next_inode_no++;
+    inode_info->data_block_number = block;
+    inode_info->atime = inode_info->mtime = inode_info->ctime = time;
+    if (S_ISDIR(mode))
+    {
+        // El bloque de un directorio es un bloque de metadatos (vacío) que se prepara en memoria
+        inode_info->tree_inodes = 1;
+        img->meta |= 1ULL << block;
+        img->used |= 1ULL << block;
+    }
+
+    return inode_info;
+}
+
+static int add_welcomefile(struct image *img)
+{
+    struct assoofs_inode_info *root = &img->inodes[0];
+    struct assoofs_inode_info *welcome;
+    char welcomefile_body[] = "Hola mundo, os saludo desde un sistema de ficheros ASSOOFS.\n";
+
+    // Las fechas de welcomefile son las del momento de creación del sistema de archivos
+    welcome = image_add(img, root, "README.txt", S_IFREG, root->ctime);
+    if (!welcome)
+        return -1;
+
+    // Su contenido se prepara en memoria y se escribe junto a los metadatos
+    welcome->file_size = sizeof(welcomefile_body);
+    memcpy(img->blocks[welcome->data_block_number], welcomefile_body, welcome->file_size);
+    img->used |= 1ULL << welcome->data_block_number;
+
+    root->tree_inodes++;
+    root->tree_size += welcome->file_size;
 
-    printf("root directory inode written succesfully.\n");
     return 0;
 }
 
-static int write_welcome_inode(int fd, const struct assoofs_inode_info *i)
+static int compare_names(const void *a, const void *b)
 {
-    // nbytes representa el número de bytes necesario de padding para alinear el siguiente inodo
-    off_t nbytes;
-    // ret representa el número de bytes escritos
-    ssize_t ret;
+    // strcmp y no strcoll: el orden no debe depender de la configuración regional
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
 
-    // Escribe el inodo de welcomefile en el almacén de inodos
-    ret = write(fd, i, sizeof(*i));
-    if (ret != sizeof(*i))
+static int populate_dir(struct image *img, struct assoofs_inode_info *dir, int dirfd, const char *path)
+{
+    char *names[ASSOOFS_DIR_ENTRIES_PER_BLOCK];
+    char child_path[PATH_MAX];
+    struct assoofs_inode_info *child;
+    struct dirent *entry;
+    struct stat st;
+    DIR *d;
+    int fd;
+    int count = 0;
+    int ret = -1;
+    int i;
+
+    // 1. Leemos los nombres del directorio (como mucho, los que caben en un bloque) y los ordenamos
+    fd = dup(dirfd);
+    d = fd == -1 ? NULL : fdopendir(fd);
+    if (!d)
     {
-        printf("The welcomefile inode was not written properly.\n");
+        perror(path);
+        if (fd != -1)
+            close(fd);
         return -1;
     }
-    printf("welcomefile inode written succesfully.\n");
+    while ((entry = readdir(d)) != NULL)
+    {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+            continue;
+        if (count == ASSOOFS_DIR_ENTRIES_PER_BLOCK)
+        {
+            printf("%s: a directory can hold at most %d entries.\n", path, (int)ASSOOFS_DIR_ENTRIES_PER_BLOCK);
+            goto out;
+        }
+        names[count] = strdup(entry->d_name);
+        if (!names[count])
+        {
+            perror(path);
+            goto out;
+        }
+        count++;
+    }
+    qsort(names, count, sizeof(*names), compare_names);
+
+    // 2. Añadimos cada entrada al directorio de la imagen
+    for (i = 0; i < count; i++)
+    {
+        snprintf(child_path, sizeof(child_path), "%s/%s", path, names[i]);
+        if (fstatat(dirfd, names[i], &st, AT_SYMLINK_NOFOLLOW) == -1)
+        {
+            perror(child_path);
+            goto out;
+        }
+        if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode))
+        {
+            printf("%s: only regular files and directories are supported.\n", child_path);
+            goto out;
+        }
+        if (S_ISREG(st.st_mode) && st.st_size > ASSOOFS_DEFAULT_BLOCK_SIZE)
+        {
+            printf("%s: files can be at most %d bytes long.\n", child_path, ASSOOFS_DEFAULT_BLOCK_SIZE);
+            goto out;
+        }
+
+        // Las fechas son la de modificación del original, para que la imagen no dependa del momento en que se crea
+        child = image_add(img, dir, names[i], st.st_mode & (S_IFMT | 07777), (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec);
+        if (!child)
+            goto out;
+
+        // 2.1. Un fichero se apunta (abierto) para copiar su contenido en su bloque de datos cuando la imagen esté planificada
+        // 2.2. Un directorio se recorre a continuación, para que sus bloques sigan al suyo
+        fd = openat(dirfd, names[i], (S_ISDIR(st.st_mode) ? O_DIRECTORY : 0) | O_RDONLY | O_NOFOLLOW);
+        if (fd == -1)
+        {
+            perror(child_path);
+            goto out;
+        }
+        if (S_ISREG(st.st_mode))
+        {
+            child->file_size = st.st_size;
+            img->files[img->files_count].fd = fd;
+            img->files[img->files_count].path = strdup(child_path);
+            img->files[img->files_count].block = child->data_block_number;
+            img->files[img->files_count].size = child->file_size;
+            if (!img->files[img->files_count++].path)
+            {
+                perror(child_path);
+                goto out;
+            }
+            dir->tree_inodes++;
+            dir->tree_size += child->file_size;
+        }
+        else
+        {
+            if (populate_dir(img, child, fd, child_path))
+            {
+                close(fd);
+                goto out;
+            }
+            close(fd);
+            dir->tree_inodes += child->tree_inodes;
+            dir->tree_size += child->tree_size;
+        }
+    }
+    ret = 0;
+
+out:
+    while (count-- > 0)
+        free(names[count]);
+    closedir(d);
+    return ret;
+}
+
+static int copy_data(struct image *img, int src, uint64_t block, uint64_t size)
+{
+    char buffer[ASSOOFS_DEFAULT_BLOCK_SIZE];
+    unsigned int dev;
+    loff_t offset;
+    uint64_t done = 0;
+    ssize_t ret = 0;
+
+    // Posición del bloque en su dispositivo
+    offset = assoofs_core_layout_map(block, img->count, &dev) * ASSOOFS_DEFAULT_BLOCK_SIZE;
 
-    // Esto asegura que el tamaño total de dos inodos más los bytes de padding coincida con el tamaño del bloque.
-    nbytes = ASSOOFS_DEFAULT_BLOCK_SIZE - (sizeof(*i) * 2);
-    // Mueve el puntero de archivo hacia adelante por nbytes (padding) desde la posición actual (SEEK_CUR)
-    ret = lseek(fd, nbytes, SEEK_CUR);
+    // copy_file_range copia dentro del núcleo, sin pasar el contenido por este proceso
+    while (done < size)
+    {
+        ret = copy_file_range(src, NULL, img->fds[dev], &offset, size - done, 0);
+        if (ret <= 0)
+            break;
+        done += ret;
+    }
+    if (done == size)
+        return 0;
+    if (ret == 0)
+    {
+        // El fichero es más corto de lo que indicaba fstatat (ha cambiado mientras se copiaba)
+        errno = EIO;
+        return -1;
+    }
+    if (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP)
+        return -1;
 
-    // (off_t)-1 representa un error en lseek. -1 es casteado a off_t
-    if (ret == (off_t)-1)
+    // El núcleo no copia entre estos sistemas de archivos: se copia el resto del fichero con pread y pwrite
+    ret = pread(src, buffer, size - done, done);
+    if (ret != (ssize_t)(size - done))
     {
-        printf("The padding bytes were not written properly.\n");
+        errno = ret < 0 ? errno : EIO;
         return -1;
     }
+    if (pwrite(img->fds[dev], buffer, ret, offset) != ret)
+        return -1;
 
-    printf("inode store padding bytes (after two inodes) written sucessfully.\n");
     return 0;
 }
 
-int write_dirent(int fd, const struct assoofs_dir_record_entry *record)
+static int copy_files(struct image *img)
 {
-    // nbytes representa el número de bytes necesarios para escribir la entrada de directorio
-    ssize_t nbytes = sizeof(*record);
-    // ret representa el número de bytes escritos
-    ssize_t ret;
+    int i;
 
-    // Escribe la entrada de directorio en el descriptor de archivo
-    ret = write(fd, record, nbytes);
-    if (ret != nbytes)
+    for (i = 0; i < img->files_count; i++)
     {
-        printf("Writing the rootdirectory datablock (name+inode_no pair for welcomefile) has failed.\n");
-        return -1;
+        if (copy_data(img, img->files[i].fd, img->files[i].block, img->files[i].size))
+        {
+            perror(img->files[i].path);
+            return -1;
+        }
     }
-    printf("root directory datablocks (name+inode_no pair for welcomefile) written succesfully.\n");
 
-    // nbytes representa el número de bytes necesario de padding para alinear el siguiente inodo
-    nbytes = ASSOOFS_DEFAULT_BLOCK_SIZE - sizeof(*record);
-    // Mueve el puntero de archivo hacia adelante por nbytes (padding) desde la posición actual (SEEK_CUR)
-    ret = lseek(fd, nbytes, SEEK_CUR);
-    if (ret == (off_t)-1)
+    return 0;
+}
+
+static void release_files(struct image *img)
+{
+    int i;
+
+    for (i = 0; i < img->files_count; i++)
+    {
+        close(img->files[i].fd);
+        free(img->files[i].path);
+    }
+    img->files_count = 0;
+}
+
+static int write_member(int fd, int index, int devices_count, uint64_t set_id)
+{
+    struct assoofs_member_info member;
+
+    memset(&member, 0, sizeof(member));
+    member.magic = ASSOOFS_MAGIC;
+    member.set_id = set_id;
+    member.index = index;
+    member.devices_count = devices_count;
+    assoofs_block_checksum_set(&member);
+
+    if (pwrite(fd, &member, sizeof(member), 0) != sizeof(member))
     {
-        printf("Writing the padding for rootdirectory children datablock has failed.\n");
+        printf("Writing the header of device %d has failed.\n", index);
         return -1;
     }
-    printf("Padding after the rootdirectory children written succesfully.\n");
+
+    return 0;
+}
+
+static int write_image(struct image *img)
+{
+    struct iovec iov[ASSOOFS_MAX_BLOCKS];
+    uint64_t block;
+    uint64_t dev_block = 0;
+    uint64_t run_start = 0;
+    unsigned int dev = 0;
+    unsigned int run_dev = 0;
+    int n = 0;
+    int used;
+
+    // Las sumas de comprobación se calculan una vez preparados todos los bloques de metadatos
+    for (block = 0; block < ASSOOFS_MAX_BLOCKS; block++)
+        if (img->meta & (1ULL << block))
+            assoofs_block_checksum_set(img->blocks[block]);
+
+    // Se recorre un bloque más para escribir la última serie
+    for (block = 0; block <= ASSOOFS_MAX_BLOCKS; block++)
+    {
+        used = block < ASSOOFS_MAX_BLOCKS && (img->used & (1ULL << block));
+        if (used)
+            dev_block = assoofs_core_layout_map(block, img->count, &dev);
+
+        // Escribe la serie en curso si este bloque no la continúa
+        if (n && (!used || dev != run_dev || dev_block != run_start + n))
+        {
+            if (write_run(img->fds[run_dev], iov, n, run_start * ASSOOFS_DEFAULT_BLOCK_SIZE))
+                return -1;
+            n = 0;
+        }
+        if (!used)
+            continue;
+
+        if (!n)
+        {
+            run_dev = dev;
+            run_start = dev_block;
+        }
+        iov[n].iov_base = img->blocks[block];
+        iov[n].iov_len = ASSOOFS_DEFAULT_BLOCK_SIZE;
+        n++;
+    }
+
     return 0;
 }
 
-int write_block(int fd, char *block, size_t len)
+static int write_run(int fd, struct iovec *iov, int count, off_t offset)
 {
-    // ret representa el número de bytes escritos
     ssize_t ret;
+    int first = 0;
 
-    // Escribe el bloque en el descriptor de archivo
-    ret = write(fd, block, len);
-    if (ret != len)
+    // pwritev puede escribir menos bytes de los pedidos: se continúa desde donde se quedó
+    while (first < count)
     {
-        printf("Writing file body has failed.\n");
+        ret = pwritev(fd, &iov[first], count - first, offset);
+        if (ret <= 0)
+        {
+            perror("Writing the filesystem metadata has failed");
+            return -1;
+        }
+        offset += ret;
+        while (first < count && (size_t)ret >= iov[first].iov_len)
+        {
+            ret -= iov[first].iov_len;
+            first++;
+        }
+        if (first < count)
+        {
+            iov[first].iov_base = (char *)iov[first].iov_base + ret;
+            iov[first].iov_len -= ret;
+        }
+    }
+
+    return 0;
+}
+
+static int discard_device(int fd, uint64_t blocks_count)
+{
+    struct stat st;
+    uint64_t range[2];
+
+    if (fstat(fd, &st) == -1)
         return -1;
+
+    // Rango de bytes que ocupa el sistema de archivos
+    range[0] = 0;
+    range[1] = blocks_count * ASSOOFS_DEFAULT_BLOCK_SIZE;
+
+    if (S_ISBLK(st.st_mode))
+    {
+        if (ioctl(fd, BLKDISCARD, range) == -1)
+            return -1;
     }
-    printf("block has been written succesfully.\n");
+    else if (S_ISREG(st.st_mode))
+    {
+        // En un fichero (por ejemplo, la imagen de un dispositivo loop) abrimos un hueco sin cambiar su tamaño
+        if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, range[0], range[1]) == -1)
+            return -1;
+    }
+
     return 0;
 }
 
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
 int main(int argc, char *argv[])
 {
-    int fd;
+    // La imagen se prepara en memoria (a cero) antes de escribirla
+    static struct image img;
+    int fds[ASSOOFS_MAX_DEVICES];
+    int count;
+    int i;
+    int opt;
+    int discard = 1;
+    int srcfd = -1;
+    const char *srcdir = NULL;
+    uint64_t size = 0;
+    uint64_t block_size = ASSOOFS_DEFAULT_BLOCK_SIZE;
+    uint64_t inode_ratio = 0;
+    uint64_t inodes_max = 0;
+    uint64_t blocks_count = 0;
+    uint64_t set_id = 0;
+    struct stat st;
     ssize_t ret;
-    char welcomefile_body[] = "Hola mundo, os saludo desde un sistema de ficheros ASSOOFS.\n";
 
-    // Define la información del inodo de welcomefile
-    struct assoofs_inode_info welcome = {
-        .mode = S_IFREG,
-        .inode_no = WELCOMEFILE_INODE_NUMBER,
-        .data_block_number = WELCOMEFILE_DATABLOCK_NUMBER,
-        .file_size = sizeof(welcomefile_body),
-    };
-
-    // Define la entrada de directorio para welcomefile
-    struct assoofs_dir_record_entry record = {
-        .filename = "README.txt",
-        .inode_no = WELCOMEFILE_INODE_NUMBER,
-    };
+    // Interpreta las opciones: -K conserva el contenido previo del dispositivo (no lo descarta),
+    // -s fija el tamaño del sistema de archivos, -b el tamaño de bloque, -i los bytes por inodo
+    // y -d el directorio cuyo contenido se copia en el sistema de archivos (en lugar de welcomefile)
+    while ((opt = getopt(argc, argv, "Ks:b:i:d:")) != -1)
+    {
+        if (opt == 'K')
+            discard = 0;
+        else if (opt == 's' && parse_size(optarg, &size) == 0 && size > 0)
+            continue;
+        else if (opt == 'b' && parse_size(optarg, &block_size) == 0)
+            continue;
+        else if (opt == 'i' && parse_size(optarg, &inode_ratio) == 0 && inode_ratio > 0)
+            continue;
+        else if (opt == 'd')
+            srcdir = optarg;
+        else
+        {
+            opt = '?';
+            break;
+        }
+    }
 
     // Comprueba que el número de argumentos sea correcto
-    if (argc != 2)
+    // Se admiten varios dispositivos: el primero contiene el superbloque y el resto se reparten los bloques por turnos
+    count = argc - optind;
+    if (opt == '?' || count < 1 || count > ASSOOFS_MAX_DEVICES)
     {
-        printf("Usage: mkassoofs <device>\n");
+        printf("Usage: mkassoofs [-K] [-s size[K|M|G]] [-b block-size] [-i bytes-per-inode] [-d srcdir] <device> [<device>...] (at most %d devices)\n",
+               ASSOOFS_MAX_DEVICES);
         return -1;
     }
 
-    // Abre el dispositivo especificado (argumento de línea de comandos) en modo lectura/escritura
-    fd = open(argv[1], O_RDWR);
-    if (fd == -1)
+    // El formato solo admite bloques de ASSOOFS_DEFAULT_BLOCK_SIZE bytes (el tamaño de las páginas y de los buffer heads)
+    if (block_size != ASSOOFS_DEFAULT_BLOCK_SIZE)
     {
-        perror("Error opening the device");
+        printf("Unsupported block size %llu: assoofs only uses blocks of %d bytes.\n", (unsigned long long)block_size, ASSOOFS_DEFAULT_BLOCK_SIZE);
         return -1;
     }
 
+    // Abre el directorio de origen, si se ha especificado
+    if (srcdir)
+    {
+        srcfd = open(srcdir, O_RDONLY | O_DIRECTORY);
+        if (srcfd == -1 || fstat(srcfd, &st) == -1)
+        {
+            perror(srcdir);
+            if (srcfd != -1)
+                close(srcfd);
+            return -1;
+        }
+    }
+
+    // Abre los dispositivos especificados (argumentos de línea de comandos) en modo lectura/escritura
+    for (i = 0; i < count; i++)
+    {
+        fds[i] = open(argv[optind + i], O_RDWR);
+        if (fds[i] == -1)
+        {
+            perror("Error opening the device");
+            while (i-- > 0)
+                close(fds[i]);
+            if (srcfd != -1)
+                close(srcfd);
+            return -1;
+        }
+    }
+    img.fds = fds;
+    img.count = count;
+    img.asb = (struct assoofs_super_block_info *)img.blocks[ASSOOFS_SUPERBLOCK_BLOCK_NUMBER];
+    img.inodes = (struct assoofs_inode_info *)img.blocks[ASSOOFS_INODESTORE_BLOCK_NUMBER];
+
     // Inicializa ret a 1 (indicando un error) para el bucle do-while
     ret = 1;
     do
     {
-        // Escribe el superbloque
-        if (write_superblock(fd))
+        // Calcula el tamaño del sistema de archivos
+        if (device_blocks(fds, count, size, &blocks_count))
             break;
 
-        // Escribe el inodo raíz
-        if (write_root_inode(fd))
+        // Calcula el número máximo de inodos: uno por cada inode_ratio bytes, y al menos la raíz y welcomefile
+        if (inode_ratio)
+        {
+            inodes_max = blocks_count * ASSOOFS_DEFAULT_BLOCK_SIZE / inode_ratio;
+            if (inodes_max < WELCOMEFILE_INODE_NUMBER)
+            {
+                printf("The inode ratio leaves room for fewer than %d inodes.\n", WELCOMEFILE_INODE_NUMBER);
+                break;
+            }
+            if (inodes_max >= ASSOOFS_MAX_INODES)
+                inodes_max = 0;
+        }
+
+        // Un sistema de archivos con varios dispositivos se identifica por un número aleatorio que comparten todos
+        if (count > 1 && getrandom(&set_id, sizeof(set_id), 0) != sizeof(set_id))
+        {
+            perror("Error generating the filesystem identifier");
+            break;
+        }
+
+        // Planifica la imagen completa en memoria antes de modificar los dispositivos: si algo no cabe
+        // (entradas de un directorio, inodos o bloques), los dispositivos quedan como estaban
+        // Prepara el superbloque, el almacén de inodos y el directorio raíz
+        build_superblock(img.asb, blocks_count, count, set_id, inodes_max);
+
+        // Sin -d, el directorio raíz contiene welcomefile y sus fechas son las del momento de creación.
+        // Con -d, contiene el árbol de srcdir (los ficheros se apuntan para copiarlos después)
+        // y las fechas son las de srcdir, para que el mismo árbol produzca la misma imagen
+        if (!srcdir)
+        {
+            build_root(&img, S_IFDIR, now_ns());
+            if (add_welcomefile(&img))
+                break;
+        }
+        else
+        {
+            build_root(&img, st.st_mode & (S_IFMT | 07777), (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec);
+            if (populate_dir(&img, &img.inodes[0], srcfd, srcdir))
+                break;
+        }
+
+        // Amplía los ficheros imagen que lo necesiten: es la primera modificación de los dispositivos
+        if (extend_devices(fds, count, blocks_count))
             break;
 
-        // Escribe el inodo de welcomefile
-        if (write_welcome_inode(fd, &welcome))
+        // Descarta el contenido previo antes de escribir las estructuras del sistema de archivos
+        // No es un error que el dispositivo no admita descartes
+        for (i = 0; discard && i < count; i++)
+            if (discard_device(fds[i], assoofs_core_layout_device_blocks(blocks_count, count, i)))
+                printf("Device %d does not support discard, its previous contents are kept.\n", i);
+
+        // Escribe la cabecera de cada dispositivo miembro
+        for (i = 1; i < count; i++)
+            if (write_member(fds[i], i, count, set_id))
+                break;
+        if (i < count)
             break;
 
-        // Escribe la entrada de directorio para welcomefile
-        if (write_dirent(fd, &record))
+        // Copia el contenido de los ficheros en sus bloques de datos, antes de que ningún inodo apunte a ellos
+        if (copy_files(&img))
             break;
 
-        // Escribir el contenido de welcomefile
-        if (write_block(fd, welcomefile_body, welcome.file_size))
+        // Escribe los bloques preparados en memoria (con las sumas de comprobación de los de metadatos)
+        if (write_image(&img))
             break;
 
+        printf("%s: %llu blocks of %d bytes on %d device(s), %llu of at most %llu inodes in use.\n", argv[optind], (unsigned long long)blocks_count,
+               ASSOOFS_DEFAULT_BLOCK_SIZE, count, (unsigned long long)img.asb->inodes_count, (unsigned long long)assoofs_core_max_inodes(img.asb));
+
         // Si todo salió bien, establece ret a 0
         ret = 0;
     } while (0);
 
-    // Cierra el descriptor de archivo
-    close(fd);
+    // Cierra los descriptores de archivo
+    release_files(&img);
+    for (i = 0; i < count; i++)
+        close(fds[i]);
+    if (srcfd != -1)
+        close(srcfd);
 
     // Devuelve 0 si todo salió bien, -1 en caso contrario
     return ret;